@@ -7,16 +7,22 @@ volatile bool abort_program_ = false;
 
 int main()
 {
+	VirtualPlatform::recordBootPhase("main");
+
 	printf("Blinky application booted!\n");
 
 	auto& platform = VirtualPlatform::inst();
+	platform.printBootTimeline();
+	platform.printMemoryMap();
+	platform.printMemcpyBenchmark();
+	platform.printCRCBenchmark();
 
-	printf("Starting blink\n");
+	PLATFORM_LOG("Starting blink\n");
 	platform.startBlink();
 
 	while(!abort_program_)
 	{
-		// spin
+		VirtualPlatform::drainLog();
 		// embvm::this_thread::sleep_for(std::chrono::milliseconds(250));
 	}
 
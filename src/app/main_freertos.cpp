@@ -0,0 +1,48 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include <FreeRTOS.h>
+#include <platform.hpp>
+#include <task.h>
+
+namespace
+{
+constexpr size_t MAIN_TASK_STACK_SIZE = 1024; // words
+constexpr unsigned MAIN_TASK_PRIORITY = 2;
+constexpr uint32_t BENCHMARK_ITERATIONS = 1000;
+
+StaticTask_t main_task_tcb_;
+StackType_t main_task_stack_[MAIN_TASK_STACK_SIZE];
+
+void main_task(void* param)
+{
+	auto& platform = *static_cast<VirtualPlatform*>(param);
+
+	auto cycles = platform.measureContextSwitchLatency(BENCHMARK_ITERATIONS);
+	printf("Context switch latency: %u cycles (%u iterations)\n", static_cast<unsigned>(cycles),
+		   static_cast<unsigned>(BENCHMARK_ITERATIONS));
+
+	while(1)
+	{
+		vTaskDelay(pdMS_TO_TICKS(1000));
+	}
+}
+} // namespace
+
+int main()
+{
+	printf("Blinky FreeRTOS application booted!\n");
+
+	auto& platform = VirtualPlatform::inst();
+
+	auto handle = xTaskCreateStatic(main_task, "main", MAIN_TASK_STACK_SIZE, &platform,
+									MAIN_TASK_PRIORITY, main_task_stack_, &main_task_tcb_);
+	assert(handle);
+
+	printf("Starting blink\n");
+	platform.startBlink();
+
+	platform.startScheduler();
+
+	return 0;
+}
@@ -94,6 +94,34 @@ void STM32GPIOTranslator::configure_alternate_i2c(uint8_t port, uint8_t pin,
 	LL_GPIO_Init(ports[port], &gpio_init); // GPIOx, GPIO_InitStruct
 }
 
+void STM32GPIOTranslator::configure_alternate(uint8_t port, uint8_t pin, uint8_t alt_func) noexcept
+{
+	LL_GPIO_InitTypeDef gpio_init = {
+		.Pin = PIN_INT_TO_STM32(pin),
+		.Mode = LL_GPIO_MODE_ALTERNATE,
+		.Speed = LL_GPIO_SPEED_FREQ_VERY_HIGH,
+		.OutputType = LL_GPIO_OUTPUT_PUSHPULL,
+		.Pull = LL_GPIO_PULL_NO,
+		.Alternate = alt_func,
+	};
+
+	LL_GPIO_Init(ports[port], &gpio_init); // GPIOx, GPIO_InitStruct
+}
+
+void STM32GPIOTranslator::configure_analog(uint8_t port, uint8_t pin) noexcept
+{
+	LL_GPIO_InitTypeDef gpio_init = {
+		.Pin = PIN_INT_TO_STM32(pin),
+		.Mode = LL_GPIO_MODE_ANALOG,
+		.Speed = LL_GPIO_SPEED_FREQ_LOW,
+		.OutputType = LL_GPIO_OUTPUT_PUSHPULL,
+		.Pull = LL_GPIO_PULL_NO,
+		.Alternate = LL_GPIO_AF_0,
+	};
+
+	LL_GPIO_Init(ports[port], &gpio_init); // GPIOx, GPIO_InitStruct
+}
+
 void STM32GPIOTranslator::configure_default(uint8_t port, uint8_t pin) noexcept
 {
 	configure_input(port, pin, 0); // TODO: set to no-pull
@@ -118,3 +146,8 @@ bool STM32GPIOTranslator::get(uint8_t port, uint8_t pin) noexcept
 {
 	return static_cast<bool>(LL_GPIO_IsInputPinSet(ports[port], PIN_INT_TO_STM32(pin)));
 }
+
+void* STM32GPIOTranslator::bsrr_address(uint8_t port) noexcept
+{
+	return const_cast<uint32_t*>(&ports[port]->BSRR);
+}
@@ -22,6 +22,10 @@ class STM32GPIOTranslator
 	static void configure_output(uint8_t port, uint8_t pin) noexcept;
 	static void configure_input(uint8_t port, uint8_t pin, uint8_t pull_config) noexcept;
 	static void configure_alternate_i2c(uint8_t port, uint8_t pin, uint8_t alt_func) noexcept;
+	/// Configure a push-pull, high-speed alternate function pin (SPI, UART, timer outputs).
+	static void configure_alternate(uint8_t port, uint8_t pin, uint8_t alt_func) noexcept;
+	/// Configure a pin for analog use (ADC inputs). The digital input buffer is disabled.
+	static void configure_analog(uint8_t port, uint8_t pin) noexcept;
 	static void configure_default(uint8_t port, uint8_t pin) noexcept;
 
 	// Output Functions
@@ -32,6 +36,9 @@ class STM32GPIOTranslator
 	// Input functions
 	static bool get(uint8_t port, uint8_t pin) noexcept;
 
+	/// Address of the port's bit set/reset register, for use as a DMA destination.
+	static void* bsrr_address(uint8_t port) noexcept;
+
   private:
 	/// This class can't be instantiated
 	STM32GPIOTranslator() = default;
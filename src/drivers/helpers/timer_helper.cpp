@@ -0,0 +1,260 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "timer_helper.hpp"
+#include <array>
+#include <cassert>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_sections.hpp>
+#include <stm32l4xx_ll_dmamux.h>
+#include <stm32l4xx_ll_rcc.h>
+#include <stm32l4xx_ll_tim.h>
+
+/* Useful Developer Notes
+ *
+ * TIM1 and TIM8 are clocked from APB2; the others are clocked from APB1. If the APB
+ * prescaler is 1, the timer clock is PCLK. Otherwise, the timer clock is 2 x PCLK.
+ *
+ * TIM2-TIM7 have a single interrupt line each. TIM1 and TIM8 split their interrupts across
+ * several lines; the update (UP) and capture/compare (CC) lines are dispatched here. The
+ * TIM1 update line is shared with TIM16, which is not used by these drivers.
+ *
+ * SR flags are cleared by writing 0 to them, and writing 1 has no effect, so only the
+ * handled flags are cleared. Flags whose interrupts are disabled are left for drivers which
+ * poll them (e.g., STM32InputCapture::pwmInput()).
+ */
+
+extern "C" void TIM1_UP_TIM16_IRQHandler();
+extern "C" void TIM1_CC_IRQHandler();
+extern "C" void TIM2_IRQHandler();
+extern "C" void TIM3_IRQHandler();
+extern "C" void TIM4_IRQHandler();
+extern "C" void TIM5_IRQHandler();
+extern "C" void TIM6_DAC_IRQHandler();
+extern "C" void TIM7_IRQHandler();
+extern "C" void TIM8_UP_IRQHandler();
+extern "C" void TIM8_CC_IRQHandler();
+
+#pragma mark - Variables -
+
+constexpr std::array<TIM_TypeDef* const, 9> timer_instance = {nullptr, TIM1, TIM2, TIM3, TIM4,
+															  TIM5,	   TIM6, TIM7, TIM8};
+
+/// Interrupt lines for each timer: {update, capture/compare}. Basic and general-purpose
+/// timers use the same line for both.
+constexpr std::array<std::array<uint8_t, 2>, 9> timer_irq = {{
+	{0, 0},
+	{TIM1_UP_TIM16_IRQn, TIM1_CC_IRQn},
+	{TIM2_IRQn, TIM2_IRQn},
+	{TIM3_IRQn, TIM3_IRQn},
+	{TIM4_IRQn, TIM4_IRQn},
+	{TIM5_IRQn, TIM5_IRQn},
+	{TIM6_DAC_IRQn, TIM6_DAC_IRQn},
+	{TIM7_IRQn, TIM7_IRQn},
+	{TIM8_UP_IRQn, TIM8_CC_IRQn},
+}};
+
+static std::array<STM32TimerHelper::interrupt_handler_t, 9> interrupt_handlers = {nullptr};
+
+constexpr std::array<uint8_t, 9> timer_channel_count = {0, 6, 4, 4, 4, 4, 0, 0, 6};
+
+constexpr std::array<uint32_t, 9> update_request = {
+	0,
+	LL_DMAMUX_REQ_TIM1_UP,
+	LL_DMAMUX_REQ_TIM2_UP,
+	LL_DMAMUX_REQ_TIM3_UP,
+	LL_DMAMUX_REQ_TIM4_UP,
+	LL_DMAMUX_REQ_TIM5_UP,
+	LL_DMAMUX_REQ_TIM6_UP,
+	LL_DMAMUX_REQ_TIM7_UP,
+	LL_DMAMUX_REQ_TIM8_UP,
+};
+
+// clang-format off
+constexpr std::array<std::array<uint32_t, 4>, 9> cc_request = {{
+	{0, 0, 0, 0},
+	{LL_DMAMUX_REQ_TIM1_CH1, LL_DMAMUX_REQ_TIM1_CH2, LL_DMAMUX_REQ_TIM1_CH3, LL_DMAMUX_REQ_TIM1_CH4},
+	{LL_DMAMUX_REQ_TIM2_CH1, LL_DMAMUX_REQ_TIM2_CH2, LL_DMAMUX_REQ_TIM2_CH3, LL_DMAMUX_REQ_TIM2_CH4},
+	{LL_DMAMUX_REQ_TIM3_CH1, LL_DMAMUX_REQ_TIM3_CH2, LL_DMAMUX_REQ_TIM3_CH3, LL_DMAMUX_REQ_TIM3_CH4},
+	{LL_DMAMUX_REQ_TIM4_CH1, LL_DMAMUX_REQ_TIM4_CH2, LL_DMAMUX_REQ_TIM4_CH3, LL_DMAMUX_REQ_TIM4_CH4},
+	{LL_DMAMUX_REQ_TIM5_CH1, LL_DMAMUX_REQ_TIM5_CH2, LL_DMAMUX_REQ_TIM5_CH3, LL_DMAMUX_REQ_TIM5_CH4},
+	{0, 0, 0, 0},
+	{0, 0, 0, 0},
+	{LL_DMAMUX_REQ_TIM8_CH1, LL_DMAMUX_REQ_TIM8_CH2, LL_DMAMUX_REQ_TIM8_CH3, LL_DMAMUX_REQ_TIM8_CH4},
+}};
+// clang-format on
+
+constexpr std::array<uint32_t, 16> input_filter = {
+	LL_TIM_IC_FILTER_FDIV1,		 LL_TIM_IC_FILTER_FDIV1_N2,	 LL_TIM_IC_FILTER_FDIV1_N4,
+	LL_TIM_IC_FILTER_FDIV1_N8,	 LL_TIM_IC_FILTER_FDIV2_N6,	 LL_TIM_IC_FILTER_FDIV2_N8,
+	LL_TIM_IC_FILTER_FDIV4_N6,	 LL_TIM_IC_FILTER_FDIV4_N8,	 LL_TIM_IC_FILTER_FDIV8_N6,
+	LL_TIM_IC_FILTER_FDIV8_N8,	 LL_TIM_IC_FILTER_FDIV16_N5, LL_TIM_IC_FILTER_FDIV16_N6,
+	LL_TIM_IC_FILTER_FDIV16_N8, LL_TIM_IC_FILTER_FDIV32_N5, LL_TIM_IC_FILTER_FDIV32_N6,
+	LL_TIM_IC_FILTER_FDIV32_N8};
+
+#pragma mark - Implementations -
+
+void* STM32TimerHelper::instance(embvm::timer::channel ch) noexcept
+{
+	auto inst = timer_instance[ch];
+	assert(inst); // Invalid timer device
+	return inst;
+}
+
+uint32_t STM32TimerHelper::clockFrequency(embvm::timer::channel ch) noexcept
+{
+	if(isAdvanced(ch))
+	{
+		auto prescaler = LL_RCC_GetAPB2Prescaler();
+		return (prescaler == LL_RCC_APB2_DIV_1)
+				   ? SystemCoreClock
+				   : __LL_RCC_CALC_PCLK2_FREQ(SystemCoreClock, prescaler) * 2;
+	}
+
+	auto prescaler = LL_RCC_GetAPB1Prescaler();
+	return (prescaler == LL_RCC_APB1_DIV_1)
+			   ? SystemCoreClock
+			   : __LL_RCC_CALC_PCLK1_FREQ(SystemCoreClock, prescaler) * 2;
+}
+
+uint32_t STM32TimerHelper::updateRequest(embvm::timer::channel ch) noexcept
+{
+	auto request = update_request[ch];
+	assert(request); // Invalid timer device
+	return request;
+}
+
+uint32_t STM32TimerHelper::captureCompareRequest(embvm::timer::channel ch, uint8_t cc) noexcept
+{
+	assert(cc >= 1 && cc <= 4);
+	auto request = cc_request[ch][cc - 1];
+	assert(request); // Timer has no capture/compare channels
+	return request;
+}
+
+uint8_t STM32TimerHelper::channelCount(embvm::timer::channel ch) noexcept
+{
+	return timer_channel_count[ch];
+}
+
+uint32_t STM32TimerHelper::inputFilter(uint8_t level) noexcept
+{
+	assert(level < input_filter.size());
+	return input_filter[level];
+}
+
+STM32TimerHelper::time_base_t STM32TimerHelper::timeBase(embvm::timer::channel ch,
+														  uint32_t frequency) noexcept
+{
+	assert(frequency > 0);
+
+	uint32_t ticks = clockFrequency(ch) / frequency;
+	uint32_t max_reload = is32Bit(ch) ? UINT32_MAX : UINT16_MAX;
+	assert(ticks > 1); // Frequency is too high for the timer clock
+
+	// The smallest prescaler that keeps the auto-reload value within the counter width
+	uint32_t prescaler = (max_reload == UINT32_MAX) ? 0 : (ticks - 1) / (max_reload + 1);
+	assert(prescaler <= UINT16_MAX); // Frequency is too low for this timer
+
+	time_base_t result;
+	result.prescaler = static_cast<uint16_t>(prescaler);
+	result.autoreload = (ticks / (prescaler + 1)) - 1;
+	return result;
+}
+
+void STM32TimerHelper::registerInterruptHandler(embvm::timer::channel ch,
+												const interrupt_handler_t& handler) noexcept
+{
+	assert(timer_instance[ch]); // Invalid timer device
+	interrupt_handlers[ch] = handler;
+}
+
+void STM32TimerHelper::enableInterrupts(embvm::timer::channel ch, uint8_t priority) noexcept
+{
+	assert(timer_instance[ch]); // Invalid timer device
+
+	for(auto irq : timer_irq[ch])
+	{
+		NVICControl::priority(irq, priority);
+		NVICControl::enable(irq);
+	}
+}
+
+void STM32TimerHelper::disableInterrupts(embvm::timer::channel ch) noexcept
+{
+	assert(timer_instance[ch]); // Invalid timer device
+
+	for(auto irq : timer_irq[ch])
+	{
+		NVICControl::disable(irq);
+	}
+}
+
+#pragma mark - Interrupt Handlers -
+
+// TODO: should this be handled with a bottom half handler instead, using
+// an interrupt queue?
+STM32_RAMFUNC static void timer_interrupt_handler(embvm::timer::channel ch)
+{
+	auto inst = timer_instance[ch];
+	// DIER bits 8+ are DMA request enables, which would otherwise match (and clear) the
+	// unrelated CCxOF flags at the same positions in SR
+	uint32_t status = inst->SR & (inst->DIER & 0x00FF);
+	inst->SR = ~status;
+
+	if(interrupt_handlers[ch])
+	{
+		interrupt_handlers[ch](status);
+	}
+}
+
+extern "C" void TIM1_UP_TIM16_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH1);
+}
+
+extern "C" void TIM1_CC_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH1);
+}
+
+extern "C" void TIM2_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH2);
+}
+
+extern "C" void TIM3_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH3);
+}
+
+extern "C" void TIM4_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH4);
+}
+
+extern "C" void TIM5_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH5);
+}
+
+extern "C" void TIM6_DAC_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH6);
+}
+
+extern "C" void TIM7_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH7);
+}
+
+extern "C" void TIM8_UP_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH8);
+}
+
+extern "C" void TIM8_CC_IRQHandler()
+{
+	timer_interrupt_handler(embvm::timer::channel::CH8);
+}
@@ -0,0 +1,126 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_TIMER_HELPER_HPP_
+#define STM32_TIMER_HELPER_HPP_
+
+#include <cstdint>
+#include <driver/timer.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <stm32_completion.hpp>
+
+/** Shared lookups for drivers which program STM32 timer devices directly.
+ *
+ * STM32Timer, STM32Waveform, and the other timer-based drivers all need to map an
+ * embvm::timer::channel (TIM1 = CH1) to its registers, DMA requests, and clock. These
+ * helpers keep the lookup tables in one place. The timer interrupt vectors are also defined
+ * here, and dispatched to the handler registered by the driver which owns the timer.
+ *
+ * The register pointer is returned as a void* so that the STM32 headers are not exposed to
+ * users of this header. Drivers cast it to TIM_TypeDef*.
+ *
+ * This class cannot be directly instantiated.
+ */
+class STM32TimerHelper
+{
+  public:
+	/// Prescaler and auto-reload settings for a requested update frequency
+	struct time_base_t
+	{
+		uint16_t prescaler;
+		uint32_t autoreload;
+	};
+
+	/** Timer interrupt handler.
+	 *
+	 * The handler receives the status register (SR) flags which were pending and enabled
+	 * in DIER when the interrupt was taken. Those flags are cleared before the handler is
+	 * invoked. Overcapture (CCxOF) flags are never reported; drivers poll them directly.
+	 * It is called from the timer's interrupt context.
+	 */
+	using interrupt_handler_t = stdext::inplace_function<void(uint32_t)>;
+
+	/// Get the register block for a timer device.
+	/// @precondition ch is in the range [CH1..CH8].
+	static void* instance(embvm::timer::channel ch) noexcept;
+
+	/// Get the timer kernel clock frequency, in Hz.
+	static uint32_t clockFrequency(embvm::timer::channel ch) noexcept;
+
+	/// Get the DMAMUX request ID for the timer's update event.
+	static uint32_t updateRequest(embvm::timer::channel ch) noexcept;
+
+	/** Get the DMAMUX request ID for one of the timer's capture/compare channels.
+	 *
+	 * @precondition The timer has capture/compare channels (i.e., it is not TIM6/TIM7).
+	 * @param [in] ch The timer device.
+	 * @param [in] cc The capture/compare channel, [1..4].
+	 */
+	static uint32_t captureCompareRequest(embvm::timer::channel ch, uint8_t cc) noexcept;
+
+	/// Check whether the timer is an advanced-control timer (TIM1/TIM8).
+	static bool isAdvanced(embvm::timer::channel ch) noexcept
+	{
+		return ch == embvm::timer::channel::CH1 || ch == embvm::timer::channel::CH8;
+	}
+
+	/// Check whether the timer has a 32-bit counter (TIM2/TIM5).
+	static bool is32Bit(embvm::timer::channel ch) noexcept
+	{
+		return ch == embvm::timer::channel::CH2 || ch == embvm::timer::channel::CH5;
+	}
+
+	/// Number of capture/compare channels on the timer (0 for basic timers TIM6/TIM7).
+	static uint8_t channelCount(embvm::timer::channel ch) noexcept;
+
+	/** Get the LL input capture filter setting (ICxF) for a filter level.
+	 *
+	 * Higher levels require an input to be stable for more samples, at a lower sampling
+	 * frequency, before an edge is detected.
+	 *
+	 * @param [in] level The filter level, [0..15]. 0 disables filtering.
+	 */
+	static uint32_t inputFilter(uint8_t level) noexcept;
+
+	/** Compute the smallest prescaler which reaches the requested update frequency.
+	 *
+	 * Using the smallest prescaler maximizes the resolution of the auto-reload value (and of
+	 * any compare values derived from it).
+	 *
+	 * @precondition frequency is > 0 and achievable with the timer's counter width.
+	 * @param [in] ch The timer device.
+	 * @param [in] frequency The update (overflow) frequency, in Hz.
+	 */
+	static time_base_t timeBase(embvm::timer::channel ch, uint32_t frequency) noexcept;
+
+	/** Register the interrupt handler for a timer device.
+	 *
+	 * Each timer device has a single handler, which is shared by all of its interrupt lines
+	 * (e.g., TIM1_UP and TIM1_CC). Only the driver which owns the timer should register one.
+	 *
+	 * @param [in] ch The timer device.
+	 * @param [in] handler The handler, or nullptr to remove it.
+	 */
+	static void registerInterruptHandler(embvm::timer::channel ch,
+										 const interrupt_handler_t& handler) noexcept;
+
+	/** Enable the NVIC interrupt lines for a timer device.
+	 *
+	 * The interrupt sources themselves are selected by the driver in DIER.
+	 *
+	 * @param [in] ch The timer device.
+	 * @param [in] priority The NVIC priority for the timer's interrupt lines.
+	 */
+	static void enableInterrupts(embvm::timer::channel ch,
+								 uint8_t priority = STM32_COMPLETION_IRQ_PRIORITY) noexcept;
+
+	/// Disable the NVIC interrupt lines for a timer device.
+	static void disableInterrupts(embvm::timer::channel ch) noexcept;
+
+  private:
+	/// This class can't be instantiated
+	STM32TimerHelper() = default;
+	~STM32TimerHelper() = default;
+};
+
+#endif // STM32_TIMER_HELPER_HPP_
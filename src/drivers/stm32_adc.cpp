@@ -0,0 +1,415 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_adc.hpp"
+#include <array>
+#include <cassert>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_gpio.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_adc.h>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+
+/* Useful Developer Notes
+ *
+ * Power-up sequence (RM0432, "ADC on-off control"):
+ *   1. Exit deep power-down (DEEPPWD = 0)
+ *   2. Enable the voltage regulator (ADVREGEN = 1) and wait T_ADCVREG_STUP (20 us)
+ *   3. Calibrate with the ADC disabled (ADCAL = 1, wait for it to clear)
+ *   4. Wait at least 4 ADC clock cycles before setting ADEN
+ *   5. Set ADEN and wait for ADRDY
+ *
+ * The common clock mode (CKMODE) can only be changed while the ADC is disabled.
+ * Most CFGR/SQR/SMPR fields can only be written while no conversion is ongoing, so all
+ * configuration is applied before the ADC is enabled.
+ *
+ * DMACFG = 1 (circular) keeps issuing DMA requests after the DMA transfer count reaches zero,
+ * which is required for the circular DMA channel.
+ *
+ * With the oversampler in "continued" mode (TROVS = 0), a single trigger performs all of the
+ * oversampling conversions for each channel in the sequence.
+ *
+ * The STM32L4R5 GPIO banks have no ASCR register, so analog mode alone connects a pin to
+ * the ADC.
+ */
+
+#pragma mark - Definitions -
+
+using STM32ADC_cb_t = stdext::inplace_function<void()>;
+
+#pragma mark - Types and Declarations -
+
+struct STM32_ADC_Pin_t
+{
+	embvm::gpio::port port;
+	uint8_t pin;
+	/// Internal channels are not connected to a pin
+	bool internal;
+} __attribute__((packed));
+
+// clang-format off
+constexpr std::array<STM32_ADC_Pin_t, STM32ADC::MAX_CHANNEL + 1> adc_pins =
+{
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 0, true}, // IN0: VREFINT
+  STM32_ADC_Pin_t{embvm::gpio::port::C, 0, false}, // IN1
+  STM32_ADC_Pin_t{embvm::gpio::port::C, 1, false}, // IN2
+  STM32_ADC_Pin_t{embvm::gpio::port::C, 2, false}, // IN3
+  STM32_ADC_Pin_t{embvm::gpio::port::C, 3, false}, // IN4
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 0, false}, // IN5
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 1, false}, // IN6
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 2, false}, // IN7
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 3, false}, // IN8
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 4, false}, // IN9
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 5, false}, // IN10
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 6, false}, // IN11
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 7, false}, // IN12
+  STM32_ADC_Pin_t{embvm::gpio::port::C, 4, false}, // IN13
+  STM32_ADC_Pin_t{embvm::gpio::port::C, 5, false}, // IN14
+  STM32_ADC_Pin_t{embvm::gpio::port::B, 0, false}, // IN15
+  STM32_ADC_Pin_t{embvm::gpio::port::B, 1, false}, // IN16
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 0, true}, // IN17: temperature sensor
+  STM32_ADC_Pin_t{embvm::gpio::port::A, 0, true}, // IN18: VBAT / 3
+};
+// clang-format on
+
+constexpr std::array<uint32_t, 8> trigger_source = {
+	LL_ADC_REG_TRIG_SOFTWARE,		  LL_ADC_REG_TRIG_EXT_TIM1_TRGO, LL_ADC_REG_TRIG_EXT_TIM2_TRGO,
+	LL_ADC_REG_TRIG_EXT_TIM3_TRGO, LL_ADC_REG_TRIG_EXT_TIM4_TRGO, LL_ADC_REG_TRIG_EXT_TIM6_TRGO,
+	LL_ADC_REG_TRIG_EXT_TIM8_TRGO, LL_ADC_REG_TRIG_EXT_TIM15_TRGO};
+
+constexpr std::array<uint32_t, 4> resolution_setting = {
+	LL_ADC_RESOLUTION_12B, LL_ADC_RESOLUTION_10B, LL_ADC_RESOLUTION_8B, LL_ADC_RESOLUTION_6B};
+
+constexpr std::array<uint8_t, 4> resolution_bits = {12, 10, 8, 6};
+
+constexpr std::array<uint32_t, 8> sample_time_setting = {
+	LL_ADC_SAMPLINGTIME_2CYCLES_5,	 LL_ADC_SAMPLINGTIME_6CYCLES_5,
+	LL_ADC_SAMPLINGTIME_12CYCLES_5,	 LL_ADC_SAMPLINGTIME_24CYCLES_5,
+	LL_ADC_SAMPLINGTIME_47CYCLES_5,	 LL_ADC_SAMPLINGTIME_92CYCLES_5,
+	LL_ADC_SAMPLINGTIME_247CYCLES_5, LL_ADC_SAMPLINGTIME_640CYCLES_5};
+
+/// Oversampling ratios, indexed by log2(ratio) - 1
+constexpr std::array<uint32_t, 8> oversample_ratio_setting = {
+	LL_ADC_OVS_RATIO_2,	 LL_ADC_OVS_RATIO_4,  LL_ADC_OVS_RATIO_8,	LL_ADC_OVS_RATIO_16,
+	LL_ADC_OVS_RATIO_32, LL_ADC_OVS_RATIO_64, LL_ADC_OVS_RATIO_128, LL_ADC_OVS_RATIO_256};
+
+constexpr std::array<uint32_t, 9> oversample_shift_setting = {
+	LL_ADC_OVS_SHIFT_NONE,	  LL_ADC_OVS_SHIFT_RIGHT_1, LL_ADC_OVS_SHIFT_RIGHT_2,
+	LL_ADC_OVS_SHIFT_RIGHT_3, LL_ADC_OVS_SHIFT_RIGHT_4, LL_ADC_OVS_SHIFT_RIGHT_5,
+	LL_ADC_OVS_SHIFT_RIGHT_6, LL_ADC_OVS_SHIFT_RIGHT_7, LL_ADC_OVS_SHIFT_RIGHT_8};
+
+constexpr std::array<uint32_t, STM32ADC::MAX_SEQUENCE_LENGTH> sequence_rank = {
+	LL_ADC_REG_RANK_1,	LL_ADC_REG_RANK_2,	LL_ADC_REG_RANK_3,	LL_ADC_REG_RANK_4,
+	LL_ADC_REG_RANK_5,	LL_ADC_REG_RANK_6,	LL_ADC_REG_RANK_7,	LL_ADC_REG_RANK_8,
+	LL_ADC_REG_RANK_9,	LL_ADC_REG_RANK_10, LL_ADC_REG_RANK_11, LL_ADC_REG_RANK_12,
+	LL_ADC_REG_RANK_13, LL_ADC_REG_RANK_14, LL_ADC_REG_RANK_15, LL_ADC_REG_RANK_16};
+
+constexpr std::array<uint32_t, STM32ADC::MAX_SEQUENCE_LENGTH> sequence_length_setting = {
+	LL_ADC_REG_SEQ_SCAN_DISABLE,		LL_ADC_REG_SEQ_SCAN_ENABLE_2RANKS,
+	LL_ADC_REG_SEQ_SCAN_ENABLE_3RANKS,	LL_ADC_REG_SEQ_SCAN_ENABLE_4RANKS,
+	LL_ADC_REG_SEQ_SCAN_ENABLE_5RANKS,	LL_ADC_REG_SEQ_SCAN_ENABLE_6RANKS,
+	LL_ADC_REG_SEQ_SCAN_ENABLE_7RANKS,	LL_ADC_REG_SEQ_SCAN_ENABLE_8RANKS,
+	LL_ADC_REG_SEQ_SCAN_ENABLE_9RANKS,	LL_ADC_REG_SEQ_SCAN_ENABLE_10RANKS,
+	LL_ADC_REG_SEQ_SCAN_ENABLE_11RANKS, LL_ADC_REG_SEQ_SCAN_ENABLE_12RANKS,
+	LL_ADC_REG_SEQ_SCAN_ENABLE_13RANKS, LL_ADC_REG_SEQ_SCAN_ENABLE_14RANKS,
+	LL_ADC_REG_SEQ_SCAN_ENABLE_15RANKS, LL_ADC_REG_SEQ_SCAN_ENABLE_16RANKS};
+
+/// Number of CPU cycles per ADC clock cycle (CKMODE = HCLK / 2)
+constexpr uint32_t CPU_CYCLES_PER_ADC_CYCLE = 2;
+
+/// Largest transfer supported by a DMA channel
+constexpr size_t MAX_BUFFER_LENGTH = 65535;
+
+static STM32ADC_cb_t adc_callback = nullptr;
+
+#pragma mark - Helpers -
+
+/// Busy-wait for approximately the specified number of CPU cycles
+static void spin_cycles(uint32_t cycles)
+{
+	// Each iteration takes at least 4 cycles
+	for(volatile uint32_t i = (cycles / 4) + 1; i > 0; i--)
+	{
+	}
+}
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void ADC1_IRQHandler(void);
+
+// Only the overrun interrupt is enabled; data is moved by DMA
+void ADC1_IRQHandler()
+{
+	if(LL_ADC_IsActiveFlag_OVR(ADC1))
+	{
+		LL_ADC_ClearFlag_OVR(ADC1);
+
+		if(adc_callback)
+		{
+			adc_callback();
+		}
+	}
+}
+
+#pragma mark - Driver APIs -
+
+void STM32ADC::start_() noexcept
+{
+	assert(sequence_length_ > 0); // setSequence() must be called first
+	assert(buffer_ && buffer_length_); // setBuffer() must be called first
+	assert((buffer_length_ % (2 * sequence_length_)) == 0);
+
+	// The oversampled result must fit in the 16-bit data register
+	auto ratio_bits = static_cast<uint8_t>(oversample_ratio_);
+	assert((resolution_bits[static_cast<uint8_t>(resolution_)] + ratio_bits) <=
+		   (16 + oversample_shift_));
+
+	overrun_count_ = 0;
+	block_count_ = 0;
+
+	configure_adc_pins_();
+
+	STM32ClockControl::adcEnable();
+	calibrate();
+	applyConfiguration();
+	configureDMA();
+
+	adc_callback = [this]() { handleInterrupt(); };
+	enableInterrupts();
+
+	// Enable the ADC
+	LL_ADC_ClearFlag_ADRDY(ADC1);
+	LL_ADC_Enable(ADC1);
+	while(LL_ADC_IsActiveFlag_ADRDY(ADC1) == 0)
+	{
+	}
+
+	dma_channel_.enable();
+
+	// With an external trigger, this arms the ADC; conversions begin at the next trigger
+	LL_ADC_REG_StartConversion(ADC1);
+}
+
+void STM32ADC::stop_() noexcept
+{
+	disableInterrupts();
+
+	if(LL_ADC_REG_IsConversionOngoing(ADC1))
+	{
+		LL_ADC_REG_StopConversion(ADC1);
+		while(LL_ADC_REG_IsStopConversionOngoing(ADC1))
+		{
+		}
+	}
+
+	if(LL_ADC_IsEnabled(ADC1))
+	{
+		LL_ADC_Disable(ADC1);
+		while(LL_ADC_IsDisableOngoing(ADC1))
+		{
+		}
+	}
+
+	dma_channel_.stop();
+
+	adc_callback = nullptr;
+
+	LL_ADC_SetCommonPathInternalCh(__LL_ADC_COMMON_INSTANCE(ADC1), LL_ADC_PATH_INTERNAL_NONE);
+	LL_ADC_DisableInternalRegulator(ADC1);
+	LL_ADC_EnableDeepPowerDown(ADC1);
+	STM32ClockControl::adcDisable();
+}
+
+void STM32ADC::calibrate() noexcept
+{
+	assert(LL_ADC_IsEnabled(ADC1) == 0);
+
+	// The clock mode can only be changed while the ADC is disabled
+	LL_ADC_SetCommonClock(__LL_ADC_COMMON_INSTANCE(ADC1), LL_ADC_CLOCK_SYNC_PCLK_DIV2);
+
+	LL_ADC_DisableDeepPowerDown(ADC1);
+	LL_ADC_EnableInternalRegulator(ADC1);
+	spin_cycles(LL_ADC_DELAY_INTERNAL_REGUL_STAB_US * (SystemCoreClock / 1000000));
+
+	LL_ADC_StartCalibration(ADC1, LL_ADC_SINGLE_ENDED);
+	while(LL_ADC_IsCalibrationOnGoing(ADC1))
+	{
+	}
+
+	spin_cycles(LL_ADC_DELAY_CALIB_ENABLE_ADC_CYCLES * CPU_CYCLES_PER_ADC_CYCLE);
+}
+
+void STM32ADC::applyConfiguration() noexcept
+{
+	assert(LL_ADC_IsEnabled(ADC1) == 0);
+
+	LL_ADC_SetResolution(ADC1, resolution_setting[static_cast<uint8_t>(resolution_)]);
+	LL_ADC_SetDataAlignment(ADC1, LL_ADC_DATA_ALIGN_RIGHT);
+	LL_ADC_SetLowPowerMode(ADC1, LL_ADC_LP_MODE_NONE);
+
+	LL_ADC_REG_SetTriggerSource(ADC1, trigger_source[static_cast<uint8_t>(trigger_)]);
+	LL_ADC_REG_SetContinuousMode(ADC1, (trigger_ == trigger::continuous)
+										   ? LL_ADC_REG_CONV_CONTINUOUS
+										   : LL_ADC_REG_CONV_SINGLE);
+	LL_ADC_REG_SetSequencerDiscont(ADC1, LL_ADC_REG_SEQ_DISCONT_DISABLE);
+	LL_ADC_REG_SetDMATransfer(ADC1, LL_ADC_REG_DMA_TRANSFER_UNLIMITED);
+	// A late DMA read loses a sample, but the stream keeps running; overruns are counted
+	LL_ADC_REG_SetOverrun(ADC1, LL_ADC_REG_OVR_DATA_OVERWRITTEN);
+
+	uint32_t internal_paths = LL_ADC_PATH_INTERNAL_NONE;
+
+	LL_ADC_REG_SetSequencerLength(ADC1, sequence_length_setting[sequence_length_ - 1]);
+	for(size_t i = 0; i < sequence_length_; i++)
+	{
+		auto& entry = sequence_[i];
+		auto channel = __LL_ADC_DECIMAL_NB_TO_CHANNEL(entry.channel);
+
+		LL_ADC_REG_SetSequencerRanks(ADC1, sequence_rank[i], channel);
+		LL_ADC_SetChannelSamplingTime(ADC1, channel,
+									  sample_time_setting[static_cast<uint8_t>(entry.time)]);
+		LL_ADC_SetChannelSingleDiff(ADC1, channel, LL_ADC_SINGLE_ENDED);
+
+		if(entry.channel == 0)
+		{
+			internal_paths |= LL_ADC_PATH_INTERNAL_VREFINT;
+		}
+		else if(entry.channel == 17)
+		{
+			internal_paths |= LL_ADC_PATH_INTERNAL_TEMPSENSOR;
+		}
+		else if(entry.channel == 18)
+		{
+			internal_paths |= LL_ADC_PATH_INTERNAL_VBAT;
+		}
+	}
+
+	LL_ADC_SetCommonPathInternalCh(__LL_ADC_COMMON_INSTANCE(ADC1), internal_paths);
+
+	if(oversample_ratio_ == oversample_ratio::disabled)
+	{
+		LL_ADC_SetOverSamplingScope(ADC1, LL_ADC_OVS_DISABLE);
+	}
+	else
+	{
+		LL_ADC_SetOverSamplingScope(ADC1, LL_ADC_OVS_GRP_REGULAR_CONTINUED);
+		LL_ADC_SetOverSamplingDiscont(ADC1, LL_ADC_OVS_REG_CONT);
+		LL_ADC_ConfigOverSamplingRatioShift(
+			ADC1, oversample_ratio_setting[static_cast<uint8_t>(oversample_ratio_) - 1],
+			oversample_shift_setting[oversample_shift_]);
+	}
+}
+
+void STM32ADC::configureDMA() noexcept
+{
+	// ADC data must be read before the next conversion completes, so the channel gets
+	// the highest priority
+	dma_channel_.setConfiguration(LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_VERYHIGH |
+									  LL_DMA_MODE_CIRCULAR | LL_DMA_PERIPH_NOINCREMENT |
+									  LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_HALFWORD |
+									  LL_DMA_MDATAALIGN_HALFWORD,
+								  LL_DMAMUX_REQ_ADC1);
+
+	dma_channel_.registerCallback([this](STM32DMA::status status) { handleDMA(status); });
+	dma_channel_.start();
+	dma_channel_.enableHalfTransferInterrupt(true);
+
+	dma_channel_.setAddresses(
+		reinterpret_cast<void*>(LL_ADC_DMA_GetRegAddr(ADC1, LL_ADC_DMA_REG_REGULAR_DATA)),
+		buffer_, buffer_length_);
+}
+
+void STM32ADC::configure_adc_pins_() noexcept
+{
+	// TODO: move out of here and into hardware platform??
+	for(size_t i = 0; i < sequence_length_; i++)
+	{
+		auto& pin = adc_pins[sequence_[i].channel];
+		if(!pin.internal)
+		{
+			STM32GPIOTranslator::configure_analog(pin.port, pin.pin);
+		}
+	}
+}
+
+void STM32ADC::setSequence(const sequence_entry_t* sequence, size_t length) noexcept
+{
+	assert(started() == false);
+	assert(sequence && length > 0 && length <= MAX_SEQUENCE_LENGTH);
+
+	for(size_t i = 0; i < length; i++)
+	{
+		assert(sequence[i].channel <= MAX_CHANNEL);
+		sequence_[i] = sequence[i];
+	}
+
+	sequence_length_ = length;
+}
+
+void STM32ADC::setTrigger(trigger t) noexcept
+{
+	assert(started() == false);
+	trigger_ = t;
+}
+
+void STM32ADC::setResolution(resolution r) noexcept
+{
+	assert(started() == false);
+	resolution_ = r;
+}
+
+void STM32ADC::setOversampling(oversample_ratio ratio, uint8_t shift) noexcept
+{
+	assert(started() == false);
+	assert(shift < oversample_shift_setting.size());
+
+	oversample_ratio_ = ratio;
+	oversample_shift_ = shift;
+}
+
+void STM32ADC::setBuffer(uint16_t* buffer, size_t length) noexcept
+{
+	assert(started() == false);
+	assert(buffer && length >= 2 && length <= MAX_BUFFER_LENGTH);
+
+	buffer_ = buffer;
+	buffer_length_ = length;
+}
+
+// Called from the DMA ISR
+void STM32ADC::handleDMA(STM32DMA::status status) noexcept
+{
+	assert(status != STM32DMA::status::error); // transfer failed
+
+	const size_t half_length = buffer_length_ / 2;
+	half h = (status == STM32DMA::status::half_transfer) ? half::first : half::second;
+	const uint16_t* samples = (h == half::first) ? buffer_ : &buffer_[half_length];
+
+	block_count_ = block_count_ + 1;
+
+	if(cb_)
+	{
+		cb_(samples, half_length, h);
+	}
+}
+
+// Called from the ADC ISR
+void STM32ADC::handleInterrupt() noexcept
+{
+	overrun_count_ = overrun_count_ + 1;
+}
+
+void STM32ADC::enableInterrupts() noexcept
+{
+	// Overruns are only counted, but keep the ISR at the same level as the DMA callbacks
+	NVICControl::priority(ADC1_IRQn, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(ADC1_IRQn);
+
+	LL_ADC_EnableIT_OVR(ADC1);
+}
+
+void STM32ADC::disableInterrupts() noexcept
+{
+	LL_ADC_DisableIT_OVR(ADC1);
+	NVICControl::disable(ADC1_IRQn);
+}
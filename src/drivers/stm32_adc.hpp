@@ -0,0 +1,272 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_ADC_HPP_
+#define STM32_ADC_HPP_
+
+#include <array>
+#include <driver/driver.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <stm32_dma.hpp>
+
+// TODO: Handle interrupt priority - as a constructor parameter
+// TODO: support injected conversions, analog watchdogs, and differential inputs
+
+/** STM32 ADC driver with DMA streaming.
+ *
+ * The STM32L4R5 has a single ADC (ADC1). The driver converts a scan sequence of up to
+ * MAX_SEQUENCE_LENGTH channels and streams the results into a caller-supplied buffer
+ * using a circular DMA channel, so the CPU does no per-sample work:
+ *
+ *	- Each trigger converts the entire sequence. The trigger is either a timer TRGO event
+ *		(see STM32Timer::triggerOutput()) or trigger::continuous, in which case the ADC
+ *		converts back-to-back at its maximum rate.
+ *	- The buffer is treated as two halves. The callback is invoked with the first half while
+ *		the DMA fills the second half, and vice versa. The callback must finish with its half
+ *		before the DMA wraps around to it again.
+ *	- Samples are interleaved in sequence order: buffer[i] is the result of
+ *		sequence[i % sequence length].
+ *	- The hardware oversampler can accumulate 2-256 conversions per sample and right-shift
+ *		the result, which averages away noise without CPU involvement.
+ *
+ * The ADC runs from HCLK / 2 (60 MHz), so each conversion takes (sampling time + resolution
+ * + 0.5) ADC clock cycles. With the shortest sampling time, the maximum rates are:
+ *	- 12-bit: 15 cycles, 4 Msps
+ *	- 10-bit: 13 cycles, 4.6 Msps
+ *	- 8-bit: 11 cycles, 5.45 Msps
+ *	- 6-bit: 9 cycles, 6.67 Msps
+ *
+ * Note that this class is implemented using DMA, so you need to create a DMA instance for
+ * the channel in order to use this driver.
+ *
+ * @code
+ * STM32_DMA_BUFFER static uint16_t adc_samples[256];
+ *
+ * STM32Timer adc_timer{embvm::timer::channel::CH6, std::chrono::microseconds(100)};
+ * STM32DMA dma_ch_adc{STM32DMA::device::dma2, STM32DMA::channel::CH1};
+ * STM32ADC adc{dma_ch_adc};
+ *
+ * constexpr STM32ADC::sequence_entry_t sequence[] = {
+ *		{1, STM32ADC::sample_time::cycles24_5},
+ *		{2, STM32ADC::sample_time::cycles24_5},
+ * };
+ *
+ * adc.setSequence(sequence, 2);
+ * adc.setTrigger(STM32ADC::trigger::tim6_trgo);
+ * adc.setOversampling(STM32ADC::oversample_ratio::x16, 4);
+ * adc.setBuffer(adc_samples, 256);
+ * adc.registerCallback([](const uint16_t* samples, size_t count, STM32ADC::half h) {
+ *		// process count samples
+ * });
+ * adc.start();
+ *
+ * adc_timer.triggerOutput(true);
+ * adc_timer.start();
+ * @endcode
+ *
+ * You must enable the appropriate DMA device clock in the hardware platform; the ADC
+ * driver will not handle that.
+ *
+ * @see STM32DMA
+ * @see STM32Timer
+ */
+class STM32ADC final : public embvm::DriverBase
+{
+  public:
+	/// Source which starts a conversion of the sequence
+	enum class trigger : uint8_t
+	{
+		/// Convert continuously, without waiting for a trigger
+		continuous = 0,
+		tim1_trgo,
+		tim2_trgo,
+		tim3_trgo,
+		tim4_trgo,
+		tim6_trgo,
+		tim8_trgo,
+		tim15_trgo,
+	};
+
+	enum class resolution : uint8_t
+	{
+		bits12 = 0,
+		bits10,
+		bits8,
+		bits6,
+	};
+
+	/// Channel sampling time, in ADC clock cycles
+	enum class sample_time : uint8_t
+	{
+		cycles2_5 = 0,
+		cycles6_5,
+		cycles12_5,
+		cycles24_5,
+		cycles47_5,
+		cycles92_5,
+		cycles247_5,
+		cycles640_5,
+	};
+
+	/// Number of conversions accumulated by the hardware oversampler for each sample
+	enum class oversample_ratio : uint8_t
+	{
+		disabled = 0,
+		x2,
+		x4,
+		x8,
+		x16,
+		x32,
+		x64,
+		x128,
+		x256,
+	};
+
+	/// Identifies the half of the sample buffer which is ready to be processed
+	enum class half : uint8_t
+	{
+		first = 0,
+		second,
+	};
+
+	/// An entry in the scan sequence
+	struct sequence_entry_t
+	{
+		/// ADC channel number [0..MAX_CHANNEL]
+		uint8_t channel;
+		sample_time time;
+	};
+
+	/** Sample buffer callback.
+	 *
+	 * This is invoked from an interrupt context whenever half of the sample buffer is full.
+	 * The parameters are a pointer to the completed half, the number of samples in it,
+	 * and which half it is.
+	 */
+	using cb_t = stdext::inplace_function<void(const uint16_t*, size_t, half)>;
+
+	/// Maximum number of entries in the scan sequence
+	static constexpr size_t MAX_SEQUENCE_LENGTH = 16;
+
+	/// Highest ADC channel number. Channels 0, 17, and 18 are internal (VREFINT, VTS, VBAT).
+	static constexpr uint8_t MAX_CHANNEL = 18;
+
+  public:
+	explicit STM32ADC(STM32DMA& dma_channel) noexcept
+		: embvm::DriverBase(embvm::DriverType::ADC), dma_channel_(dma_channel)
+	{
+	}
+	~STM32ADC() noexcept = default;
+
+	void enableInterrupts() noexcept;
+	void disableInterrupts() noexcept;
+
+	/** Set the scan sequence.
+	 *
+	 * @precondition The driver is stopped.
+	 * @precondition length is in [1..MAX_SEQUENCE_LENGTH].
+	 * @param [in] sequence The channels to convert, in conversion order.
+	 * @param [in] length The number of entries in the sequence.
+	 */
+	void setSequence(const sequence_entry_t* sequence, size_t length) noexcept;
+
+	/** Select the source which triggers a conversion of the sequence.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] t The trigger source.
+	 */
+	void setTrigger(trigger t) noexcept;
+
+	/** Set the conversion resolution.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] r The resolution.
+	 */
+	void setResolution(resolution r) noexcept;
+
+	/** Configure the hardware oversampler.
+	 *
+	 * Each sample is the sum of ratio conversions, shifted right by shift bits. The result is
+	 * truncated to 16 bits, so the shift must be large enough for the sum to fit:
+	 * resolution + log2(ratio) - shift <= 16.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] ratio The number of conversions to accumulate.
+	 * @param [in] shift The right shift applied to the sum, [0..8].
+	 */
+	void setOversampling(oversample_ratio ratio, uint8_t shift) noexcept;
+
+	/** Set the sample buffer.
+	 *
+	 * The buffer should be declared with STM32_DMA_BUFFER.
+	 *
+	 * @precondition The driver is stopped.
+	 * @precondition length is a multiple of twice the sequence length, so that each half of
+	 *	the buffer holds whole sequences.
+	 * @param [in] buffer The sample buffer. Must remain valid while the driver is started.
+	 * @param [in] length The number of samples in the buffer, [2..65535].
+	 */
+	void setBuffer(uint16_t* buffer, size_t length) noexcept;
+
+	/// Register the callback which is invoked when half of the buffer is ready.
+	void registerCallback(const cb_t& cb) noexcept
+	{
+		cb_ = cb;
+	}
+
+	/// Register the callback which is invoked when half of the buffer is ready.
+	void registerCallback(cb_t&& cb) noexcept
+	{
+		cb_ = std::move(cb);
+	}
+
+	/** The number of ADC overruns since the driver started.
+	 *
+	 * An overrun means that a conversion result was overwritten before the DMA read it,
+	 * which indicates that the trigger rate is too high for the bus load.
+	 */
+	uint32_t overrunCount() const noexcept
+	{
+		return overrun_count_;
+	}
+
+	/// The number of sample buffer halves that have been delivered since the driver started.
+	uint32_t blockCount() const noexcept
+	{
+		return block_count_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	void configure_adc_pins_() noexcept;
+	void configureDMA() noexcept;
+	/// Power up and calibrate the ADC
+	void calibrate() noexcept;
+	/// Apply the sequence, trigger, resolution, and oversampling settings
+	void applyConfiguration() noexcept;
+	void handleDMA(STM32DMA::status status) noexcept;
+	/// Handle overrun events from the ADC interrupt
+	void handleInterrupt() noexcept;
+
+  private:
+	STM32DMA& dma_channel_;
+	cb_t cb_;
+
+	std::array<sequence_entry_t, MAX_SEQUENCE_LENGTH> sequence_{};
+	size_t sequence_length_ = 0;
+	trigger trigger_ = trigger::continuous;
+	resolution resolution_ = resolution::bits12;
+	oversample_ratio oversample_ratio_ = oversample_ratio::disabled;
+	uint8_t oversample_shift_ = 0;
+
+	uint16_t* buffer_ = nullptr;
+	size_t buffer_length_ = 0;
+
+	volatile uint32_t overrun_count_ = 0;
+	volatile uint32_t block_count_ = 0;
+};
+
+#endif // STM32_ADC_HPP_
@@ -0,0 +1,23 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_completion.hpp"
+
+/// Bare-metal implementation: the waiter spins until the ISR sets the flag.
+
+void STM32Completion::arm() noexcept
+{
+	complete_ = false;
+	waiter_ = nullptr;
+}
+
+void STM32Completion::signal() noexcept
+{
+	complete_ = true;
+}
+
+void STM32Completion::wait() noexcept
+{
+	while(!complete_)
+		;
+}
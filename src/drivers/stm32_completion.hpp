@@ -0,0 +1,68 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_COMPLETION_HPP_
+#define STM32_COMPLETION_HPP_
+
+#include <cstdint>
+
+/** Interrupt priority for driver ISRs that signal an STM32Completion.
+ *
+ * When an RTOS is used, ISRs that interact with the kernel must not run at a priority
+ * above the kernel's maximum syscall priority (configMAX_SYSCALL_INTERRUPT_PRIORITY for
+ * FreeRTOS). Lower numbers are higher priorities.
+ */
+constexpr uint8_t STM32_COMPLETION_IRQ_PRIORITY = 5;
+
+/** Signals the completion of an asynchronous driver operation.
+ *
+ * Drivers use this to implement blocking APIs on top of interrupt-driven transfers:
+ *	1. Call arm() from the waiting context before starting the transfer
+ *	2. Start the transfer
+ *	3. Call wait(), which returns once the ISR calls signal()
+ *
+ * The implementation is selected at build time:
+ *	- stm32_completion.cpp spins on a flag (default)
+ *	- stm32_completion_freertos.cpp blocks the calling task with a task notification, so
+ *		other tasks run while the transfer is in progress. It uses notification index 1, and
+ *		leaves index 0 to the application. If the scheduler has not been started, it falls
+ *		back to spinning.
+ *
+ * @code
+ * completion_.arm();
+ * LL_I2C_HandleTransfer(...);
+ * completion_.wait();
+ * @endcode
+ *
+ * A completion supports a single waiter. Drivers with a queue of operations (and therefore
+ * several possible blocking callers) declare the completion on the caller's stack and capture
+ * it in the operation's callback, rather than sharing a member.
+ */
+class STM32Completion
+{
+  public:
+	STM32Completion() noexcept = default;
+	~STM32Completion() noexcept = default;
+
+	/// Prepare for a new operation. Must be called by the context that will wait().
+	void arm() noexcept;
+
+	/// Mark the operation as complete and wake the waiter. Safe to call from an ISR.
+	void signal() noexcept;
+
+	/// Block until signal() is called.
+	void wait() noexcept;
+
+	/// Check whether signal() has been called since the last arm().
+	bool complete() const noexcept
+	{
+		return complete_;
+	}
+
+  private:
+	volatile bool complete_ = false;
+	/// Handle for the waiting context; used by RTOS implementations
+	void* volatile waiter_ = nullptr;
+};
+
+#endif // STM32_COMPLETION_HPP_
@@ -0,0 +1,321 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_crc.hpp"
+#include <cassert>
+#include <cstring>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+
+/* Useful Developer Notes
+ *
+ * There is no LL driver for the CRC unit, so the registers are programmed directly.
+ *
+ * The unit shifts data into the CRC most significant bit first. POLYSIZE selects the width,
+ * and setting RESET loads INIT into the CRC register. The result is read from the low bits
+ * of DR.
+ *
+ * A 32-bit write to DR is processed from its most significant byte. Writes can also be 8 or
+ * 16 bits wide, in which case only the written bits are processed.
+ *
+ * REV_IN bit-reverses the data as it is written: by byte, by half-word, or by word. Reversing
+ * a whole word puts the first byte in memory (bit-reversed) at the top, so reflected
+ * algorithms are fed unmodified words with REV_IN = word. For unreflected algorithms, the
+ * bytes of each word must be swapped, which the CPU does with REV. The DMA cannot swap bytes,
+ * so it feeds unreflected algorithms with byte writes. REV_IN can be changed between writes
+ * without affecting the CRC register.
+ *
+ * The output reflection and the final XOR are done in software. REV_OUT is not used.
+ *
+ * The CRC unit has no DMA request, so the DMA runs memory-to-memory transfers (MEM2MEM = 1).
+ * The source is the "peripheral" address, and DR is the (non-incrementing) "memory" address.
+ * The DMA can only read aligned items, so for word transfers the unaligned head and the tail
+ * of the buffer are written by the CPU.
+ */
+
+#pragma mark - Helpers -
+
+/// Configure the unit for a calculation, and load the initial value
+static void crc_reset(const crc_params_t& params)
+{
+	assert(params.polynomial & 1U);
+
+	uint32_t polysize = 0;
+	switch(params.width)
+	{
+		case 32:
+			break;
+		case 16:
+			polysize = CRC_CR_POLYSIZE_0;
+			break;
+		case 8:
+			polysize = CRC_CR_POLYSIZE_1;
+			break;
+		case 7:
+			polysize = CRC_CR_POLYSIZE_1 | CRC_CR_POLYSIZE_0;
+			break;
+		default:
+			assert(0); // Unsupported width
+	}
+
+	WRITE_REG(CRC->INIT, params.init & params.mask());
+	WRITE_REG(CRC->POL, params.polynomial & params.mask());
+	WRITE_REG(CRC->CR, polysize | CRC_CR_RESET);
+}
+
+static void crc_write_bytes(const uint8_t* data, size_t length, bool reflect)
+{
+	MODIFY_REG(CRC->CR, CRC_CR_REV_IN, reflect ? CRC_CR_REV_IN_0 : 0);
+
+	for(size_t i = 0; i < length; i++)
+	{
+		*reinterpret_cast<volatile uint8_t*>(&CRC->DR) = data[i];
+	}
+}
+
+/// Set REV_IN for the word writes of an algorithm
+static void crc_prepare_words(bool reflect)
+{
+	MODIFY_REG(CRC->CR, CRC_CR_REV_IN, reflect ? CRC_CR_REV_IN : 0);
+}
+
+static void crc_write_words(const uint8_t* data, size_t words, bool reflect)
+{
+	crc_prepare_words(reflect);
+
+	for(size_t i = 0; i < words; i++)
+	{
+		uint32_t word;
+		memcpy(&word, &data[i * sizeof(word)], sizeof(word));
+		WRITE_REG(CRC->DR, reflect ? word : __REV(word));
+	}
+}
+
+static uint32_t crc_result(const crc_params_t& params)
+{
+	auto value = READ_REG(CRC->DR) & params.mask();
+
+	if(params.reflect_out)
+	{
+		value = crcReflect(value, params.width);
+	}
+
+	return (value ^ params.xor_out) & params.mask();
+}
+
+static uint32_t crc_calculate(const crc_params_t& params, const uint8_t* data, size_t length)
+{
+	auto words = length / sizeof(uint32_t);
+
+	crc_reset(params);
+	crc_write_words(data, words, params.reflect_in);
+	crc_write_bytes(&data[words * sizeof(uint32_t)], length % sizeof(uint32_t),
+					params.reflect_in);
+
+	return crc_result(params);
+}
+
+#pragma mark - Driver APIs -
+
+void STM32CRC::start_() noexcept
+{
+	STM32ClockControl::crcEnable();
+	bytes_processed_ = 0;
+}
+
+void STM32CRC::stop_() noexcept
+{
+	STM32DMA* channel = nullptr;
+
+	{
+		STM32InterruptLock lock;
+		active_ = false;
+		channel = channel_;
+		channel_ = nullptr;
+	}
+
+	if(channel)
+	{
+		pool_.release(channel);
+	}
+
+	STM32ClockControl::crcDisable();
+}
+
+uint32_t STM32CRC::calculate(const crc_params_t& params, const void* data, size_t length) noexcept
+{
+	assert(started() && !active_);
+	assert(data || length == 0);
+
+	bytes_processed_ = bytes_processed_ + length;
+
+	return crc_calculate(params, static_cast<const uint8_t*>(data), length);
+}
+
+STM32CRC::status STM32CRC::calculate(const crc_params_t& params, const void* data, size_t length,
+									 const cb_t& cb) noexcept
+{
+	assert(started());
+	assert(data || length == 0);
+
+	{
+		STM32InterruptLock lock;
+
+		if(active_)
+		{
+			return status::busy;
+		}
+
+		active_ = true;
+	}
+
+	auto bytes = static_cast<const uint8_t*>(data);
+
+	if(length >= DMA_THRESHOLD)
+	{
+		// The channel is released by chunkComplete() once every chunk has been transferred
+		channel_ = pool_.acquire(LL_DMA_DIRECTION_MEMORY_TO_MEMORY | LL_DMA_MODE_NORMAL |
+									 LL_DMA_PERIPH_INCREMENT | LL_DMA_MEMORY_NOINCREMENT |
+									 LL_DMA_PDATAALIGN_WORD | LL_DMA_MDATAALIGN_WORD,
+								 LL_DMAMUX_REQ_MEM2MEM, STM32DMAPool::priority::low,
+								 [this](STM32DMA::status s) { chunkComplete(s); }, false);
+	}
+
+	if(channel_ == nullptr)
+	{
+		auto crc = crc_calculate(params, bytes, length);
+		bytes_processed_ = bytes_processed_ + length;
+		active_ = false;
+
+		if(cb)
+		{
+			cb(status::ok, crc);
+		}
+
+		return status::ok;
+	}
+
+	params_ = params;
+	cb_ = cb;
+	crc_reset(params);
+
+	if(params.reflect_in)
+	{
+		// Words are read from aligned addresses
+		auto head = (sizeof(uint32_t) - (reinterpret_cast<uintptr_t>(bytes) & 0x3)) & 0x3;
+		crc_write_bytes(bytes, head, true);
+
+		item_size_ = sizeof(uint32_t);
+		next_ = &bytes[head];
+		dma_remaining_ = (length - head) & ~(sizeof(uint32_t) - 1);
+		tail_ = length - head - dma_remaining_;
+		bytes_processed_ = bytes_processed_ + head;
+	}
+	else
+	{
+		item_size_ = 1;
+		next_ = bytes;
+		dma_remaining_ = length;
+		tail_ = 0;
+	}
+
+	crc_prepare_words(params.reflect_in);
+
+	{
+		STM32InterruptLock lock;
+		startNextChunk();
+	}
+
+	return status::ok;
+}
+
+STM32CRC::status STM32CRC::calculate(const crc_params_t& params, const void* data, size_t length,
+									 uint32_t& crc) noexcept
+{
+	// Arming a local completion cannot disturb a calculation that is already running; that
+	// case is rejected as busy below.
+	STM32Completion completion;
+	volatile status result = status::ok;
+	volatile uint32_t value = 0;
+
+	completion.arm();
+
+	auto r = calculate(params, data, length,
+					   [&completion, &result, &value](status s, uint32_t calculated) {
+						   value = calculated;
+						   result = s;
+						   completion.signal();
+					   });
+
+	if(r != status::ok)
+	{
+		return r;
+	}
+
+	completion.wait();
+	crc = value;
+	return result;
+}
+
+// Called with interrupts masked, or from the DMA ISR
+void STM32CRC::startNextChunk() noexcept
+{
+	auto items = dma_remaining_ / item_size_;
+	items = (items < MAX_CHUNK_ITEMS) ? items : MAX_CHUNK_ITEMS;
+	chunk_bytes_ = items * item_size_;
+
+	auto width = (item_size_ == sizeof(uint32_t)) ? STM32DMA::width::word : STM32DMA::width::byte;
+
+	channel_->disable();
+	channel_->setDataWidth(width, width);
+	// The underlying STM32 code doesn't take const.
+	channel_->setAddresses(const_cast<uint8_t*>(next_), const_cast<uint32_t*>(&CRC->DR), items);
+	channel_->enable();
+}
+
+// Called from the DMA ISR
+void STM32CRC::chunkComplete(STM32DMA::status s) noexcept
+{
+	if(!active_)
+	{
+		return;
+	}
+
+	status result = (s == STM32DMA::status::ok) ? status::ok : status::error;
+	uint32_t crc = 0;
+
+	if(result == status::ok)
+	{
+		bytes_processed_ = bytes_processed_ + chunk_bytes_;
+		next_ += chunk_bytes_;
+		dma_remaining_ -= chunk_bytes_;
+
+		if(dma_remaining_ > 0)
+		{
+			startNextChunk();
+			return;
+		}
+	}
+
+	pool_.release(channel_);
+	channel_ = nullptr;
+
+	if(result == status::ok)
+	{
+		crc_write_bytes(next_, tail_, params_.reflect_in);
+		bytes_processed_ = bytes_processed_ + tail_;
+		crc = crc_result(params_);
+	}
+
+	auto cb = std::move(cb_);
+	active_ = false;
+
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(cb)
+	{
+		cb(result, crc);
+	}
+}
@@ -0,0 +1,164 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_CRC_HPP_
+#define STM32_CRC_HPP_
+
+#include <crc.hpp>
+#include <driver/driver.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <stm32_dma.hpp>
+#include <stm32_dma_pool.hpp>
+
+/** STM32L4+ CRC calculation unit driver.
+ *
+ * The CRC unit supports 7, 8, 16, and 32-bit polynomials, with a programmable polynomial
+ * and initial value. Each calculation takes its parameters (see crc.hpp), so different
+ * algorithms can be used for different data (e.g., CRC32_IEEE for flash images and
+ * CRC16_CCITT_FALSE for serial frames). The result matches SoftwareCRC for the same
+ * parameters.
+ *
+ *	- calculate(params, data, length): The CPU feeds the data. Best for short buffers.
+ *	- calculate(params, data, length, cb): A DMA channel feeds the data in the background,
+ *		and the callback receives the CRC. Buffers of any size are accepted.
+ *	- calculate(params, data, length, crc): Blocking variant of the DMA calculation.
+ *
+ * The unit processes a 32-bit word in 1 AHB cycle. Reflected algorithms (reflect_in set)
+ * are fed in 32-bit words. For other algorithms, the bytes of a word would have to be swapped,
+ * so the DMA feeds them one byte at a time, which is about 4 times slower.
+ *
+ * A DMA channel is acquired from a STM32DMAPool for each calculation, and released when the
+ * calculation completes. The channel runs memory-to-memory transfers at low priority, since
+ * the CRC unit has no DMA request. Data can be read from flash or SRAM. If no channel is free,
+ * the CPU feeds the data instead.
+ *
+ * Only one calculation can be in progress at a time.
+ *
+ * @code
+ * STM32CRC crc{dma_pool};
+ *
+ * crc.start();
+ * crc.calculate(CRC32_IEEE, image, image_size, [](STM32CRC::status s, uint32_t value) {
+ *	// Runs in interrupt context
+ * });
+ * @endcode
+ *
+ * @see SoftwareCRC
+ * @see STM32DMAPool
+ */
+class STM32CRC final : public embvm::DriverBase
+{
+  public:
+	enum class status : uint8_t
+	{
+		/// The calculation completed successfully
+		ok = 0,
+		/// Another calculation is in progress
+		busy,
+		/// A DMA transfer error occurred
+		error,
+	};
+
+	/// Completion callback. This is invoked from the DMA interrupt context.
+	using cb_t = stdext::inplace_function<void(status, uint32_t)>;
+
+	/// Maximum number of items in a single DMA transfer (limited by the DMA counter).
+	static constexpr size_t MAX_CHUNK_ITEMS = 65535;
+
+	/// Buffers shorter than this are fed by the CPU, since setting up a transfer costs more.
+	static constexpr size_t DMA_THRESHOLD = 64;
+
+  public:
+	/// @param [in] pool The pool which provides a DMA channel for each calculation.
+	explicit STM32CRC(STM32DMAPool& pool) noexcept
+		: embvm::DriverBase(embvm::DriverType::Undefined), pool_(pool)
+	{
+	}
+	~STM32CRC() noexcept = default;
+
+	/** Calculate a CRC, with the CPU feeding the data.
+	 *
+	 * @precondition The driver is started, and no calculation is in progress.
+	 * @precondition The polynomial is odd, and the width is 7, 8, 16, or 32 bits.
+	 * @param [in] params The CRC algorithm.
+	 * @param [in] data The data. Need not be aligned.
+	 * @param [in] length The number of bytes.
+	 * @returns The CRC.
+	 */
+	uint32_t calculate(const crc_params_t& params, const void* data, size_t length) noexcept;
+
+	/** Start a CRC calculation, with the DMA feeding the data.
+	 *
+	 * The data must not be modified until the calculation completes. Buffers shorter than
+	 * DMA_THRESHOLD, or which arrive when no pool channel is free, are processed by the CPU.
+	 * In that case the callback is invoked before this function returns.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition The polynomial is odd, and the width is 7, 8, 16, or 32 bits.
+	 * @param [in] params The CRC algorithm.
+	 * @param [in] data The data. Need not be aligned.
+	 * @param [in] length The number of bytes.
+	 * @param [in] cb Callback invoked with the result when the calculation completes.
+	 * @returns status::ok if the calculation was started, status::busy if a calculation is in
+	 *	progress.
+	 */
+	status calculate(const crc_params_t& params, const void* data, size_t length,
+					 const cb_t& cb) noexcept;
+
+	/** Calculate a CRC with the DMA, and wait for the result.
+	 *
+	 * When built with RTOS support, the calling task is blocked (not spinning) while the DMA
+	 * feeds the data.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition This is not called from an interrupt context.
+	 * @param [out] crc The CRC, if status::ok is returned.
+	 */
+	status calculate(const crc_params_t& params, const void* data, size_t length,
+					 uint32_t& crc) noexcept;
+
+	/// Check whether a calculation is in progress.
+	bool busy() const noexcept
+	{
+		return active_;
+	}
+
+	/// The total number of bytes processed since the driver started.
+	uint32_t bytesProcessed() const noexcept
+	{
+		return bytes_processed_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	/// Start the next DMA transfer of the active calculation
+	void startNextChunk() noexcept;
+	void chunkComplete(STM32DMA::status s) noexcept;
+
+  private:
+	STM32DMAPool& pool_;
+	volatile bool active_ = false;
+
+	/// The pool channel held by the active DMA calculation
+	STM32DMA* channel_ = nullptr;
+
+	// Active DMA calculation
+	crc_params_t params_{};
+	const uint8_t* next_ = nullptr;
+	/// Bytes left for the DMA to transfer
+	size_t dma_remaining_ = 0;
+	/// Bytes written by the CPU after the DMA transfers
+	size_t tail_ = 0;
+	/// Size of each DMA item, in bytes (1 or 4)
+	size_t item_size_ = 0;
+	/// Size of the active DMA transfer, in bytes
+	size_t chunk_bytes_ = 0;
+	cb_t cb_;
+
+	volatile uint32_t bytes_processed_ = 0;
+};
+
+#endif // STM32_CRC_HPP_
@@ -6,11 +6,32 @@
 #include <cassert>
 #include <nvic.hpp>
 #include <processor_includes.hpp>
+#include <stm32_sections.hpp>
 #include <stm32l4xx_ll_dma.h>
 #include <volatile/volatile.hpp>
 
+/* Useful Developer Notes
+ *
+ * DMAMUX request line multiplexer channels 0-6 feed DMA1 channels 1-7, and channels 7-13
+ * feed DMA2 channels 1-7.
+ *
+ * The synchronization settings (SE, SPOL, NBREQ, SYNC_ID, EGE) of a DMAMUX channel should
+ * only be changed while the DMA channel is disabled. NBREQ can only be written while both
+ * SE and EGE are cleared.
+ *
+ * A request generator's GNBREQ can only be written while the generator is disabled (GE = 0).
+ *
+ * Synchronization overruns (SOFx) and request generator overruns (OFx) share the
+ * DMAMUX1_OVR interrupt.
+ */
+
 #pragma mark - Variables -
 
+constexpr std::array<uint32_t const, 3> periph_width = {
+	LL_DMA_PDATAALIGN_BYTE, LL_DMA_PDATAALIGN_HALFWORD, LL_DMA_PDATAALIGN_WORD};
+constexpr std::array<uint32_t const, 3> memory_width = {
+	LL_DMA_MDATAALIGN_BYTE, LL_DMA_MDATAALIGN_HALFWORD, LL_DMA_MDATAALIGN_WORD};
+
 constexpr std::array<DMA_TypeDef* const, STM32DMA::device::MAX_DMA> dma_devices = {DMA1, DMA2};
 constexpr std::array<uint32_t const, STM32DMA::channel::MAX_CH> transfer_complete_flags = {
 	DMA_ISR_TCIF1, DMA_ISR_TCIF2, DMA_ISR_TCIF3, DMA_ISR_TCIF4,
@@ -20,14 +41,22 @@ constexpr std::array<uint32_t const, STM32DMA::channel::MAX_CH> transfer_error_f
 	DMA_ISR_TEIF1, DMA_ISR_TEIF2, DMA_ISR_TEIF3, DMA_ISR_TEIF4,
 	DMA_ISR_TEIF5, DMA_ISR_TEIF6, DMA_ISR_TEIF7};
 
-constexpr std::array<uint32_t const, STM32DMA::channel::MAX_CH> clear_transfer_general_flags = {
-	DMA_ISR_GIF1, DMA_ISR_GIF2, DMA_ISR_GIF3, DMA_ISR_GIF4,
-	DMA_ISR_GIF5, DMA_ISR_GIF6, DMA_ISR_GIF7};
+constexpr std::array<uint32_t const, STM32DMA::channel::MAX_CH> half_transfer_flags = {
+	DMA_ISR_HTIF1, DMA_ISR_HTIF2, DMA_ISR_HTIF3, DMA_ISR_HTIF4,
+	DMA_ISR_HTIF5, DMA_ISR_HTIF6, DMA_ISR_HTIF7};
 
 constexpr std::array<uint32_t const, STM32DMA::channel::MAX_CH> clear_transfer_complete_flags = {
 	DMA_IFCR_CTCIF1, DMA_IFCR_CTCIF2, DMA_IFCR_CTCIF3, DMA_IFCR_CTCIF4,
 	DMA_IFCR_CTCIF5, DMA_IFCR_CTCIF6, DMA_IFCR_CTCIF7};
 
+constexpr std::array<uint32_t const, STM32DMA::channel::MAX_CH> clear_transfer_error_flags = {
+	DMA_IFCR_CTEIF1, DMA_IFCR_CTEIF2, DMA_IFCR_CTEIF3, DMA_IFCR_CTEIF4,
+	DMA_IFCR_CTEIF5, DMA_IFCR_CTEIF6, DMA_IFCR_CTEIF7};
+
+constexpr std::array<uint32_t const, STM32DMA::channel::MAX_CH> clear_half_transfer_flags = {
+	DMA_IFCR_CHTIF1, DMA_IFCR_CHTIF2, DMA_IFCR_CHTIF3, DMA_IFCR_CHTIF4,
+	DMA_IFCR_CHTIF5, DMA_IFCR_CHTIF6, DMA_IFCR_CHTIF7};
+
 constexpr std::array<std::array<IRQn_Type, STM32DMA::channel::MAX_CH>, STM32DMA::device::MAX_DMA>
 	irq_num = {
 		std::array<IRQn_Type, STM32DMA::channel::MAX_CH>{
@@ -41,6 +70,24 @@ constexpr std::array<std::array<IRQn_Type, STM32DMA::channel::MAX_CH>, STM32DMA:
 static std::array<std::array<STM32DMA::cb_t, STM32DMA::channel::MAX_CH>, STM32DMA::device::MAX_DMA>
 	irq_handlers = {nullptr};
 
+constexpr size_t NUM_MUX_CHANNELS = STM32DMA::device::MAX_DMA * STM32DMA::channel::MAX_CH;
+
+constexpr std::array<uint32_t const, 3> sync_polarity = {
+	LL_DMAMUX_SYNC_POL_RISING, LL_DMAMUX_SYNC_POL_FALLING, LL_DMAMUX_SYNC_POL_RISING_FALLING};
+constexpr std::array<uint32_t const, 3> generator_polarity = {
+	LL_DMAMUX_REQ_GEN_POL_RISING, LL_DMAMUX_REQ_GEN_POL_FALLING,
+	LL_DMAMUX_REQ_GEN_POL_RISING_FALLING};
+constexpr std::array<uint32_t const, STM32DMARequestGenerator::MAX_GEN> generator_requests = {
+	LL_DMAMUX_REQ_GENERATOR0, LL_DMAMUX_REQ_GENERATOR1, LL_DMAMUX_REQ_GENERATOR2,
+	LL_DMAMUX_REQ_GENERATOR3};
+
+static std::array<STM32DMA::overrun_cb_t, NUM_MUX_CHANNELS> sync_overrun_handlers = {nullptr};
+static std::array<volatile uint32_t, NUM_MUX_CHANNELS> sync_overrun_counts = {0};
+static std::array<STM32DMA::overrun_cb_t, STM32DMARequestGenerator::MAX_GEN>
+	generator_overrun_handlers = {nullptr};
+static std::array<volatile uint32_t, STM32DMARequestGenerator::MAX_GEN> generator_overrun_counts =
+	{0};
+
 #pragma mark - Helper Functions -
 
 static inline bool check_dma_complete_flag(STM32DMA::device dev, STM32DMA::channel ch)
@@ -53,9 +100,9 @@ static inline bool check_dma_error_flag(STM32DMA::device dev, STM32DMA::channel
 	return READ_BIT(dma_devices[dev]->ISR, transfer_error_flags[ch]);
 }
 
-static inline void clear_dma_general_int_flag(STM32DMA::device dev, STM32DMA::channel ch)
+static inline bool check_dma_half_transfer_flag(STM32DMA::device dev, STM32DMA::channel ch)
 {
-	embutil::volatile_store(&dma_devices[dev]->IFCR, clear_transfer_general_flags[ch]);
+	return READ_BIT(dma_devices[dev]->ISR, half_transfer_flags[ch]);
 }
 
 static inline void clear_transfer_complete_flag(STM32DMA::device dev, STM32DMA::channel ch)
@@ -63,6 +110,27 @@ static inline void clear_transfer_complete_flag(STM32DMA::device dev, STM32DMA::
 	embutil::volatile_store(&dma_devices[dev]->IFCR, clear_transfer_complete_flags[ch]);
 }
 
+static inline void clear_transfer_error_flag(STM32DMA::device dev, STM32DMA::channel ch)
+{
+	embutil::volatile_store(&dma_devices[dev]->IFCR, clear_transfer_error_flags[ch]);
+}
+
+static inline void clear_half_transfer_flag(STM32DMA::device dev, STM32DMA::channel ch)
+{
+	embutil::volatile_store(&dma_devices[dev]->IFCR, clear_half_transfer_flags[ch]);
+}
+
+static inline uint32_t mux_channel(STM32DMA::device dev, STM32DMA::channel ch)
+{
+	return (static_cast<uint32_t>(dev) * STM32DMA::channel::MAX_CH) + ch;
+}
+
+static void enable_overrun_interrupt()
+{
+	NVICControl::priority(DMAMUX1_OVR_IRQn, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(DMAMUX1_OVR_IRQn);
+}
+
 #pragma mark - Interrupt Handling -
 
 extern "C" void DMA1_Channel1_IRQHandler();
@@ -79,34 +147,56 @@ extern "C" void DMA2_Channel4_IRQHandler();
 extern "C" void DMA2_Channel5_IRQHandler();
 extern "C" void DMA2_Channel6_IRQHandler();
 extern "C" void DMA2_Channel7_IRQHandler();
-
-// TODO: ?
-// DMA2D_IRQHandler
-// DMAMUX1_OVR_IRQHandler
+extern "C" void DMAMUX1_OVR_IRQHandler();
 
 // TODO: bottom half handler or dispatch
-static void dma_handler(STM32DMA::device dev, STM32DMA::channel ch)
+STM32_RAMFUNC static void dma_handler(STM32DMA::device dev, STM32DMA::channel ch)
 {
 	auto handler = irq_handlers[dev][ch];
-	STM32DMA::status status;
 	assert(handler); // check to see if a valid handler is registered
 
-	if(check_dma_complete_flag(dev, ch))
+	// Several events can be pending when the ISR runs (e.g., HT and TC of a short transfer), so
+	// each flag is handled on its own. HTIF is set even when its interrupt is disabled, so it is
+	// only reported if enabled.
+	bool half = check_dma_half_transfer_flag(dev, ch) &&
+				LL_DMA_IsEnabledIT_HT(dma_devices[dev], ch);
+	bool complete = check_dma_complete_flag(dev, ch);
+	bool error = check_dma_error_flag(dev, ch);
+	assert(half || complete || error); // Case not handled!
+
+	// Only the handled flags are cleared, before dispatching, so that an event raised while
+	// the handlers run is not lost
+	if(half)
+	{
+		clear_half_transfer_flag(dev, ch);
+	}
+
+	if(complete)
 	{
 		clear_transfer_complete_flag(dev, ch);
-		status = STM32DMA::status::ok;
 	}
-	else if(check_dma_error_flag(dev, ch))
+
+	if(error)
 	{
-		status = STM32DMA::status::error;
+		clear_transfer_error_flag(dev, ch);
 	}
-	else
+
+	// Dispatch in the order the events occur, so a circular buffer's first half is
+	// processed before its second
+	if(half)
 	{
-		assert(0); // Case not handled!
+		handler(STM32DMA::status::half_transfer);
 	}
 
-	clear_dma_general_int_flag(dev, ch);
-	handler(status);
+	if(complete)
+	{
+		handler(STM32DMA::status::ok);
+	}
+
+	if(error)
+	{
+		handler(STM32DMA::status::error);
+	}
 }
 
 void DMA1_Channel1_IRQHandler()
@@ -179,6 +269,39 @@ void DMA2_Channel7_IRQHandler()
 	dma_handler(STM32DMA::device::dma2, STM32DMA::channel::CH7);
 }
 
+void DMAMUX1_OVR_IRQHandler()
+{
+	uint32_t sync_flags = embutil::volatile_load(&DMAMUX1_ChannelStatus->CSR);
+	embutil::volatile_store(&DMAMUX1_ChannelStatus->CFR, sync_flags);
+
+	for(size_t i = 0; sync_flags; i++, sync_flags >>= 1)
+	{
+		if(sync_flags & 0x1)
+		{
+			sync_overrun_counts[i] = sync_overrun_counts[i] + 1;
+			if(sync_overrun_handlers[i])
+			{
+				sync_overrun_handlers[i]();
+			}
+		}
+	}
+
+	uint32_t generator_flags = embutil::volatile_load(&DMAMUX1_RequestGenStatus->RGSR);
+	embutil::volatile_store(&DMAMUX1_RequestGenStatus->RGCFR, generator_flags);
+
+	for(size_t i = 0; generator_flags; i++, generator_flags >>= 1)
+	{
+		if(generator_flags & 0x1)
+		{
+			generator_overrun_counts[i] = generator_overrun_counts[i] + 1;
+			if(generator_overrun_handlers[i])
+			{
+				generator_overrun_handlers[i]();
+			}
+		}
+	}
+}
+
 #pragma mark - Driver -
 
 void STM32DMA::setAddresses(void* source_address, void* dest_address, size_t transfer_size) noexcept
@@ -196,6 +319,48 @@ void STM32DMA::setAddresses(void* source_address, void* dest_address, size_t tra
 	LL_DMA_SetDataLength(inst, channel_, transfer_size);
 }
 
+void STM32DMA::setDataWidth(width peripheral, width memory) noexcept
+{
+	auto inst = dma_devices[device_];
+	assert(inst); // Check for invalid device instance
+	assert(LL_DMA_IsEnabledChannel(inst, channel_) == false);
+
+	LL_DMA_SetPeriphSize(inst, channel_, periph_width[static_cast<uint8_t>(peripheral)]);
+	LL_DMA_SetMemorySize(inst, channel_, memory_width[static_cast<uint8_t>(memory)]);
+}
+
+void STM32DMA::setDirection(direction d) noexcept
+{
+	auto inst = dma_devices[device_];
+	assert(inst); // Check for invalid device instance
+	assert(LL_DMA_IsEnabledChannel(inst, channel_) == false);
+
+	LL_DMA_SetDataTransferDirection(inst, channel_,
+									(d == direction::memory_to_peripheral)
+										? LL_DMA_DIRECTION_MEMORY_TO_PERIPH
+										: LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+}
+
+void STM32DMA::setMemoryIncrement(bool increment) noexcept
+{
+	auto inst = dma_devices[device_];
+	assert(inst); // Check for invalid device instance
+	assert(LL_DMA_IsEnabledChannel(inst, channel_) == false);
+
+	LL_DMA_SetMemoryIncMode(inst, channel_,
+							increment ? LL_DMA_MEMORY_INCREMENT : LL_DMA_MEMORY_NOINCREMENT);
+}
+
+void STM32DMA::setPeripheralIncrement(bool increment) noexcept
+{
+	auto inst = dma_devices[device_];
+	assert(inst); // Check for invalid device instance
+	assert(LL_DMA_IsEnabledChannel(inst, channel_) == false);
+
+	LL_DMA_SetPeriphIncMode(inst, channel_,
+							increment ? LL_DMA_PERIPH_INCREMENT : LL_DMA_PERIPH_NOINCREMENT);
+}
+
 void STM32DMA::enable() noexcept
 {
 	auto inst = dma_devices[device_];
@@ -221,6 +386,30 @@ void STM32DMA::start_() noexcept
 	LL_DMA_ConfigTransfer(inst, channel_, configuration_);
 	LL_DMA_SetPeriphRequest(inst, channel_, mux_request_);
 
+	auto mux = mux_channel(device_, channel_);
+	LL_DMAMUX_DisableSync(DMAMUX1, mux);
+	LL_DMAMUX_DisableEventGeneration(DMAMUX1, mux);
+	LL_DMAMUX_DisableIT_SO(DMAMUX1, mux);
+
+	if(sync_enabled_)
+	{
+		sync_overrun_counts[mux] = 0;
+
+		LL_DMAMUX_SetSyncRequestNb(DMAMUX1, mux, sync_requests_);
+		LL_DMAMUX_SetSyncPolarity(DMAMUX1, mux,
+								  sync_polarity[static_cast<uint8_t>(sync_polarity_)]);
+		LL_DMAMUX_SetSyncID(DMAMUX1, mux, sync_input_);
+
+		if(sync_event_)
+		{
+			LL_DMAMUX_EnableEventGeneration(DMAMUX1, mux);
+		}
+
+		enable_overrun_interrupt();
+		LL_DMAMUX_EnableIT_SO(DMAMUX1, mux);
+		LL_DMAMUX_EnableSync(DMAMUX1, mux);
+	}
+
 	enableInterrupts();
 }
 
@@ -231,13 +420,23 @@ void STM32DMA::stop_() noexcept
 
 	disableInterrupts();
 	LL_DMA_DisableChannel(inst, channel_); // TODO: does this need to be here, or elsewhere?
+
+	if(sync_enabled_)
+	{
+		auto mux = mux_channel(device_, channel_);
+		LL_DMAMUX_DisableIT_SO(DMAMUX1, mux);
+		LL_DMAMUX_DisableSync(DMAMUX1, mux);
+		LL_DMAMUX_DisableEventGeneration(DMAMUX1, mux);
+	}
 }
 
 void STM32DMA::enableInterrupts() noexcept
 {
 	auto irq = irq_num[device_][channel_];
 	assert(irq); // Check that channel is supported
-	NVICControl::priority(irq, 4); // TODO: how to configure priority for the driver?
+	// Channel callbacks may signal an STM32Completion, so the priority must be RTOS-compatible
+	// TODO: how to configure priority for the driver?
+	NVICControl::priority(irq, STM32_COMPLETION_IRQ_PRIORITY);
 	NVICControl::enable(irq);
 
 	// Enable complete/error interrupts
@@ -257,6 +456,29 @@ void STM32DMA::disableInterrupts() noexcept
 	LL_DMA_DisableIT_TE(dma_devices[device_], channel_);
 }
 
+size_t STM32DMA::remaining() const noexcept
+{
+	auto inst = dma_devices[device_];
+	assert(inst); // Check for invalid device instance
+
+	return LL_DMA_GetDataLength(inst, channel_);
+}
+
+void STM32DMA::enableHalfTransferInterrupt(bool enable) noexcept
+{
+	auto inst = dma_devices[device_];
+	assert(inst); // Check for invalid device instance
+
+	if(enable)
+	{
+		LL_DMA_EnableIT_HT(inst, channel_);
+	}
+	else
+	{
+		LL_DMA_DisableIT_HT(inst, channel_);
+	}
+}
+
 void STM32DMA::registerCallback(const STM32DMA::cb_t& cb) noexcept
 {
 	irq_handlers[device_][channel_] = cb;
@@ -266,3 +488,66 @@ void STM32DMA::registerCallback(STM32DMA::cb_t&& cb) noexcept
 {
 	irq_handlers[device_][channel_] = std::move(cb);
 }
+
+void STM32DMA::setSynchronization(uint32_t sync_input, edge polarity, uint8_t requests,
+								  bool generate_event) noexcept
+{
+	assert(started() == false);
+	assert(requests > 0 && requests <= MAX_EVENT_REQUESTS);
+
+	sync_enabled_ = true;
+	sync_input_ = sync_input;
+	sync_polarity_ = polarity;
+	sync_requests_ = requests;
+	sync_event_ = generate_event;
+}
+
+void STM32DMA::registerOverrunCallback(const overrun_cb_t& cb) noexcept
+{
+	sync_overrun_handlers[mux_channel(device_, channel_)] = cb;
+}
+
+uint32_t STM32DMA::overrunCount() const noexcept
+{
+	return sync_overrun_counts[mux_channel(device_, channel_)];
+}
+
+#pragma mark - Request Generator -
+
+uint32_t STM32DMARequestGenerator::request() const noexcept
+{
+	return generator_requests[generator_];
+}
+
+void STM32DMARequestGenerator::start_() noexcept
+{
+	LL_DMAMUX_DisableRequestGen(DMAMUX1, generator_);
+
+	generator_overrun_counts[generator_] = 0;
+
+	LL_DMAMUX_SetGenRequestNb(DMAMUX1, generator_, requests_);
+	LL_DMAMUX_SetRequestGenPolarity(DMAMUX1, generator_,
+									generator_polarity[static_cast<uint8_t>(polarity_)]);
+	LL_DMAMUX_SetRequestSignalID(DMAMUX1, generator_, signal_);
+
+	enable_overrun_interrupt();
+	LL_DMAMUX_EnableIT_RGO(DMAMUX1, generator_);
+	LL_DMAMUX_EnableRequestGen(DMAMUX1, generator_);
+}
+
+void STM32DMARequestGenerator::stop_() noexcept
+{
+	LL_DMAMUX_DisableRequestGen(DMAMUX1, generator_);
+	LL_DMAMUX_DisableIT_RGO(DMAMUX1, generator_);
+}
+
+void STM32DMARequestGenerator::registerOverrunCallback(
+	const STM32DMA::overrun_cb_t& cb) noexcept
+{
+	generator_overrun_handlers[generator_] = cb;
+}
+
+uint32_t STM32DMARequestGenerator::overrunCount() const noexcept
+{
+	return generator_overrun_counts[generator_];
+}
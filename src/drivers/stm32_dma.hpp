@@ -7,6 +7,8 @@
 #include <cassert>
 #include <driver/driver.hpp>
 #include <inplace_function/inplace_function.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_sections.hpp>
 
 // TODO: document requirement to enable the DMA clock in the hardware platform, since
 // we can have multiple channels configured. That means we can't just start/stop DMA.
@@ -55,7 +57,16 @@ enabling and disabling the channel?
  * STM32ClockControl::dmaEnable(STM32DMA::device::dma1);
  * @endcode
  *
+ * Transfer buffers should be declared with STM32_DMA_BUFFER, which places them in an SRAM
+ * bank that the CPU is not using for its stack and general data. This reduces bus matrix
+ * contention between the DMA controller and the CPU.
+ *
+ * @code
+ * STM32_DMA_BUFFER static uint8_t rx_buffer[64];
+ * @endcode
+ *
  * @see STM32ClockControl
+ * @see stm32_sections.hpp
  */
 class STM32DMA final : public embvm::DriverBase
 {
@@ -63,12 +74,28 @@ class STM32DMA final : public embvm::DriverBase
 	enum class status
 	{
 		ok = 0,
-		error
+		error,
+		/// The first half of a transfer is complete (only reported if enabled)
+		half_transfer,
 		// TODO: expand
 	};
 
 	using cb_t = stdext::inplace_function<void(STM32DMA::status)>;
 
+	/// Callback invoked when a DMAMUX synchronization or request generator overrun occurs.
+	using overrun_cb_t = stdext::inplace_function<void()>;
+
+	/// DMAMUX synchronization and request generator trigger edge
+	enum class edge : uint8_t
+	{
+		rising = 0,
+		falling,
+		both,
+	};
+
+	/// Maximum number of requests forwarded per synchronization or generator event
+	static constexpr uint8_t MAX_EVENT_REQUESTS = 32;
+
 	enum device : uint8_t
 	{
 		dma1 = 0,
@@ -76,6 +103,21 @@ class STM32DMA final : public embvm::DriverBase
 		MAX_DMA
 	};
 
+	/// Direction of a peripheral transfer
+	enum class direction : uint8_t
+	{
+		peripheral_to_memory = 0,
+		memory_to_peripheral,
+	};
+
+	/// Size of each data item transferred by the channel
+	enum class width : uint8_t
+	{
+		byte = 0,
+		halfword,
+		word
+	};
+
 	enum channel : uint8_t
 	{
 		CH1 = 0,
@@ -148,6 +190,53 @@ class STM32DMA final : public embvm::DriverBase
 		mux_request_ = mux_request;
 	}
 
+	/** Change the peripheral and memory data widths.
+	 *
+	 * This overrides the PSIZE/MSIZE settings from setConfiguration(), allowing a driver to
+	 * switch between 8- and 16-bit transfers without stopping the channel.
+	 * The transfer size passed to setAddresses() is in units of the peripheral width.
+	 *
+	 * @precondition The DMA channel is disabled.
+	 *
+	 * @param [in] peripheral The data width for the peripheral side of the transfer.
+	 * @param [in] memory The data width for the memory side of the transfer.
+	 */
+	void setDataWidth(width peripheral, width memory) noexcept;
+
+	/** Change the transfer direction.
+	 *
+	 * This overrides the direction from setConfiguration(), allowing a driver with a single
+	 * DMA request (e.g., OCTOSPI) to read and write through one channel. The direction must be
+	 * set before setAddresses(), which assigns the addresses according to it.
+	 *
+	 * @precondition The DMA channel is disabled.
+	 *
+	 * @param [in] d The new transfer direction.
+	 */
+	void setDirection(direction d) noexcept;
+
+	/** Enable or disable memory address increment.
+	 *
+	 * Disabling the increment allows a single memory location to be used as a fill value
+	 * (for transmit) or discard location (for receive).
+	 *
+	 * @precondition The DMA channel is disabled.
+	 *
+	 * @param [in] increment True to increment the memory address after each item.
+	 */
+	void setMemoryIncrement(bool increment) noexcept;
+
+	/** Enable or disable peripheral address increment.
+	 *
+	 * For memory-to-memory transfers, the peripheral address is the source. Disabling the
+	 * increment repeats a single source value (e.g., for a memory fill).
+	 *
+	 * @precondition The DMA channel is disabled.
+	 *
+	 * @param [in] increment True to increment the peripheral address after each item.
+	 */
+	void setPeripheralIncrement(bool increment) noexcept;
+
 	/** Enable the DMA device for executing transfer.
 	 *
 	 * @precondition The DMA device is disabled.
@@ -162,6 +251,65 @@ class STM32DMA final : public embvm::DriverBase
 	 */
 	void disable() noexcept;
 
+	/** Get the number of data items remaining in the current transfer.
+	 *
+	 * In circular mode, this can be used to find the current write position in a receive
+	 * buffer: position = transfer_size - remaining().
+	 */
+	size_t remaining() const noexcept;
+
+	/** Enable the half-transfer interrupt for this channel.
+	 *
+	 * The channel callback will be invoked with status::half_transfer when the first half of
+	 * the buffer has been transferred. This is primarily useful in circular mode, where it
+	 * allows one half of a buffer to be processed while the other half is being filled.
+	 *
+	 * @param [in] enable True to enable the interrupt, false to disable it.
+	 */
+	void enableHalfTransferInterrupt(bool enable) noexcept;
+
+	/** Synchronize the channel's DMAMUX request line to an external event.
+	 *
+	 * While synchronization is enabled, the DMAMUX holds the channel's requests until a
+	 * synchronization event occurs, then forwards `requests` requests. This paces a
+	 * free-running request (such as a request generator or a peripheral that is always
+	 * ready) to an EXTI line or LPTIM output.
+	 *
+	 * If the next event arrives before `requests` requests have been forwarded, a
+	 * synchronization overrun is reported (see registerOverrunCallback()).
+	 *
+	 * @precondition The DMA channel is stopped. The setting is applied by start().
+	 * @precondition requests is in the range [1..MAX_EVENT_REQUESTS].
+	 *
+	 * @param [in] sync_input The synchronization input (LL_DMAMUX_SYNC_*).
+	 * @param [in] polarity The event edge.
+	 * @param [in] requests The number of requests forwarded per event.
+	 * @param [in] generate_event If true, the DMAMUX channel event output is pulsed after
+	 *	`requests` requests. It can be used as a synchronization or generator input for
+	 *	another DMAMUX channel.
+	 */
+	void setSynchronization(uint32_t sync_input, edge polarity, uint8_t requests,
+							bool generate_event = false) noexcept;
+
+	/** Disable DMAMUX synchronization for this channel.
+	 *
+	 * @precondition The DMA channel is stopped. The setting is applied by start().
+	 */
+	void clearSynchronization() noexcept
+	{
+		assert(started() == false);
+		sync_enabled_ = false;
+	}
+
+	/** Register a callback for DMAMUX synchronization overruns on this channel.
+	 *
+	 * The callback is invoked from the DMAMUX overrun interrupt.
+	 */
+	void registerOverrunCallback(const overrun_cb_t& cb) noexcept;
+
+	/// The number of synchronization overruns on this channel since it was started.
+	uint32_t overrunCount() const noexcept;
+
 	// TODO: document
 	void registerCallback(const cb_t& cb) noexcept;
 	void registerCallback(cb_t&& cb) noexcept;
@@ -181,6 +329,102 @@ class STM32DMA final : public embvm::DriverBase
 	uint32_t configuration_;
 	/// Peripheral Request (DMA Mux)
 	uint32_t mux_request_;
+	/// DMAMUX synchronization settings, applied in start_()
+	bool sync_enabled_ = false;
+	bool sync_event_ = false;
+	edge sync_polarity_ = edge::rising;
+	uint8_t sync_requests_ = 1;
+	uint32_t sync_input_ = 0;
+};
+
+/** DMAMUX request generator channel.
+ *
+ * A request generator produces DMA requests without a peripheral: each trigger event (an
+ * EXTI line, LPTIM output, or another DMAMUX channel's event output) generates a
+ * configurable number of requests. A DMA channel configured with request() as its DMAMUX
+ * request then transfers one item per generated request.
+ *
+ * This allows a precomputed buffer to be written to a register (e.g., GPIO BSRR or a DAC
+ * data register) at hardware-timed intervals without CPU involvement:
+ *
+ * @code
+ * STM32DMARequestGenerator gen{STM32DMARequestGenerator::RG0, LL_DMAMUX_REQ_GEN_LPTIM1_OUT,
+ *								STM32DMA::edge::rising, 1};
+ * dma_ch.setConfiguration(LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_MODE_CIRCULAR |
+ *						   LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_WORD |
+ *						   LL_DMA_MDATAALIGN_WORD, gen.request());
+ * dma_ch.start();
+ * dma_ch.setAddresses(pattern, const_cast<uint32_t*>(&GPIOB->BSRR), pattern_length);
+ * dma_ch.enable();
+ * gen.start();
+ * @endcode
+ *
+ * If a trigger event occurs before the previous event's requests have been serviced, a
+ * generator overrun is reported.
+ *
+ * The DMAMUX clock must be enabled in the hardware platform.
+ *
+ * @see STM32DMA::setSynchronization()
+ */
+class STM32DMARequestGenerator final : public embvm::DriverBase
+{
+  public:
+	enum generator : uint8_t
+	{
+		RG0 = 0,
+		RG1,
+		RG2,
+		RG3,
+		MAX_GEN
+	};
+
+	/** Create a request generator.
+	 *
+	 * @param [in] gen The generator channel.
+	 * @param [in] signal The trigger input (LL_DMAMUX_REQ_GEN_*).
+	 * @param [in] polarity The trigger edge.
+	 * @param [in] requests The number of requests per trigger, [1..MAX_EVENT_REQUESTS].
+	 */
+	STM32DMARequestGenerator(generator gen, uint32_t signal, STM32DMA::edge polarity,
+							 uint8_t requests) noexcept
+		: embvm::DriverBase(embvm::DriverType::DMA), generator_(gen), signal_(signal),
+		  polarity_(polarity), requests_(requests)
+	{
+		assert(gen < MAX_GEN);
+		assert(requests > 0 && requests <= STM32DMA::MAX_EVENT_REQUESTS);
+	}
+	~STM32DMARequestGenerator() noexcept = default;
+
+	/// The DMAMUX request ID to pass to STM32DMA::setConfiguration()
+	uint32_t request() const noexcept;
+
+	/** Change the number of requests generated per trigger.
+	 *
+	 * @precondition The generator is stopped.
+	 */
+	void setRequests(uint8_t requests) noexcept
+	{
+		assert(started() == false);
+		assert(requests > 0 && requests <= STM32DMA::MAX_EVENT_REQUESTS);
+		requests_ = requests;
+	}
+
+	/// Register a callback for generator overruns. It is invoked from the DMAMUX overrun ISR.
+	void registerOverrunCallback(const STM32DMA::overrun_cb_t& cb) noexcept;
+
+	/// The number of generator overruns since the generator was started.
+	uint32_t overrunCount() const noexcept;
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+  private:
+	const generator generator_;
+	const uint32_t signal_;
+	const STM32DMA::edge polarity_;
+	uint8_t requests_;
 };
 
 #endif // STM32_DMA_HPP_
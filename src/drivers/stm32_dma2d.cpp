@@ -0,0 +1,472 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_dma2d.hpp"
+#include <array>
+#include <cassert>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_dma2d.h>
+
+/* Useful Developer Notes
+ *
+ * Transfer modes (DMA2D_CR MODE):
+ *	- R2M: the output color register (OCOLR) is written to every output pixel. OCOLR must be
+ *		encoded in the output format.
+ *	- M2M: foreground pixels are copied without conversion
+ *	- M2M_PFC: foreground pixels are converted to the output format
+ *	- M2M_BLEND: foreground and background pixels are converted, blended, and converted to
+ *		the output format
+ *
+ * Line offsets (OOR, FGOR, BGOR) are the number of pixels skipped at the end of each line,
+ * i.e. stride - width. NLR holds the pixels per line (14 bits) and the number of lines.
+ *
+ * Indexed formats (L8, AL44, AL88) need the CLUT to be loaded into the DMA2D's internal CLUT
+ * memory. The load is started by setting START in FGPFCCR/BGPFCCR, and CTC is raised when it
+ * completes. The CLUT must not be loaded while a transfer is in progress, so loads are run
+ * as separate steps before the transfer is started.
+ *
+ * START in DMA2D_CR is cleared by hardware when the transfer completes or an error occurs.
+ * On a transfer or configuration error, the DMA2D stops and the operation is reported as
+ * failed.
+ */
+
+#pragma mark - Definitions -
+
+using STM32DMA2D_cb_t = stdext::inplace_function<void()>;
+
+constexpr size_t NUM_FORMATS = static_cast<size_t>(STM32DMA2D::pixel_format::a8) + 1;
+
+/// Formats up to and including this one can be used as an output format
+constexpr auto LAST_OUTPUT_FORMAT = STM32DMA2D::pixel_format::argb4444;
+
+/// Largest line offset supported by the offset registers
+constexpr uint32_t MAX_LINE_OFFSET = 0x3FFF;
+
+#pragma mark - Variables -
+
+constexpr std::array<uint32_t, NUM_FORMATS> input_mode = {
+	LL_DMA2D_INPUT_MODE_ARGB8888, LL_DMA2D_INPUT_MODE_RGB888, LL_DMA2D_INPUT_MODE_RGB565,
+	LL_DMA2D_INPUT_MODE_ARGB1555, LL_DMA2D_INPUT_MODE_ARGB4444, LL_DMA2D_INPUT_MODE_L8,
+	LL_DMA2D_INPUT_MODE_AL44,	 LL_DMA2D_INPUT_MODE_AL88,	 LL_DMA2D_INPUT_MODE_A8,
+};
+
+constexpr std::array<uint32_t, static_cast<size_t>(LAST_OUTPUT_FORMAT) + 1> output_mode = {
+	LL_DMA2D_OUTPUT_MODE_ARGB8888, LL_DMA2D_OUTPUT_MODE_RGB888, LL_DMA2D_OUTPUT_MODE_RGB565,
+	LL_DMA2D_OUTPUT_MODE_ARGB1555, LL_DMA2D_OUTPUT_MODE_ARGB4444,
+};
+
+constexpr std::array<uint8_t, NUM_FORMATS> bytes_per_pixel = {4, 3, 2, 2, 2, 1, 1, 2, 1};
+
+static STM32DMA2D_cb_t dma2d_callback = nullptr;
+
+#pragma mark - Helpers -
+
+static bool is_output_format(STM32DMA2D::pixel_format format)
+{
+	return format <= LAST_OUTPUT_FORMAT;
+}
+
+static bool uses_clut(STM32DMA2D::pixel_format format)
+{
+	return format == STM32DMA2D::pixel_format::l8 || format == STM32DMA2D::pixel_format::al44 ||
+		   format == STM32DMA2D::pixel_format::al88;
+}
+
+/// Address of pixel (x, y) within a surface
+static uint32_t pixel_address(const STM32DMA2D::surface_t& surface, uint16_t x, uint16_t y)
+{
+	auto offset = ((static_cast<uint32_t>(y) * surface.stride) + x) *
+				  bytes_per_pixel[static_cast<size_t>(surface.format)];
+
+	return reinterpret_cast<uintptr_t>(surface.pixels) + offset;
+}
+
+static uint32_t line_offset(const STM32DMA2D::surface_t& surface, uint16_t width)
+{
+	assert(surface.stride >= width);
+	uint32_t offset = surface.stride - width;
+	assert(offset <= MAX_LINE_OFFSET);
+	return offset;
+}
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void DMA2D_IRQHandler(void);
+
+void DMA2D_IRQHandler()
+{
+	if(dma2d_callback)
+	{
+		dma2d_callback();
+	}
+}
+
+#pragma mark - Driver APIs -
+
+void STM32DMA2D::start_() noexcept
+{
+	STM32ClockControl::dma2dEnable();
+
+	loaded_fg_clut_ = nullptr;
+	loaded_bg_clut_ = nullptr;
+	error_ = false;
+
+	dma2d_callback = [this]() { handleInterrupt(); };
+	enableInterrupts();
+}
+
+void STM32DMA2D::stop_() noexcept
+{
+	disableInterrupts();
+
+	if(LL_DMA2D_IsTransferOngoing(DMA2D))
+	{
+		LL_DMA2D_Abort(DMA2D);
+		while(LL_DMA2D_IsTransferOngoing(DMA2D))
+		{
+		}
+	}
+
+	dma2d_callback = nullptr;
+
+	StaticQueue<flush_waiter_t, MAX_FLUSH_WAITERS> waiters;
+
+	{
+		STM32InterruptLock lock;
+		queue_.clear();
+		active_ = false;
+		for(; !flush_waiters_.empty(); flush_waiters_.pop())
+		{
+			waiters.push(flush_waiters_.front());
+		}
+	}
+
+	// Queued operations were discarded, so nothing else will wake these tasks
+	for(; !waiters.empty(); waiters.pop())
+	{
+		waiters.front().completion->signal();
+	}
+
+	STM32ClockControl::dma2dDisable();
+}
+
+void STM32DMA2D::enableInterrupts() noexcept
+{
+	NVICControl::priority(DMA2D_IRQn, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(DMA2D_IRQn);
+
+	LL_DMA2D_EnableIT_TC(DMA2D);
+	LL_DMA2D_EnableIT_TE(DMA2D);
+	LL_DMA2D_EnableIT_CE(DMA2D);
+	LL_DMA2D_EnableIT_CTC(DMA2D);
+	LL_DMA2D_EnableIT_CAE(DMA2D);
+}
+
+void STM32DMA2D::disableInterrupts() noexcept
+{
+	LL_DMA2D_DisableIT_TC(DMA2D);
+	LL_DMA2D_DisableIT_TE(DMA2D);
+	LL_DMA2D_DisableIT_CE(DMA2D);
+	LL_DMA2D_DisableIT_CTC(DMA2D);
+	LL_DMA2D_DisableIT_CAE(DMA2D);
+
+	NVICControl::disable(DMA2D_IRQn);
+}
+
+STM32DMA2D::status STM32DMA2D::fill(const surface_t& dest, const rect_t& area, uint32_t argb,
+									const cb_t& cb) noexcept
+{
+	op_t op;
+	op.type = kind::fill;
+	op.dest = dest;
+	op.area = area;
+	op.color = encodeColor(argb, dest.format);
+	op.cb = cb;
+
+	return enqueue(op);
+}
+
+STM32DMA2D::status STM32DMA2D::copy(const surface_t& src, point_t src_origin,
+									const surface_t& dest, const rect_t& area,
+									const cb_t& cb) noexcept
+{
+	op_t op;
+	op.type = kind::copy;
+	op.dest = dest;
+	op.area = area;
+	op.fg = src;
+	op.fg_origin = src_origin;
+	op.cb = cb;
+
+	return enqueue(op);
+}
+
+STM32DMA2D::status STM32DMA2D::blend(const surface_t& fg, point_t fg_origin, uint8_t fg_alpha,
+									 const surface_t& bg, point_t bg_origin,
+									 const surface_t& dest, const rect_t& area,
+									 const cb_t& cb) noexcept
+{
+	op_t op;
+	op.type = kind::blend;
+	op.dest = dest;
+	op.area = area;
+	op.fg = fg;
+	op.fg_origin = fg_origin;
+	op.fg_alpha = fg_alpha;
+	op.bg = bg;
+	op.bg_origin = bg_origin;
+	op.cb = cb;
+
+	return enqueue(op);
+}
+
+// The waiter records how many operations had been queued when flush() was called, and the
+// ISR signals it once that many have completed. Operations queued afterwards by other tasks
+// do not extend the wait.
+STM32DMA2D::status STM32DMA2D::flush() noexcept
+{
+	STM32Completion completion;
+	bool wait = false;
+
+	{
+		STM32InterruptLock lock;
+
+		if(active_)
+		{
+			completion.arm();
+			if(!flush_waiters_.push({enqueued_count_, &completion}))
+			{
+				return status::busy;
+			}
+
+			wait = true;
+		}
+	}
+
+	if(wait)
+	{
+		completion.wait();
+	}
+
+	STM32InterruptLock lock;
+	auto result = error_ ? status::error : status::ok;
+	error_ = false;
+	return result;
+}
+
+void STM32DMA2D::invalidateClut() noexcept
+{
+	STM32InterruptLock lock;
+	loaded_fg_clut_ = nullptr;
+	loaded_bg_clut_ = nullptr;
+}
+
+STM32DMA2D::status STM32DMA2D::enqueue(const op_t& op) noexcept
+{
+	assert(started());
+	assert(op.dest.pixels && is_output_format(op.dest.format));
+	assert(op.area.width > 0 && op.area.width <= MAX_WIDTH && op.area.height > 0);
+
+	if(op.type != kind::fill)
+	{
+		assert(op.fg.pixels);
+		assert(!uses_clut(op.fg.format) || (op.fg.clut && op.fg.clut_size > 0 &&
+											op.fg.clut_size <= 256));
+	}
+
+	if(op.type == kind::blend)
+	{
+		assert(op.bg.pixels);
+		assert(!uses_clut(op.bg.format) || (op.bg.clut && op.bg.clut_size > 0 &&
+											op.bg.clut_size <= 256));
+	}
+
+	STM32InterruptLock lock;
+
+	if(!queue_.push(op))
+	{
+		return status::busy;
+	}
+
+	enqueued_count_++;
+
+	if(!active_)
+	{
+		active_ = true;
+		startNextOperation();
+	}
+
+	return status::enqueued;
+}
+
+// Called with interrupts masked, or from the DMA2D ISR
+void STM32DMA2D::startNextOperation() noexcept
+{
+	const auto& op = queue_.front();
+	const auto& area = op.area;
+
+	LL_DMA2D_SetOutputColorMode(DMA2D, output_mode[static_cast<size_t>(op.dest.format)]);
+	LL_DMA2D_SetOutputMemAddr(DMA2D, pixel_address(op.dest, area.x, area.y));
+	LL_DMA2D_SetLineOffset(DMA2D, line_offset(op.dest, area.width));
+	LL_DMA2D_ConfigSize(DMA2D, area.height, area.width);
+
+	if(op.type == kind::fill)
+	{
+		LL_DMA2D_SetMode(DMA2D, LL_DMA2D_MODE_R2M);
+		LL_DMA2D_SetOutputColor(DMA2D, op.color);
+	}
+	else
+	{
+		const auto& fg = op.fg;
+
+		LL_DMA2D_FGND_SetMemAddr(DMA2D, pixel_address(fg, op.fg_origin.x, op.fg_origin.y));
+		LL_DMA2D_FGND_SetLineOffset(DMA2D, line_offset(fg, area.width));
+		LL_DMA2D_FGND_SetColorMode(DMA2D, input_mode[static_cast<size_t>(fg.format)]);
+		LL_DMA2D_FGND_SetColor(DMA2D, (fg.color >> 16) & 0xFF, (fg.color >> 8) & 0xFF,
+							   fg.color & 0xFF);
+
+		if(op.type == kind::copy)
+		{
+			LL_DMA2D_SetMode(DMA2D, (fg.format == op.dest.format) ? LL_DMA2D_MODE_M2M
+																   : LL_DMA2D_MODE_M2M_PFC);
+			LL_DMA2D_FGND_SetAlphaMode(DMA2D, LL_DMA2D_ALPHA_MODE_NO_MODIF);
+		}
+		else
+		{
+			const auto& bg = op.bg;
+
+			LL_DMA2D_SetMode(DMA2D, LL_DMA2D_MODE_M2M_BLEND);
+			LL_DMA2D_FGND_SetAlphaMode(DMA2D, LL_DMA2D_ALPHA_MODE_COMBINE);
+			LL_DMA2D_FGND_SetAlpha(DMA2D, op.fg_alpha);
+
+			LL_DMA2D_BGND_SetMemAddr(DMA2D, pixel_address(bg, op.bg_origin.x, op.bg_origin.y));
+			LL_DMA2D_BGND_SetLineOffset(DMA2D, line_offset(bg, area.width));
+			LL_DMA2D_BGND_SetColorMode(DMA2D, input_mode[static_cast<size_t>(bg.format)]);
+			LL_DMA2D_BGND_SetAlphaMode(DMA2D, LL_DMA2D_ALPHA_MODE_NO_MODIF);
+			LL_DMA2D_BGND_SetColor(DMA2D, (bg.color >> 16) & 0xFF, (bg.color >> 8) & 0xFF,
+								   bg.color & 0xFF);
+		}
+	}
+
+	continueOperation();
+}
+
+// Called with interrupts masked, or from the DMA2D ISR
+void STM32DMA2D::continueOperation() noexcept
+{
+	const auto& op = queue_.front();
+
+	if(op.type != kind::fill && uses_clut(op.fg.format) && op.fg.clut != loaded_fg_clut_)
+	{
+		loaded_fg_clut_ = op.fg.clut;
+		LL_DMA2D_FGND_SetCLUTMemAddr(DMA2D, reinterpret_cast<uintptr_t>(op.fg.clut));
+		LL_DMA2D_FGND_SetCLUTSize(DMA2D, op.fg.clut_size - 1U);
+		LL_DMA2D_FGND_SetCLUTColorMode(DMA2D, LL_DMA2D_CLUT_COLOR_MODE_ARGB8888);
+		LL_DMA2D_FGND_EnableCLUTLoad(DMA2D);
+		return;
+	}
+
+	if(op.type == kind::blend && uses_clut(op.bg.format) && op.bg.clut != loaded_bg_clut_)
+	{
+		loaded_bg_clut_ = op.bg.clut;
+		LL_DMA2D_BGND_SetCLUTMemAddr(DMA2D, reinterpret_cast<uintptr_t>(op.bg.clut));
+		LL_DMA2D_BGND_SetCLUTSize(DMA2D, op.bg.clut_size - 1U);
+		LL_DMA2D_BGND_SetCLUTColorMode(DMA2D, LL_DMA2D_CLUT_COLOR_MODE_ARGB8888);
+		LL_DMA2D_BGND_EnableCLUTLoad(DMA2D);
+		return;
+	}
+
+	LL_DMA2D_Start(DMA2D);
+}
+
+// Called from the DMA2D ISR
+void STM32DMA2D::handleInterrupt() noexcept
+{
+	if(LL_DMA2D_IsActiveFlag_CAE(DMA2D) || LL_DMA2D_IsActiveFlag_TE(DMA2D) ||
+	   LL_DMA2D_IsActiveFlag_CE(DMA2D))
+	{
+		LL_DMA2D_ClearFlag_CAE(DMA2D);
+		LL_DMA2D_ClearFlag_TE(DMA2D);
+		LL_DMA2D_ClearFlag_CE(DMA2D);
+		LL_DMA2D_ClearFlag_CTC(DMA2D);
+		LL_DMA2D_ClearFlag_TC(DMA2D);
+
+		// The CLUT memories may hold partial data
+		loaded_fg_clut_ = nullptr;
+		loaded_bg_clut_ = nullptr;
+
+		operationComplete(status::error);
+	}
+	else if(LL_DMA2D_IsActiveFlag_CTC(DMA2D))
+	{
+		LL_DMA2D_ClearFlag_CTC(DMA2D);
+
+		STM32InterruptLock lock;
+		if(active_)
+		{
+			continueOperation();
+		}
+	}
+	else if(LL_DMA2D_IsActiveFlag_TC(DMA2D))
+	{
+		LL_DMA2D_ClearFlag_TC(DMA2D);
+		operationComplete(status::ok);
+	}
+}
+
+// Called from the DMA2D ISR
+void STM32DMA2D::operationComplete(status s) noexcept
+{
+	op_t completed;
+	StaticQueue<flush_waiter_t, MAX_FLUSH_WAITERS> flushed;
+
+	{
+		STM32InterruptLock lock;
+
+		if(!active_)
+		{
+			return;
+		}
+
+		if(s == status::error)
+		{
+			error_ = true;
+		}
+
+		completed = std::move(queue_.front());
+		queue_.pop();
+		completed_count_++;
+
+		while(!flush_waiters_.empty() &&
+			  static_cast<int32_t>(completed_count_ - flush_waiters_.front().target) >= 0)
+		{
+			flushed.push(flush_waiters_.front());
+			flush_waiters_.pop();
+		}
+
+		// Start the next operation before running the callback to keep the DMA2D busy
+		if(queue_.empty())
+		{
+			active_ = false;
+		}
+		else
+		{
+			startNextOperation();
+		}
+	}
+
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(completed.cb)
+	{
+		completed.cb(s);
+	}
+
+	for(; !flushed.empty(); flushed.pop())
+	{
+		flushed.front().completion->signal();
+	}
+}
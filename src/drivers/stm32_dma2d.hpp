@@ -0,0 +1,291 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_DMA2D_HPP_
+#define STM32_DMA2D_HPP_
+
+#include <cstdint>
+#include <driver/driver.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <static_queue.hpp>
+#include <stm32_completion.hpp>
+
+// TODO: Handle interrupt priority - as a constructor parameter
+// TODO: support 4-bit formats (L4, A4), fixed-color blending, and line watermark interrupts
+
+/** STM32 DMA2D (Chrom-ART) graphics accelerator driver.
+ *
+ * The DMA2D moves rectangular blocks of pixels without CPU involvement:
+ *
+ *	- fill(): Fill a rectangle with a solid color (register-to-memory)
+ *	- copy(): Copy a rectangle between surfaces with independent strides. If the surfaces have
+ *		different pixel formats, the pixels are converted (e.g., L8 with a CLUT to RGB565).
+ *	- blend(): Alpha-blend a foreground rectangle over a background rectangle and write the
+ *		result to a third surface (which may be the background)
+ *
+ * Operations are queued and executed in order in the background. The next operation is
+ * started from the DMA2D interrupt. A typical frame is rendered by queueing all of the
+ * operations and calling flush() before the frame buffer is displayed.
+ *
+ * @code
+ * STM32DMA2D::surface_t fb = {framebuffer, 320, STM32DMA2D::pixel_format::rgb565};
+ * STM32DMA2D::surface_t icon = {icon_pixels, 32, STM32DMA2D::pixel_format::l8,
+ *								icon_palette, 256};
+ *
+ * dma2d.fill(fb, {0, 0, 320, 240}, 0xFF202020);
+ * dma2d.copy(icon, {0, 0}, fb, {16, 16, 32, 32});
+ * dma2d.blend(sprite, {0, 0}, 0x80, fb, {100, 50}, fb, {100, 50, 64, 64});
+ * dma2d.flush();
+ * @endcode
+ *
+ * Pixel buffers and CLUTs must remain valid until the operation's callback is invoked (or
+ * flush() returns). The DMA2D is an AHB master, so buffers can be placed in any SRAM bank.
+ *
+ * A CLUT is only reloaded into the DMA2D when a surface with a different CLUT pointer is
+ * used. If the contents of a CLUT are modified in place, call invalidateClut().
+ *
+ * @see STM32DMA2D::encodeColor()
+ */
+class STM32DMA2D final : public embvm::DriverBase
+{
+  public:
+	enum class status : uint8_t
+	{
+		/// The operation completed successfully
+		ok = 0,
+		/// The operation was added to the queue
+		enqueued,
+		/// The operation queue is full
+		busy,
+		/// A transfer, CLUT access, or configuration error occurred
+		error,
+	};
+
+	/** Pixel formats.
+	 *
+	 * All formats can be used as a source. Only the first five formats (up to argb4444) can
+	 * be used as a destination.
+	 */
+	enum class pixel_format : uint8_t
+	{
+		argb8888 = 0,
+		rgb888,
+		rgb565,
+		argb1555,
+		argb4444,
+		/// 8-bit index into a CLUT
+		l8,
+		/// 4-bit alpha, 4-bit CLUT index
+		al44,
+		/// 8-bit alpha, 8-bit CLUT index
+		al88,
+		/// 8-bit alpha; the color is taken from the surface's fixed color
+		a8,
+	};
+
+	/// A pixel buffer
+	struct surface_t
+	{
+		void* pixels;
+		/// Number of pixels in each line of the buffer, which may exceed the width of any
+		/// rectangle drawn on it
+		uint16_t stride;
+		pixel_format format;
+		/// ARGB8888 color lookup table for l8, al44, and al88 surfaces
+		const uint32_t* clut = nullptr;
+		/// Number of entries in the CLUT, [1..256]
+		uint16_t clut_size = 0;
+		/// ARGB8888 color used for a8 surfaces
+		uint32_t color = 0;
+	};
+
+	struct point_t
+	{
+		uint16_t x;
+		uint16_t y;
+	};
+
+	struct rect_t
+	{
+		uint16_t x;
+		uint16_t y;
+		uint16_t width;
+		uint16_t height;
+	};
+
+	/// Operation callback. This is invoked from the DMA2D interrupt context.
+	using cb_t = stdext::inplace_function<void(status)>;
+
+	/// Maximum number of operations which can be queued.
+	static constexpr size_t QUEUE_DEPTH = 16;
+
+	/// Maximum number of tasks which can wait in flush() at the same time.
+	static constexpr size_t MAX_FLUSH_WAITERS = 4;
+
+	/// Maximum width of a rectangle, in pixels (limited by the 14-bit pixel-per-line counter).
+	static constexpr uint16_t MAX_WIDTH = 16383;
+
+  public:
+	STM32DMA2D() noexcept : embvm::DriverBase(embvm::DriverType::DMA) {}
+	~STM32DMA2D() noexcept = default;
+
+	void enableInterrupts() noexcept;
+	void disableInterrupts() noexcept;
+
+	/** Queue a rectangle fill.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] dest The destination surface. Must use an output-capable format.
+	 * @param [in] area The rectangle to fill.
+	 * @param [in] argb The fill color, in ARGB8888 format. It is converted to the
+	 *	destination format.
+	 * @param [in] cb Optional callback invoked when the fill completes.
+	 * @returns status::enqueued if the operation was queued, status::busy if the queue is full.
+	 */
+	status fill(const surface_t& dest, const rect_t& area, uint32_t argb,
+				const cb_t& cb = nullptr) noexcept;
+
+	/** Queue a rectangle copy, converting the pixel format if needed.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] src The source surface.
+	 * @param [in] src_origin The top-left corner of the source rectangle.
+	 * @param [in] dest The destination surface. Must use an output-capable format.
+	 * @param [in] area The destination rectangle. Its size is also the size of the source
+	 *	rectangle.
+	 * @param [in] cb Optional callback invoked when the copy completes.
+	 * @returns status::enqueued if the operation was queued, status::busy if the queue is full.
+	 */
+	status copy(const surface_t& src, point_t src_origin, const surface_t& dest,
+				const rect_t& area, const cb_t& cb = nullptr) noexcept;
+
+	/** Queue an alpha blend.
+	 *
+	 * Each foreground pixel's alpha is multiplied by fg_alpha, and the result is used to
+	 * blend the foreground over the background.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] fg The foreground surface.
+	 * @param [in] fg_origin The top-left corner of the foreground rectangle.
+	 * @param [in] fg_alpha The constant alpha applied to the foreground, [0..255].
+	 * @param [in] bg The background surface.
+	 * @param [in] bg_origin The top-left corner of the background rectangle.
+	 * @param [in] dest The destination surface. Must use an output-capable format.
+	 * @param [in] area The destination rectangle. Its size is also the size of the
+	 *	foreground and background rectangles.
+	 * @param [in] cb Optional callback invoked when the blend completes.
+	 * @returns status::enqueued if the operation was queued, status::busy if the queue is full.
+	 */
+	status blend(const surface_t& fg, point_t fg_origin, uint8_t fg_alpha, const surface_t& bg,
+				 point_t bg_origin, const surface_t& dest, const rect_t& area,
+				 const cb_t& cb = nullptr) noexcept;
+
+	/** Wait for all queued operations to complete.
+	 *
+	 * Only the operations queued before the call are waited for. Several tasks can flush at
+	 * the same time. When built with RTOS support, the calling task is blocked (not spinning).
+	 *
+	 * @precondition This is not called from an interrupt context.
+	 * @returns status::error if any operation failed since the last flush(), status::busy if
+	 *	MAX_FLUSH_WAITERS tasks are already waiting, status::ok otherwise.
+	 */
+	status flush() noexcept;
+
+	/// Force the CLUTs to be reloaded by the next operation which uses them.
+	void invalidateClut() noexcept;
+
+	/// Check whether an operation is in progress.
+	bool busy() const noexcept
+	{
+		return active_;
+	}
+
+	/** Convert an ARGB8888 color to a destination pixel format.
+	 *
+	 * @param [in] argb The color, in ARGB8888 format.
+	 * @param [in] format The destination format. Must be an output-capable format.
+	 * @returns The encoded color, in the low bits of the result.
+	 */
+	static constexpr uint32_t encodeColor(uint32_t argb, pixel_format format) noexcept
+	{
+		uint32_t a = (argb >> 24) & 0xFF;
+		uint32_t r = (argb >> 16) & 0xFF;
+		uint32_t g = (argb >> 8) & 0xFF;
+		uint32_t b = argb & 0xFF;
+
+		switch(format)
+		{
+			case pixel_format::rgb888:
+				return argb & 0xFFFFFF;
+			case pixel_format::rgb565:
+				return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+			case pixel_format::argb1555:
+				return ((a >> 7) << 15) | ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+			case pixel_format::argb4444:
+				return ((a >> 4) << 12) | ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4);
+			case pixel_format::argb8888:
+			default:
+				return argb;
+		}
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	enum class kind : uint8_t
+	{
+		fill = 0,
+		copy,
+		blend,
+	};
+
+	struct op_t
+	{
+		kind type = kind::fill;
+		surface_t dest = {};
+		rect_t area = {};
+		surface_t fg = {};
+		point_t fg_origin = {};
+		uint8_t fg_alpha = 0xFF;
+		surface_t bg = {};
+		point_t bg_origin = {};
+		uint32_t color = 0;
+		cb_t cb;
+	};
+
+	/// A task waiting in flush()
+	struct flush_waiter_t
+	{
+		/// The flush completes once this many operations have completed
+		uint32_t target;
+		STM32Completion* completion;
+	};
+
+	status enqueue(const op_t& op) noexcept;
+	/// Program the operation at the front of the queue
+	void startNextOperation() noexcept;
+	/// Load any CLUT that the active operation needs, then start the transfer
+	void continueOperation() noexcept;
+	/// Handle the DMA2D interrupt
+	void handleInterrupt() noexcept;
+	void operationComplete(status s) noexcept;
+
+  private:
+	StaticQueue<op_t, QUEUE_DEPTH> queue_;
+	volatile bool active_ = false;
+	/// The CLUTs currently held in the DMA2D CLUT memories, to avoid reloading them
+	const uint32_t* loaded_fg_clut_ = nullptr;
+	const uint32_t* loaded_bg_clut_ = nullptr;
+	/// Set when an operation fails; reported and cleared by flush()
+	volatile bool error_ = false;
+	/// Operations queued and completed since the driver was started. These wrap, and are
+	/// compared by their difference.
+	uint32_t enqueued_count_ = 0;
+	uint32_t completed_count_ = 0;
+	/// Waiters are queued in flush() order, so their targets are in completion order
+	StaticQueue<flush_waiter_t, MAX_FLUSH_WAITERS> flush_waiters_;
+};
+
+#endif // STM32_DMA2D_HPP_
@@ -0,0 +1,237 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_dma_memcpy.hpp"
+#include <array>
+#include <cassert>
+#include <dma_chunk.hpp>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+
+/* Useful Developer Notes
+ *
+ * In memory-to-memory mode (MEM2MEM = 1, DIR = 0), the channel reads from CPAR and writes to
+ * CMAR without waiting for a peripheral request, so the DMAMUX request is unused. Circular
+ * mode is not allowed in memory-to-memory mode.
+ *
+ * The channel remains enabled after the transfer completes (EN is not cleared by hardware),
+ * so it must be disabled before the next chunk is programmed.
+ *
+ * Fills are implemented with a non-incrementing source that points at the fill value.
+ */
+
+#pragma mark - Helpers -
+
+/// Map a chunk width in bytes to the DMA data width
+static STM32DMA::width dma_width(size_t bytes)
+{
+	switch(bytes)
+	{
+		case 4:
+			return STM32DMA::width::word;
+		case 2:
+			return STM32DMA::width::halfword;
+		default:
+			return STM32DMA::width::byte;
+	}
+}
+
+#pragma mark - Driver APIs -
+
+void STM32DMAMemcpy::start_() noexcept
+{
+	channel_.setConfiguration(LL_DMA_DIRECTION_MEMORY_TO_MEMORY | LL_DMA_PRIORITY_LOW |
+								  LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_INCREMENT |
+								  LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_WORD |
+								  LL_DMA_MDATAALIGN_WORD,
+							  LL_DMAMUX_REQ_MEM2MEM);
+
+	channel_.registerCallback([this](STM32DMA::status s) { chunkComplete(s); });
+	channel_.start();
+
+	bytes_transferred_ = 0;
+}
+
+void STM32DMAMemcpy::stop_() noexcept
+{
+	channel_.stop();
+
+	STM32InterruptLock lock;
+	queue_.clear();
+	active_ = false;
+}
+
+STM32DMAMemcpy::status STM32DMAMemcpy::copy(void* dest, const void* src, size_t length,
+											const cb_t& cb) noexcept
+{
+	assert(dest && src && length);
+
+	request_t request;
+	request.dest = static_cast<uint8_t*>(dest);
+	request.src = static_cast<const uint8_t*>(src);
+	request.remaining = length;
+	request.cb = cb;
+
+	return enqueue(request);
+}
+
+STM32DMAMemcpy::status STM32DMAMemcpy::fill(void* dest, uint8_t value, size_t length,
+											const cb_t& cb) noexcept
+{
+	assert(dest && length);
+
+	request_t request;
+	request.dest = static_cast<uint8_t*>(dest);
+	request.fill_value = value * UINT32_C(0x01010101);
+	request.remaining = length;
+	request.cb = cb;
+
+	return enqueue(request);
+}
+
+STM32DMAMemcpy::status STM32DMAMemcpy::copy(void* dest, const void* src, size_t length) noexcept
+{
+	// The completion and result belong to this call, since several callers may be waiting
+	STM32Completion completion;
+	volatile status result = status::ok;
+
+	completion.arm();
+
+	auto r = copy(dest, src, length, [&completion, &result](status s) {
+		result = s;
+		completion.signal();
+	});
+
+	if(r != status::enqueued)
+	{
+		return r;
+	}
+
+	completion.wait();
+	return result;
+}
+
+STM32DMAMemcpy::status STM32DMAMemcpy::fill(void* dest, uint8_t value, size_t length) noexcept
+{
+	// The completion and result belong to this call, since several callers may be waiting
+	STM32Completion completion;
+	volatile status result = status::ok;
+
+	completion.arm();
+
+	auto r = fill(dest, value, length, [&completion, &result](status s) {
+		result = s;
+		completion.signal();
+	});
+
+	if(r != status::enqueued)
+	{
+		return r;
+	}
+
+	completion.wait();
+	return result;
+}
+
+STM32DMAMemcpy::status STM32DMAMemcpy::enqueue(const request_t& request) noexcept
+{
+	assert(started());
+
+	STM32InterruptLock lock;
+
+	if(!queue_.push(request))
+	{
+		return status::busy;
+	}
+
+	if(!active_)
+	{
+		active_ = true;
+		startNextChunk();
+	}
+
+	return status::enqueued;
+}
+
+// Called with interrupts masked, or from the DMA ISR
+void STM32DMAMemcpy::startNextChunk() noexcept
+{
+	auto& request = queue_.front();
+	bool fill = (request.src == nullptr);
+
+	auto chunk = nextDmaChunk(reinterpret_cast<uintptr_t>(request.dest),
+							  reinterpret_cast<uintptr_t>(request.src), request.remaining, fill,
+							  MAX_CHUNK_ITEMS);
+	chunk_bytes_ = chunk.bytes();
+
+	auto width = dma_width(chunk.width);
+
+	channel_.disable();
+	channel_.setDataWidth(width, width);
+	channel_.setPeripheralIncrement(!fill);
+	// The underlying STM32 code doesn't take const.
+	channel_.setAddresses(fill ? static_cast<void*>(&request.fill_value)
+							   : const_cast<uint8_t*>(request.src),
+						  request.dest, chunk.items);
+	channel_.enable();
+}
+
+// Called from the DMA ISR
+void STM32DMAMemcpy::chunkComplete(STM32DMA::status s) noexcept
+{
+	request_t completed;
+	status result = (s == STM32DMA::status::ok) ? status::ok : status::error;
+
+	{
+		STM32InterruptLock lock;
+
+		if(!active_)
+		{
+			return;
+		}
+
+		auto& request = queue_.front();
+
+		if(result == status::ok)
+		{
+			bytes_transferred_ = bytes_transferred_ + chunk_bytes_;
+			request.remaining -= chunk_bytes_;
+			request.dest += chunk_bytes_;
+			if(request.src)
+			{
+				request.src += chunk_bytes_;
+			}
+
+			if(request.remaining > 0)
+			{
+				startNextChunk();
+				return;
+			}
+		}
+		else
+		{
+			channel_.disable();
+		}
+
+		completed = std::move(request);
+		queue_.pop();
+
+		// Start the next request before running the callback to keep the channel busy
+		if(queue_.empty())
+		{
+			active_ = false;
+		}
+		else
+		{
+			startNextChunk();
+		}
+	}
+
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(completed.cb)
+	{
+		completed.cb(result);
+	}
+}
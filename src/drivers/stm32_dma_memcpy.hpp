@@ -0,0 +1,160 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_DMA_MEMCPY_HPP_
+#define STM32_DMA_MEMCPY_HPP_
+
+#include <driver/driver.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <static_queue.hpp>
+#include <stm32_dma.hpp>
+
+/** Memory-to-memory copy and fill engine using a dedicated DMA channel.
+ *
+ * Requests are queued and executed in order in the background. Each request is split into
+ * DMA transfers with nextDmaChunk(): the bulk of the data is moved in 32-bit words whenever
+ * the source and destination alignment allows it, and transfers are limited to
+ * MAX_CHUNK_ITEMS items. The next chunk is started from the DMA interrupt.
+ *
+ * The channel runs at low priority, so peripheral DMA requests on the same controller are
+ * serviced first. The CPU can continue running from a different SRAM bank (or flash)
+ * while a copy is in progress. Copies between different SRAM banks make the best use of
+ * the bus matrix.
+ *
+ * The channel is dedicated to this engine. To run copies in parallel, create another engine
+ * on another channel.
+ *
+ * @code
+ * STM32DMA dma_ch_memcpy{STM32DMA::device::dma2, STM32DMA::channel::CH2};
+ * STM32DMAMemcpy memcpy_engine{dma_ch_memcpy};
+ *
+ * memcpy_engine.start();
+ * memcpy_engine.copy(dest, src, 4096, [](STM32DMAMemcpy::status s) {
+ *	// Runs in interrupt context
+ * });
+ * @endcode
+ *
+ * You must enable the appropriate DMA device clock in the hardware platform; this driver
+ * will not handle that.
+ *
+ * @see STM32DMA
+ * @see nextDmaChunk()
+ */
+class STM32DMAMemcpy final : public embvm::DriverBase
+{
+  public:
+	enum class status : uint8_t
+	{
+		/// The request completed successfully
+		ok = 0,
+		/// The request was added to the queue
+		enqueued,
+		/// The request queue is full
+		busy,
+		/// A DMA transfer error occurred
+		error,
+	};
+
+	/// Completion callback. This is invoked from the DMA interrupt context.
+	using cb_t = stdext::inplace_function<void(status)>;
+
+	/// Maximum number of requests which can be queued.
+	static constexpr size_t QUEUE_DEPTH = 8;
+
+	/// Maximum number of items in a single DMA transfer (limited by the DMA counter).
+	static constexpr size_t MAX_CHUNK_ITEMS = 65535;
+
+  public:
+	explicit STM32DMAMemcpy(STM32DMA& channel) noexcept
+		: embvm::DriverBase(embvm::DriverType::DMA), channel_(channel)
+	{
+	}
+	~STM32DMAMemcpy() noexcept = default;
+
+	/** Queue an asynchronous memory copy.
+	 *
+	 * The buffers must not overlap.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition length > 0
+	 * @param [in] dest The destination buffer.
+	 * @param [in] src The source buffer.
+	 * @param [in] length The number of bytes to copy.
+	 * @param [in] cb Callback invoked (in interrupt context) when the copy completes.
+	 * @returns status::enqueued if the request was queued, status::busy if the queue is full.
+	 */
+	status copy(void* dest, const void* src, size_t length, const cb_t& cb) noexcept;
+
+	/** Queue an asynchronous memory fill.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition length > 0
+	 * @param [in] dest The destination buffer.
+	 * @param [in] value The byte value to write.
+	 * @param [in] length The number of bytes to write.
+	 * @param [in] cb Callback invoked (in interrupt context) when the fill completes.
+	 * @returns status::enqueued if the request was queued, status::busy if the queue is full.
+	 */
+	status fill(void* dest, uint8_t value, size_t length, const cb_t& cb) noexcept;
+
+	/** Perform a blocking memory copy.
+	 *
+	 * The copy is queued behind any pending requests. When built with RTOS support, the
+	 * calling task is blocked (not spinning) until the copy completes.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition This is not called from an interrupt context.
+	 * @returns The copy result, or status::busy if the queue is full.
+	 */
+	status copy(void* dest, const void* src, size_t length) noexcept;
+
+	/** Perform a blocking memory fill.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition This is not called from an interrupt context.
+	 * @returns The fill result, or status::busy if the queue is full.
+	 */
+	status fill(void* dest, uint8_t value, size_t length) noexcept;
+
+	/// Check whether a request is in progress.
+	bool busy() const noexcept
+	{
+		return active_;
+	}
+
+	/// The total number of bytes moved since the driver started.
+	uint32_t bytesTransferred() const noexcept
+	{
+		return bytes_transferred_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	struct request_t
+	{
+		uint8_t* dest = nullptr;
+		const uint8_t* src = nullptr;
+		/// Fill value, replicated into each byte. Used when src is nullptr.
+		uint32_t fill_value = 0;
+		size_t remaining = 0;
+		cb_t cb;
+	};
+
+	status enqueue(const request_t& request) noexcept;
+	/// Start the next chunk of the request at the front of the queue
+	void startNextChunk() noexcept;
+	void chunkComplete(STM32DMA::status s) noexcept;
+
+  private:
+	STM32DMA& channel_;
+	StaticQueue<request_t, QUEUE_DEPTH> queue_;
+	volatile bool active_ = false;
+	/// Size of the active DMA transfer, in bytes
+	size_t chunk_bytes_ = 0;
+	volatile uint32_t bytes_transferred_ = 0;
+};
+
+#endif // STM32_DMA_MEMCPY_HPP_
@@ -0,0 +1,175 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_dma_pool.hpp"
+#include <cassert>
+#include <processor_includes.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32l4xx_ll_dma.h>
+
+#pragma mark - Variables -
+
+constexpr std::array<uint32_t, static_cast<size_t>(STM32DMAPool::priority::NUM_PRIORITIES)>
+	priority_setting = {LL_DMA_PRIORITY_LOW, LL_DMA_PRIORITY_MEDIUM, LL_DMA_PRIORITY_HIGH,
+						LL_DMA_PRIORITY_VERYHIGH};
+
+#pragma mark - Helpers -
+
+static size_t count_bits(uint16_t mask)
+{
+	size_t count = 0;
+	for(; mask; mask &= static_cast<uint16_t>(mask - 1))
+	{
+		count++;
+	}
+
+	return count;
+}
+
+#pragma mark - Pool APIs -
+
+STM32DMAPool::STM32DMAPool(STM32DMA* const* channels, size_t count) noexcept : count_(count)
+{
+	assert(channels && count > 0 && count <= MAX_CHANNELS);
+
+	for(size_t i = 0; i < count; i++)
+	{
+		assert(channels[i]);
+		channels_[i] = channels[i];
+	}
+
+	stats_.channels = count;
+}
+
+STM32DMA* STM32DMAPool::acquire(uint32_t configuration, uint32_t mux_request, priority p,
+								const STM32DMA::cb_t& cb, bool auto_release) noexcept
+{
+	auto p_index = static_cast<size_t>(p);
+	STM32DMA* channel = nullptr;
+	size_t index = 0;
+
+	{
+		STM32InterruptLock lock;
+		bool prefer_first = (p == priority::high || p == priority::very_high);
+
+		for(size_t n = 0; n < count_; n++)
+		{
+			size_t i = prefer_first ? n : (count_ - 1 - n);
+			auto bit = static_cast<uint16_t>(1U << i);
+
+			if((in_use_mask_ & bit) == 0)
+			{
+				in_use_mask_ |= bit;
+				if(auto_release)
+				{
+					auto_release_mask_ |= bit;
+				}
+				else
+				{
+					auto_release_mask_ &= static_cast<uint16_t>(~bit);
+				}
+
+				channel = channels_[i];
+				index = i;
+				break;
+			}
+		}
+
+		if(channel == nullptr)
+		{
+			stats_.contention[p_index]++;
+			return nullptr;
+		}
+
+		stats_.acquisitions[p_index]++;
+		auto in_use = count_bits(in_use_mask_);
+		if(in_use > stats_.high_water_mark)
+		{
+			stats_.high_water_mark = in_use;
+		}
+	}
+
+	// The channel is owned by the caller now, so it can be configured outside of the lock
+	channel->setConfiguration((configuration & ~DMA_CCR_PL) | priority_setting[p_index],
+							  mux_request);
+	callbacks_[index] = cb;
+	channel->registerCallback(
+		[this, index](STM32DMA::status s) { channelCallback(index, s); });
+	channel->start();
+
+	return channel;
+}
+
+void STM32DMAPool::release(STM32DMA* channel) noexcept
+{
+	assert(channel);
+
+	// The channel callback is left registered: release() may be running inside it, and the
+	// stopped channel cannot invoke it. The holder callback is replaced by the next acquire().
+	channel->stop();
+	channel->clearSynchronization();
+	channel->registerOverrunCallback(nullptr);
+
+	waiter_t waiter;
+
+	{
+		STM32InterruptLock lock;
+		size_t i = 0;
+
+		while(i < count_ && channels_[i] != channel)
+		{
+			i++;
+		}
+
+		auto bit = static_cast<uint16_t>(1U << i);
+		assert(i < count_ && (in_use_mask_ & bit)); // Channel does not belong to this pool
+		in_use_mask_ &= static_cast<uint16_t>(~bit);
+
+		if(!waiters_.empty())
+		{
+			waiter = std::move(waiters_.front());
+			waiters_.pop();
+			stats_.waiters_woken++;
+		}
+	}
+
+	if(waiter)
+	{
+		waiter();
+	}
+}
+
+void STM32DMAPool::channelCallback(size_t index, STM32DMA::status s) noexcept
+{
+	auto bit = static_cast<uint16_t>(1U << index);
+
+	// Both are sampled before the callback runs. A holder which opted out may release the
+	// channel from its callback, and a waiter may then acquire it (and replace callbacks_[index])
+	// for a new holder.
+	bool auto_release = (s != STM32DMA::status::half_transfer) && (auto_release_mask_ & bit);
+	auto cb = callbacks_[index];
+
+	if(cb)
+	{
+		cb(s);
+	}
+
+	if(auto_release && (in_use_mask_ & bit))
+	{
+		release(channels_[index]);
+	}
+}
+
+bool STM32DMAPool::wait(const waiter_t& waiter) noexcept
+{
+	STM32InterruptLock lock;
+	return waiters_.push(waiter);
+}
+
+STM32DMAPool::stats_t STM32DMAPool::stats() const noexcept
+{
+	STM32InterruptLock lock;
+	auto stats = stats_;
+	stats.in_use = count_bits(in_use_mask_);
+	return stats;
+}
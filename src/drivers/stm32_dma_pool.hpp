@@ -0,0 +1,170 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_DMA_POOL_HPP_
+#define STM32_DMA_POOL_HPP_
+
+#include <array>
+#include <inplace_function/inplace_function.hpp>
+#include <static_queue.hpp>
+#include <stm32_dma.hpp>
+
+/** Allocator which hands out DMA channels on demand.
+ *
+ * Instead of dedicating a channel to each peripheral for the life of the program, a driver
+ * acquires a channel when it starts a transfer, and the channel returns to the pool when the
+ * transfer completes.
+ * Because the DMAMUX can route any request to any channel, the channel is configured with
+ * the requested DMAMUX request ID at acquisition time. This lets bursty peripherals share a
+ * small set of channels.
+ *
+ * The pool is given a set of channels which are not used by any other driver. Channel order
+ * matters: when two channels have the same software priority, the DMA controller services
+ * the lower-numbered channel first. High and very high priority requests are given the
+ * first free channel in the list, and low and medium priority requests are given the last
+ * free channel. List the channels in ascending order (per controller) to take advantage of
+ * this.
+ *
+ * When no channel is free, acquire() fails immediately and the failure is counted as
+ * contention. A driver can register a waiter, which is invoked (once) when a channel is
+ * released so that it can retry.
+ *
+ * By default, the pool releases the channel after the holder's callback returns for a
+ * complete or failed transfer (half-transfer notifications do not release the channel).
+ * Holders that keep a channel across several transfers, such as circular transfers, pass
+ * auto_release = false to acquire() and call release() themselves.
+ *
+ * release() returns the channel to a clean state: DMAMUX synchronization, event generation,
+ * and the overrun callback are cleared so they do not carry over to the next holder.
+ *
+ * acquire() and release() can be called from interrupt context.
+ *
+ * @code
+ * std::array<STM32DMA*, 2> channels = {&dma2_ch3, &dma2_ch4};
+ * STM32DMAPool pool{channels.data(), channels.size()};
+ *
+ * auto ch = pool.acquire(LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_MODE_NORMAL |
+ *							LL_DMA_MEMORY_INCREMENT,
+ *						LL_DMAMUX_REQ_USART2_TX, STM32DMAPool::priority::medium,
+ *						[&](STM32DMA::status s) {
+ *							tx_done = (s == STM32DMA::status::ok);
+ *						});
+ * if(ch)
+ * {
+ *	ch->setAddresses(buffer, data_reg, length);
+ *	ch->enable();
+ * }
+ * @endcode
+ *
+ * You must enable the appropriate DMA device clocks in the hardware platform; the pool will
+ * not handle that.
+ *
+ * @see STM32DMA
+ */
+class STM32DMAPool
+{
+  public:
+	/// Channel software priority
+	enum class priority : uint8_t
+	{
+		low = 0,
+		medium,
+		high,
+		very_high,
+		NUM_PRIORITIES
+	};
+
+	/// Callback invoked when a channel has been released.
+	using waiter_t = stdext::inplace_function<void()>;
+
+	/// Maximum number of channels managed by a pool (all channels of DMA1 and DMA2)
+	static constexpr size_t MAX_CHANNELS = 14;
+
+	/// Maximum number of waiters which can be registered at once
+	static constexpr size_t MAX_WAITERS = 4;
+
+	struct stats_t
+	{
+		/// Number of channels managed by the pool
+		size_t channels;
+		/// Number of channels currently acquired
+		size_t in_use;
+		/// Largest number of channels acquired at once
+		size_t high_water_mark;
+		/// Successful acquisitions, per priority
+		std::array<uint32_t, static_cast<size_t>(priority::NUM_PRIORITIES)> acquisitions;
+		/// Acquisitions that failed because no channel was free, per priority
+		std::array<uint32_t, static_cast<size_t>(priority::NUM_PRIORITIES)> contention;
+		/// Number of waiters that have been woken by a release
+		uint32_t waiters_woken;
+	};
+
+  public:
+	/** Construct a channel pool.
+	 *
+	 * @precondition The channels are stopped and are not used outside of the pool.
+	 * @param [in] channels The channels managed by the pool, in preference order.
+	 * @param [in] count The number of channels, [1..MAX_CHANNELS].
+	 */
+	STM32DMAPool(STM32DMA* const* channels, size_t count) noexcept;
+	~STM32DMAPool() noexcept = default;
+
+	/** Acquire a channel and configure it for a transfer.
+	 *
+	 * The channel is configured, the callback is registered, and the channel is started.
+	 * The caller still needs to set the addresses and enable the channel.
+	 *
+	 * @param [in] configuration The raw DMA configuration (see STM32DMA::setConfiguration()).
+	 *	Any priority bits are replaced by p.
+	 * @param [in] mux_request The DMAMUX request ID to route to the channel.
+	 * @param [in] p The software priority of the channel.
+	 * @param [in] cb The channel callback.
+	 * @param [in] auto_release If true, the channel is released after cb returns for a
+	 *	complete or failed transfer, and cb must not call release(). If false, the holder
+	 *	must call release(), which it may do from cb.
+	 * @returns The acquired channel, or nullptr if no channel is free.
+	 */
+	STM32DMA* acquire(uint32_t configuration, uint32_t mux_request, priority p,
+					  const STM32DMA::cb_t& cb, bool auto_release = true) noexcept;
+
+	/** Release a channel back to the pool.
+	 *
+	 * The channel is stopped and its DMAMUX synchronization settings and overrun callback are
+	 * cleared. If a waiter is registered, it is invoked after the channel has been returned to
+	 * the pool.
+	 *
+	 * @precondition channel was acquired from this pool.
+	 * @param [in] channel The channel to release.
+	 */
+	void release(STM32DMA* channel) noexcept;
+
+	/** Register a callback to be invoked when a channel is released.
+	 *
+	 * Waiters are woken in registration order, one per release, and are then removed.
+	 *
+	 * @param [in] waiter The callback. It is invoked from the context that calls release().
+	 * @returns true if the waiter was registered, false if too many waiters are registered.
+	 */
+	bool wait(const waiter_t& waiter) noexcept;
+
+	/// Get the pool usage and contention statistics.
+	stats_t stats() const noexcept;
+
+  private:
+	/// Channel callback registered by the pool; forwards to the holder and auto-releases.
+	void channelCallback(size_t index, STM32DMA::status s) noexcept;
+
+  private:
+	std::array<STM32DMA*, MAX_CHANNELS> channels_{};
+	/// Holder callbacks, indexed like channels_
+	std::array<STM32DMA::cb_t, MAX_CHANNELS> callbacks_{};
+	const size_t count_;
+	/// Bit n is set when channels_[n] is acquired
+	uint16_t in_use_mask_ = 0;
+	/// Bit n is set when channels_[n] is released automatically when its transfer completes
+	uint16_t auto_release_mask_ = 0;
+	StaticQueue<waiter_t, MAX_WAITERS> waiters_;
+	stats_t stats_{};
+};
+
+#endif // STM32_DMA_POOL_HPP_
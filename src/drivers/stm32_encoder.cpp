@@ -0,0 +1,227 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_encoder.hpp"
+#include "helpers/gpio_helper.hpp"
+#include "helpers/timer_helper.hpp"
+#include <array>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_tim.h>
+
+/* Useful Developer Notes
+ *
+ * In encoder mode, TI1FP1 and TI2FP2 clock the counter, and the counting direction (DIR) is
+ * decoded from the level of the other input. The polarity of TI1 inverts the direction.
+ *
+ * The counter runs between 0 and ARR. An update event is generated when it wraps in either
+ * direction. The direction of a wrap is found from the counter value after the wrap: a
+ * counter near 0 has overflowed, and a counter near ARR has underflowed. This is reliable as
+ * long as the update interrupt is serviced before the counter moves half its range, and
+ * unlike the DIR bit, it is not confused by a direction change right after the wrap.
+ *
+ * The index input uses channel 3 in input capture mode. The slave mode controller is
+ * occupied by the encoder interface, so the counter cannot be reset by the index in
+ * hardware. Instead, the count captured at the index edge is used as the position
+ * reference.
+ */
+
+#pragma mark - Variables -
+
+constexpr std::array<uint32_t, 3> ll_encoder_mode = {
+	LL_TIM_ENCODERMODE_X2_TI1, LL_TIM_ENCODERMODE_X2_TI2, LL_TIM_ENCODERMODE_X4_TI12};
+
+#pragma mark - Helpers -
+
+static inline TIM_TypeDef* timer_instance(embvm::timer::channel ch)
+{
+	return static_cast<TIM_TypeDef*>(STM32TimerHelper::instance(ch));
+}
+
+/// Resolve a counter value to the extended position closest to a reference position.
+/// The counter range is a power of two.
+static int64_t nearest_position(int64_t reference, uint32_t counter, uint64_t range)
+{
+	auto mask = range - 1;
+	auto delta = (counter - static_cast<uint64_t>(reference)) & mask;
+
+	// Map the distance to [-range / 2, range / 2)
+	auto signed_delta = static_cast<int64_t>(delta);
+	if(delta >= (range / 2))
+	{
+		signed_delta -= static_cast<int64_t>(range);
+	}
+
+	return reference + signed_delta;
+}
+
+#pragma mark - Driver APIs -
+
+void STM32Encoder::start_() noexcept
+{
+	auto inst = timer_instance(timer_);
+	assert(STM32TimerHelper::channelCount(timer_) >= 4); // Basic timers have no inputs
+
+	STM32GPIOTranslator::configure_alternate(a_.port, a_.pin, a_.af);
+	STM32GPIOTranslator::configure_alternate(b_.port, b_.pin, b_.af);
+	if(has_index_)
+	{
+		STM32GPIOTranslator::configure_alternate(index_.port, index_.pin, index_.af);
+	}
+
+	STM32ClockControl::timerEnable(timer_);
+
+	auto max_count = STM32TimerHelper::is32Bit(timer_) ? UINT32_MAX : UINT16_MAX;
+	counter_range_ = static_cast<uint64_t>(max_count) + 1;
+
+	LL_TIM_SetPrescaler(inst, 0);
+	LL_TIM_SetAutoReload(inst, max_count);
+
+	auto filter = STM32TimerHelper::inputFilter(filter_);
+	LL_TIM_IC_Config(inst, LL_TIM_CHANNEL_CH1,
+					 LL_TIM_ACTIVEINPUT_DIRECTTI | LL_TIM_ICPSC_DIV1 | filter |
+						 (reversed_ ? LL_TIM_IC_POLARITY_FALLING : LL_TIM_IC_POLARITY_RISING));
+	LL_TIM_IC_Config(inst, LL_TIM_CHANNEL_CH2,
+					 LL_TIM_ACTIVEINPUT_DIRECTTI | LL_TIM_ICPSC_DIV1 | filter |
+						 LL_TIM_IC_POLARITY_RISING);
+	LL_TIM_SetEncoderMode(inst, ll_encoder_mode[static_cast<uint8_t>(mode_)]);
+
+	if(has_index_)
+	{
+		LL_TIM_IC_Config(inst, LL_TIM_CHANNEL_CH3,
+						 LL_TIM_ACTIVEINPUT_DIRECTTI | LL_TIM_ICPSC_DIV1 | filter |
+							 LL_TIM_IC_POLARITY_RISING);
+		LL_TIM_CC_EnableChannel(inst, LL_TIM_CHANNEL_CH3);
+	}
+
+	wraps_ = 0;
+	offset_ = 0;
+	indexed_ = false;
+	last_sample_ = 0;
+	last_delta_ = 0;
+	velocity_ = 0;
+
+	LL_TIM_GenerateEvent_UPDATE(inst);
+	LL_TIM_SetCounter(inst, 0);
+	LL_TIM_ClearFlag_UPDATE(inst);
+	LL_TIM_ClearFlag_CC3(inst);
+
+	STM32TimerHelper::registerInterruptHandler(timer_,
+											   [this](uint32_t status) { interruptHandler(status); });
+	STM32TimerHelper::enableInterrupts(timer_, STM32_COMPLETION_IRQ_PRIORITY);
+	LL_TIM_EnableIT_UPDATE(inst);
+	if(has_index_)
+	{
+		LL_TIM_EnableIT_CC3(inst);
+	}
+
+	LL_TIM_CC_EnableChannel(inst, LL_TIM_CHANNEL_CH1 | LL_TIM_CHANNEL_CH2);
+	LL_TIM_EnableCounter(inst);
+}
+
+void STM32Encoder::stop_() noexcept
+{
+	auto inst = timer_instance(timer_);
+
+	LL_TIM_DisableIT_UPDATE(inst);
+	LL_TIM_DisableIT_CC3(inst);
+	STM32TimerHelper::disableInterrupts(timer_);
+	STM32TimerHelper::registerInterruptHandler(timer_, nullptr);
+
+	LL_TIM_DeInit(inst);
+	STM32ClockControl::timerDisable(timer_);
+
+	STM32GPIOTranslator::configure_default(a_.port, a_.pin);
+	STM32GPIOTranslator::configure_default(b_.port, b_.pin);
+	if(has_index_)
+	{
+		STM32GPIOTranslator::configure_default(index_.port, index_.pin);
+	}
+}
+
+#pragma mark - Position -
+
+int64_t STM32Encoder::rawPosition() const noexcept
+{
+	auto inst = timer_instance(timer_);
+
+	STM32InterruptLock lock;
+
+	int64_t wraps = wraps_;
+	uint32_t counter = LL_TIM_GetCounter(inst);
+
+	// Account for a wrap which has not been handled by the interrupt yet. The counter is
+	// read again, since it may have wrapped after the first read.
+	if(LL_TIM_IsActiveFlag_UPDATE(inst))
+	{
+		counter = LL_TIM_GetCounter(inst);
+		wraps += (counter < (counter_range_ / 2)) ? 1 : -1;
+	}
+
+	return (wraps * static_cast<int64_t>(counter_range_)) + counter;
+}
+
+int64_t STM32Encoder::position() const noexcept
+{
+	STM32InterruptLock lock;
+	return rawPosition() - offset_;
+}
+
+void STM32Encoder::setPosition(int64_t position) noexcept
+{
+	assert(started());
+
+	STM32InterruptLock lock;
+	offset_ = rawPosition() - position;
+}
+
+#pragma mark - Velocity -
+
+void STM32Encoder::sample() noexcept
+{
+	// Raw positions are used so that index and setPosition() changes don't appear as motion
+	auto raw = rawPosition();
+	auto delta = raw - last_sample_;
+	last_sample_ = raw;
+
+	delta = (delta > INT32_MAX) ? INT32_MAX : ((delta < INT32_MIN) ? INT32_MIN : delta);
+	last_delta_ = static_cast<int32_t>(delta);
+
+	int64_t measured = delta * sample_rate_;
+	measured = (measured > INT32_MAX) ? INT32_MAX
+									  : ((measured < INT32_MIN) ? INT32_MIN : measured);
+
+	int64_t velocity = velocity_;
+	velocity += (measured - velocity) / (INT64_C(1) << velocity_filter_);
+	velocity_ = static_cast<int32_t>(velocity);
+}
+
+#pragma mark - Interrupt Handling -
+
+// Called from the timer ISR
+void STM32Encoder::interruptHandler(uint32_t status) noexcept
+{
+	auto inst = timer_instance(timer_);
+
+	if(status & TIM_SR_UIF)
+	{
+		auto counter = LL_TIM_GetCounter(inst);
+		wraps_ = wraps_ + ((counter < (counter_range_ / 2)) ? 1 : -1);
+	}
+
+	if(status & TIM_SR_CC3IF)
+	{
+		// The capture may be older than the latest wrap, so resolve it relative to the
+		// current position rather than the current wrap count
+		auto capture = LL_TIM_IC_GetCaptureCH3(inst);
+		auto index = nearest_position(rawPosition(), capture, counter_range_);
+
+		if(index_mode_ == index_mode::every || !indexed_)
+		{
+			offset_ = index;
+			indexed_ = true;
+		}
+	}
+}
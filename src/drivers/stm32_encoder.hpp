@@ -0,0 +1,216 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_ENCODER_HPP_
+#define STM32_ENCODER_HPP_
+
+#include <cassert>
+#include <cstdint>
+#include <driver/driver.hpp>
+#include <driver/gpio.hpp>
+#include <driver/timer.hpp>
+
+/** STM32 quadrature encoder driver.
+ *
+ * Uses the timer's encoder interface (slave mode controller in encoder mode) to count the
+ * edges of a quadrature encoder's A/B signals in hardware. The direction is decoded from the
+ * phase of the signals, so no CPU time is spent per edge.
+ *
+ * The hardware counter is 16 bits (32 bits on TIM2/TIM5). It is extended to a signed 64-bit
+ * position in software with the timer's update (overflow/underflow) interrupt, which fires
+ * once every 65536 counts on 16-bit timers.
+ *
+ * An optional index pulse (Z) on channel 3 captures the hardware count in hardware at the
+ * index edge, and the position is referenced to that count. The capture happens at the
+ * edge, so the reference is exact even if the interrupt is delayed.
+ *
+ * Velocity is estimated by calling sample() at a fixed rate (e.g., from a periodic timer
+ * callback or a control loop). Each sample measures the position change since the previous
+ * one.
+ *
+ * @code
+ * STM32Encoder axis{embvm::timer::channel::CH3, {embvm::gpio::port::C, 6, 2},
+ *					 {embvm::gpio::port::C, 7, 2}};
+ * axis.configureIndex({embvm::gpio::port::C, 8, 2});
+ * axis.setSampleRate(1000);
+ * axis.start();
+ * ...
+ * // 1 kHz control loop
+ * axis.sample();
+ * auto pos = axis.position();
+ * auto vel = axis.velocity(); // counts per second
+ * @endcode
+ *
+ * The GPIO bank clocks must be enabled in the hardware platform. The timer clock is managed
+ * by this driver.
+ */
+class STM32Encoder final : public embvm::DriverBase
+{
+  public:
+	/// Which signal edges are counted
+	enum class mode : uint8_t
+	{
+		/// Count both edges of A (2 counts per cycle)
+		x2_a = 0,
+		/// Count both edges of B (2 counts per cycle)
+		x2_b,
+		/// Count both edges of both signals (4 counts per cycle)
+		x4,
+	};
+
+	/// How the index pulse references the position
+	enum class index_mode : uint8_t
+	{
+		/// The first index pulse sets the position to 0 (homing)
+		first = 0,
+		/// Every index pulse sets the position to 0
+		every,
+	};
+
+	/// An input pin for an encoder signal
+	struct pin_t
+	{
+		embvm::gpio::port port;
+		uint8_t pin;
+		/// Alternate function number which connects the pin to the timer channel
+		uint8_t af;
+	};
+
+	/// Maximum input filter setting
+	static constexpr uint8_t MAX_FILTER = 15;
+
+  public:
+	/** Construct an encoder driver.
+	 *
+	 * @param [in] timer The timer device (TIM1-TIM5 or TIM8).
+	 * @param [in] a The A signal pin, on timer channel 1.
+	 * @param [in] b The B signal pin, on timer channel 2.
+	 * @param [in] m The counting mode.
+	 * @param [in] filter The digital input filter setting (ICxF), [0..MAX_FILTER]. Filtering
+	 *	rejects contact bounce and noise, but limits the maximum edge rate.
+	 */
+	STM32Encoder(embvm::timer::channel timer, const pin_t& a, const pin_t& b, mode m = mode::x4,
+				 uint8_t filter = 0) noexcept
+		: embvm::DriverBase(embvm::DriverType::TIMER), timer_(timer), a_(a), b_(b), mode_(m),
+		  filter_(filter)
+	{
+		assert(filter <= MAX_FILTER);
+	}
+	~STM32Encoder() noexcept = default;
+
+	/** Use an index pulse to reference the position.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] index The index signal pin, on timer channel 3.
+	 * @param [in] m Whether the first or every index pulse resets the position.
+	 */
+	void configureIndex(const pin_t& index, index_mode m = index_mode::first) noexcept
+	{
+		assert(started() == false);
+		index_ = index;
+		index_mode_ = m;
+		has_index_ = true;
+	}
+
+	/// Reverse the counting direction.
+	/// @precondition The driver is stopped.
+	void setReversed(bool reversed) noexcept
+	{
+		assert(started() == false);
+		reversed_ = reversed;
+	}
+
+	/** Set the rate at which sample() is called.
+	 *
+	 * @param [in] rate The number of sample() calls per second.
+	 */
+	void setSampleRate(uint32_t rate) noexcept
+	{
+		assert(rate > 0);
+		sample_rate_ = rate;
+	}
+
+	/** Set the velocity smoothing.
+	 *
+	 * Each sample moves the velocity estimate 1 / 2^shift of the way toward the new
+	 * measurement (an exponential moving average). 0 disables smoothing.
+	 *
+	 * @param [in] shift The smoothing factor, [0..8].
+	 */
+	void setVelocityFilter(uint8_t shift) noexcept
+	{
+		assert(shift <= 8);
+		velocity_filter_ = shift;
+	}
+
+	/// The current position, in counts.
+	/// Safe to call from any context, including the timer interrupt.
+	int64_t position() const noexcept;
+
+	/// Set the current position, in counts.
+	void setPosition(int64_t position) noexcept;
+
+	/// Check whether an index pulse has referenced the position.
+	bool indexed() const noexcept
+	{
+		return indexed_;
+	}
+
+	/// Wait for the next index pulse to reference the position again (index_mode::first).
+	void rearmIndex() noexcept
+	{
+		indexed_ = false;
+	}
+
+	/** Update the velocity estimate.
+	 *
+	 * Call this at the rate set with setSampleRate().
+	 */
+	void sample() noexcept;
+
+	/// The velocity estimate, in counts per second.
+	int32_t velocity() const noexcept
+	{
+		return velocity_;
+	}
+
+	/// The signed number of counts between the last two calls to sample().
+	int32_t lastDelta() const noexcept
+	{
+		return last_delta_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	/// The hardware count extended with the overflow count (not referenced to the index)
+	int64_t rawPosition() const noexcept;
+	void interruptHandler(uint32_t status) noexcept;
+
+  private:
+	const embvm::timer::channel timer_;
+	const pin_t a_;
+	const pin_t b_;
+	const mode mode_;
+	const uint8_t filter_;
+	pin_t index_ = {};
+	index_mode index_mode_ = index_mode::first;
+	bool has_index_ = false;
+	bool reversed_ = false;
+	/// Number of counts in one counter cycle (ARR + 1)
+	uint64_t counter_range_ = 0;
+	/// Counter overflows minus underflows, in units of counter_range_
+	volatile int64_t wraps_ = 0;
+	/// Raw position which corresponds to position 0
+	volatile int64_t offset_ = 0;
+	volatile bool indexed_ = false;
+	uint32_t sample_rate_ = 1000;
+	uint8_t velocity_filter_ = 0;
+	int64_t last_sample_ = 0;
+	int32_t last_delta_ = 0;
+	int32_t velocity_ = 0;
+};
+
+#endif // STM32_ENCODER_HPP_
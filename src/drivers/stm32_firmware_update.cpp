@@ -0,0 +1,260 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_firmware_update.hpp"
+#include <cassert>
+#include <cstring>
+
+/* Useful Developer Notes
+ *
+ * The STM32L4+ boots from the bank selected by the BFB2 option bit, and maps that bank at
+ * 0x08000000 (SYSCFG_MEMRMP FB_MODE). The other bank is always at 0x08100000. So the new
+ * image is written to 0x08100000, but it is linked to run at 0x08000000.
+ *
+ * Fast programming would need a mass erase of the inactive bank, which would also erase the
+ * preserved region. The image is written with double-word programming instead, and each
+ * page is erased just before it is first programmed.
+ */
+
+#pragma mark - Definitions -
+
+/// SRAM1, SRAM2, and SRAM3 are contiguous from 0x20000000
+constexpr uintptr_t SRAM_START = 0x20000000;
+constexpr uintptr_t SRAM_END = 0x200A0000;
+/// SRAM2 is also aliased on the code bus
+constexpr uintptr_t SRAM2_ALIAS_START = 0x10000000;
+constexpr uintptr_t SRAM2_ALIAS_END = 0x10010000;
+
+#pragma mark - Helpers -
+
+static bool all_erased(const uint8_t* data, size_t length)
+{
+	for(size_t i = 0; i < length; i++)
+	{
+		if(data[i] != 0xFF)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#pragma mark - Constructor -
+
+STM32FirmwareUpdate::STM32FirmwareUpdate(STM32InternalFlash& flash, STM32CRC& crc,
+										 uintptr_t preserved_start, size_t preserved_size) noexcept
+	: flash_(flash), crc_(crc), preserved_start_(preserved_start), preserved_size_(preserved_size),
+	  max_image_size_(preserved_size ? (preserved_start - INACTIVE_BANK_ADDRESS)
+									 : STM32InternalFlash::BANK_SIZE)
+{
+	// The preserved region must be whole pages at the end of the inactive bank window
+	assert(preserved_size == 0 ||
+		   (preserved_start >= INACTIVE_BANK_ADDRESS &&
+			(preserved_start % STM32InternalFlash::PAGE_SIZE) == 0 &&
+			(preserved_start + preserved_size) ==
+				(INACTIVE_BANK_ADDRESS + STM32InternalFlash::BANK_SIZE)));
+}
+
+#pragma mark - Update APIs -
+
+STM32FirmwareUpdate::status STM32FirmwareUpdate::begin(size_t size, uint32_t crc) noexcept
+{
+	assert(flash_.started() && crc_.started());
+
+	state_ = state::idle;
+
+	if(size == 0 || size > max_image_size_)
+	{
+		return status::too_large;
+	}
+
+	image_size_ = size;
+	expected_crc_ = crc;
+	written_ = 0;
+	buffered_ = 0;
+	next_erase_ = INACTIVE_BANK_ADDRESS;
+	state_ = state::receiving;
+
+	return status::ok;
+}
+
+STM32FirmwareUpdate::status STM32FirmwareUpdate::write(const void* data, size_t length) noexcept
+{
+	assert(state_ == state::receiving);
+	assert(data || length == 0);
+
+	if(received() + length > image_size_)
+	{
+		return status::too_large;
+	}
+
+	auto bytes = static_cast<const uint8_t*>(data);
+	while(length)
+	{
+		auto count = BUFFER_SIZE - buffered_;
+		count = (length < count) ? length : count;
+
+		memcpy(buffer_.data() + buffered_, bytes, count);
+		buffered_ += count;
+		bytes += count;
+		length -= count;
+
+		if(buffered_ == BUFFER_SIZE)
+		{
+			auto r = flush();
+			if(r != status::ok)
+			{
+				state_ = state::idle;
+				return r;
+			}
+		}
+	}
+
+	return status::ok;
+}
+
+STM32FirmwareUpdate::status STM32FirmwareUpdate::finish() noexcept
+{
+	assert(state_ == state::receiving);
+	assert(received() == image_size_);
+
+	state_ = state::idle;
+
+	if(buffered_)
+	{
+		auto r = flush();
+		if(r != status::ok)
+		{
+			return r;
+		}
+	}
+
+	if(!validVectorTable())
+	{
+		return status::invalid_image;
+	}
+
+	uint32_t crc = 0;
+	auto r = crc_.calculate(CRC32_IEEE, reinterpret_cast<const void*>(INACTIVE_BANK_ADDRESS),
+							image_size_, crc);
+	if(r != STM32CRC::status::ok)
+	{
+		return status::error;
+	}
+
+	if(crc != expected_crc_)
+	{
+		return status::verify_failed;
+	}
+
+	state_ = state::verified;
+	return status::ok;
+}
+
+STM32FirmwareUpdate::status STM32FirmwareUpdate::activate() noexcept
+{
+	assert(state_ == state::verified);
+
+	if(preserved_size_)
+	{
+		auto r = copyPreservedRegion();
+		if(r != status::ok)
+		{
+			return r;
+		}
+	}
+
+	flash_.setBootBank(STM32InternalFlash::bankOf(INACTIVE_BANK_ADDRESS));
+}
+
+#pragma mark - Helpers -
+
+STM32FirmwareUpdate::status STM32FirmwareUpdate::flush() noexcept
+{
+	// The end of the image is padded to a whole double-word with the erased value
+	auto length = (buffered_ + STM32InternalFlash::PROGRAM_SIZE - 1) &
+				  ~(STM32InternalFlash::PROGRAM_SIZE - 1);
+	memset(buffer_.data() + buffered_, 0xFF, length - buffered_);
+
+	auto address = INACTIVE_BANK_ADDRESS + written_;
+
+	while(next_erase_ < (address + length))
+	{
+		if(flash_.erasePage(next_erase_) != STM32InternalFlash::status::ok)
+		{
+			return status::error;
+		}
+
+		next_erase_ += STM32InternalFlash::PAGE_SIZE;
+	}
+
+	if(flash_.program(address, buffer_.data(), length) != STM32InternalFlash::status::ok)
+	{
+		return status::error;
+	}
+
+	written_ += buffered_;
+	buffered_ = 0;
+
+	return status::ok;
+}
+
+bool STM32FirmwareUpdate::validVectorTable() const noexcept
+{
+	if(image_size_ < (2 * sizeof(uint32_t)))
+	{
+		return false;
+	}
+
+	auto vectors = reinterpret_cast<const uint32_t*>(INACTIVE_BANK_ADDRESS);
+	auto stack = vectors[0];
+	auto reset = vectors[1];
+
+	bool stack_valid = ((stack > SRAM_START && stack <= SRAM_END) ||
+						(stack > SRAM2_ALIAS_START && stack <= SRAM2_ALIAS_END)) &&
+					   ((stack % sizeof(uint32_t)) == 0);
+
+	// The image runs at BASE_ADDRESS once it is booted, and the reset handler is Thumb code
+	auto offset = (reset & ~1U) - STM32InternalFlash::BASE_ADDRESS;
+	bool reset_valid = (reset & 1U) && reset >= STM32InternalFlash::BASE_ADDRESS &&
+					   offset < image_size_;
+
+	return stack_valid && reset_valid;
+}
+
+STM32FirmwareUpdate::status STM32FirmwareUpdate::copyPreservedRegion() noexcept
+{
+	// The same offset in the active bank, which must be outside of the running image
+	auto destination = preserved_start_ - STM32InternalFlash::BANK_SIZE;
+
+	for(size_t offset = 0; offset < preserved_size_; offset += BUFFER_SIZE)
+	{
+		if((offset % STM32InternalFlash::PAGE_SIZE) == 0 &&
+		   flash_.erasePage(destination + offset) != STM32InternalFlash::status::ok)
+		{
+			return status::error;
+		}
+
+		// A double-word with an ECC error is copied as read. KVStore records are protected by
+		// their own CRC.
+		(void)flash_.read(preserved_start_ + offset, buffer_.data(), BUFFER_SIZE);
+
+		for(size_t i = 0; i < BUFFER_SIZE; i += STM32InternalFlash::PROGRAM_SIZE)
+		{
+			// Erased double-words are skipped, so they can still be programmed after the swap
+			if(all_erased(&buffer_[i], STM32InternalFlash::PROGRAM_SIZE))
+			{
+				continue;
+			}
+
+			if(flash_.program(destination + offset + i, &buffer_[i],
+							  STM32InternalFlash::PROGRAM_SIZE) != STM32InternalFlash::status::ok)
+			{
+				return status::error;
+			}
+		}
+	}
+
+	return status::ok;
+}
@@ -0,0 +1,184 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_FIRMWARE_UPDATE_HPP_
+#define STM32_FIRMWARE_UPDATE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stm32_crc.hpp>
+#include <stm32_internal_flash.hpp>
+
+/** Dual-bank firmware update.
+ *
+ * The running image executes from the bank mapped at 0x08000000. A new image is streamed into
+ * the other (inactive) bank, which is mapped at 0x08100000, while the application keeps
+ * running: erasing and programming the inactive bank does not stall execution. Once the image
+ * is complete, it is verified with the CRC unit (fed by DMA, see STM32CRC), and activate()
+ * selects the inactive bank with the BFB2 option bit and resets into the new image. The update
+ * costs a single reboot, and the previous image remains in the other bank.
+ *
+ * Images are linked at 0x08000000, since the booted bank is always mapped there.
+ *
+ * Data which is stored outside of the image, such as the KVStore pages, can be kept at the
+ * top of the inactive bank window (the preserved region). Pages are erased one at a time
+ * as the image is written, so the preserved region stays usable during an update. The image
+ * must not overlap it. Before the banks are swapped, the preserved region is copied to the same
+ * offset in the active bank, so it is found at the same address after the reboot.
+ *
+ * @code
+ * update.begin(header.size, header.crc);
+ * while(receiving)
+ * {
+ *	update.write(chunk, chunk_size);
+ * }
+ * if(update.finish() == STM32FirmwareUpdate::status::ok)
+ * {
+ *	update.activate();
+ * }
+ * @endcode
+ *
+ * The expected CRC is the standard CRC-32 (CRC32_IEEE, as computed by zlib's crc32()) of the
+ * image.
+ *
+ * Updates are driven from a single context. Erases block the calling context (or task) until
+ * they complete.
+ */
+class STM32FirmwareUpdate
+{
+  public:
+	enum class status : uint8_t
+	{
+		ok = 0,
+		/// A flash operation failed
+		error,
+		/// The image does not fit in the inactive bank, or more data was written than declared
+		too_large,
+		/// The image does not start with a valid vector table
+		invalid_image,
+		/// The CRC of the written image does not match the expected CRC
+		verify_failed,
+	};
+
+	enum class state : uint8_t
+	{
+		idle = 0,
+		/// begin() was called, and the image is being written
+		receiving,
+		/// The image was written and verified, and can be activated
+		verified,
+	};
+
+	/// The address of the inactive bank
+	static constexpr uintptr_t INACTIVE_BANK_ADDRESS =
+		STM32InternalFlash::BASE_ADDRESS + STM32InternalFlash::BANK_SIZE;
+
+  public:
+	/** Construct an updater.
+	 *
+	 * @param [in] flash The internal flash driver. It must be started before use.
+	 * @param [in] crc The CRC driver used to verify the image. It must be started before use.
+	 * @param [in] preserved_start The start of the preserved region, in the inactive bank
+	 *	window. Must be page aligned.
+	 * @param [in] preserved_size The size of the preserved region, which extends to the end of
+	 *	the bank. May be 0.
+	 */
+	STM32FirmwareUpdate(STM32InternalFlash& flash, STM32CRC& crc, uintptr_t preserved_start = 0,
+						size_t preserved_size = 0) noexcept;
+	~STM32FirmwareUpdate() noexcept = default;
+
+	/** Start an update.
+	 *
+	 * Any update in progress is abandoned.
+	 *
+	 * @param [in] size The size of the image, in bytes.
+	 * @param [in] crc The expected CRC-32 of the image.
+	 * @returns status::too_large if the image does not fit below the preserved region.
+	 */
+	status begin(size_t size, uint32_t crc) noexcept;
+
+	/** Write the next part of the image.
+	 *
+	 * Data can be written in chunks of any size. Each page of the inactive bank is erased
+	 * before the first data is written to it.
+	 *
+	 * @precondition begin() was called.
+	 */
+	status write(const void* data, size_t length) noexcept;
+
+	/** Finish writing the image, and verify it.
+	 *
+	 * @precondition All of the image has been written.
+	 * @returns status::ok if the image can be activated.
+	 */
+	status finish() noexcept;
+
+	/** Boot the verified image.
+	 *
+	 * The preserved region is copied to the active bank, the inactive bank is selected as the
+	 * boot bank, and the device is reset. Data must not be written to the preserved region
+	 * once this is called.
+	 *
+	 * The CPU stalls while the active bank is erased and programmed, which takes about 25 ms
+	 * per page of the preserved region.
+	 *
+	 * @precondition finish() returned status::ok.
+	 * @returns Only returns if the preserved region could not be copied, in which case the
+	 *	running image is kept.
+	 */
+	status activate() noexcept;
+
+	/// Abandon the current update.
+	void abort() noexcept
+	{
+		state_ = state::idle;
+	}
+
+	state currentState() const noexcept
+	{
+		return state_;
+	}
+
+	/// The number of image bytes written so far
+	size_t received() const noexcept
+	{
+		return written_ + buffered_;
+	}
+
+	/// The largest image which can be written
+	size_t maxImageSize() const noexcept
+	{
+		return max_image_size_;
+	}
+
+  private:
+	/// Program the buffered data, erasing pages as needed
+	status flush() noexcept;
+	bool validVectorTable() const noexcept;
+	/// Copy the preserved region from the inactive bank to the active bank
+	status copyPreservedRegion() noexcept;
+
+  private:
+	/// Data is programmed in blocks of this size
+	static constexpr size_t BUFFER_SIZE = 256;
+
+	STM32InternalFlash& flash_;
+	STM32CRC& crc_;
+	const uintptr_t preserved_start_;
+	const size_t preserved_size_;
+	const size_t max_image_size_;
+
+	state state_ = state::idle;
+	size_t image_size_ = 0;
+	uint32_t expected_crc_ = 0;
+	/// Bytes programmed into the inactive bank
+	size_t written_ = 0;
+	/// Bytes held in buffer_
+	size_t buffered_ = 0;
+	/// The next page which must be erased before it is programmed
+	uintptr_t next_erase_ = 0;
+	alignas(uint32_t) std::array<uint8_t, BUFFER_SIZE> buffer_{};
+};
+
+#endif // STM32_FIRMWARE_UPDATE_HPP_
@@ -8,6 +8,7 @@
 #include <nvic.hpp>
 #include <processor_includes.hpp>
 #include <stm32_rcc.hpp>
+#include <stm32_sections.hpp>
 #include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
 #include <stm32l4xx_ll_gpio.h> // TODO: break dependency
 #include <stm32l4xx_ll_i2c.h>
@@ -254,7 +255,7 @@ static void i2c_error_handler(STM32I2CMaster::device dev)
 	assert(0); // TODO: Handle error
 }
 
-static void i2c_event_handler(STM32I2CMaster::device dev)
+STM32_RAMFUNC static void i2c_event_handler(STM32I2CMaster::device dev)
 {
 	auto inst = i2c_instance[dev];
 	assert(inst); // invalid instance
@@ -438,7 +439,10 @@ int stm32_i2c_configure_timing(const struct device *dev, uint32_t clock)
   return 0;
 }
 #endif
-#define I2C_TIMING 0x00F02B86 // Also try: 0x0020098E, 0x00F02B86, 0x00D00E28
+#define I2C_TIMING 0x10B02064 // Also try: 0x0020098E, 0x00F02B86, 0x00D00E28
+// 10B is 400kHz with I2CCLK = SYSCLK = 120 MHz (see STM32ClockControl::configureSystemClock).
+//	This is the 00F value below scaled to 120 MHz: PRESC = 1, SCLDEL = 0xB, SCLH = 0x20,
+//	SCLL = 0x64
 // the 002 version is 100kHz with HSI = 16MHz
 // 00D is 1MHz with I2C source as SYSCLK = 80 MHz
 // 00F is 400Khz with I2CCLK = 80MHz
@@ -555,9 +559,10 @@ void STM32I2CMaster::enableInterrupts() noexcept
 	auto inst = i2c_instance[device_];
 	assert(error_irq && event_irq && inst); // Check that channel is supported
 
-	NVICControl::priority(error_irq, 0); // TODO: how to configure priority for the driver?
+	// The event ISR signals completion_, so it must be compatible with the RTOS (if used)
+	NVICControl::priority(error_irq, STM32_COMPLETION_IRQ_PRIORITY);
 	NVICControl::enable(error_irq);
-	NVICControl::priority(event_irq, 0); // TODO: how to configure priority for the driver?
+	NVICControl::priority(event_irq, STM32_COMPLETION_IRQ_PRIORITY);
 	NVICControl::enable(event_irq);
 
 	/* Enable I2C transfer complete/error interrupts:
@@ -588,6 +593,8 @@ void STM32I2CMaster::disableInterrupts() noexcept
 }
 
 // Blocking implementation - nonblocking to come
+// When built with RTOS support, the calling task is blocked (not spinning) until the ISR
+// signals that the transfer is complete.
 embvm::i2c::status STM32I2CMaster::transfer_(const embvm::i2c::op_t& op,
 											 const embvm::i2c::master::cb_t& cb) noexcept
 {
@@ -603,7 +610,7 @@ embvm::i2c::status STM32I2CMaster::transfer_(const embvm::i2c::op_t& op,
 	uint32_t address = static_cast<uint32_t>(op.address << 1);
 
 	// Reset per-transfer settings
-	transfer_completed_ = false;
+	completion_.arm();
 	i2c_callbacks[device_] = nullptr;
 
 	// TODO: need to check if busy, or else we return (see nRF52 implementation)
@@ -677,9 +684,9 @@ embvm::i2c::status STM32I2CMaster::transfer_(const embvm::i2c::op_t& op,
 				i2c_callbacks[device_] = i2c_callbacks[device_] = [this](auto s)
 				{
 					assert(s == embvm::i2c::status::ok);
-					transfer_completed_ = true;
 					tx_channel_.disable();
 					rx_channel_.disable();
+					completion_.signal();
 				};
 			};
 			enableDMATx(tx_channel_, i2c_inst, op.tx_buffer, op.tx_size);
@@ -724,9 +731,9 @@ embvm::i2c::status STM32I2CMaster::transfer_(const embvm::i2c::op_t& op,
 		i2c_callbacks[device_] = [this](auto s)
 		{
 			assert(s == embvm::i2c::status::ok);
-			transfer_completed_ = true;
 			tx_channel_.disable();
 			rx_channel_.disable();
+			completion_.signal();
 		};
 	}
 
@@ -735,8 +742,7 @@ embvm::i2c::status STM32I2CMaster::transfer_(const embvm::i2c::op_t& op,
 						  generate_mode);
 
 	// TODO: this needs to return enqueued and handle things asynchronously... for now we block.
-	while(!transfer_completed_)
-		;
+	completion_.wait();
 
 	// TODO: make sure error is properly reported
 
@@ -5,6 +5,7 @@
 #define STM32_I2C_MASTER_HPP_
 
 #include <driver/i2c.hpp>
+#include <stm32_completion.hpp>
 #include <stm32_dma.hpp>
 #include <stm32_gpio.hpp>
 // TODO: #include <driver/hal_driver.hpp>
@@ -77,8 +78,8 @@ class STM32I2CMaster final : public embvm::i2c::master
 	const STM32I2CMaster::device device_;
 	STM32DMA& tx_channel_;
 	STM32DMA& rx_channel_;
-	// TODO: temporary, refactor out
-	bool transfer_completed_ = false;
+	/// Signalled by the ISR when the active transfer completes
+	STM32Completion completion_;
 	// TODO: ?
 	//embvm::i2c::master::cb_t active_cb_{nullptr};
 	embvm::i2c::op_t active_op_{};
@@ -0,0 +1,354 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_input_capture.hpp"
+#include "helpers/gpio_helper.hpp"
+#include "helpers/timer_helper.hpp"
+#include <cassert>
+#include <processor_includes.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+#include <stm32l4xx_ll_tim.h>
+
+/* Useful Developer Notes
+ *
+ * In input capture mode, each detected edge copies CNT to CCRx, sets CCxIF, and issues the
+ * channel's DMA request if CCxDE is set. Reading CCRx clears CCxIF. If an edge arrives while
+ * CCxIF is still set, CCxOF (overcapture) is set.
+ *
+ * PWM input mode uses two channels on the same input (TI1 or TI2): one captures the period
+ * start edge directly, the other captures the opposite edge through the indirect path. The
+ * slave mode controller is set to reset mode, triggered by the direct input (TI1FP1/TI2FP2),
+ * so the counter restarts at each period and the captures are the period and the active
+ * time.
+ *
+ * Capturing both edges (CCxP = CCxNP = 1) is not compatible with the slave mode trigger in
+ * PWM input mode.
+ */
+
+#pragma mark - Variables -
+
+constexpr std::array<uint32_t, STM32InputCapture::MAX_CHANNELS> ll_channel = {
+	LL_TIM_CHANNEL_CH1, LL_TIM_CHANNEL_CH2, LL_TIM_CHANNEL_CH3, LL_TIM_CHANNEL_CH4};
+
+constexpr std::array<uint32_t, 3> ll_polarity = {
+	LL_TIM_IC_POLARITY_RISING, LL_TIM_IC_POLARITY_FALLING, LL_TIM_IC_POLARITY_BOTHEDGE};
+
+#pragma mark - Helpers -
+
+static inline TIM_TypeDef* timer_instance(embvm::timer::channel ch)
+{
+	return static_cast<TIM_TypeDef*>(STM32TimerHelper::instance(ch));
+}
+
+static volatile uint32_t* capture_register(TIM_TypeDef* inst, uint8_t channel)
+{
+	switch(channel)
+	{
+		case 1:
+			return &inst->CCR1;
+		case 2:
+			return &inst->CCR2;
+		case 3:
+			return &inst->CCR3;
+		case 4:
+			return &inst->CCR4;
+		default:
+			assert(0); // Invalid channel
+			return nullptr;
+	}
+}
+
+static void enable_capture_dma(TIM_TypeDef* inst, uint8_t channel, bool enable)
+{
+	// CCxDE bits are consecutive in DIER, starting at CC1DE
+	auto mask = TIM_DIER_CC1DE << (channel - 1);
+
+	if(enable)
+	{
+		SET_BIT(inst->DIER, mask);
+	}
+	else
+	{
+		CLEAR_BIT(inst->DIER, mask);
+	}
+}
+
+#pragma mark - Configuration -
+
+void STM32InputCapture::configureChannel(uint8_t channel, const pin_t& input, edge e,
+										 uint8_t filter) noexcept
+{
+	assert(pwm_input_ == 0 || channel > 2); // Channels 1 and 2 are used by PWM input mode
+	enableChannel(channel, &input, e, filter);
+}
+
+void STM32InputCapture::configurePWMInput(uint8_t channel, const pin_t& input, edge period_start,
+										  uint8_t filter) noexcept
+{
+	assert(channel == 1 || channel == 2);
+	assert(period_start != edge::both);
+
+	auto other = static_cast<uint8_t>(3 - channel);
+	auto opposite = (period_start == edge::rising) ? edge::falling : edge::rising;
+
+	enableChannel(channel, &input, period_start, filter);
+	enableChannel(other, nullptr, opposite, filter);
+	channels_[other - 1].indirect = true;
+	pwm_input_ = channel;
+}
+
+void STM32InputCapture::enableChannel(uint8_t channel, const pin_t* input, edge e,
+									  uint8_t filter) noexcept
+{
+	assert(started() == false);
+	assert(channel >= 1 && channel <= MAX_CHANNELS);
+	assert(filter <= MAX_FILTER);
+
+	auto& config = channels_[channel - 1];
+	config.enabled = true;
+	config.indirect = false;
+	config.captured_edge = e;
+	config.filter = filter;
+	config.has_input = (input != nullptr);
+
+	if(input)
+	{
+		config.input = *input;
+	}
+}
+
+uint32_t STM32InputCapture::counterMask() const noexcept
+{
+	return STM32TimerHelper::is32Bit(timer_) ? UINT32_MAX : UINT16_MAX;
+}
+
+#pragma mark - Driver APIs -
+
+void STM32InputCapture::start_() noexcept
+{
+	auto inst = timer_instance(timer_);
+
+	for(const auto& config : channels_)
+	{
+		if(config.has_input)
+		{
+			STM32GPIOTranslator::configure_alternate(config.input.port, config.input.pin,
+													 config.input.af);
+		}
+	}
+
+	STM32ClockControl::timerEnable(timer_);
+
+	auto clock = STM32TimerHelper::clockFrequency(timer_);
+	uint32_t prescaler = 0;
+	if(tick_frequency_ && tick_frequency_ < clock)
+	{
+		prescaler = ((clock + (tick_frequency_ / 2)) / tick_frequency_) - 1;
+		prescaler = (prescaler > UINT16_MAX) ? UINT16_MAX : prescaler;
+	}
+
+	actual_tick_frequency_ = clock / (prescaler + 1);
+
+	LL_TIM_SetPrescaler(inst, prescaler);
+	LL_TIM_SetAutoReload(inst, counterMask());
+	LL_TIM_SetCounterMode(inst, LL_TIM_COUNTERMODE_UP);
+
+	for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+	{
+		const auto& config = channels_[i];
+		if(!config.enabled)
+		{
+			continue;
+		}
+
+		auto input = config.indirect ? LL_TIM_ACTIVEINPUT_INDIRECTTI : LL_TIM_ACTIVEINPUT_DIRECTTI;
+		LL_TIM_IC_Config(inst, ll_channel[i],
+						 input | LL_TIM_ICPSC_DIV1 | STM32TimerHelper::inputFilter(config.filter) |
+							 ll_polarity[static_cast<uint8_t>(config.captured_edge)]);
+		LL_TIM_CC_EnableChannel(inst, ll_channel[i]);
+	}
+
+	if(pwm_input_)
+	{
+		LL_TIM_SetTriggerInput(inst, (pwm_input_ == 1) ? LL_TIM_TS_TI1FP1 : LL_TIM_TS_TI2FP2);
+		LL_TIM_SetSlaveMode(inst, LL_TIM_SLAVEMODE_RESET);
+	}
+
+	if(dma_)
+	{
+		dma_->registerCallback([this](STM32DMA::status s) { captureEvent(s); });
+	}
+
+	// Load the prescaler, and discard any flags set during configuration
+	LL_TIM_GenerateEvent_UPDATE(inst);
+	WRITE_REG(inst->SR, 0);
+	LL_TIM_EnableCounter(inst);
+}
+
+void STM32InputCapture::stop_() noexcept
+{
+	if(dma_)
+	{
+		stopCapture();
+		dma_->stop();
+		dma_->registerCallback(nullptr);
+	}
+
+	LL_TIM_DeInit(timer_instance(timer_));
+	STM32ClockControl::timerDisable(timer_);
+
+	for(const auto& config : channels_)
+	{
+		if(config.has_input)
+		{
+			STM32GPIOTranslator::configure_default(config.input.port, config.input.pin);
+		}
+	}
+}
+
+#pragma mark - Measurements -
+
+uint32_t STM32InputCapture::capture(uint8_t channel) const noexcept
+{
+	assert(started());
+	assert(channel >= 1 && channel <= MAX_CHANNELS && channels_[channel - 1].enabled);
+
+	return *capture_register(timer_instance(timer_), channel);
+}
+
+bool STM32InputCapture::pwmInput(uint32_t& period, uint32_t& active) noexcept
+{
+	assert(started() && pwm_input_);
+
+	auto inst = timer_instance(timer_);
+
+	// CCxIF is set by each period start edge, and cleared by reading CCRx
+	auto period_flag = TIM_SR_CC1IF << (pwm_input_ - 1);
+	if(!READ_BIT(inst->SR, period_flag))
+	{
+		return false;
+	}
+
+	period = *capture_register(inst, pwm_input_);
+	active = *capture_register(inst, static_cast<uint8_t>(3 - pwm_input_));
+
+	return true;
+}
+
+bool STM32InputCapture::overcapture(uint8_t channel) noexcept
+{
+	assert(channel >= 1 && channel <= MAX_CHANNELS);
+
+	auto inst = timer_instance(timer_);
+
+	// CCxOF bits are consecutive in SR, starting at CC1OF
+	auto flag = TIM_SR_CC1OF << (channel - 1);
+	bool set = READ_BIT(inst->SR, flag);
+
+	if(set)
+	{
+		// SR bits are cleared by writing 0, and writing 1 has no effect
+		WRITE_REG(inst->SR, ~flag);
+	}
+
+	return set;
+}
+
+#pragma mark - DMA Capture -
+
+void STM32InputCapture::startCapture(uint8_t channel, uint32_t* buffer, size_t count,
+									 const cb_t& cb) noexcept
+{
+	assert(started() && dma_);
+	assert(channel >= 1 && channel <= MAX_CHANNELS && channels_[channel - 1].enabled);
+	assert(buffer && count >= 2 && count <= MAX_CAPTURES);
+
+	auto inst = timer_instance(timer_);
+
+	stopCapture();
+
+	dma_->stop();
+	dma_->setConfiguration(LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_HIGH |
+							   LL_DMA_MODE_CIRCULAR | LL_DMA_PERIPH_NOINCREMENT |
+							   LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_WORD |
+							   LL_DMA_MDATAALIGN_WORD,
+						   STM32TimerHelper::captureCompareRequest(timer_, channel));
+	dma_->start();
+	dma_->enableHalfTransferInterrupt(true);
+
+	// The underlying STM32 code doesn't take volatile.
+	dma_->setAddresses(const_cast<uint32_t*>(capture_register(inst, channel)), buffer, count);
+
+	cb_ = cb;
+	capture_channel_ = channel;
+	buffer_length_ = count;
+	wrapped_ = false;
+	capturing_ = true;
+
+	// Discard a stale capture so the first DMA request is for a new edge
+	(void)*capture_register(inst, channel);
+	(void)overcapture(channel);
+
+	dma_->enable();
+	enable_capture_dma(inst, channel, true);
+}
+
+void STM32InputCapture::stopCapture() noexcept
+{
+	assert(dma_);
+
+	if(capture_channel_)
+	{
+		enable_capture_dma(timer_instance(timer_), capture_channel_, false);
+	}
+
+	dma_->disable();
+	capturing_ = false;
+}
+
+size_t STM32InputCapture::captured() const noexcept
+{
+	if(buffer_length_ == 0)
+	{
+		return 0;
+	}
+
+	return wrapped_ ? buffer_length_ : (buffer_length_ - dma_->remaining());
+}
+
+size_t STM32InputCapture::oldestIndex() const noexcept
+{
+	if(!wrapped_ || buffer_length_ == 0)
+	{
+		return 0;
+	}
+
+	// Once the buffer has wrapped, the next entry to be written is the oldest
+	return (buffer_length_ - dma_->remaining()) % buffer_length_;
+}
+
+// Called from the DMA ISR
+void STM32InputCapture::captureEvent(STM32DMA::status s) noexcept
+{
+	capture_event event = capture_event::complete;
+
+	if(s == STM32DMA::status::half_transfer)
+	{
+		event = capture_event::half;
+	}
+	else if(s == STM32DMA::status::error)
+	{
+		event = capture_event::error;
+		stopCapture();
+	}
+	else
+	{
+		wrapped_ = true;
+	}
+
+	if(cb_)
+	{
+		cb_(event);
+	}
+}
@@ -0,0 +1,250 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_INPUT_CAPTURE_HPP_
+#define STM32_INPUT_CAPTURE_HPP_
+
+#include <array>
+#include <driver/driver.hpp>
+#include <driver/gpio.hpp>
+#include <driver/timer.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <stm32_dma.hpp>
+
+/** STM32 timer input capture driver.
+ *
+ * Measures external signals (tachometers, encoder index pulses, PWM outputs of other devices)
+ * by latching the timer counter at each edge. Two measurement paths are supported:
+ *
+ *	- Timestamp capture: the counter value at every edge on a channel is written to a circular
+ *		buffer by DMA, with no per-edge interrupts. Use the helpers in capture_stats.hpp to
+ *		compute the frequency and jitter from the buffer.
+ *	- PWM input: the timer measures the period and active time of a signal in hardware. The
+ *		counter is reset at each period start, so the latest period and pulse width can be
+ *		read at any time with pwmInput().
+ *
+ * @code
+ * STM32InputCapture tach{embvm::timer::channel::CH2, &dma_ch};
+ * STM32_DMA_BUFFER static uint32_t edges[64];
+ *
+ * tach.configureChannel(1, {embvm::gpio::port::A, 0, 1}, STM32InputCapture::edge::rising);
+ * tach.start();
+ * tach.startCapture(1, edges, std::size(edges));
+ * ...
+ * auto count = tach.captured();
+ * auto stats = captureStatistics(edges, std::size(edges), tach.oldestIndex(), count,
+ *								  tach.counterMask());
+ * auto rpm = captureFrequency(tach.tickFrequency(), stats.total, stats.intervals, 60);
+ * @endcode
+ *
+ * The counter runs over its full range, so on 16-bit timers the interval between two edges
+ * must be shorter than 65536 ticks. Reduce the tick frequency with setTickFrequency() to
+ * measure slower signals, or use a 32-bit timer (TIM2/TIM5).
+ *
+ * The GPIO bank clocks must be enabled in the hardware platform. The timer clock is managed
+ * by this driver. If a DMA channel is used, its device clock must also be enabled.
+ */
+class STM32InputCapture final : public embvm::DriverBase
+{
+  public:
+	/// The signal edge(s) which trigger a capture
+	enum class edge : uint8_t
+	{
+		rising = 0,
+		falling,
+		/// Capture both edges (not supported in PWM input mode)
+		both,
+	};
+
+	/// DMA capture events
+	enum class capture_event : uint8_t
+	{
+		/// The first half of the buffer has been filled
+		half = 0,
+		/// The whole buffer has been filled; capture continues at the start of the buffer
+		complete,
+		error,
+	};
+
+	/// An input pin for a capture channel
+	struct pin_t
+	{
+		embvm::gpio::port port;
+		uint8_t pin;
+		/// Alternate function number which connects the pin to the timer channel
+		uint8_t af;
+	};
+
+	/// DMA capture callback. This is invoked from the DMA interrupt context.
+	using cb_t = stdext::inplace_function<void(capture_event)>;
+
+	/// Number of capture channels on a timer
+	static constexpr uint8_t MAX_CHANNELS = 4;
+
+	/// Maximum number of entries in a capture buffer (limited by the DMA counter).
+	static constexpr size_t MAX_CAPTURES = 65535;
+
+	/// Maximum input filter setting
+	static constexpr uint8_t MAX_FILTER = 15;
+
+  public:
+	/** Construct an input capture driver.
+	 *
+	 * @param [in] timer The timer device (TIM1-TIM5 or TIM8).
+	 * @param [in] dma Optional DMA channel used for startCapture(). It is dedicated to this
+	 *	driver.
+	 */
+	explicit STM32InputCapture(embvm::timer::channel timer, STM32DMA* dma = nullptr) noexcept
+		: embvm::DriverBase(embvm::DriverType::TIMER), timer_(timer), dma_(dma)
+	{
+	}
+	~STM32InputCapture() noexcept = default;
+
+	/** Enable a capture channel.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] channel The channel number, [1..4].
+	 * @param [in] input The input pin.
+	 * @param [in] e The edge(s) to capture.
+	 * @param [in] filter The digital input filter setting (ICxF), [0..MAX_FILTER]. Higher
+	 *	values require the input to be stable for more samples before an edge is detected.
+	 */
+	void configureChannel(uint8_t channel, const pin_t& input, edge e = edge::rising,
+						  uint8_t filter = 0) noexcept;
+
+	/** Configure PWM input mode.
+	 *
+	 * The signal on channel 1 or 2 is routed to both channels 1 and 2. The period start edge
+	 * resets the counter and is captured by the input's channel, and the opposite edge is
+	 * captured by the other channel.
+	 *
+	 * The other channel of the pair cannot be used while PWM input mode is configured.
+	 * Channels 3 and 4 are still available, but their captures are relative to the last
+	 * period start.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] channel The input channel, 1 or 2.
+	 * @param [in] input The input pin.
+	 * @param [in] period_start The edge which starts each period (rising or falling). With
+	 *	edge::rising, the active time is the high time of the signal.
+	 * @param [in] filter The digital input filter setting, [0..MAX_FILTER].
+	 */
+	void configurePWMInput(uint8_t channel, const pin_t& input, edge period_start = edge::rising,
+						   uint8_t filter = 0) noexcept;
+
+	/** Set the counter tick frequency.
+	 *
+	 * The frequency is rounded to the nearest achievable value (see tickFrequency()). The
+	 * default is the timer clock frequency, which gives the best resolution.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] frequency The tick frequency, in Hz.
+	 */
+	void setTickFrequency(uint32_t frequency) noexcept
+	{
+		assert(started() == false);
+		tick_frequency_ = frequency;
+	}
+
+	/// The achieved counter tick frequency, in Hz. Valid once the driver is started.
+	uint32_t tickFrequency() const noexcept
+	{
+		return actual_tick_frequency_;
+	}
+
+	/// The counter width mask (0xFFFF or 0xFFFFFFFF) for the capture_stats.hpp helpers.
+	uint32_t counterMask() const noexcept;
+
+	/** Read the latest capture on a channel.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] channel The channel number.
+	 * @returns The counter value latched at the latest edge.
+	 */
+	uint32_t capture(uint8_t channel) const noexcept;
+
+	/** Read the latest PWM input measurement.
+	 *
+	 * @precondition The driver is started in PWM input mode.
+	 * @param [out] period The signal period, in counter ticks.
+	 * @param [out] active The time from the period start edge to the opposite edge, in
+	 *	counter ticks.
+	 * @returns true if a new period has been measured since the last call. If false, the
+	 *	signal may have stopped, and the outputs are not modified.
+	 */
+	bool pwmInput(uint32_t& period, uint32_t& active) noexcept;
+
+	/** Check whether an edge was missed on a channel.
+	 *
+	 * An overcapture occurs when an edge is captured before the previous capture was read
+	 * (by software or DMA). The flag is cleared by this call.
+	 *
+	 * @param [in] channel The channel number.
+	 * @returns true if an edge was missed since the last call.
+	 */
+	bool overcapture(uint8_t channel) noexcept;
+
+	/** Start capturing edge timestamps into a circular buffer with DMA.
+	 *
+	 * Capture continues until stopCapture() is called, overwriting the oldest entries.
+	 *
+	 * @precondition The driver is started with a DMA channel, and channel is configured.
+	 * @precondition 2 <= count <= MAX_CAPTURES
+	 * @param [in] channel The channel to capture.
+	 * @param [in] buffer The capture buffer. It must remain valid until capture is stopped.
+	 * @param [in] count The number of entries in the buffer.
+	 * @param [in] cb Optional callback invoked as each half of the buffer is filled.
+	 */
+	void startCapture(uint8_t channel, uint32_t* buffer, size_t count,
+					  const cb_t& cb = nullptr) noexcept;
+
+	/// Stop DMA capture. The buffer keeps the captured values.
+	void stopCapture() noexcept;
+
+	/// Check whether DMA capture is running.
+	bool capturing() const noexcept
+	{
+		return capturing_;
+	}
+
+	/// The number of valid entries in the capture buffer, up to the buffer length.
+	size_t captured() const noexcept;
+
+	/// The index of the oldest valid entry in the capture buffer.
+	size_t oldestIndex() const noexcept;
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	void enableChannel(uint8_t channel, const pin_t* input, edge e, uint8_t filter) noexcept;
+	void captureEvent(STM32DMA::status s) noexcept;
+
+  private:
+	struct channel_config_t
+	{
+		bool enabled = false;
+		bool has_input = false;
+		/// Capture the other channel's input (PWM input mode)
+		bool indirect = false;
+		edge captured_edge = edge::rising;
+		uint8_t filter = 0;
+		pin_t input = {};
+	};
+
+	const embvm::timer::channel timer_;
+	STM32DMA* const dma_;
+	std::array<channel_config_t, MAX_CHANNELS> channels_{};
+	/// PWM input channel (1 or 2), or 0 if PWM input mode is not configured
+	uint8_t pwm_input_ = 0;
+	uint32_t tick_frequency_ = 0;
+	uint32_t actual_tick_frequency_ = 0;
+	uint8_t capture_channel_ = 0;
+	size_t buffer_length_ = 0;
+	volatile bool capturing_ = false;
+	volatile bool wrapped_ = false;
+	cb_t cb_;
+};
+
+#endif // STM32_INPUT_CAPTURE_HPP_
@@ -0,0 +1,453 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_internal_flash.hpp"
+#include <cassert>
+#include <cstring>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32_sections.hpp>
+
+/* Useful Developer Notes
+ *
+ * There is no LL driver for the flash interface, so the registers are programmed directly.
+ *
+ * FLASH_CR is locked after reset. It is unlocked by writing the two keys to KEYR, and locked
+ * again by setting LOCK. The driver unlocks the CR for each operation and locks it afterward,
+ * so a stray write cannot modify the flash.
+ *
+ * Programming (PG = 1): write the two words of a double-word, in order, to the destination.
+ * Programming starts when the second word is written, and BSY is set until it completes. A
+ * double-word can only be programmed once after an erase (otherwise PROGERR is set).
+ *
+ * Fast programming (FSTPG = 1): write the 64 double-words of a row back to back. The high
+ * voltage is held for the whole row, so the bank must have been mass-erased first, and no
+ * flash access or interrupt may occur in the sequence (otherwise MISERR or FASTERR is set).
+ * The sequence runs from RAM with interrupts masked.
+ *
+ * Erase (PER or MER1/MER2): STRT starts the erase. EOP is set when it completes if EOPIE is
+ * set, and OPERR is set on an error if ERRIE is set. Both are cleared by writing 1. Pages are
+ * selected with PNB (page within the bank) and BKER (physical bank).
+ *
+ * The instruction and data caches can hold stale contents of erased pages, so they are reset
+ * after each erase (ICRST/DCRST may only be set while the cache is disabled).
+ *
+ * With FB_MODE = 1 in SYSCFG_MEMRMP, bank 2 is mapped at 0x08000000 and bank 1 at 0x08100000.
+ * BKER, MER1, and MER2 always refer to physical banks.
+ *
+ * Option bytes: OPTR is written after unlocking OPTLOCK with the two OPTKEYR keys (FLASH_CR
+ * must be unlocked first). OPTSTRT programs the option bytes, but they only take effect once
+ * they are reloaded. Setting OBL_LAUNCH reloads them, which resets the device. With BFB2 = 1,
+ * the boot loader jumps to bank 2 and sets FB_MODE if bank 2 holds a valid image.
+ *
+ * Reading a double-word with a two-bit ECC error sets ECCD in FLASH_ECCR and raises an NMI.
+ * NMI_Handler returns, and read() reports the error. ECCD is cleared by writing 1.
+ */
+
+#pragma mark - Definitions -
+
+using STM32InternalFlash_cb_t = stdext::inplace_function<void(uint32_t)>;
+
+constexpr uint32_t FLASH_KEY1 = 0x45670123;
+constexpr uint32_t FLASH_KEY2 = 0xCDEF89AB;
+constexpr uint32_t FLASH_OPTKEY1 = 0x08192A3B;
+constexpr uint32_t FLASH_OPTKEY2 = 0x4C5D6E7F;
+
+constexpr uint32_t FLASH_SR_ERRORS = FLASH_SR_OPERR | FLASH_SR_PROGERR | FLASH_SR_WRPERR |
+									 FLASH_SR_PGAERR | FLASH_SR_SIZERR | FLASH_SR_PGSERR |
+									 FLASH_SR_MISERR | FLASH_SR_FASTERR | FLASH_SR_RDERR |
+									 FLASH_SR_OPTVERR;
+
+#pragma mark - Variables -
+
+static STM32InternalFlash_cb_t flash_callback = nullptr;
+
+#pragma mark - Helpers -
+
+static void unlock_flash()
+{
+	if(READ_BIT(FLASH->CR, FLASH_CR_LOCK))
+	{
+		WRITE_REG(FLASH->KEYR, FLASH_KEY1);
+		WRITE_REG(FLASH->KEYR, FLASH_KEY2);
+	}
+
+	assert(!READ_BIT(FLASH->CR, FLASH_CR_LOCK));
+}
+
+static void lock_flash()
+{
+	SET_BIT(FLASH->CR, FLASH_CR_LOCK);
+}
+
+static void wait_idle()
+{
+	while(READ_BIT(FLASH->SR, FLASH_SR_BSY))
+	{
+	}
+}
+
+/// Reset the caches after an erase, so that erased contents are not read from the caches
+static void flush_caches()
+{
+	if(READ_BIT(FLASH->ACR, FLASH_ACR_ICEN))
+	{
+		CLEAR_BIT(FLASH->ACR, FLASH_ACR_ICEN);
+		SET_BIT(FLASH->ACR, FLASH_ACR_ICRST);
+		CLEAR_BIT(FLASH->ACR, FLASH_ACR_ICRST);
+		SET_BIT(FLASH->ACR, FLASH_ACR_ICEN);
+	}
+
+	if(READ_BIT(FLASH->ACR, FLASH_ACR_DCEN))
+	{
+		CLEAR_BIT(FLASH->ACR, FLASH_ACR_DCEN);
+		SET_BIT(FLASH->ACR, FLASH_ACR_DCRST);
+		CLEAR_BIT(FLASH->ACR, FLASH_ACR_DCRST);
+		SET_BIT(FLASH->ACR, FLASH_ACR_DCEN);
+	}
+}
+
+static bool in_flash(uintptr_t address, size_t length)
+{
+	return address >= STM32InternalFlash::BASE_ADDRESS &&
+		   length <= STM32InternalFlash::SIZE &&
+		   (address - STM32InternalFlash::BASE_ADDRESS) <= (STM32InternalFlash::SIZE - length);
+}
+
+/// FLASH_CR bits which select the page holding an address
+static uint32_t page_erase_bits(uintptr_t address)
+{
+	assert(in_flash(address, 1));
+
+	auto page = ((address - STM32InternalFlash::BASE_ADDRESS) % STM32InternalFlash::BANK_SIZE) /
+				STM32InternalFlash::PAGE_SIZE;
+	auto cr = FLASH_CR_PER | (static_cast<uint32_t>(page) << FLASH_CR_PNB_Pos);
+	if(STM32InternalFlash::bankOf(address) == STM32InternalFlash::bank::bank2)
+	{
+		cr |= FLASH_CR_BKER;
+	}
+
+	return cr;
+}
+
+/** Program one row with fast programming.
+ *
+ * This runs from RAM with interrupts masked, since the bank cannot be read until the row is
+ * complete. It only accesses registers, so it does not call into flash.
+ *
+ * @returns The FLASH_SR error flags.
+ */
+STM32_RAMFUNC static uint32_t program_row(volatile uint32_t* dest, const uint32_t* src)
+{
+	SET_BIT(FLASH->CR, FLASH_CR_FSTPG);
+
+	for(size_t i = 0; i < (STM32InternalFlash::ROW_SIZE / sizeof(uint32_t)); i++)
+	{
+		dest[i] = src[i];
+	}
+
+	while(READ_BIT(FLASH->SR, FLASH_SR_BSY))
+	{
+	}
+
+	CLEAR_BIT(FLASH->CR, FLASH_CR_FSTPG);
+
+	return READ_REG(FLASH->SR) & FLASH_SR_ERRORS;
+}
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void FLASH_IRQHandler(void);
+
+void FLASH_IRQHandler()
+{
+	auto flags = READ_REG(FLASH->SR) & (FLASH_SR_EOP | FLASH_SR_ERRORS);
+	WRITE_REG(FLASH->SR, flags);
+
+	if(flash_callback && flags)
+	{
+		flash_callback(flags);
+	}
+}
+
+#pragma mark - Driver APIs -
+
+void STM32InternalFlash::start_() noexcept
+{
+	// Pages are 8 KB in single-bank mode
+	assert(READ_BIT(FLASH->OPTR, FLASH_OPTR_DBANK));
+
+	// The bank mapping is read from SYSCFG
+	STM32ClockControl::syscfgEnable();
+
+	wait_idle();
+	WRITE_REG(FLASH->SR, FLASH_SR_EOP | FLASH_SR_ERRORS);
+	lock_flash();
+
+	flash_callback = [this](uint32_t flags) { eraseComplete(flags); };
+	NVICControl::priority(FLASH_IRQn, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(FLASH_IRQn);
+}
+
+void STM32InternalFlash::stop_() noexcept
+{
+	wait_idle();
+
+	NVICControl::disable(FLASH_IRQn);
+	CLEAR_BIT(FLASH->CR, FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+	lock_flash();
+
+	flash_callback = nullptr;
+	active_ = false;
+}
+
+#pragma mark - Bank Mapping -
+
+void STM32InternalFlash::setBootBank(bank b) noexcept
+{
+	assert(started());
+	assert(!active_);
+
+	wait_idle();
+	unlock_flash();
+
+	if(READ_BIT(FLASH->CR, FLASH_CR_OPTLOCK))
+	{
+		WRITE_REG(FLASH->OPTKEYR, FLASH_OPTKEY1);
+		WRITE_REG(FLASH->OPTKEYR, FLASH_OPTKEY2);
+	}
+
+	WRITE_REG(FLASH->SR, FLASH_SR_EOP | FLASH_SR_ERRORS);
+	MODIFY_REG(FLASH->OPTR, FLASH_OPTR_BFB2, (b == bank::bank2) ? FLASH_OPTR_BFB2 : 0);
+	SET_BIT(FLASH->CR, FLASH_CR_OPTSTRT);
+	wait_idle();
+
+	// Reloading the option bytes resets the device
+	SET_BIT(FLASH->CR, FLASH_CR_OBL_LAUNCH);
+
+	while(true)
+	{
+	}
+}
+
+STM32InternalFlash::bank STM32InternalFlash::bootBank() noexcept
+{
+	return READ_BIT(FLASH->OPTR, FLASH_OPTR_BFB2) ? bank::bank2 : bank::bank1;
+}
+
+STM32InternalFlash::bank STM32InternalFlash::activeBank() noexcept
+{
+	return READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE) ? bank::bank2 : bank::bank1;
+}
+
+STM32InternalFlash::bank STM32InternalFlash::bankOf(uintptr_t address) noexcept
+{
+	assert(in_flash(address, 1));
+
+	// The window an address falls in is swapped with the bank mapping
+	bool second_window = (address - BASE_ADDRESS) >= BANK_SIZE;
+	bool swapped = activeBank() == bank::bank2;
+	return (second_window != swapped) ? bank::bank2 : bank::bank1;
+}
+
+#pragma mark - Read and Program -
+
+STM32InternalFlash::status STM32InternalFlash::read(uintptr_t address, void* data,
+													size_t length) const noexcept
+{
+	assert(data || length == 0);
+
+	if(!in_flash(address, length))
+	{
+		return status::error;
+	}
+
+	memcpy(data, reinterpret_cast<const void*>(address), length);
+
+	if(READ_BIT(FLASH->ECCR, FLASH_ECCR_ECCD))
+	{
+		// Clear ECCD without clearing a pending single-bit correction
+		MODIFY_REG(FLASH->ECCR, FLASH_ECCR_ECCC, FLASH_ECCR_ECCD);
+		return status::error;
+	}
+
+	return status::ok;
+}
+
+STM32InternalFlash::status STM32InternalFlash::program(uintptr_t address, const void* data,
+													   size_t length) noexcept
+{
+	assert(started());
+	assert((address % PROGRAM_SIZE) == 0 && (length % PROGRAM_SIZE) == 0);
+	assert(data || length == 0);
+
+	if(!in_flash(address, length))
+	{
+		return status::error;
+	}
+
+	if(active_)
+	{
+		return status::busy;
+	}
+
+	auto bytes = static_cast<const uint8_t*>(data);
+	uint32_t errors = 0;
+
+	wait_idle();
+	unlock_flash();
+	WRITE_REG(FLASH->SR, FLASH_SR_EOP | FLASH_SR_ERRORS);
+	SET_BIT(FLASH->CR, FLASH_CR_PG);
+
+	for(size_t i = 0; i < length && errors == 0; i += PROGRAM_SIZE)
+	{
+		// The source may be unaligned, but the flash must be written with word accesses
+		uint32_t words[2];
+		memcpy(words, &bytes[i], sizeof(words));
+
+		auto dest = reinterpret_cast<volatile uint32_t*>(address + i);
+		dest[0] = words[0];
+		dest[1] = words[1];
+
+		wait_idle();
+		errors = READ_REG(FLASH->SR) & FLASH_SR_ERRORS;
+	}
+
+	CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+	WRITE_REG(FLASH->SR, FLASH_SR_EOP | errors);
+	lock_flash();
+
+	return errors ? status::error : status::ok;
+}
+
+STM32InternalFlash::status STM32InternalFlash::programRow(uintptr_t address,
+														  const void* data) noexcept
+{
+	assert(started());
+	assert((address % ROW_SIZE) == 0);
+	assert((reinterpret_cast<uintptr_t>(data) % sizeof(uint32_t)) == 0);
+	assert(!in_flash(reinterpret_cast<uintptr_t>(data), ROW_SIZE));
+
+	if(!in_flash(address, ROW_SIZE))
+	{
+		return status::error;
+	}
+
+	if(active_)
+	{
+		return status::busy;
+	}
+
+	uint32_t errors;
+
+	wait_idle();
+	unlock_flash();
+	WRITE_REG(FLASH->SR, FLASH_SR_EOP | FLASH_SR_ERRORS);
+
+	{
+		STM32InterruptLock lock;
+		errors = program_row(reinterpret_cast<volatile uint32_t*>(address),
+							 static_cast<const uint32_t*>(data));
+	}
+
+	WRITE_REG(FLASH->SR, FLASH_SR_EOP | errors);
+	lock_flash();
+
+	return errors ? status::error : status::ok;
+}
+
+#pragma mark - Erase -
+
+STM32InternalFlash::status STM32InternalFlash::erasePage(uintptr_t address,
+														 const cb_t& cb) noexcept
+{
+	return startErase(page_erase_bits(address), cb);
+}
+
+STM32InternalFlash::status STM32InternalFlash::erasePage(uintptr_t address) noexcept
+{
+	return eraseAndWait(page_erase_bits(address));
+}
+
+STM32InternalFlash::status STM32InternalFlash::massErase(bank b, const cb_t& cb) noexcept
+{
+	return startErase((b == bank::bank1) ? FLASH_CR_MER1 : FLASH_CR_MER2, cb);
+}
+
+STM32InternalFlash::status STM32InternalFlash::massErase(bank b) noexcept
+{
+	return eraseAndWait((b == bank::bank1) ? FLASH_CR_MER1 : FLASH_CR_MER2);
+}
+
+STM32InternalFlash::status STM32InternalFlash::startErase(uint32_t cr, const cb_t& cb) noexcept
+{
+	assert(started());
+
+	{
+		STM32InterruptLock lock;
+
+		if(active_)
+		{
+			return status::busy;
+		}
+
+		active_ = true;
+	}
+
+	cb_ = cb;
+
+	wait_idle();
+	unlock_flash();
+	WRITE_REG(FLASH->SR, FLASH_SR_EOP | FLASH_SR_ERRORS);
+
+	MODIFY_REG(FLASH->CR,
+			   FLASH_CR_PER | FLASH_CR_PNB | FLASH_CR_BKER | FLASH_CR_MER1 | FLASH_CR_MER2,
+			   cr | FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+	SET_BIT(FLASH->CR, FLASH_CR_STRT);
+
+	return status::ok;
+}
+
+// When built with RTOS support, the calling task is blocked (not spinning) until the ISR
+// signals that the erase is complete. The completion is local to this call: if another
+// erase is in progress, startErase() fails and we return before waiting on anything.
+STM32InternalFlash::status STM32InternalFlash::eraseAndWait(uint32_t cr) noexcept
+{
+	STM32Completion completion;
+	volatile status result = status::ok;
+
+	completion.arm();
+
+	auto r = startErase(cr, [&completion, &result](status s) {
+		result = s;
+		completion.signal();
+	});
+
+	if(r != status::ok)
+	{
+		return r;
+	}
+
+	completion.wait();
+	return result;
+}
+
+// Called from the flash ISR
+void STM32InternalFlash::eraseComplete(uint32_t flags) noexcept
+{
+	CLEAR_BIT(FLASH->CR, FLASH_CR_PER | FLASH_CR_PNB | FLASH_CR_BKER | FLASH_CR_MER1 |
+							 FLASH_CR_MER2 | FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+	lock_flash();
+	flush_caches();
+
+	auto s = (flags & FLASH_SR_ERRORS) ? status::error : status::ok;
+	active_ = false;
+
+	if(cb_)
+	{
+		cb_(s);
+	}
+}
@@ -0,0 +1,187 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_INTERNAL_FLASH_HPP_
+#define STM32_INTERNAL_FLASH_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <driver/driver.hpp>
+#include <inplace_function/inplace_function.hpp>
+
+// TODO: Handle interrupt priority - as a constructor parameter
+// TODO: support write protection and the other option bytes
+
+/** STM32L4+ internal flash driver.
+ *
+ * The driver supports the dual-bank layout (DBANK = 1) of the 2 MB devices: two banks of
+ * 1 MB, each with 256 pages of 4 KB.
+ *
+ *	- program(): Program double-words (8 bytes). This is the unit used for small writes,
+ *		such as KVStore records.
+ *	- programRow(): Program a row of 64 double-words with fast programming, which is much
+ *		faster than double-word programming but requires a mass-erased bank. Use it when a
+ *		whole bank is rewritten.
+ *	- erasePage() and massErase(): Erase a page or a whole bank. These are interrupt-driven,
+ *		and have blocking variants.
+ *	- setBootBank(): Select the bank which is booted (BFB2 option bit), and reset.
+ *
+ * Addresses are absolute (e.g., 0x08080000), and may refer to either bank window. The
+ * physical bank is determined from the current bank mapping (SYSCFG_MEMRMP FB_MODE), so
+ * addresses in the first 1 MB always refer to the bank that the CPU boots from.
+ *
+ * The CPU stalls when it fetches from a bank that is being programmed or erased. To keep
+ * running while a page is erased, execute from the other bank (or from RAM).
+ *
+ * Only one operation can be in progress at a time. The driver is not internally locked.
+ *
+ * @code
+ * flash.erasePage(0x081F0000);
+ * flash.program(0x081F0000, &settings, sizeof(settings));
+ * @endcode
+ */
+class STM32InternalFlash final : public embvm::DriverBase
+{
+  public:
+	enum class status : uint8_t
+	{
+		/// The operation completed successfully
+		ok = 0,
+		/// Another operation is in progress
+		busy,
+		/// A programming, erase, or ECC error occurred
+		error,
+	};
+
+	enum class bank : uint8_t
+	{
+		bank1 = 0,
+		bank2,
+	};
+
+	/// Erase callback. This is invoked from the flash interrupt context.
+	using cb_t = stdext::inplace_function<void(status)>;
+
+	static constexpr uintptr_t BASE_ADDRESS = 0x08000000;
+	static constexpr size_t BANK_SIZE = 1024 * 1024;
+	static constexpr size_t SIZE = 2 * BANK_SIZE;
+	static constexpr size_t PAGE_SIZE = 4096;
+	/// The smallest unit which can be programmed (a double-word)
+	static constexpr size_t PROGRAM_SIZE = 8;
+	/// The unit used by fast programming
+	static constexpr size_t ROW_SIZE = 64 * PROGRAM_SIZE;
+
+  public:
+	STM32InternalFlash() noexcept : embvm::DriverBase(embvm::DriverType::Undefined) {}
+	~STM32InternalFlash() noexcept = default;
+
+	/** Read from flash.
+	 *
+	 * A double-word whose programming was interrupted (e.g., by a reset) can fail its ECC
+	 * check. The error is reported instead of returning corrupted data.
+	 *
+	 * @returns status::error if the range is outside of flash or an ECC error was detected.
+	 */
+	status read(uintptr_t address, void* data, size_t length) const noexcept;
+
+	/** Program double-words.
+	 *
+	 * Each double-word can only be programmed once after it is erased.
+	 *
+	 * @precondition The driver is started, and no erase is in progress.
+	 * @param [in] address The destination. Must be double-word aligned.
+	 * @param [in] data The data to program. Need not be aligned.
+	 * @param [in] length The number of bytes to program. Must be a multiple of PROGRAM_SIZE.
+	 */
+	status program(uintptr_t address, const void* data, size_t length) noexcept;
+
+	/** Program a row with fast programming.
+	 *
+	 * The bank must have been mass-erased. Interrupts are masked for the duration of the
+	 * row (about 2.5 ms), and the programming sequence runs from RAM because the bank cannot
+	 * be read while it is programmed.
+	 *
+	 * @precondition The driver is started, and no erase is in progress.
+	 * @param [in] address The destination. Must be aligned to ROW_SIZE.
+	 * @param [in] data ROW_SIZE bytes of data, which must be word aligned and must not be in
+	 *	flash.
+	 */
+	status programRow(uintptr_t address, const void* data) noexcept;
+
+	/** Start erasing a page.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] address Any address in the page.
+	 * @param [in] cb Callback invoked when the erase completes.
+	 * @returns status::ok if the erase was started, status::busy if an operation is in
+	 *	progress.
+	 */
+	status erasePage(uintptr_t address, const cb_t& cb) noexcept;
+
+	/// Erase a page and wait for completion.
+	/// When built with RTOS support, the calling task is blocked (not spinning).
+	status erasePage(uintptr_t address) noexcept;
+
+	/** Start erasing a whole bank.
+	 *
+	 * @precondition The driver is started. The CPU is not executing from the bank.
+	 * @param [in] b The physical bank.
+	 * @param [in] cb Callback invoked when the erase completes.
+	 * @returns status::ok if the erase was started, status::busy if an operation is in
+	 *	progress.
+	 */
+	status massErase(bank b, const cb_t& cb) noexcept;
+
+	/// Erase a whole bank and wait for completion.
+	status massErase(bank b) noexcept;
+
+	/** Select the bank to boot from, and reset the device.
+	 *
+	 * The BFB2 option bit is programmed, and the option bytes are reloaded, which resets the
+	 * device. With BFB2 set, the device boots from bank 2 (if it holds a valid stack pointer
+	 * and vector table), and bank 2 is mapped at BASE_ADDRESS.
+	 *
+	 * @precondition The driver is started, and no erase is in progress.
+	 * @param [in] b The physical bank to boot from.
+	 */
+	[[noreturn]] void setBootBank(bank b) noexcept;
+
+	/// The physical bank selected by the BFB2 option bit.
+	static bank bootBank() noexcept;
+
+	/// The physical bank which is mapped at BASE_ADDRESS (the bank the CPU booted from).
+	static bank activeBank() noexcept;
+
+	/// The physical bank which holds an address.
+	static bank bankOf(uintptr_t address) noexcept;
+
+	/// The address of a physical bank in the current memory map.
+	static uintptr_t bankAddress(bank b) noexcept
+	{
+		return BASE_ADDRESS + ((b == activeBank()) ? 0 : BANK_SIZE);
+	}
+
+	/// Check whether an erase is in progress.
+	bool busy() const noexcept
+	{
+		return active_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	/// Start an erase with the given FLASH_CR bits
+	status startErase(uint32_t cr, const cb_t& cb) noexcept;
+	/// Start an erase and wait for it to complete
+	status eraseAndWait(uint32_t cr) noexcept;
+	/// Handle the end of an erase
+	void eraseComplete(uint32_t flags) noexcept;
+
+  private:
+	cb_t cb_;
+	volatile bool active_ = false;
+};
+
+#endif // STM32_INTERNAL_FLASH_HPP_
@@ -0,0 +1,67 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_INTERRUPT_LOCK_HPP_
+#define STM32_INTERRUPT_LOCK_HPP_
+
+#include <cstdint>
+
+/** RAII critical section which masks interrupts.
+ *
+ * The PRIMASK value is saved on construction and restored on destruction, so locks can be
+ * nested and can be safely used from an interrupt context.
+ *
+ * This is implemented with inline assembly so that we do not need to expose the CMSIS
+ * headers to the rest of the system.
+ *
+ * @code
+ * {
+ *	STM32InterruptLock lock;
+ *	// Interrupts are masked in this scope
+ * }
+ * @endcode
+ */
+class STM32InterruptLock
+{
+  public:
+	STM32InterruptLock() noexcept
+	{
+		__asm volatile("mrs %0, primask\n"
+					   "cpsid i"
+					   : "=r"(primask_)
+					   :
+					   : "memory");
+	}
+
+	~STM32InterruptLock() noexcept
+	{
+		__asm volatile("msr primask, %0" : : "r"(primask_) : "memory");
+	}
+
+	/** Check whether the caller can wait for an interrupt to be serviced.
+	 *
+	 * This is false when interrupts are masked (by PRIMASK, or by BASEPRI as in an RTOS
+	 * critical section), or when called from an exception handler (where interrupts at the
+	 * same or lower priority cannot preempt the caller).
+	 */
+	static bool canWaitForInterrupt() noexcept
+	{
+		uint32_t primask;
+		uint32_t basepri;
+		uint32_t ipsr;
+
+		__asm volatile("mrs %0, primask" : "=r"(primask));
+		__asm volatile("mrs %0, basepri" : "=r"(basepri));
+		__asm volatile("mrs %0, ipsr" : "=r"(ipsr));
+
+		return ((primask & 0x1) == 0) && (basepri == 0) && ((ipsr & 0x1FF) == 0);
+	}
+
+	STM32InterruptLock(const STM32InterruptLock&) = delete;
+	const STM32InterruptLock& operator=(const STM32InterruptLock&) = delete;
+
+  private:
+	uint32_t primask_;
+};
+
+#endif // STM32_INTERRUPT_LOCK_HPP_
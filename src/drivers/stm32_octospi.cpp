@@ -0,0 +1,553 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_octospi.hpp"
+#include "helpers/gpio_helper.hpp"
+#include <array>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+
+/* Useful Developer Notes
+ *
+ * There is no LL driver for the OCTOSPI, so the registers are programmed directly.
+ *
+ * The functional mode (CR.FMODE) selects indirect write, indirect read, automatic polling,
+ * or memory-mapped mode. FMODE and the command registers can only be changed while BUSY = 0.
+ *
+ * An indirect or polling operation starts when the last register it needs is written:
+ *	- AR, if the command has an address phase
+ *	- IR, otherwise
+ * In indirect write mode, the data phase then waits for data in the FIFO. So for writes, the
+ * command is issued before the DMA request is enabled, and for reads the DMA request is
+ * enabled before the command is issued.
+ *
+ * TCF is set when the last byte has been transferred on the bus. For reads, the data can still
+ * be in the FIFO at that point, so reads complete on the DMA transfer complete interrupt, and
+ * writes and data-less commands complete on TCF. Automatic polling with APMS = 1 stops and
+ * sets SMF when the status matches.
+ *
+ * The SR flags and the CR interrupt enables use the same bit order (CR is offset by 16), and
+ * the FCR clear bits are at the same positions as the SR flags.
+ *
+ * ABORT stops the current operation, flushes the FIFO, and exits memory-mapped mode. The bit is
+ * cleared by hardware when the abort is complete.
+ */
+
+#pragma mark - Definitions -
+
+using STM32OctoSPI_irq_cb_t = stdext::inplace_function<void(uint32_t)>;
+
+/// CR.FMODE values
+constexpr uint32_t FMODE_INDIRECT_WRITE = 0;
+constexpr uint32_t FMODE_INDIRECT_READ = 1;
+constexpr uint32_t FMODE_AUTOMATIC_POLLING = 2;
+constexpr uint32_t FMODE_MEMORY_MAPPED = 3;
+
+constexpr uint32_t OCTOSPI_FLAGS = OCTOSPI_SR_TEF | OCTOSPI_SR_TCF | OCTOSPI_SR_SMF;
+
+#pragma mark - Variables -
+
+constexpr unsigned OCTOSPI_COUNT = STM32OctoSPI::device::NUM_OCTOSPI_DEVICES;
+
+constexpr std::array<OCTOSPI_TypeDef* const, OCTOSPI_COUNT> octospi_instance = {OCTOSPI1,
+																			   OCTOSPI2};
+
+constexpr std::array<uintptr_t, OCTOSPI_COUNT> octospi_memory_base = {OCTOSPI1_BASE,
+																	  OCTOSPI2_BASE};
+
+constexpr std::array<uint32_t, OCTOSPI_COUNT> dma_routing = {LL_DMAMUX_REQ_OCTOSPI1,
+															 LL_DMAMUX_REQ_OCTOSPI2};
+
+constexpr std::array<uint8_t, OCTOSPI_COUNT> octospi_irq_num = {OCTOSPI1_IRQn, OCTOSPI2_IRQn};
+
+/// CR.FMODE for each op_type
+constexpr std::array<uint32_t, 4> op_fmode = {FMODE_INDIRECT_WRITE, FMODE_INDIRECT_READ,
+											  FMODE_INDIRECT_WRITE, FMODE_AUTOMATIC_POLLING};
+
+static std::array<STM32OctoSPI_irq_cb_t, OCTOSPI_COUNT> octospi_callbacks = {nullptr};
+
+#pragma mark - Helpers -
+
+/// Encode a phase size in bytes as a xSIZE field value
+static inline uint32_t phase_size(uint8_t bytes)
+{
+	assert(bytes >= 1 && bytes <= 4);
+	return bytes - 1U;
+}
+
+/// Build the CCR (or WCCR) value for a command
+static uint32_t communication_config(const STM32OctoSPI::command_t& c, bool has_data)
+{
+	using lines = STM32OctoSPI::lines;
+
+	uint32_t ccr = (static_cast<uint32_t>(c.instruction_lines) << OCTOSPI_CCR_IMODE_Pos) |
+				   (phase_size(c.instruction_size) << OCTOSPI_CCR_ISIZE_Pos);
+
+	if(c.address_lines != lines::none)
+	{
+		ccr |= (static_cast<uint32_t>(c.address_lines) << OCTOSPI_CCR_ADMODE_Pos) |
+			   (phase_size(c.address_size) << OCTOSPI_CCR_ADSIZE_Pos);
+	}
+
+	if(c.alternate_lines != lines::none)
+	{
+		ccr |= (static_cast<uint32_t>(c.alternate_lines) << OCTOSPI_CCR_ABMODE_Pos) |
+			   (phase_size(c.alternate_size) << OCTOSPI_CCR_ABSIZE_Pos);
+	}
+
+	if(has_data)
+	{
+		assert(c.data_lines != lines::none);
+		ccr |= static_cast<uint32_t>(c.data_lines) << OCTOSPI_CCR_DMODE_Pos;
+	}
+
+	if(c.dtr)
+	{
+		ccr |= OCTOSPI_CCR_IDTR | OCTOSPI_CCR_ADDTR | OCTOSPI_CCR_ABDTR | OCTOSPI_CCR_DDTR;
+	}
+
+	if(c.dqs)
+	{
+		ccr |= OCTOSPI_CCR_DQSE;
+	}
+
+	return ccr;
+}
+
+/// Build the TCR value for a command
+static uint32_t timing_config(const STM32OctoSPI::command_t& c, bool sample_shift)
+{
+	assert(c.dummy_cycles <= STM32OctoSPI::MAX_DUMMY_CYCLES);
+
+	uint32_t tcr = static_cast<uint32_t>(c.dummy_cycles) << OCTOSPI_TCR_DCYC_Pos;
+
+	if(c.dtr)
+	{
+		// Output data is held for a quarter cycle, as recommended for DTR mode
+		tcr |= OCTOSPI_TCR_DHQC;
+	}
+	else if(sample_shift)
+	{
+		// Sample shifting is only available in SDR mode
+		tcr |= OCTOSPI_TCR_SSHIFT;
+	}
+
+	return tcr;
+}
+
+/// Issue the instruction and address of a command, which starts the operation
+static void issue_command(OCTOSPI_TypeDef* inst, const STM32OctoSPI::op_t& op)
+{
+	WRITE_REG(inst->ABR, op.command.alternate);
+	WRITE_REG(inst->IR, op.command.instruction);
+
+	if(op.command.address_lines != STM32OctoSPI::lines::none)
+	{
+		WRITE_REG(inst->AR, op.address);
+	}
+}
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void OCTOSPI1_IRQHandler(void);
+extern "C" void OCTOSPI2_IRQHandler(void);
+
+static void octospi_irq_handler(STM32OctoSPI::device dev)
+{
+	auto inst = octospi_instance[dev];
+	assert(inst); // invalid instance
+
+	// Only report the flags whose interrupts are enabled
+	auto enabled = (READ_REG(inst->CR) >> OCTOSPI_CR_TEIE_Pos) & OCTOSPI_FLAGS;
+	auto flags = READ_REG(inst->SR) & enabled;
+	WRITE_REG(inst->FCR, flags);
+
+	auto& cb = octospi_callbacks[dev];
+	if(cb && flags)
+	{
+		cb(flags);
+	}
+}
+
+void OCTOSPI1_IRQHandler()
+{
+	octospi_irq_handler(STM32OctoSPI::device::octospi1);
+}
+
+void OCTOSPI2_IRQHandler()
+{
+	octospi_irq_handler(STM32OctoSPI::device::octospi2);
+}
+
+#pragma mark - Driver APIs -
+
+void STM32OctoSPI::start_() noexcept
+{
+	auto inst = octospi_instance[device_];
+	assert(inst); // if failed, device is invalid
+	assert(pins_); // Pins must be configured with configurePins()
+
+	for(size_t i = 0; i < pin_count_; i++)
+	{
+		STM32GPIOTranslator::configure_alternate(pins_[i].port, pins_[i].pin, pins_[i].af);
+	}
+
+	STM32ClockControl::octospiEnable(device_);
+
+	// Disable before modifying configuration registers
+	CLEAR_BIT(inst->CR, OCTOSPI_CR_EN);
+
+	WRITE_REG(inst->DCR1, (static_cast<uint32_t>(config_.type) << OCTOSPI_DCR1_MTYP_Pos) |
+							  (static_cast<uint32_t>(config_.size_log2 - 1)
+							   << OCTOSPI_DCR1_DEVSIZE_Pos) |
+							  (static_cast<uint32_t>(config_.cs_high_cycles - 1)
+							   << OCTOSPI_DCR1_CSHT_Pos));
+	WRITE_REG(inst->DCR2, static_cast<uint32_t>(config_.prescaler - 1)
+							  << OCTOSPI_DCR2_PRESCALER_Pos);
+	WRITE_REG(inst->DCR3, static_cast<uint32_t>(config_.cs_boundary) << OCTOSPI_DCR3_CSBOUND_Pos);
+	WRITE_REG(inst->DCR4, config_.refresh_cycles);
+	WRITE_REG(inst->LPTR, config_.idle_timeout_cycles);
+	WRITE_REG(inst->CR, FMODE_INDIRECT_WRITE << OCTOSPI_CR_FMODE_Pos);
+	WRITE_REG(inst->FCR, OCTOSPI_FLAGS);
+
+	dma_.setConfiguration(LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_HIGH |
+							  LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT |
+							  LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
+							  LL_DMA_MDATAALIGN_BYTE,
+						  dma_routing[device_]);
+	dma_.registerCallback([this](STM32DMA::status s) {
+		if(s == STM32DMA::status::error)
+		{
+			operationComplete(status::error);
+		}
+		else if(s == STM32DMA::status::ok && dma_completes_)
+		{
+			operationComplete(status::ok);
+		}
+	});
+	dma_.start();
+
+	octospi_callbacks[device_] = [this](uint32_t flags) { interruptHandler(flags); };
+	enableInterrupts();
+
+	SET_BIT(inst->CR, OCTOSPI_CR_EN);
+}
+
+void STM32OctoSPI::stop_() noexcept
+{
+	auto inst = octospi_instance[device_];
+	assert(inst); // if failed, device is invalid
+
+	disableInterrupts();
+	abort();
+	memory_mapped_ = false;
+	CLEAR_BIT(inst->CR, OCTOSPI_CR_EN);
+
+	dma_.stop();
+	dma_.registerCallback(nullptr);
+
+	{
+		STM32InterruptLock lock;
+		queue_.clear();
+		active_ = false;
+	}
+
+	octospi_callbacks[device_] = nullptr;
+
+	STM32ClockControl::octospiDisable(device_);
+
+	for(size_t i = 0; i < pin_count_; i++)
+	{
+		STM32GPIOTranslator::configure_default(pins_[i].port, pins_[i].pin);
+	}
+}
+
+void STM32OctoSPI::enableInterrupts() noexcept
+{
+	uint8_t irq = octospi_irq_num[device_];
+	assert(irq); // Check that device is supported
+
+	// The ISR completes operations, so it must be compatible with the RTOS (if used)
+	NVICControl::priority(irq, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(irq);
+}
+
+void STM32OctoSPI::disableInterrupts() noexcept
+{
+	uint8_t irq = octospi_irq_num[device_];
+	assert(irq); // Check that device is supported
+
+	NVICControl::disable(irq);
+}
+
+void STM32OctoSPI::waitIdle() const noexcept
+{
+	auto inst = octospi_instance[device_];
+
+	while(READ_BIT(inst->SR, OCTOSPI_SR_BUSY))
+	{
+	}
+}
+
+void STM32OctoSPI::abort() noexcept
+{
+	auto inst = octospi_instance[device_];
+
+	CLEAR_BIT(inst->CR, OCTOSPI_CR_DMAEN | OCTOSPI_CR_TCIE | OCTOSPI_CR_SMIE | OCTOSPI_CR_TEIE |
+							OCTOSPI_CR_TCEN);
+	dma_.disable();
+
+	if(READ_BIT(inst->CR, OCTOSPI_CR_EN))
+	{
+		SET_BIT(inst->CR, OCTOSPI_CR_ABORT);
+		while(READ_BIT(inst->CR, OCTOSPI_CR_ABORT))
+		{
+		}
+	}
+
+	MODIFY_REG(inst->CR, OCTOSPI_CR_FMODE, FMODE_INDIRECT_WRITE << OCTOSPI_CR_FMODE_Pos);
+	WRITE_REG(inst->FCR, OCTOSPI_FLAGS);
+}
+
+#pragma mark - Indirect Mode -
+
+STM32OctoSPI::status STM32OctoSPI::transfer(const op_t& op, const cb_t& cb) noexcept
+{
+	assert(started());
+	assert(!memory_mapped_); // Indirect operations are not possible in memory-mapped mode
+	assert(op.type == op_type::command || op.buffer || op.type == op_type::poll);
+	assert(op.type != op_type::poll || (op.length >= 1 && op.length <= 4));
+	assert(op.type == op_type::command || (op.length > 0 && op.length <= MAX_TRANSFER_BYTES));
+
+	STM32InterruptLock lock;
+
+	if(!queue_.push({op, cb}))
+	{
+		return status::busy;
+	}
+
+	if(!active_)
+	{
+		active_ = true;
+		startNextOperation();
+	}
+
+	return status::enqueued;
+}
+
+// When built with RTOS support, the calling task is blocked (not spinning) until the ISR
+// signals that the operation is complete. Each caller waits on its own completion, since
+// operations from several tasks can be queued at once.
+STM32OctoSPI::status STM32OctoSPI::transfer(const op_t& op) noexcept
+{
+	STM32Completion completion;
+	volatile status result = status::ok;
+
+	completion.arm();
+
+	auto r = transfer(op, [&completion, &result](const op_t&, status s) {
+		result = s;
+		completion.signal();
+	});
+
+	if(r != status::enqueued)
+	{
+		return r;
+	}
+
+	completion.wait();
+	return result;
+}
+
+// Called with interrupts masked, or from the driver's ISRs
+void STM32OctoSPI::startNextOperation() noexcept
+{
+	auto inst = octospi_instance[device_];
+	assert(inst);
+	const auto& op = queue_.front().op;
+	bool has_data = (op.type != op_type::command);
+
+	// The previous read may still be draining the FIFO
+	waitIdle();
+
+	// Word accesses move four bytes per DMA request
+	bool word = has_data && (op.type != op_type::poll) &&
+				(((reinterpret_cast<uintptr_t>(op.buffer) | op.length) & 0x3) == 0);
+
+	uint32_t cr = (op_fmode[static_cast<uint8_t>(op.type)] << OCTOSPI_CR_FMODE_Pos) |
+				  ((word ? 3U : 0U) << OCTOSPI_CR_FTHRES_Pos) | OCTOSPI_CR_TEIE;
+
+	switch(op.type)
+	{
+		case op_type::poll:
+			// Stop polling automatically at the first match
+			cr |= OCTOSPI_CR_APMS | OCTOSPI_CR_SMIE;
+			WRITE_REG(inst->PSMKR, op.mask);
+			WRITE_REG(inst->PSMAR, op.match);
+			WRITE_REG(inst->PIR, op.poll_interval);
+			break;
+		case op_type::read:
+			cr |= OCTOSPI_CR_DMAEN;
+			break;
+		default:
+			cr |= OCTOSPI_CR_TCIE;
+			break;
+	}
+
+	WRITE_REG(inst->FCR, OCTOSPI_FLAGS);
+	MODIFY_REG(inst->CR,
+			   OCTOSPI_CR_FMODE | OCTOSPI_CR_FTHRES | OCTOSPI_CR_APMS | OCTOSPI_CR_DMAEN |
+				   OCTOSPI_CR_TEIE | OCTOSPI_CR_TCIE | OCTOSPI_CR_SMIE,
+			   cr);
+
+	if(has_data)
+	{
+		WRITE_REG(inst->DLR, op.length - 1);
+	}
+
+	WRITE_REG(inst->TCR, timing_config(op.command, config_.sample_shift));
+	WRITE_REG(inst->CCR, communication_config(op.command, has_data));
+
+	dma_completes_ = (op.type == op_type::read);
+
+	if(op.type == op_type::read || op.type == op_type::write)
+	{
+		auto width = word ? STM32DMA::width::word : STM32DMA::width::byte;
+		size_t count = word ? (op.length / 4) : op.length;
+		// The underlying STM32 code doesn't take volatile.
+		auto data_reg = const_cast<uint32_t*>(&inst->DR);
+
+		dma_.setDataWidth(width, width);
+
+		if(op.type == op_type::read)
+		{
+			dma_.setDirection(STM32DMA::direction::peripheral_to_memory);
+			dma_.setAddresses(data_reg, op.buffer, count);
+			dma_.enable();
+		}
+		else
+		{
+			dma_.setDirection(STM32DMA::direction::memory_to_peripheral);
+			dma_.setAddresses(op.buffer, data_reg, count);
+			issue_command(inst, op);
+			dma_.enable();
+			SET_BIT(inst->CR, OCTOSPI_CR_DMAEN);
+			return;
+		}
+	}
+
+	issue_command(inst, op);
+}
+
+void STM32OctoSPI::operationComplete(status s) noexcept
+{
+	auto inst = octospi_instance[device_];
+	assert(inst);
+	queued_op_t completed;
+
+	{
+		STM32InterruptLock lock;
+
+		if(!active_)
+		{
+			// A DMA error and an OCTOSPI error can both be reported for the same operation
+			return;
+		}
+
+		CLEAR_BIT(inst->CR, OCTOSPI_CR_DMAEN | OCTOSPI_CR_TCIE | OCTOSPI_CR_SMIE);
+		dma_.disable();
+
+		if(s != status::ok)
+		{
+			abort();
+		}
+
+		completed = std::move(queue_.front());
+		queue_.pop();
+
+		// Start the next operation before running the callback to keep the bus busy
+		if(queue_.empty())
+		{
+			active_ = false;
+		}
+		else
+		{
+			startNextOperation();
+		}
+	}
+
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(completed.cb)
+	{
+		completed.cb(completed.op, s);
+	}
+}
+
+// Called from the OCTOSPI ISR
+void STM32OctoSPI::interruptHandler(uint32_t flags) noexcept
+{
+	if(flags & OCTOSPI_SR_TEF)
+	{
+		operationComplete(status::error);
+	}
+	else if(flags & (OCTOSPI_SR_TCF | OCTOSPI_SR_SMF))
+	{
+		operationComplete(status::ok);
+	}
+}
+
+#pragma mark - Memory-Mapped Mode -
+
+void STM32OctoSPI::enableMemoryMapped(const command_t& read, const command_t* write) noexcept
+{
+	auto inst = octospi_instance[device_];
+	assert(started());
+	assert(!memory_mapped_);
+	assert(!active_); // Queued operations must finish first
+	assert(read.address_lines != lines::none);
+
+	waitIdle();
+
+	CLEAR_BIT(inst->CR, OCTOSPI_CR_DMAEN | OCTOSPI_CR_TCIE | OCTOSPI_CR_SMIE | OCTOSPI_CR_TEIE);
+
+	WRITE_REG(inst->TCR, timing_config(read, config_.sample_shift));
+	WRITE_REG(inst->CCR, communication_config(read, true));
+	WRITE_REG(inst->ABR, read.alternate);
+	WRITE_REG(inst->IR, read.instruction);
+
+	if(write)
+	{
+		assert(write->address_lines != lines::none);
+		WRITE_REG(inst->WTCR, static_cast<uint32_t>(write->dummy_cycles) << OCTOSPI_WTCR_DCYC_Pos);
+		WRITE_REG(inst->WCCR, communication_config(*write, true));
+		WRITE_REG(inst->WABR, write->alternate);
+		WRITE_REG(inst->WIR, write->instruction);
+	}
+
+	uint32_t cr = FMODE_MEMORY_MAPPED << OCTOSPI_CR_FMODE_Pos;
+	if(config_.idle_timeout_cycles)
+	{
+		cr |= OCTOSPI_CR_TCEN;
+	}
+
+	MODIFY_REG(inst->CR, OCTOSPI_CR_FMODE | OCTOSPI_CR_TCEN, cr);
+	memory_mapped_ = true;
+}
+
+void STM32OctoSPI::disableMemoryMapped() noexcept
+{
+	assert(memory_mapped_);
+
+	// The ABORT bit is the only way out of memory-mapped mode
+	abort();
+	memory_mapped_ = false;
+}
+
+void* STM32OctoSPI::mappedAddress() const noexcept
+{
+	return reinterpret_cast<void*>(octospi_memory_base[device_]);
+}
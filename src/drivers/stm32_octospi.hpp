@@ -0,0 +1,351 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_OCTOSPI_HPP_
+#define STM32_OCTOSPI_HPP_
+
+#include <cassert>
+#include <driver/driver.hpp>
+#include <driver/gpio.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <static_queue.hpp>
+#include <stm32_dma.hpp>
+
+// TODO: support HyperBus memories and the delay block
+
+/** STM32 OCTOSPI driver for external flash and PSRAM.
+ *
+ * The OCTOSPI interface talks to serial memories over 1, 2, 4, or 8 data lines. Each
+ * operation is made of optional instruction, address, alternate byte, dummy, and data phases,
+ * whose widths and timing are described by a command_t.
+ *
+ * Three access modes are supported:
+ *
+ *	- Indirect mode: queued reads and writes, with data moved by DMA. Commands without a data
+ *		phase (e.g., write enable or sector erase) are queued the same way.
+ *	- Automatic polling: the interface reads a status register repeatedly until the masked
+ *		value matches, with no CPU involvement. This is used to wait for a flash program or
+ *		erase to finish.
+ *	- Memory-mapped mode: the memory appears in the address space (0x90000000 for OCTOSPI1,
+ *		0x70000000 for OCTOSPI2), so code can execute in place from external flash and PSRAM
+ *		can be used as ordinary RAM. The interface issues the read (and write) commands
+ *		itself.
+ *
+ * Because operations are queued, a complete flash program sequence can be submitted at once
+ * and runs back-to-back from the interrupt handler:
+ *
+ * @code
+ * STM32DMA dma_ch_ospi{STM32DMA::device::dma2, STM32DMA::channel::CH3};
+ * STM32OctoSPI flash{STM32OctoSPI::device::octospi1, dma_ch_ospi};
+ *
+ * STM32OctoSPI::op_t wren = {.type = STM32OctoSPI::op_type::command,
+ *							  .command = {.instruction = 0x06}};
+ * STM32OctoSPI::op_t program = {.type = STM32OctoSPI::op_type::write,
+ *								 .command = quad_page_program,
+ *								 .address = 0x1000,
+ *								 .buffer = page,
+ *								 .length = 256};
+ * STM32OctoSPI::op_t wait = {.type = STM32OctoSPI::op_type::poll,
+ *							  .command = read_status,
+ *							  .length = 1,
+ *							  .match = 0,
+ *							  .mask = 0x01}; // WIP
+ * flash.transfer(wren, nullptr);
+ * flash.transfer(program, nullptr);
+ * flash.transfer(wait); // Blocks until the flash is no longer busy
+ * @endcode
+ *
+ * Once the memory is configured, switch to memory-mapped mode for execute-in-place:
+ *
+ * @code
+ * flash.enableMemoryMapped(quad_fast_read);
+ * @endcode
+ *
+ * Pins depend on the board design, so they are supplied with configurePins(). The OCTOSPI
+ * I/O manager is left in its reset configuration, which connects OCTOSPI1 to port 1 and
+ * OCTOSPI2 to port 2. The GPIO bank clocks and the DMA device clock must be enabled in the
+ * hardware platform. The OCTOSPI clock is managed by this driver.
+ *
+ * @see stm32_sections.hpp for placing code and data in external memory.
+ */
+class STM32OctoSPI final : public embvm::DriverBase
+{
+  public:
+	enum device : uint8_t
+	{
+		octospi1 = 0,
+		octospi2,
+		NUM_OCTOSPI_DEVICES
+	};
+
+	enum class status : uint8_t
+	{
+		/// The operation completed successfully
+		ok = 0,
+		/// The operation was added to the queue
+		enqueued,
+		/// The operation queue is full
+		busy,
+		/// The operation failed (e.g., an access beyond the memory size, or a DMA error)
+		error,
+	};
+
+	/// Number of lines used by a phase. The values match the xMODE register encoding.
+	enum class lines : uint8_t
+	{
+		/// The phase is skipped
+		none = 0,
+		single,
+		dual,
+		quad,
+		octal,
+	};
+
+	/// Memory type, which determines the data ordering in octal DTR mode (DCR1.MTYP)
+	enum class memory_type : uint8_t
+	{
+		/// D0/D1 byte order used by Micron octal memories
+		micron = 0,
+		/// D1/D0 byte order used by Macronix octal memories
+		macronix = 1,
+		/// Standard (single, dual, and quad SPI) memories
+		standard = 2,
+		/// Macronix RAM
+		macronix_ram = 3,
+	};
+
+	/// Interface configuration for the attached memory
+	struct config_t
+	{
+		memory_type type = memory_type::standard;
+		/// Memory size: 2^size_log2 bytes. Accesses beyond this size fail.
+		uint8_t size_log2 = 24;
+		/// Kernel clock divider, [1..256]
+		uint16_t prescaler = 2;
+		/// Minimum chip select high time between commands, in clock cycles, [1..8]
+		uint8_t cs_high_cycles = 2;
+		/// Split memory-mapped bursts at 2^cs_boundary byte boundaries (e.g., PSRAM pages).
+		/// 0 disables the boundary.
+		uint8_t cs_boundary = 0;
+		/// Maximum chip select low time in clock cycles, so that PSRAM can refresh.
+		/// 0 disables the limit.
+		uint32_t refresh_cycles = 0;
+		/// Release the chip select after this many idle clock cycles in memory-mapped mode.
+		/// This saves power, but increases the latency of the next access. 0 keeps the chip
+		/// selected until another access needs a new command.
+		uint16_t idle_timeout_cycles = 0;
+		/// Sample read data half a cycle late (SDR only), for fast clocks with long traces
+		bool sample_shift = false;
+	};
+
+	/// The phases of a command
+	struct command_t
+	{
+		uint32_t instruction = 0;
+		lines instruction_lines = lines::single;
+		/// Instruction size in bytes, [1..4]
+		uint8_t instruction_size = 1;
+		lines address_lines = lines::none;
+		/// Address size in bytes, [1..4]
+		uint8_t address_size = 3;
+		uint32_t alternate = 0;
+		lines alternate_lines = lines::none;
+		/// Alternate bytes size in bytes, [1..4]
+		uint8_t alternate_size = 1;
+		/// Number of dummy cycles between the address (or alternate bytes) and data phases
+		uint8_t dummy_cycles = 0;
+		lines data_lines = lines::single;
+		/// Use double transfer rate for every phase
+		bool dtr = false;
+		/// Use the data strobe (DQS) to sample read data (octal DTR memories)
+		bool dqs = false;
+	};
+
+	enum class op_type : uint8_t
+	{
+		/// A command without a data phase
+		command = 0,
+		read,
+		write,
+		/// Read a status register until (value & mask) == match
+		poll,
+	};
+
+	/// Describes a single operation
+	struct op_t
+	{
+		op_type type = op_type::command;
+		command_t command = {};
+		/// Address sent in the address phase, if the command has one
+		uint32_t address = 0;
+		/// Data to write, or the buffer for read data. Word-aligned buffers with a length that
+		/// is a multiple of 4 are transferred with word-sized DMA accesses.
+		void* buffer = nullptr;
+		/// Number of bytes to transfer. For op_type::poll, the status size in bytes, [1..4].
+		size_t length = 0;
+		/// Status value to wait for (op_type::poll)
+		uint32_t match = 0;
+		/// Status bits to compare (op_type::poll)
+		uint32_t mask = 0;
+		/// Clock cycles between status reads (op_type::poll)
+		uint16_t poll_interval = 16;
+	};
+
+	/// Operation callback. This is invoked from an interrupt context.
+	using cb_t = stdext::inplace_function<void(const op_t&, status)>;
+
+	/// An OCTOSPI pin (CLK, NCS, DQS, or IOx)
+	struct pin_t
+	{
+		embvm::gpio::port port;
+		uint8_t pin;
+		/// Alternate function number which connects the pin to the OCTOSPI port
+		uint8_t af;
+	};
+
+	/// Maximum number of operations which can be queued.
+	static constexpr size_t QUEUE_DEPTH = 8;
+
+	/// Maximum number of bytes in a single operation (limited by the DMA counter).
+	static constexpr size_t MAX_TRANSFER_BYTES = 65535;
+
+	/// Maximum number of dummy cycles in a command
+	static constexpr uint8_t MAX_DUMMY_CYCLES = 31;
+
+  public:
+	/** Construct an OCTOSPI driver.
+	 *
+	 * @param [in] dev The OCTOSPI device.
+	 * @param [in] dma The DMA channel used for indirect reads and writes. It is dedicated to
+	 *	this driver.
+	 * @param [in] config The interface configuration for the attached memory.
+	 */
+	explicit STM32OctoSPI(STM32OctoSPI::device dev, STM32DMA& dma,
+						  const config_t& config) noexcept
+		: embvm::DriverBase(embvm::DriverType::SPI), device_(dev), dma_(dma), config_(config)
+	{
+		assert(config.prescaler >= 1 && config.prescaler <= 256);
+		assert(config.cs_high_cycles >= 1 && config.cs_high_cycles <= 8);
+		assert(config.size_log2 >= 1 && config.size_log2 <= 32);
+	}
+
+	/// Construct an OCTOSPI driver with the default configuration (16 MiB standard memory).
+	explicit STM32OctoSPI(STM32OctoSPI::device dev, STM32DMA& dma) noexcept
+		: STM32OctoSPI(dev, dma, config_t{})
+	{
+	}
+	~STM32OctoSPI() noexcept = default;
+
+	/** Set the pins used by the interface.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] pins The CLK, NCS, (optional) DQS, and IO pins. The array must remain valid
+	 *	while the driver is in use.
+	 * @param [in] count The number of pins.
+	 */
+	void configurePins(const pin_t* pins, size_t count) noexcept
+	{
+		assert(started() == false);
+		assert(pins && count);
+		pins_ = pins;
+		pin_count_ = count;
+	}
+
+	/** Queue an asynchronous operation.
+	 *
+	 * @precondition The driver is started, and is not in memory-mapped mode.
+	 * @precondition 0 < op.length <= MAX_TRANSFER_BYTES for reads and writes.
+	 *
+	 * @param [in] op The operation to perform. Buffers must remain valid until the callback is
+	 *	invoked.
+	 * @param [in] cb Callback invoked (in interrupt context) when the operation completes.
+	 * @returns status::enqueued if the operation was queued, status::busy if the queue is full.
+	 */
+	status transfer(const op_t& op, const cb_t& cb) noexcept;
+
+	/** Perform a blocking operation.
+	 *
+	 * The operation is queued behind any pending operations. When built with RTOS support, the
+	 * calling task is blocked (not spinning) until the operation completes.
+	 *
+	 * @precondition The driver is started, and is not in memory-mapped mode.
+	 * @precondition This is not called from an interrupt context.
+	 *
+	 * @param [in] op The operation to perform.
+	 * @returns The operation result, or status::busy if the queue is full.
+	 */
+	status transfer(const op_t& op) noexcept;
+
+	/** Enter memory-mapped mode.
+	 *
+	 * Afterward, the memory can be accessed directly at mappedAddress(). Queued operations are
+	 * not allowed until memory-mapped mode is exited.
+	 *
+	 * @precondition The driver is started, and no operations are queued.
+	 * @param [in] read The command used for reads. Its address phase must be enabled.
+	 * @param [in] write The command used for writes (e.g., for PSRAM), or nullptr if the memory
+	 *	is read-only. Writes to a read-only mapping cause a bus fault.
+	 */
+	void enableMemoryMapped(const command_t& read, const command_t* write = nullptr) noexcept;
+
+	/// Exit memory-mapped mode, so that indirect operations can be queued again.
+	void disableMemoryMapped() noexcept;
+
+	/// Check whether the memory is mapped into the address space.
+	bool memoryMapped() const noexcept
+	{
+		return memory_mapped_;
+	}
+
+	/// The address at which the memory appears in memory-mapped mode.
+	void* mappedAddress() const noexcept;
+
+	/// The size of the memory, in bytes.
+	size_t size() const noexcept
+	{
+		return (config_.size_log2 >= 32) ? SIZE_MAX : (size_t(1) << config_.size_log2);
+	}
+
+	/// Check whether an operation is in progress.
+	bool busy() const noexcept
+	{
+		return active_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	void enableInterrupts() noexcept;
+	void disableInterrupts() noexcept;
+	/// Wait for the interface to be idle, so that the configuration can be changed
+	void waitIdle() const noexcept;
+	/// Abort the current operation and return to indirect mode
+	void abort() noexcept;
+	/// Start the operation at the front of the queue
+	void startNextOperation() noexcept;
+	/// Finish the active operation and start the next one
+	void operationComplete(status s) noexcept;
+	void interruptHandler(uint32_t flags) noexcept;
+
+  private:
+	struct queued_op_t
+	{
+		op_t op;
+		cb_t cb;
+	};
+
+	const STM32OctoSPI::device device_;
+	STM32DMA& dma_;
+	const config_t config_;
+	const pin_t* pins_ = nullptr;
+	size_t pin_count_ = 0;
+	StaticQueue<queued_op_t, QUEUE_DEPTH> queue_;
+	volatile bool active_ = false;
+	/// The active operation completes when its DMA transfer completes (reads)
+	bool dma_completes_ = false;
+	bool memory_mapped_ = false;
+};
+
+#endif // STM32_OCTOSPI_HPP_
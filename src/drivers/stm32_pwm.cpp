@@ -0,0 +1,417 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_pwm.hpp"
+#include "helpers/gpio_helper.hpp"
+#include "helpers/timer_helper.hpp"
+#include <cassert>
+#include <processor_includes.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+#include <stm32l4xx_ll_tim.h>
+
+/* Useful Developer Notes
+ *
+ * PWM mode 1: the output is active while CNT < CCRx. With ARR preload and OCxPE set, new
+ * ARR/CCRx values are transferred from the preload registers at the update event.
+ *
+ * In center-aligned mode, the counter counts up to ARR and back down, so the PWM frequency
+ * is f_timer / (2 * (ARR + 1)).
+ *
+ * The advanced timers (TIM1/TIM8) gate all outputs with MOE in BDTR. Dead-time (DTG) is
+ * expressed in t_DTS, which is the timer clock period with CKD = 0.
+ *
+ * With CCxE = 0 and CCxNE = 1 (and MOE = 1), OCxN is driven by OCxREF without inversion, so
+ * a complementary-only output behaves like a main output.
+ *
+ * The repetition counter (RCR) delays the update event by RCR overflows. In center-aligned
+ * mode, both overflows and underflows are counted, so each repetition is half a period.
+ *
+ * DMA burst (DCR/DMAR): DBA selects the first register (as a word offset from CR1) and DBL
+ * the number of registers written per request. Each DMA write to DMAR is redirected to the
+ * next register in the burst. The burst is triggered by the update DMA request (UDE).
+ * CCR5/CCR6 are not contiguous with CCR1-CCR4, so they cannot be part of a burst.
+ */
+
+#pragma mark - Variables -
+
+constexpr std::array<uint32_t, STM32PWM::MAX_CHANNELS> ll_channel = {
+	LL_TIM_CHANNEL_CH1, LL_TIM_CHANNEL_CH2, LL_TIM_CHANNEL_CH3,
+	LL_TIM_CHANNEL_CH4, LL_TIM_CHANNEL_CH5, LL_TIM_CHANNEL_CH6};
+
+constexpr std::array<uint32_t, 3> ll_complementary_channel = {
+	LL_TIM_CHANNEL_CH1N, LL_TIM_CHANNEL_CH2N, LL_TIM_CHANNEL_CH3N};
+
+constexpr std::array<uint32_t, 4> burst_base = {
+	LL_TIM_DMABURST_BASEADDR_CCR1, LL_TIM_DMABURST_BASEADDR_CCR2, LL_TIM_DMABURST_BASEADDR_CCR3,
+	LL_TIM_DMABURST_BASEADDR_CCR4};
+
+constexpr std::array<uint32_t, 4> burst_length = {
+	LL_TIM_DMABURST_LENGTH_1TRANSFER, LL_TIM_DMABURST_LENGTH_2TRANSFERS,
+	LL_TIM_DMABURST_LENGTH_3TRANSFERS, LL_TIM_DMABURST_LENGTH_4TRANSFERS};
+
+#pragma mark - Helpers -
+
+static inline TIM_TypeDef* timer_instance(embvm::timer::channel ch)
+{
+	return static_cast<TIM_TypeDef*>(STM32TimerHelper::instance(ch));
+}
+
+static void set_compare(TIM_TypeDef* inst, uint8_t channel, uint32_t compare)
+{
+	switch(channel)
+	{
+		case 1:
+			LL_TIM_OC_SetCompareCH1(inst, compare);
+			break;
+		case 2:
+			LL_TIM_OC_SetCompareCH2(inst, compare);
+			break;
+		case 3:
+			LL_TIM_OC_SetCompareCH3(inst, compare);
+			break;
+		case 4:
+			LL_TIM_OC_SetCompareCH4(inst, compare);
+			break;
+		case 5:
+			LL_TIM_OC_SetCompareCH5(inst, compare);
+			break;
+		case 6:
+			LL_TIM_OC_SetCompareCH6(inst, compare);
+			break;
+		default:
+			assert(0); // Invalid channel
+	}
+}
+
+#pragma mark - Configuration -
+
+void STM32PWM::configureChannel(uint8_t channel, const pin_t& output, polarity p) noexcept
+{
+	assert(channel <= 4); // Channels 5 and 6 have no output pins
+	enableChannel(channel, &output, nullptr, p);
+}
+
+void STM32PWM::configureChannel(uint8_t channel, const pin_t& output, const pin_t& complementary,
+								polarity p) noexcept
+{
+	assert(STM32TimerHelper::isAdvanced(timer_) && channel <= 3);
+	enableChannel(channel, &output, &complementary, p);
+}
+
+void STM32PWM::configureComplementaryChannel(uint8_t channel, const pin_t& complementary,
+											 polarity p) noexcept
+{
+	assert(STM32TimerHelper::isAdvanced(timer_) && channel <= 3);
+	enableChannel(channel, nullptr, &complementary, p);
+}
+
+void STM32PWM::configureChannel(uint8_t channel) noexcept
+{
+	enableChannel(channel, nullptr, nullptr, polarity::active_high);
+}
+
+void STM32PWM::enableChannel(uint8_t channel, const pin_t* output, const pin_t* complementary,
+							 polarity p) noexcept
+{
+	assert(started() == false);
+	assert(channel >= 1 && channel <= STM32TimerHelper::channelCount(timer_));
+
+	auto& config = channels_[channel - 1];
+	config.enabled = true;
+	config.pol = p;
+	config.has_output = (output != nullptr);
+	config.has_complementary = (complementary != nullptr);
+
+	if(output)
+	{
+		config.output = *output;
+	}
+
+	if(complementary)
+	{
+		config.complementary = *complementary;
+	}
+}
+
+void STM32PWM::setDeadTime(uint32_t nanoseconds) noexcept
+{
+	assert(started() == false);
+	assert(STM32TimerHelper::isAdvanced(timer_));
+	dead_time_ns_ = nanoseconds;
+}
+
+#pragma mark - Driver APIs -
+
+void STM32PWM::start_() noexcept
+{
+	auto inst = timer_instance(timer_);
+
+	for(const auto& config : channels_)
+	{
+		if(config.has_output)
+		{
+			STM32GPIOTranslator::configure_alternate(config.output.port, config.output.pin,
+													 config.output.af);
+		}
+
+		if(config.has_complementary)
+		{
+			STM32GPIOTranslator::configure_alternate(
+				config.complementary.port, config.complementary.pin, config.complementary.af);
+		}
+	}
+
+	STM32ClockControl::timerEnable(timer_);
+
+	LL_TIM_SetCounterMode(inst, (alignment_ == alignment::center)
+									? LL_TIM_COUNTERMODE_CENTER_UP_DOWN
+									: LL_TIM_COUNTERMODE_UP);
+	LL_TIM_SetClockDivision(inst, LL_TIM_CLOCKDIVISION_DIV1);
+	LL_TIM_EnableARRPreload(inst);
+	applyFrequency();
+
+	for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+	{
+		const auto& config = channels_[i];
+		if(!config.enabled)
+		{
+			continue;
+		}
+
+		auto ch = ll_channel[i];
+		auto pol = (config.pol == polarity::active_high) ? LL_TIM_OCPOLARITY_HIGH
+														 : LL_TIM_OCPOLARITY_LOW;
+
+		LL_TIM_OC_SetMode(inst, ch, LL_TIM_OCMODE_PWM1);
+		LL_TIM_OC_SetPolarity(inst, ch, pol);
+		LL_TIM_OC_EnablePreload(inst, ch);
+		set_compare(inst, i + 1, 0);
+
+		if(config.has_output)
+		{
+			LL_TIM_CC_EnableChannel(inst, ch);
+		}
+
+		if(config.has_complementary)
+		{
+			auto ch_n = ll_complementary_channel[i];
+			LL_TIM_OC_SetPolarity(inst, ch_n, pol);
+			LL_TIM_CC_EnableChannel(inst, ch_n);
+		}
+	}
+
+	if(STM32TimerHelper::isAdvanced(timer_))
+	{
+		auto ticks = static_cast<uint32_t>(
+			((static_cast<uint64_t>(dead_time_ns_) * STM32TimerHelper::clockFrequency(timer_)) +
+			 999999999) /
+			1000000000);
+		LL_TIM_OC_SetDeadTime(inst, encodeDeadTime(ticks));
+		LL_TIM_SetRepetitionCounter(inst, repetition_);
+		LL_TIM_EnableAllOutputs(inst);
+	}
+
+	if(dma_)
+	{
+		dma_->registerCallback([this](STM32DMA::status s) { streamEvent(s); });
+	}
+
+	// Load the preload registers before the counter starts
+	LL_TIM_GenerateEvent_UPDATE(inst);
+	LL_TIM_EnableCounter(inst);
+}
+
+void STM32PWM::stop_() noexcept
+{
+	auto inst = timer_instance(timer_);
+
+	if(dma_ || pool_)
+	{
+		stopStream();
+	}
+
+	// Only a dedicated channel is left after stopStream()
+	if(dma_)
+	{
+		dma_->stop();
+		dma_->registerCallback(nullptr);
+	}
+
+	if(STM32TimerHelper::isAdvanced(timer_))
+	{
+		LL_TIM_DisableAllOutputs(inst);
+	}
+
+	LL_TIM_DeInit(inst);
+	STM32ClockControl::timerDisable(timer_);
+
+	for(const auto& config : channels_)
+	{
+		if(config.has_output)
+		{
+			STM32GPIOTranslator::configure_default(config.output.port, config.output.pin);
+		}
+
+		if(config.has_complementary)
+		{
+			STM32GPIOTranslator::configure_default(config.complementary.port,
+												   config.complementary.pin);
+		}
+	}
+}
+
+void STM32PWM::setFrequency(uint32_t frequency) noexcept
+{
+	frequency_ = frequency;
+
+	if(started())
+	{
+		applyFrequency();
+	}
+}
+
+void STM32PWM::applyFrequency() noexcept
+{
+	// The counter covers the period twice in center-aligned mode
+	auto counter_frequency = (alignment_ == alignment::center) ? 2 * frequency_ : frequency_;
+	auto base = STM32TimerHelper::timeBase(timer_, counter_frequency);
+	auto inst = timer_instance(timer_);
+
+	LL_TIM_SetPrescaler(inst, base.prescaler);
+	LL_TIM_SetAutoReload(inst, base.autoreload);
+	period_ = base.autoreload + 1;
+}
+
+void STM32PWM::setRepetition(uint16_t count) noexcept
+{
+	assert(STM32TimerHelper::isAdvanced(timer_));
+	repetition_ = count;
+
+	if(started())
+	{
+		LL_TIM_SetRepetitionCounter(timer_instance(timer_), repetition_);
+	}
+}
+
+void STM32PWM::setCompare(uint8_t channel, uint32_t compare) noexcept
+{
+	assert(started());
+	assert(channel >= 1 && channel <= MAX_CHANNELS && channels_[channel - 1].enabled);
+
+	set_compare(timer_instance(timer_), channel, compare);
+}
+
+#pragma mark - DMA Burst -
+
+bool STM32PWM::streamCompare(uint8_t first_channel, uint8_t channels, const uint32_t* frames,
+							 size_t frame_count, bool circular, const stream_cb_t& cb) noexcept
+{
+	assert(started() && (dma_ || pool_));
+	assert(first_channel >= 1 && channels >= 1 && (first_channel + channels - 1) <= 4);
+	assert(frames && frame_count > 0 && (frame_count * channels) <= MAX_STREAM_ITEMS);
+
+	auto inst = timer_instance(timer_);
+
+	stopStream();
+
+	uint32_t configuration = LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_HIGH |
+							 (circular ? LL_DMA_MODE_CIRCULAR : LL_DMA_MODE_NORMAL) |
+							 LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+							 LL_DMA_PDATAALIGN_WORD | LL_DMA_MDATAALIGN_WORD;
+
+	if(pool_)
+	{
+		// stopStream() releases the channel, including when a normal stream completes
+		dma_ = pool_->acquire(configuration, STM32TimerHelper::updateRequest(timer_),
+							  STM32DMAPool::priority::high,
+							  [this](STM32DMA::status s) { streamEvent(s); }, false);
+		if(dma_ == nullptr)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		dma_->stop();
+		dma_->setConfiguration(configuration, STM32TimerHelper::updateRequest(timer_));
+		dma_->start();
+	}
+
+	dma_->enableHalfTransferInterrupt(circular);
+
+	// The underlying STM32 code doesn't take const.
+	dma_->setAddresses(const_cast<uint32_t*>(frames), const_cast<uint32_t*>(&inst->DMAR),
+					   frame_count * channels);
+
+	stream_cb_ = cb;
+	stream_circular_ = circular;
+	streaming_ = true;
+
+	LL_TIM_ConfigDMABurst(inst, burst_base[first_channel - 1], burst_length[channels - 1]);
+	dma_->enable();
+	LL_TIM_EnableDMAReq_UPDATE(inst);
+
+	return true;
+}
+
+void STM32PWM::stopStream() noexcept
+{
+	assert(dma_ || pool_);
+
+	STM32DMA* pooled = nullptr;
+
+	{
+		STM32InterruptLock lock;
+
+		LL_TIM_DisableDMAReq_UPDATE(timer_instance(timer_));
+		if(dma_)
+		{
+			dma_->disable();
+		}
+
+		streaming_ = false;
+
+		if(pool_)
+		{
+			pooled = dma_;
+			dma_ = nullptr;
+		}
+	}
+
+	if(pooled)
+	{
+		pool_->release(pooled);
+	}
+}
+
+// Called from the DMA ISR
+void STM32PWM::streamEvent(STM32DMA::status s) noexcept
+{
+	if(!streaming_)
+	{
+		return; // An interrupt which was pending when the stream was stopped
+	}
+
+	stream_event event = stream_event::complete;
+
+	if(s == STM32DMA::status::half_transfer)
+	{
+		event = stream_event::half;
+	}
+	else if(s == STM32DMA::status::error)
+	{
+		event = stream_event::error;
+		stopStream();
+	}
+	else if(!stream_circular_)
+	{
+		stopStream();
+	}
+
+	if(stream_cb_)
+	{
+		stream_cb_(event);
+	}
+}
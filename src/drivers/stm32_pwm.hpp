@@ -0,0 +1,352 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_PWM_HPP_
+#define STM32_PWM_HPP_
+
+#include <array>
+#include <driver/driver.hpp>
+#include <driver/gpio.hpp>
+#include <driver/timer.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <stm32_dma.hpp>
+#include <stm32_dma_pool.hpp>
+
+// TODO: support the break input (BKIN) on the advanced timers
+
+/** STM32 PWM output driver.
+ *
+ * Each timer device drives up to four PWM channels (TIM2-TIM5), or six on the advanced
+ * timers TIM1/TIM8. All channels on a timer share the same frequency. Channels 1-3 of the
+ * advanced timers have complementary outputs (CHxN) with hardware dead-time insertion for
+ * driving half-bridges. Channels 5 and 6 of TIM1/TIM8 have no output pins; they can be used
+ * as internal compare events.
+ *
+ * Duty cycles can be set from software (setDuty(), setCompare()), or streamed from a buffer
+ * with a DMA burst: at every update event, the timer's DMA burst unit writes one frame of
+ * compare values to consecutive CCRx registers. This updates several channels every PWM
+ * period without interrupts, which suits motor commutation tables and PWM audio.
+ *
+ * @code
+ * STM32PWM motor{embvm::timer::channel::CH1, 20000, &dma_ch};
+ * motor.configureChannel(1, {embvm::gpio::port::A, 8, 1}, {embvm::gpio::port::A, 7, 1});
+ * motor.setDeadTime(500);
+ * motor.start();
+ * motor.setDuty(1, 0x8000); // 50%
+ * @endcode
+ *
+ * Compare values take effect at the next update event (preload is enabled), so duty cycle
+ * changes never produce glitched periods.
+ *
+ * Streams use either a dedicated DMA channel, or a channel acquired from a STM32DMAPool when
+ * the stream starts and released when it stops. A pool suits occasional streams.
+ *
+ * The GPIO bank clocks must be enabled in the hardware platform. The timer clock is managed
+ * by this driver. If a DMA channel is used, its device clock must also be enabled.
+ */
+class STM32PWM final : public embvm::DriverBase
+{
+  public:
+	/// Output polarity
+	enum class polarity : uint8_t
+	{
+		/// The output is high for the duty cycle portion of the period
+		active_high = 0,
+		active_low,
+	};
+
+	/// Counter alignment
+	enum class alignment : uint8_t
+	{
+		/// Outputs switch on at the start of each period
+		edge = 0,
+		/// Counts up and down; the pulses are centered in the period. This halves the
+		/// output frequency for a given timer period and reduces switching noise.
+		center,
+	};
+
+	/// DMA stream events
+	enum class stream_event : uint8_t
+	{
+		/// The first half of the buffer has been written (circular streams only)
+		half = 0,
+		/// The whole buffer has been written
+		complete,
+		error,
+	};
+
+	/// An output pin for a PWM channel
+	struct pin_t
+	{
+		embvm::gpio::port port;
+		uint8_t pin;
+		/// Alternate function number which connects the pin to the timer channel
+		uint8_t af;
+	};
+
+	using stream_cb_t = stdext::inplace_function<void(stream_event)>;
+
+	/// Maximum number of channels on a timer
+	static constexpr uint8_t MAX_CHANNELS = 6;
+
+	/// Maximum duty cycle value (100%)
+	static constexpr uint16_t DUTY_MAX = UINT16_MAX;
+
+	/// Maximum number of compare values in a DMA stream (limited by the DMA counter).
+	static constexpr size_t MAX_STREAM_ITEMS = 65535;
+
+  public:
+	/** Construct a PWM driver.
+	 *
+	 * @param [in] timer The timer device (TIM1-TIM5 or TIM8).
+	 * @param [in] frequency The PWM frequency, in Hz.
+	 * @param [in] dma Optional DMA channel used for streamCompare(). It is dedicated to this
+	 *	driver.
+	 */
+	STM32PWM(embvm::timer::channel timer, uint32_t frequency, STM32DMA* dma = nullptr) noexcept
+		: embvm::DriverBase(embvm::DriverType::TIMER), timer_(timer), frequency_(frequency),
+		  dma_(dma)
+	{
+	}
+
+	/** Construct a PWM driver which streams with pooled DMA channels.
+	 *
+	 * @param [in] timer The timer device (TIM1-TIM5 or TIM8).
+	 * @param [in] frequency The PWM frequency, in Hz.
+	 * @param [in] pool The pool which provides a DMA channel for each streamCompare() call.
+	 */
+	STM32PWM(embvm::timer::channel timer, uint32_t frequency, STM32DMAPool& pool) noexcept
+		: embvm::DriverBase(embvm::DriverType::TIMER), timer_(timer), frequency_(frequency),
+		  pool_(&pool)
+	{
+	}
+	~STM32PWM() noexcept = default;
+
+	/** Enable a PWM channel.
+	 *
+	 * @precondition The driver is stopped.
+	 * @precondition channel is valid for the timer. Channels 5/6 cannot have pins.
+	 * @param [in] channel The channel number, [1..6].
+	 * @param [in] output The output pin.
+	 * @param [in] p The output polarity.
+	 */
+	void configureChannel(uint8_t channel, const pin_t& output,
+						  polarity p = polarity::active_high) noexcept;
+
+	/** Enable a PWM channel with a complementary output.
+	 *
+	 * The complementary output is the inverse of the main output, with dead-time inserted
+	 * between one output switching off and the other switching on (see setDeadTime()).
+	 *
+	 * @precondition The driver is stopped.
+	 * @precondition The timer is TIM1 or TIM8, and channel is in the range [1..3].
+	 * @param [in] channel The channel number, [1..3].
+	 * @param [in] output The main output pin (CHx).
+	 * @param [in] complementary The complementary output pin (CHxN).
+	 * @param [in] p The polarity of both outputs.
+	 */
+	void configureChannel(uint8_t channel, const pin_t& output, const pin_t& complementary,
+						  polarity p = polarity::active_high) noexcept;
+
+	/** Enable a PWM channel which only drives its complementary output (CHxN).
+	 *
+	 * Without the main output, CHxN follows the PWM reference directly, so duty cycles have
+	 * the same meaning as for a main output. This is useful when a pin is only routed to a
+	 * complementary output (e.g., PB14 is TIM1_CH2N).
+	 *
+	 * @precondition The driver is stopped.
+	 * @precondition The timer is TIM1 or TIM8, and channel is in the range [1..3].
+	 * @param [in] channel The channel number, [1..3].
+	 * @param [in] complementary The complementary output pin (CHxN).
+	 * @param [in] p The output polarity.
+	 */
+	void configureComplementaryChannel(uint8_t channel, const pin_t& complementary,
+									   polarity p = polarity::active_high) noexcept;
+
+	/** Enable a channel without an output pin (e.g., channels 5/6 on TIM1/TIM8).
+	 *
+	 * @precondition The driver is stopped.
+	 */
+	void configureChannel(uint8_t channel) noexcept;
+
+	/** Set the dead-time inserted between complementary outputs.
+	 *
+	 * The value is rounded up to the nearest achievable dead-time.
+	 *
+	 * @precondition The driver is stopped.
+	 * @precondition The timer is TIM1 or TIM8.
+	 * @param [in] nanoseconds The dead-time.
+	 */
+	void setDeadTime(uint32_t nanoseconds) noexcept;
+
+	/// Set the counter alignment.
+	/// @precondition The driver is stopped.
+	void setAlignment(alignment a) noexcept
+	{
+		assert(started() == false);
+		alignment_ = a;
+	}
+
+	/** Set the repetition counter of an advanced timer.
+	 *
+	 * The update event is generated once every `count + 1` PWM periods. Compare values
+	 * (including DMA stream frames) are then applied at that slower rate, which lets a short
+	 * buffer describe a long pattern, such as an LED fading in and out.
+	 *
+	 * The new value takes effect at the next update event.
+	 *
+	 * @precondition The timer is TIM1 or TIM8.
+	 * @param [in] count The number of additional periods between update events.
+	 */
+	void setRepetition(uint16_t count) noexcept;
+
+	/** Change the PWM frequency.
+	 *
+	 * The new period takes effect at the next update event. Compare values are not rescaled,
+	 * so duty cycles set with setDuty() should be reapplied.
+	 */
+	void setFrequency(uint32_t frequency) noexcept;
+
+	/// The number of timer ticks in one PWM period, which is the compare value resolution.
+	/// Valid once the driver is started.
+	uint32_t period() const noexcept
+	{
+		return period_;
+	}
+
+	/** Set a channel's compare value.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] channel The channel number.
+	 * @param [in] compare The compare value, in timer ticks [0..period()]. A value of
+	 *	period() or more holds the output active.
+	 */
+	void setCompare(uint8_t channel, uint32_t compare) noexcept;
+
+	/** Set a channel's duty cycle.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] channel The channel number.
+	 * @param [in] duty The duty cycle, where DUTY_MAX is 100%.
+	 */
+	void setDuty(uint8_t channel, uint16_t duty) noexcept
+	{
+		setCompare(channel, dutyToCompare(duty, period_));
+	}
+
+	/** Stream compare values to consecutive channels with a DMA burst.
+	 *
+	 * The buffer holds frames of `channels` compare values each. At every update event, the
+	 * next frame is written to CCR[first_channel] .. CCR[first_channel + channels - 1].
+	 *
+	 * For continuous output (e.g., PWM audio), use a circular stream and refill each half
+	 * of the buffer when the callback reports that it has been written.
+	 *
+	 * @precondition The driver is started with a DMA channel or pool.
+	 * @precondition The channels are in the range [1..4] (CCR5/CCR6 are not contiguous with
+	 *	CCR1-CCR4).
+	 * @param [in] first_channel The first channel written by each frame.
+	 * @param [in] channels The number of channels written by each frame, [1..4].
+	 * @param [in] frames The compare values. The buffer must remain valid until the stream
+	 *	completes or is stopped.
+	 * @param [in] frame_count The number of frames in the buffer.
+	 * @param [in] circular True to repeat the buffer until stopStream() is called.
+	 * @param [in] cb Optional callback invoked from the DMA interrupt.
+	 * @returns true if the stream was started, false if no pool channel was free.
+	 */
+	bool streamCompare(uint8_t first_channel, uint8_t channels, const uint32_t* frames,
+					   size_t frame_count, bool circular, const stream_cb_t& cb = nullptr) noexcept;
+
+	/** Stop a DMA stream. The channels keep the last compare values written.
+	 *
+	 * A pooled channel is released. This is also done when a non-circular stream completes.
+	 */
+	void stopStream() noexcept;
+
+	/// Check whether a DMA stream is running.
+	bool streaming() const noexcept
+	{
+		return streaming_;
+	}
+
+	/// Convert a duty cycle (DUTY_MAX = 100%) to a compare value for a period.
+	static constexpr uint32_t dutyToCompare(uint16_t duty, uint32_t period) noexcept
+	{
+		return static_cast<uint32_t>((static_cast<uint64_t>(duty) * period) / DUTY_MAX);
+	}
+
+	/** Encode a dead-time for the BDTR DTG field.
+	 *
+	 * DTG has four ranges with different step sizes (in timer clock ticks):
+	 *	- 0xxxxxxx: DTG[6:0] x 1, up to 127
+	 *	- 10xxxxxx: (64 + DTG[5:0]) x 2, up to 254
+	 *	- 110xxxxx: (32 + DTG[4:0]) x 8, up to 504
+	 *	- 111xxxxx: (32 + DTG[4:0]) x 16, up to 1008
+	 *
+	 * @param [in] ticks The dead-time, in timer clock ticks.
+	 * @returns The DTG value for the smallest dead-time >= ticks, or 0xFF (the maximum) if the
+	 *	dead-time cannot be reached.
+	 */
+	static constexpr uint8_t encodeDeadTime(uint32_t ticks) noexcept
+	{
+		if(ticks <= 127)
+		{
+			return static_cast<uint8_t>(ticks);
+		}
+
+		if(ticks <= 254)
+		{
+			return static_cast<uint8_t>(0x80 | (((ticks + 1) / 2) - 64));
+		}
+
+		if(ticks <= 504)
+		{
+			return static_cast<uint8_t>(0xC0 | (((ticks + 7) / 8) - 32));
+		}
+
+		if(ticks <= 1008)
+		{
+			return static_cast<uint8_t>(0xE0 | (((ticks + 15) / 16) - 32));
+		}
+
+		return 0xFF;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	void enableChannel(uint8_t channel, const pin_t* output, const pin_t* complementary,
+					   polarity p) noexcept;
+	/// Program the prescaler and auto-reload for frequency_
+	void applyFrequency() noexcept;
+	void streamEvent(STM32DMA::status s) noexcept;
+
+  private:
+	struct channel_config_t
+	{
+		bool enabled = false;
+		bool has_output = false;
+		bool has_complementary = false;
+		polarity pol = polarity::active_high;
+		pin_t output = {};
+		pin_t complementary = {};
+	};
+
+	const embvm::timer::channel timer_;
+	uint32_t frequency_;
+	/// The dedicated channel, or the pool channel held by the active stream
+	STM32DMA* dma_ = nullptr;
+	STM32DMAPool* const pool_ = nullptr;
+	std::array<channel_config_t, MAX_CHANNELS> channels_{};
+	alignment alignment_ = alignment::edge;
+	uint32_t dead_time_ns_ = 0;
+	uint16_t repetition_ = 0;
+	uint32_t period_ = 0;
+	volatile bool streaming_ = false;
+	bool stream_circular_ = false;
+	stream_cb_t stream_cb_;
+};
+
+#endif // STM32_PWM_HPP_
@@ -4,7 +4,11 @@
 #include "stm32_rcc.hpp"
 #include <array>
 #include <processor_includes.hpp>
+#include <stm32l4xx_ll_bus.h>
+#include <stm32l4xx_ll_pwr.h>
 #include <stm32l4xx_ll_rcc.h>
+#include <stm32l4xx_ll_system.h>
+#include <stm32l4xx_ll_utils.h>
 #include <volatile/volatile.hpp>
 
 // TODO: how can we be flexible here, adjusting for other chips?
@@ -19,8 +23,8 @@ constexpr std::array<unsigned, 9> gpio_enable_bits = {
 // TODO: fix this, use an enum instead so we don't have to waste a slot
 // CH0 is not valid for STM32 timers
 constexpr std::array<volatile uint32_t* const, 9> timer_enable_reg = {
-	nullptr,		&RCC->AHB2ENR,	&RCC->APB1ENR1, &RCC->APB1ENR1, &RCC->APB1ENR1,
-	&RCC->APB1ENR1, &RCC->APB1ENR1, &RCC->APB1ENR1, &RCC->AHB2ENR};
+	nullptr,		&RCC->APB2ENR,	&RCC->APB1ENR1, &RCC->APB1ENR1, &RCC->APB1ENR1,
+	&RCC->APB1ENR1, &RCC->APB1ENR1, &RCC->APB1ENR1, &RCC->APB2ENR};
 
 // CH0 is not valid for STM32 timers
 constexpr std::array<unsigned, 9> timer_enable_bits = {0,
@@ -31,7 +35,7 @@ constexpr std::array<unsigned, 9> timer_enable_bits = {0,
 													   RCC_APB1ENR1_TIM5EN,
 													   RCC_APB1ENR1_TIM6EN,
 													   RCC_APB1ENR1_TIM7EN,
-													   RCC_APB2ENR_TIM8EN_Pos};
+													   RCC_APB2ENR_TIM8EN};
 
 constexpr std::array<volatile uint32_t* const, 4> i2c_enable_reg = {&RCC->APB1ENR1, &RCC->APB1ENR1,
 																	&RCC->APB1ENR1, &RCC->AHB2ENR};
@@ -43,10 +47,79 @@ constexpr std::array<unsigned, 4> i2c_clock_source = {
 	LL_RCC_I2C1_CLKSOURCE_SYSCLK, LL_RCC_I2C2_CLKSOURCE_SYSCLK, LL_RCC_I2C3_CLKSOURCE_SYSCLK,
 	LL_RCC_I2C4_CLKSOURCE_SYSCLK};
 
+constexpr std::array<volatile uint32_t* const, 3> spi_enable_reg = {&RCC->APB2ENR, &RCC->APB1ENR1,
+																	&RCC->APB1ENR1};
+constexpr std::array<unsigned, 3> spi_enable_bits = {RCC_APB2ENR_SPI1EN, RCC_APB1ENR1_SPI2EN,
+													 RCC_APB1ENR1_SPI3EN};
+
+constexpr std::array<unsigned, 2> octospi_enable_bits = {RCC_AHB3ENR_OSPI1EN,
+														 RCC_AHB3ENR_OSPI2EN};
+
+constexpr std::array<volatile uint32_t* const, 6> uart_enable_reg = {
+	&RCC->APB2ENR,	&RCC->APB1ENR1, &RCC->APB1ENR1,
+	&RCC->APB1ENR1, &RCC->APB1ENR1, &RCC->APB1ENR2};
+constexpr std::array<unsigned, 6> uart_enable_bits = {
+	RCC_APB2ENR_USART1EN, RCC_APB1ENR1_USART2EN, RCC_APB1ENR1_USART3EN,
+	RCC_APB1ENR1_UART4EN, RCC_APB1ENR1_UART5EN,	 RCC_APB1ENR2_LPUART1EN};
+
 constexpr std::array<unsigned, 2> dma_enable_bits = {RCC_AHB1ENR_DMA1EN, RCC_AHB1ENR_DMA2EN};
 
+/// PLL configuration for SYSTEM_CLOCK_HZ: 4 MHz MSI * 60 / 2 = 120 MHz
+constexpr uint32_t pll_n = 60;
+
+/// Number of core clock cycles to hold the AHB prescaler at /2 after switching to the PLL.
+/// The reference manual requires at least 1 us when transitioning above 80 MHz.
+constexpr uint32_t ahb_transition_cycles = 120;
+
 }; // namespace
 
+void STM32ClockControl::configureSystemClock() noexcept
+{
+	// Range 1 boost mode is required for SYSCLK > 80 MHz
+	LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_PWR);
+	LL_PWR_SetRegulVoltageScaling(LL_PWR_REGU_VOLTAGE_SCALE1);
+	LL_PWR_EnableRange1BoostMode();
+
+	// The flash latency must be increased before the clock is raised
+	LL_FLASH_SetLatency(LL_FLASH_LATENCY_5);
+	while(LL_FLASH_GetLatency() != LL_FLASH_LATENCY_5)
+	{
+	}
+
+	LL_FLASH_EnablePrefetch();
+	LL_FLASH_EnableInstCache();
+	LL_FLASH_EnableDataCache();
+
+	LL_RCC_MSI_Enable();
+	while(LL_RCC_MSI_IsReady() != 1)
+	{
+	}
+
+	LL_RCC_PLL_ConfigDomain_SYS(LL_RCC_PLLSOURCE_MSI, LL_RCC_PLLM_DIV_1, pll_n, LL_RCC_PLLR_DIV_2);
+	LL_RCC_PLL_EnableDomain_SYS();
+	LL_RCC_PLL_Enable();
+	while(LL_RCC_PLL_IsReady() != 1)
+	{
+	}
+
+	// Step through an intermediate AHB prescaler to limit the current step
+	LL_RCC_SetAHBPrescaler(LL_RCC_SYSCLK_DIV_2);
+	LL_RCC_SetSysClkSource(LL_RCC_SYS_CLKSOURCE_PLL);
+	while(LL_RCC_GetSysClkSource() != LL_RCC_SYS_CLKSOURCE_STATUS_PLL)
+	{
+	}
+
+	for(volatile uint32_t i = 0; i < ahb_transition_cycles; i++)
+	{
+	}
+
+	LL_RCC_SetAHBPrescaler(LL_RCC_SYSCLK_DIV_1);
+	LL_RCC_SetAPB1Prescaler(LL_RCC_APB1_DIV_1);
+	LL_RCC_SetAPB2Prescaler(LL_RCC_APB2_DIV_1);
+
+	LL_SetSystemCoreClock(SYSTEM_CLOCK_HZ);
+}
+
 void STM32ClockControl::gpioEnable(embvm::gpio::port port) noexcept
 {
 	uint32_t val = embutil::volatile_load(&RCC->AHB2ENR);
@@ -98,6 +171,58 @@ void STM32ClockControl::i2cDisable(uint8_t device) noexcept
 	embutil::volatile_store(reg, val);
 }
 
+void STM32ClockControl::spiEnable(uint8_t device) noexcept
+{
+	volatile uint32_t* const reg = spi_enable_reg[device];
+	assert(reg);
+	uint32_t val = embutil::volatile_load(reg);
+	val |= spi_enable_bits[device];
+	embutil::volatile_store(reg, val);
+}
+
+void STM32ClockControl::spiDisable(uint8_t device) noexcept
+{
+	volatile uint32_t* const reg = spi_enable_reg[device];
+	assert(reg);
+	uint32_t val = embutil::volatile_load(reg);
+	val &= ~(spi_enable_bits[device]);
+	embutil::volatile_store(reg, val);
+}
+
+void STM32ClockControl::uartEnable(uint8_t device) noexcept
+{
+	volatile uint32_t* const reg = uart_enable_reg[device];
+	assert(reg);
+	uint32_t val = embutil::volatile_load(reg);
+	val |= uart_enable_bits[device];
+	embutil::volatile_store(reg, val);
+}
+
+void STM32ClockControl::uartDisable(uint8_t device) noexcept
+{
+	volatile uint32_t* const reg = uart_enable_reg[device];
+	assert(reg);
+	uint32_t val = embutil::volatile_load(reg);
+	val &= ~(uart_enable_bits[device]);
+	embutil::volatile_store(reg, val);
+}
+
+void STM32ClockControl::adcEnable() noexcept
+{
+	LL_RCC_SetADCClockSource(LL_RCC_ADC_CLKSOURCE_SYSCLK);
+
+	uint32_t val = embutil::volatile_load(&RCC->AHB2ENR);
+	val |= RCC_AHB2ENR_ADCEN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+}
+
+void STM32ClockControl::adcDisable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->AHB2ENR);
+	val &= ~RCC_AHB2ENR_ADCEN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+}
+
 void STM32ClockControl::dmaEnable(uint8_t device) noexcept
 {
 	uint32_t val = embutil::volatile_load(&RCC->AHB1ENR);
@@ -125,3 +250,148 @@ void STM32ClockControl::dmaMuxDisable() noexcept
 	val &= ~RCC_AHB1ENR_DMAMUX1EN;
 	embutil::volatile_store(&RCC->AHB1ENR, val);
 }
+
+void STM32ClockControl::dma2dEnable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->AHB1ENR);
+	val |= RCC_AHB1ENR_DMA2DEN;
+	embutil::volatile_store(&RCC->AHB1ENR, val);
+}
+
+void STM32ClockControl::dma2dDisable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->AHB1ENR);
+	val &= ~RCC_AHB1ENR_DMA2DEN;
+	embutil::volatile_store(&RCC->AHB1ENR, val);
+}
+
+void STM32ClockControl::crcEnable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->AHB1ENR);
+	val |= RCC_AHB1ENR_CRCEN;
+	embutil::volatile_store(&RCC->AHB1ENR, val);
+}
+
+void STM32ClockControl::crcDisable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->AHB1ENR);
+	val &= ~RCC_AHB1ENR_CRCEN;
+	embutil::volatile_store(&RCC->AHB1ENR, val);
+}
+
+void STM32ClockControl::clock48Enable() noexcept
+{
+	LL_RCC_HSI48_Enable();
+	while(LL_RCC_HSI48_IsReady() != 1)
+	{
+	}
+
+	LL_RCC_SetRNGClockSource(LL_RCC_RNG_CLKSOURCE_HSI48);
+}
+
+void STM32ClockControl::rngEnable() noexcept
+{
+	clock48Enable();
+
+	uint32_t val = embutil::volatile_load(&RCC->AHB2ENR);
+	val |= RCC_AHB2ENR_RNGEN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+}
+
+void STM32ClockControl::rngDisable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->AHB2ENR);
+	val &= ~RCC_AHB2ENR_RNGEN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+}
+
+void STM32ClockControl::usbEnable() noexcept
+{
+	clock48Enable();
+
+	uint32_t val = embutil::volatile_load(&RCC->APB1ENR1);
+	val |= RCC_APB1ENR1_CRSEN;
+	embutil::volatile_store(&RCC->APB1ENR1, val);
+
+	// The reset configuration synchronizes to the USB SOF, with a 1 ms period at 48 MHz
+	val = embutil::volatile_load(&CRS->CR);
+	val |= CRS_CR_AUTOTRIMEN | CRS_CR_CEN;
+	embutil::volatile_store(&CRS->CR, val);
+
+	val = embutil::volatile_load(&RCC->AHB2ENR);
+	val |= RCC_AHB2ENR_OTGFSEN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+}
+
+void STM32ClockControl::usbDisable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->AHB2ENR);
+	val &= ~RCC_AHB2ENR_OTGFSEN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+
+	val = embutil::volatile_load(&CRS->CR);
+	val &= ~(CRS_CR_AUTOTRIMEN | CRS_CR_CEN);
+	embutil::volatile_store(&CRS->CR, val);
+
+	val = embutil::volatile_load(&RCC->APB1ENR1);
+	val &= ~RCC_APB1ENR1_CRSEN;
+	embutil::volatile_store(&RCC->APB1ENR1, val);
+}
+
+void STM32ClockControl::sdmmcEnable() noexcept
+{
+	clock48Enable();
+
+	// SDMMCSEL = 0 selects CLK48 as the kernel clock
+	uint32_t val = embutil::volatile_load(&RCC->CCIPR2);
+	val &= ~RCC_CCIPR2_SDMMCSEL;
+	embutil::volatile_store(&RCC->CCIPR2, val);
+
+	val = embutil::volatile_load(&RCC->AHB2ENR);
+	val |= RCC_AHB2ENR_SDMMC1EN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+}
+
+void STM32ClockControl::sdmmcDisable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->AHB2ENR);
+	val &= ~RCC_AHB2ENR_SDMMC1EN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+}
+
+void STM32ClockControl::octospiEnable(uint8_t device) noexcept
+{
+	assert(device < octospi_enable_bits.size());
+
+	uint32_t val = embutil::volatile_load(&RCC->AHB2ENR);
+	val |= RCC_AHB2ENR_OSPIMEN;
+	embutil::volatile_store(&RCC->AHB2ENR, val);
+
+	val = embutil::volatile_load(&RCC->AHB3ENR);
+	val |= octospi_enable_bits[device];
+	embutil::volatile_store(&RCC->AHB3ENR, val);
+}
+
+void STM32ClockControl::octospiDisable(uint8_t device) noexcept
+{
+	assert(device < octospi_enable_bits.size());
+
+	uint32_t val = embutil::volatile_load(&RCC->AHB3ENR);
+	val &= ~(octospi_enable_bits[device]);
+	embutil::volatile_store(&RCC->AHB3ENR, val);
+
+	// The I/O manager is shared by both devices
+	if((val & (RCC_AHB3ENR_OSPI1EN | RCC_AHB3ENR_OSPI2EN)) == 0)
+	{
+		val = embutil::volatile_load(&RCC->AHB2ENR);
+		val &= ~RCC_AHB2ENR_OSPIMEN;
+		embutil::volatile_store(&RCC->AHB2ENR, val);
+	}
+}
+
+void STM32ClockControl::syscfgEnable() noexcept
+{
+	uint32_t val = embutil::volatile_load(&RCC->APB2ENR);
+	val |= RCC_APB2ENR_SYSCFGEN;
+	embutil::volatile_store(&RCC->APB2ENR, val);
+}
@@ -18,6 +18,26 @@
 class STM32ClockControl
 {
   public:
+	/// Core clock frequency selected by configureSystemClock().
+	static constexpr uint32_t SYSTEM_CLOCK_HZ = 120000000;
+
+	/** Raise the system clock from the 4 MHz MSI reset clock to SYSTEM_CLOCK_HZ.
+	 *
+	 * The PLL is driven from the 4 MHz MSI (M = 1, N = 60, R = 2). The regulator is placed in
+	 * Range 1 boost mode, the flash latency is raised to 5 wait states, and the ART
+	 * accelerator (prefetch, instruction cache, and data cache) is enabled to hide the flash
+	 * wait states. AHB, APB1, and APB2 all run at SYSTEM_CLOCK_HZ.
+	 *
+	 * This should be called as early as possible so that the remainder of the boot process
+	 * runs at full speed. The STM32L4R5 calls it from Reset_Handler, before .data and .bss are
+	 * initialized. Only registers are accessed, apart from the final SystemCoreClock update,
+	 * which must be repeated (e.g., with SystemCoreClockUpdate()) once .data is initialized.
+	 *
+	 * @precondition The processor is running from the MSI reset clock.
+	 * @postcondition SYSCLK is SYSTEM_CLOCK_HZ and SystemCoreClock is updated.
+	 */
+	static void configureSystemClock() noexcept;
+
 	/** Enable the peripheral clock to one of the GPIO banks.
 	 *
 	 * @precondition port is a valid port for the STM32 processor.
@@ -73,6 +93,57 @@ class STM32ClockControl
 	 */
 	static void i2cDisable(uint8_t device) noexcept;
 
+	/** Enable the peripheral clock to one of the SPI devices
+	 *
+	 * @precondition SPI device is valid for the STM32 processor.
+	 * @postcondition SPI device's peripheral clock is enabled.
+	 *
+	 * @param [in] device The SPI device ID to enable.
+	 */
+	static void spiEnable(uint8_t device) noexcept;
+
+	/** Disable the peripheral clock to one of the SPI devices
+	 *
+	 * @precondition SPI device is valid for the STM32 processor.
+	 * @postcondition SPI device's peripheral clock is disabled.
+	 *
+	 * @param [in] device The SPI device ID to disable.
+	 */
+	static void spiDisable(uint8_t device) noexcept;
+
+	/** Enable the peripheral clock to one of the U(S)ART devices
+	 *
+	 * @precondition UART device is valid for the STM32 processor.
+	 * @postcondition UART device's peripheral clock is enabled.
+	 *
+	 * @param [in] device The UART device ID to enable (see STM32UART::device).
+	 */
+	static void uartEnable(uint8_t device) noexcept;
+
+	/** Disable the peripheral clock to one of the U(S)ART devices
+	 *
+	 * @precondition UART device is valid for the STM32 processor.
+	 * @postcondition UART device's peripheral clock is disabled.
+	 *
+	 * @param [in] device The UART device ID to disable (see STM32UART::device).
+	 */
+	static void uartDisable(uint8_t device) noexcept;
+
+	/** Enable the ADC peripheral clock.
+	 *
+	 * SYSCLK is selected as the ADC kernel clock source. The STM32ADC driver runs the ADC
+	 * from the synchronous HCLK / 2 clock, but the kernel clock must still be selected.
+	 *
+	 * @postcondition The ADC peripheral clock is enabled.
+	 */
+	static void adcEnable() noexcept;
+
+	/** Disable the ADC peripheral clock.
+	 *
+	 * @postcondition The ADC peripheral clock is disabled.
+	 */
+	static void adcDisable() noexcept;
+
 	// TODO: define a portable type like the ones above
 	/** Enable the peripheral clock to one of the DMA devices
 	 *
@@ -96,6 +167,115 @@ class STM32ClockControl
 	static void dmaMuxEnable() noexcept;
 	static void dmaMuxDisable() noexcept;
 
+	/** Enable the DMA2D (Chrom-ART) peripheral clock.
+	 *
+	 * @postcondition The DMA2D peripheral clock is enabled.
+	 */
+	static void dma2dEnable() noexcept;
+
+	/** Disable the DMA2D (Chrom-ART) peripheral clock.
+	 *
+	 * @postcondition The DMA2D peripheral clock is disabled.
+	 */
+	static void dma2dDisable() noexcept;
+
+	/** Enable the CRC calculation unit peripheral clock.
+	 *
+	 * @postcondition The CRC peripheral clock is enabled.
+	 */
+	static void crcEnable() noexcept;
+
+	/** Disable the CRC calculation unit peripheral clock.
+	 *
+	 * @postcondition The CRC peripheral clock is disabled.
+	 */
+	static void crcDisable() noexcept;
+
+	/** Start the 48 MHz clock (CLK48).
+	 *
+	 * The HSI48 oscillator is started and selected as CLK48, which clocks the RNG, USB OTG FS,
+	 * and (optionally) SDMMC peripherals. CLK48 is never stopped, since it is shared. Calling
+	 * this again restarts HSI48 if it was stopped (e.g., by a low-power mode).
+	 *
+	 * @postcondition HSI48 is running and selected as CLK48.
+	 */
+	static void clock48Enable() noexcept;
+
+	/** Enable the RNG peripheral clock.
+	 *
+	 * CLK48 is started, since it is the RNG kernel clock.
+	 *
+	 * @postcondition The RNG peripheral clock is enabled.
+	 */
+	static void rngEnable() noexcept;
+
+	/** Disable the RNG peripheral clock.
+	 *
+	 * @postcondition The RNG peripheral clock is disabled.
+	 */
+	static void rngDisable() noexcept;
+
+	/** Enable the USB OTG FS peripheral clock.
+	 *
+	 * CLK48 is started, since it is the USB kernel clock. HSI48 is not accurate enough for USB
+	 * on its own, so the clock recovery system (CRS) is enabled to trim it to the host's
+	 * start-of-frame packets.
+	 *
+	 * @postcondition The USB OTG FS peripheral clock is enabled.
+	 */
+	static void usbEnable() noexcept;
+
+	/** Disable the USB OTG FS peripheral clock and the clock recovery system.
+	 *
+	 * @postcondition The USB OTG FS peripheral clock is disabled.
+	 */
+	static void usbDisable() noexcept;
+
+	/** Enable the SDMMC1 peripheral clock.
+	 *
+	 * CLK48 is started and selected as the SDMMC kernel clock.
+	 *
+	 * @postcondition The SDMMC1 peripheral clock is enabled.
+	 */
+	static void sdmmcEnable() noexcept;
+
+	/** Disable the SDMMC1 peripheral clock.
+	 *
+	 * @postcondition The SDMMC1 peripheral clock is disabled.
+	 */
+	static void sdmmcDisable() noexcept;
+
+	/** Enable the peripheral clock to one of the OCTOSPI devices.
+	 *
+	 * The OCTOSPI I/O manager clock is also enabled, since it is required to reach the pins.
+	 *
+	 * @precondition OCTOSPI device is valid for the STM32 processor.
+	 * @postcondition OCTOSPI device's peripheral clock is enabled.
+	 *
+	 * @param [in] device The OCTOSPI device ID to enable.
+	 */
+	static void octospiEnable(uint8_t device) noexcept;
+
+	/** Disable the peripheral clock to one of the OCTOSPI devices.
+	 *
+	 * The OCTOSPI I/O manager clock is disabled once neither OCTOSPI device is clocked.
+	 *
+	 * @precondition OCTOSPI device is valid for the STM32 processor.
+	 * @postcondition OCTOSPI device's peripheral clock is disabled.
+	 *
+	 * @param [in] device The OCTOSPI device ID to disable.
+	 */
+	static void octospiDisable(uint8_t device) noexcept;
+
+	/** Enable the SYSCFG peripheral clock.
+	 *
+	 * The SYSCFG clock is never disabled, since the memory remap and other SYSCFG settings are
+	 * shared by several drivers.
+	 *
+	 * @postcondition The SYSCFG peripheral clock is enabled.
+	 */
+	static void syscfgEnable() noexcept;
+
   private:
 	/// This class can't be instantiated
 	STM32ClockControl() = default;
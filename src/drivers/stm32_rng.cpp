@@ -0,0 +1,249 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_rng.hpp"
+#include <cassert>
+#include <cstring>
+#include <inplace_function/inplace_function.hpp>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+
+/* Useful Developer Notes
+ *
+ * There is no LL driver in use for the RNG, so the registers are programmed directly.
+ *
+ * RNGEN starts the RNG. DRDY is set when a word is available in DR, and it is cleared when
+ * DR is read. With IE set, the RNG interrupt is raised while DRDY (or an error flag) is set.
+ * The pool is refilled from the interrupt, and IE is cleared once the pool is full.
+ *
+ * The reference manual asks for the first word after RNGEN is set to be kept only for
+ * comparison, and for each following word to be compared with the previous one.
+ *
+ * Seed error (SECS/SEIS): the noise source produced an abnormal sequence. To recover, clear
+ * SEIS, then clear and set RNGEN. Words read around the error may not be random, so they are
+ * discarded, as is the pool.
+ *
+ * Clock error (CECS/CEIS): the RNG clock is below HCLK / 16. The generated words are not
+ * affected, and the RNG restarts by itself once the clock is correct. CLK48 is restarted in
+ * case HSI48 was stopped. CED must be 0 for the detection to be enabled.
+ *
+ * SEIS and CEIS are cleared by writing 0. Writing 1 has no effect.
+ */
+
+#pragma mark - Definitions -
+
+using STM32RNG_cb_t = stdext::inplace_function<void()>;
+
+#pragma mark - Variables -
+
+static STM32RNG_cb_t rng_callback = nullptr;
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void RNG_IRQHandler(void);
+
+void RNG_IRQHandler()
+{
+	if(rng_callback)
+	{
+		rng_callback();
+	}
+	else
+	{
+		CLEAR_BIT(RNG->CR, RNG_CR_IE);
+	}
+}
+
+#pragma mark - Driver APIs -
+
+void STM32RNG::start_() noexcept
+{
+	STM32ClockControl::rngEnable();
+
+	pool_.clear();
+	stats_ = {};
+	consecutive_recoveries_ = 0;
+	failed_ = false;
+	discard_next_ = true;
+
+	rng_callback = [this]() { refill(); };
+	NVICControl::priority(RNG_IRQn, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(RNG_IRQn);
+
+	// Clock error detection is enabled (CED = 0)
+	WRITE_REG(RNG->CR, RNG_CR_RNGEN | RNG_CR_IE);
+}
+
+void STM32RNG::stop_() noexcept
+{
+	WRITE_REG(RNG->CR, 0);
+	NVICControl::disable(RNG_IRQn);
+	rng_callback = nullptr;
+
+	{
+		STM32InterruptLock lock;
+		pool_.clear();
+	}
+
+	STM32ClockControl::rngDisable();
+}
+
+STM32RNG::status STM32RNG::read(uint32_t& value) noexcept
+{
+	assert(started());
+
+	while(true)
+	{
+		STM32InterruptLock lock;
+
+		if(!pool_.empty())
+		{
+			value = pool_.front();
+			pool_.pop();
+			SET_BIT(RNG->CR, RNG_CR_IE);
+			return status::ok;
+		}
+
+		if(failed_)
+		{
+			return status::error;
+		}
+
+		// The pool is empty, so take the next word directly
+		if(fetch(value))
+		{
+			return status::ok;
+		}
+	}
+}
+
+STM32RNG::status STM32RNG::fill(void* data, size_t length) noexcept
+{
+	assert(data || length == 0);
+
+	auto bytes = static_cast<uint8_t*>(data);
+
+	while(length)
+	{
+		uint32_t value;
+		auto r = read(value);
+		if(r != status::ok)
+		{
+			return r;
+		}
+
+		auto count = (length < sizeof(value)) ? length : sizeof(value);
+		memcpy(bytes, &value, count);
+		bytes += count;
+		length -= count;
+	}
+
+	return status::ok;
+}
+
+#pragma mark - Helpers -
+
+// Called from the RNG ISR, or with interrupts masked
+void STM32RNG::refill() noexcept
+{
+	uint32_t value;
+
+	while(!pool_.full() && fetch(value))
+	{
+		pool_.push(value);
+	}
+
+	if(pool_.full() || failed_)
+	{
+		CLEAR_BIT(RNG->CR, RNG_CR_IE);
+	}
+}
+
+// Called from the RNG ISR, or with interrupts masked
+bool STM32RNG::fetch(uint32_t& value) noexcept
+{
+	if(failed_)
+	{
+		return false;
+	}
+
+	auto sr = READ_REG(RNG->SR);
+
+	if(sr & (RNG_SR_SEIS | RNG_SR_SECS))
+	{
+		stats_.seed_errors++;
+		CLEAR_BIT(RNG->SR, RNG_SR_SEIS);
+		restart();
+		return false;
+	}
+
+	if(sr & RNG_SR_CEIS)
+	{
+		stats_.clock_errors++;
+		CLEAR_BIT(RNG->SR, RNG_SR_CEIS);
+		recovered();
+	}
+
+	if(sr & RNG_SR_CECS)
+	{
+		// The RNG resumes once its clock is correct
+		STM32ClockControl::clock48Enable();
+		return false;
+	}
+
+	if(!(sr & RNG_SR_DRDY))
+	{
+		return false;
+	}
+
+	auto word = READ_REG(RNG->DR);
+
+	// A seed error can occur while the word is read
+	if(READ_BIT(RNG->SR, RNG_SR_SEIS | RNG_SR_SECS))
+	{
+		return false;
+	}
+
+	if(discard_next_)
+	{
+		discard_next_ = false;
+		previous_ = word;
+		return false;
+	}
+
+	if(word == previous_)
+	{
+		stats_.repeated_words++;
+		restart();
+		return false;
+	}
+
+	previous_ = word;
+	stats_.words++;
+	consecutive_recoveries_ = 0;
+	value = word;
+	return true;
+}
+
+// Called from the RNG ISR, or with interrupts masked
+void STM32RNG::restart() noexcept
+{
+	CLEAR_BIT(RNG->CR, RNG_CR_RNGEN);
+	SET_BIT(RNG->CR, RNG_CR_RNGEN);
+
+	pool_.clear();
+	discard_next_ = true;
+	recovered();
+}
+
+void STM32RNG::recovered() noexcept
+{
+	if(++consecutive_recoveries_ > MAX_RECOVERIES)
+	{
+		failed_ = true;
+		CLEAR_BIT(RNG->CR, RNG_CR_IE | RNG_CR_RNGEN);
+	}
+}
@@ -0,0 +1,128 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_RNG_HPP_
+#define STM32_RNG_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <driver/driver.hpp>
+#include <static_queue.hpp>
+
+// TODO: Handle interrupt priority - as a constructor parameter
+
+/** STM32L4+ true random number generator driver.
+ *
+ * The RNG produces a 32-bit word roughly every 40 RNG clock cycles (about 1 us). The driver
+ * keeps a pool of POOL_SIZE words, which is refilled from the RNG interrupt whenever words are
+ * taken from it, so read() normally returns immediately. If the pool is empty, read() takes the
+ * next word directly from the RNG.
+ *
+ * Every word is checked before it is used:
+ *	- The first word after the RNG is enabled is discarded, and each word is compared with the
+ *		previous one (the FIPS 140-2 continuous test). A repeated word restarts the RNG.
+ *	- Seed errors (an abnormal noise source sequence) restart the RNG, and the pool is
+ *		discarded.
+ *	- Clock errors (the RNG clock is too slow) restart the 48 MHz clock.
+ * If the RNG keeps failing MAX_RECOVERIES times in a row, the driver gives up and read()
+ * returns status::error until the driver is restarted.
+ *
+ * read() and fill() can be called from any context, including interrupts.
+ *
+ * @code
+ * uint32_t nonce;
+ * if(rng.read(nonce) == STM32RNG::status::ok)
+ * {
+ *	...
+ * }
+ * @endcode
+ *
+ * The RNG is clocked from HSI48, which the driver starts.
+ */
+class STM32RNG final : public embvm::DriverBase
+{
+  public:
+	enum class status : uint8_t
+	{
+		ok = 0,
+		/// The RNG has failed, and could not be recovered
+		error,
+	};
+
+	struct stats_t
+	{
+		/// Words which passed the checks
+		uint32_t words;
+		/// Seed errors which were recovered from
+		uint32_t seed_errors;
+		/// Clock errors which were recovered from
+		uint32_t clock_errors;
+		/// Words which repeated the previous word
+		uint32_t repeated_words;
+	};
+
+	/// Number of words held in the entropy pool
+	static constexpr size_t POOL_SIZE = 16;
+
+	/// Number of consecutive recoveries attempted before the RNG is considered failed
+	static constexpr uint32_t MAX_RECOVERIES = 8;
+
+  public:
+	STM32RNG() noexcept : embvm::DriverBase(embvm::DriverType::Undefined) {}
+	~STM32RNG() noexcept = default;
+
+	/** Get a random word.
+	 *
+	 * @precondition The driver is started.
+	 * @param [out] value The random word, if status::ok is returned.
+	 */
+	status read(uint32_t& value) noexcept;
+
+	/** Fill a buffer with random bytes.
+	 *
+	 * @precondition The driver is started.
+	 */
+	status fill(void* data, size_t length) noexcept;
+
+	/// The number of words in the entropy pool.
+	size_t available() const noexcept
+	{
+		return pool_.size();
+	}
+
+	/// Check whether the RNG has failed. Restart the driver to try again.
+	bool failed() const noexcept
+	{
+		return failed_;
+	}
+
+	stats_t stats() const noexcept
+	{
+		return stats_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	/// Fill the pool from the RNG, and enable the interrupt if there is room for more words
+	void refill() noexcept;
+	/// Take a checked word from the RNG. Returns false if no word is available.
+	bool fetch(uint32_t& value) noexcept;
+	/// Reset the RNG after an error
+	void restart() noexcept;
+	/// Count a recovery, and give up after MAX_RECOVERIES consecutive recoveries
+	void recovered() noexcept;
+
+  private:
+	StaticQueue<uint32_t, POOL_SIZE> pool_;
+	stats_t stats_{};
+	uint32_t previous_ = 0;
+	/// The next word is only used for the continuous test
+	bool discard_next_ = true;
+	uint32_t consecutive_recoveries_ = 0;
+	volatile bool failed_ = false;
+};
+
+#endif // STM32_RNG_HPP_
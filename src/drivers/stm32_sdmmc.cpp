@@ -0,0 +1,682 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_sdmmc.hpp"
+#include "helpers/gpio_helper.hpp"
+#include <algorithm>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+
+/* Useful Developer Notes
+ *
+ * There is no LL driver in use for the SDMMC, so the registers are programmed directly.
+ *
+ * A command is sent by writing ARG, then CMD with CPSMEN set. CMDREND is set when a response
+ * with a valid CRC is received, CMDSENT when a command without a response has been sent.
+ * Commands with CMDTRANS set start the data path (DPSM) with the DLEN/DCTRL settings, and
+ * CMDSTOP marks the stop command, which aborts the data path if it is still active.
+ *
+ * The IDMA moves the data between memory and the FIFO. In double-buffer mode, it alternates
+ * between IDMABASE0 and IDMABASE1, each IDMABSIZE bytes long, and sets IDMABTC when a buffer
+ * is done. Only the base register of the inactive buffer can be written, so the buffer which
+ * just completed is pointed at the next part of the run. The IDMABTC interrupt must be
+ * serviced before the other buffer completes: about 340 us for an 8 KiB buffer at 24 MHz.
+ * DATAEND is set once DLEN bytes have been transferred.
+ *
+ * Multi-block commands (CMD18/CMD25) are used for every run, and are ended with CMD12. After
+ * a write, the card holds D0 low while it programs the data. The SDMMC reports this busy
+ * signal after the CMD12 response: BUSYD0 is set while the card is busy, and BUSYD0END is
+ * set when it releases D0.
+ *
+ * The MASK interrupt enables and the ICR clear bits are at the same positions as the STA
+ * flags.
+ *
+ * The CMD and D0-D3 lines need pull-ups. Most SD card sockets and breakout boards provide them.
+ */
+
+#pragma mark - Definitions -
+
+using STM32SDMMC_cb_t = stdext::inplace_function<void(uint32_t)>;
+
+/// Commands used by the driver (ACMDs are preceded by CMD_APP_CMD)
+constexpr uint32_t CMD_GO_IDLE_STATE = 0;
+constexpr uint32_t CMD_ALL_SEND_CID = 2;
+constexpr uint32_t CMD_SEND_RELATIVE_ADDR = 3;
+constexpr uint32_t ACMD_SET_BUS_WIDTH = 6;
+constexpr uint32_t CMD_SELECT_CARD = 7;
+constexpr uint32_t CMD_SEND_IF_COND = 8;
+constexpr uint32_t CMD_SEND_CSD = 9;
+constexpr uint32_t CMD_STOP_TRANSMISSION = 12;
+constexpr uint32_t CMD_SEND_STATUS = 13;
+constexpr uint32_t CMD_SET_BLOCKLEN = 16;
+constexpr uint32_t CMD_READ_MULTIPLE_BLOCK = 18;
+constexpr uint32_t CMD_WRITE_MULTIPLE_BLOCK = 25;
+constexpr uint32_t ACMD_SD_SEND_OP_COND = 41;
+constexpr uint32_t CMD_APP_CMD = 55;
+
+/// CMD.WAITRESP values
+constexpr uint32_t RESPONSE_NONE = 0;
+constexpr uint32_t RESPONSE_SHORT = SDMMC_CMD_WAITRESP_0;
+/// R3 (OCR) responses have no CRC
+constexpr uint32_t RESPONSE_SHORT_NO_CRC = SDMMC_CMD_WAITRESP_1;
+constexpr uint32_t RESPONSE_LONG = SDMMC_CMD_WAITRESP_0 | SDMMC_CMD_WAITRESP_1;
+
+/// CMD8 argument: 2.7-3.6 V, and a check pattern which the card echoes
+constexpr uint32_t SEND_IF_COND_ARGUMENT = 0x1AA;
+/// ACMD41 argument: 3.2-3.4 V window. HCS is added for version 2 cards.
+constexpr uint32_t OCR_VOLTAGE_WINDOW = 0x00100000;
+constexpr uint32_t OCR_HIGH_CAPACITY = 0x40000000;
+constexpr uint32_t OCR_POWER_UP_DONE = 0x80000000;
+/// ACMD6 argument for a 4-bit bus
+constexpr uint32_t BUS_WIDTH_4 = 2;
+
+/// R1 card status error bits
+constexpr uint32_t R1_ERRORS = 0xFDFFE008;
+constexpr uint32_t R1_CURRENT_STATE_Pos = 9;
+constexpr uint32_t R1_CURRENT_STATE_Msk = 0xFU << R1_CURRENT_STATE_Pos;
+constexpr uint32_t CARD_STATE_TRANSFER = 4;
+
+/// SDMMC_CK = kernel clock / (2 * CLKDIV)
+constexpr uint32_t SDMMC_KERNEL_CLOCK_HZ = 48000000;
+constexpr uint32_t SDMMC_INIT_CLOCK_HZ = 400000;
+constexpr uint32_t SDMMC_TRANSFER_CLOCK_HZ = 24000000;
+/// 250 ms (the SDHC write timeout), in SDMMC_CK cycles
+constexpr uint32_t SDMMC_DATA_TIMEOUT = SDMMC_TRANSFER_CLOCK_HZ / 4;
+/// DCTRL.DBLOCKSIZE: 2^9 = 512 bytes
+constexpr uint32_t BLOCK_SIZE_CODE = 9;
+
+/// ACMD41 attempts before the card is considered missing (about 1 s at 400 kHz)
+constexpr unsigned OP_COND_RETRIES = 2000;
+/// CMD13 attempts while waiting for the card to return to the transfer state
+constexpr unsigned STATUS_RETRIES = 10000;
+/// At least 74 clock cycles at 400 kHz, and at least 1 ms for the card supply to ramp up
+constexpr uint32_t POWER_UP_DELAY_LOOPS = 120000;
+
+/// The largest IDMA buffer in double-buffer mode, in blocks
+constexpr size_t IDMA_MAX_BUFFER_BLOCKS = SDMMC_IDMABSIZE_IDMABNDT_Msk / STM32SDMMC::BLOCK_SIZE;
+/// The largest data transfer, in blocks
+constexpr size_t MAX_RUN_BLOCKS = SDMMC_DLEN_DATALENGTH_Msk / STM32SDMMC::BLOCK_SIZE;
+
+static_assert(STM32SDMMC::MAX_REQUEST_BLOCKS <= MAX_RUN_BLOCKS,
+			  "A request must fit in a single data transfer");
+
+constexpr uint32_t SDMMC_COMMAND_FLAGS =
+	SDMMC_STA_CCRCFAIL | SDMMC_STA_CTIMEOUT | SDMMC_STA_CMDREND | SDMMC_STA_CMDSENT;
+constexpr uint32_t SDMMC_COMMAND_ERRORS = SDMMC_STA_CCRCFAIL | SDMMC_STA_CTIMEOUT;
+constexpr uint32_t SDMMC_DATA_ERRORS = SDMMC_STA_DCRCFAIL | SDMMC_STA_DTIMEOUT |
+									   SDMMC_STA_TXUNDERR | SDMMC_STA_RXOVERR | SDMMC_STA_IDMATE;
+constexpr uint32_t SDMMC_STATIC_FLAGS =
+	SDMMC_COMMAND_FLAGS | SDMMC_DATA_ERRORS | SDMMC_STA_DATAEND | SDMMC_STA_DBCKEND |
+	SDMMC_STA_DHOLD | SDMMC_STA_DABORT | SDMMC_STA_BUSYD0END | SDMMC_STA_IDMABTC;
+
+#pragma mark - Variables -
+
+static STM32SDMMC_cb_t sdmmc_callback = nullptr;
+
+#pragma mark - Helpers -
+
+static constexpr uint32_t clock_divider(uint32_t hz)
+{
+	return (SDMMC_KERNEL_CLOCK_HZ + (2 * hz) - 1) / (2 * hz);
+}
+
+static void power_up_delay()
+{
+	for(volatile uint32_t i = 0; i < POWER_UP_DELAY_LOOPS; i++)
+	{
+	}
+}
+
+/** Send a command, and wait for the response.
+ *
+ * @returns true if the command was sent and (if expected) a response was received.
+ */
+static bool send_command(uint32_t index, uint32_t argument, uint32_t response,
+						 uint32_t flags = 0)
+{
+	uint32_t done = (response == RESPONSE_NONE) ? SDMMC_STA_CMDSENT
+												: (SDMMC_STA_CMDREND | SDMMC_COMMAND_ERRORS);
+	uint32_t sta;
+
+	WRITE_REG(SDMMC1->ICR, SDMMC_COMMAND_FLAGS);
+	WRITE_REG(SDMMC1->ARG, argument);
+	WRITE_REG(SDMMC1->CMD, index | response | flags | SDMMC_CMD_CPSMEN);
+
+	// The command path times out after 64 clock cycles without a response
+	while(((sta = READ_REG(SDMMC1->STA)) & done) == 0)
+	{
+	}
+
+	WRITE_REG(SDMMC1->ICR, SDMMC_COMMAND_FLAGS);
+
+	return (sta & SDMMC_COMMAND_ERRORS) == 0;
+}
+
+static uint32_t card_state(uint32_t r1)
+{
+	return (r1 & R1_CURRENT_STATE_Msk) >> R1_CURRENT_STATE_Pos;
+}
+
+/// Compute the card capacity in blocks from the CSD register (RESP1-RESP4 hold bits 127:1)
+static uint32_t csd_block_count(uint32_t csd0, uint32_t csd1, uint32_t csd2)
+{
+	if((csd0 >> 30) == 1)
+	{
+		// CSD version 2.0 (SDHC/SDXC): C_SIZE is bits 69:48, in units of 512 KiB
+		uint32_t c_size = ((csd1 & 0x3F) << 16) | (csd2 >> 16);
+		return (c_size + 1) * 1024;
+	}
+
+	// CSD version 1.0 (SDSC): READ_BL_LEN is bits 83:80, C_SIZE 73:62, C_SIZE_MULT 49:47
+	uint32_t read_bl_len = (csd1 >> 16) & 0xF;
+	uint32_t c_size = ((csd1 & 0x3FF) << 2) | (csd2 >> 30);
+	uint32_t c_size_mult = (csd2 >> 15) & 0x7;
+	uint32_t blocks = (c_size + 1) << (c_size_mult + 2);
+
+	return (blocks << read_bl_len) / STM32SDMMC::BLOCK_SIZE;
+}
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void SDMMC1_IRQHandler(void);
+
+void SDMMC1_IRQHandler()
+{
+	// Only report the flags whose interrupts are enabled
+	auto flags = READ_REG(SDMMC1->STA) & READ_REG(SDMMC1->MASK);
+	WRITE_REG(SDMMC1->ICR, flags);
+
+	if(sdmmc_callback && flags)
+	{
+		sdmmc_callback(flags);
+	}
+}
+
+#pragma mark - Driver APIs -
+
+void STM32SDMMC::start_() noexcept
+{
+	assert(pins_); // Pins must be configured with configurePins()
+
+	for(size_t i = 0; i < pin_count_; i++)
+	{
+		STM32GPIOTranslator::configure_alternate(pins_[i].port, pins_[i].pin, pins_[i].af);
+	}
+
+	STM32ClockControl::sdmmcEnable();
+
+	WRITE_REG(SDMMC1->MASK, 0);
+	WRITE_REG(SDMMC1->ICR, SDMMC_STATIC_FLAGS);
+	WRITE_REG(SDMMC1->CLKCR, clock_divider(SDMMC_INIT_CLOCK_HZ));
+	// PWRCTRL = 0b11: power on, the card is clocked
+	WRITE_REG(SDMMC1->POWER, SDMMC_POWER_PWRCTRL);
+
+	sdmmc_callback = [this](uint32_t flags) { interruptHandler(flags); };
+
+	// The ISR completes requests, so it must be compatible with the RTOS (if used)
+	NVICControl::priority(SDMMC1_IRQn, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(SDMMC1_IRQn);
+}
+
+void STM32SDMMC::stop_() noexcept
+{
+	NVICControl::disable(SDMMC1_IRQn);
+	WRITE_REG(SDMMC1->MASK, 0);
+	WRITE_REG(SDMMC1->IDMACTRL, 0);
+	WRITE_REG(SDMMC1->POWER, 0);
+
+	{
+		STM32InterruptLock lock;
+		queue_.clear();
+		active_ = false;
+		state_ = run_state::idle;
+		run_length_ = 0;
+	}
+
+	card_ready_ = false;
+	sdmmc_callback = nullptr;
+
+	STM32ClockControl::sdmmcDisable();
+
+	for(size_t i = 0; i < pin_count_; i++)
+	{
+		STM32GPIOTranslator::configure_default(pins_[i].port, pins_[i].pin);
+	}
+}
+
+STM32SDMMC::status STM32SDMMC::initializeCard() noexcept
+{
+	assert(started());
+	assert(!active_);
+
+	card_ready_ = false;
+
+	// Identification runs at 400 kHz on a 1-bit bus
+	WRITE_REG(SDMMC1->CLKCR, clock_divider(SDMMC_INIT_CLOCK_HZ));
+	power_up_delay();
+
+	send_command(CMD_GO_IDLE_STATE, 0, RESPONSE_NONE);
+
+	// Version 1 cards do not respond to CMD8
+	bool version2 = send_command(CMD_SEND_IF_COND, SEND_IF_COND_ARGUMENT, RESPONSE_SHORT);
+	if(version2 && ((READ_REG(SDMMC1->RESP1) & 0xFFF) != SEND_IF_COND_ARGUMENT))
+	{
+		return status::no_card;
+	}
+
+	uint32_t ocr = 0;
+	uint32_t op_cond = OCR_VOLTAGE_WINDOW | (version2 ? OCR_HIGH_CAPACITY : 0);
+
+	for(unsigned i = 0; i < OP_COND_RETRIES && !(ocr & OCR_POWER_UP_DONE); i++)
+	{
+		if(!send_command(CMD_APP_CMD, 0, RESPONSE_SHORT) ||
+		   !send_command(ACMD_SD_SEND_OP_COND, op_cond, RESPONSE_SHORT_NO_CRC))
+		{
+			return status::no_card;
+		}
+
+		ocr = READ_REG(SDMMC1->RESP1);
+	}
+
+	if(!(ocr & OCR_POWER_UP_DONE))
+	{
+		return status::no_card;
+	}
+
+	high_capacity_ = (ocr & OCR_HIGH_CAPACITY) != 0;
+
+	if(!send_command(CMD_ALL_SEND_CID, 0, RESPONSE_LONG) ||
+	   !send_command(CMD_SEND_RELATIVE_ADDR, 0, RESPONSE_SHORT))
+	{
+		return status::no_card;
+	}
+
+	rca_ = READ_REG(SDMMC1->RESP1) & 0xFFFF0000;
+
+	if(!send_command(CMD_SEND_CSD, rca_, RESPONSE_LONG))
+	{
+		return status::no_card;
+	}
+
+	block_count_ = csd_block_count(READ_REG(SDMMC1->RESP1), READ_REG(SDMMC1->RESP2),
+								   READ_REG(SDMMC1->RESP3));
+
+	if(!send_command(CMD_SELECT_CARD, rca_, RESPONSE_SHORT) ||
+	   !send_command(CMD_APP_CMD, rca_, RESPONSE_SHORT) ||
+	   !send_command(ACMD_SET_BUS_WIDTH, BUS_WIDTH_4, RESPONSE_SHORT))
+	{
+		return status::no_card;
+	}
+
+	// SDHC/SDXC cards always use 512-byte blocks
+	if(!high_capacity_ && !send_command(CMD_SET_BLOCKLEN, BLOCK_SIZE, RESPONSE_SHORT))
+	{
+		return status::no_card;
+	}
+
+	// Hardware flow control stops the clock instead of overrunning the FIFO
+	WRITE_REG(SDMMC1->CLKCR, clock_divider(SDMMC_TRANSFER_CLOCK_HZ) | SDMMC_CLKCR_WIDBUS_0 |
+								 SDMMC_CLKCR_HWFC_EN);
+
+	card_ready_ = true;
+	return status::ok;
+}
+
+STM32SDMMC::status STM32SDMMC::read(uint32_t block, void* buffer, size_t count,
+									const cb_t& cb) noexcept
+{
+	return enqueue({request_type::read, block, buffer, count}, cb);
+}
+
+STM32SDMMC::status STM32SDMMC::write(uint32_t block, const void* buffer, size_t count,
+									 const cb_t& cb) noexcept
+{
+	// The buffer is only read by the IDMA
+	return enqueue({request_type::write, block, const_cast<void*>(buffer), count}, cb);
+}
+
+STM32SDMMC::status STM32SDMMC::read(uint32_t block, void* buffer, size_t count) noexcept
+{
+	return enqueueAndWait({request_type::read, block, buffer, count});
+}
+
+STM32SDMMC::status STM32SDMMC::write(uint32_t block, const void* buffer, size_t count) noexcept
+{
+	return enqueueAndWait({request_type::write, block, const_cast<void*>(buffer), count});
+}
+
+#pragma mark - Transfers -
+
+STM32SDMMC::status STM32SDMMC::enqueue(const request_t& request, const cb_t& cb) noexcept
+{
+	assert(card_ready_); // initializeCard() must succeed first
+	assert(request.buffer && (reinterpret_cast<uintptr_t>(request.buffer) & 0x3) == 0);
+	assert(request.count > 0 && request.count <= MAX_REQUEST_BLOCKS);
+
+	STM32InterruptLock lock;
+
+	if(!queue_.push({request, cb}))
+	{
+		return status::busy;
+	}
+
+	if(!active_)
+	{
+		active_ = true;
+		startNextRun();
+	}
+
+	return status::enqueued;
+}
+
+// When built with RTOS support, the calling task is blocked (not spinning) until the ISR
+// signals that the request is complete. Requests from several tasks can be queued at once,
+// so each caller waits on its own completion.
+STM32SDMMC::status STM32SDMMC::enqueueAndWait(const request_t& request) noexcept
+{
+	STM32Completion completion;
+	volatile status result = status::ok;
+
+	completion.arm();
+
+	auto r = enqueue(request, [&completion, &result](const request_t&, status s) {
+		result = s;
+		completion.signal();
+	});
+
+	if(r != status::enqueued)
+	{
+		return r;
+	}
+
+	completion.wait();
+	return result;
+}
+
+// Called with interrupts masked, or from the SDMMC ISR
+void STM32SDMMC::startNextRun() noexcept
+{
+	const auto& first = queue_.front().request;
+
+	// The IDMA buffers must all be the same size, so use the largest size that divides the
+	// first request. Following requests are merged if they continue where the previous one
+	// ended, and can be split into buffers of the same size.
+	size_t buffer_blocks = std::min(first.count, IDMA_MAX_BUFFER_BLOCKS);
+	while(first.count % buffer_blocks)
+	{
+		buffer_blocks--;
+	}
+
+	size_t run_blocks = first.count;
+	run_length_ = 1;
+
+	while(run_length_ < queue_.size())
+	{
+		const auto& previous = queue_[run_length_ - 1].request;
+		const auto& next = queue_[run_length_].request;
+
+		if(next.type != first.type || next.block != previous.block + previous.count ||
+		   (next.count % buffer_blocks) != 0 || run_blocks + next.count > MAX_RUN_BLOCKS)
+		{
+			break;
+		}
+
+		run_blocks += next.count;
+		run_length_++;
+	}
+
+	run_write_ = (first.type == request_type::write);
+	double_buffer_ = (run_length_ > 1);
+	buffer_size_ = (double_buffer_ ? buffer_blocks : run_blocks) * BLOCK_SIZE;
+	done_offset_ = 0;
+	program_index_ = 0;
+	program_offset_ = 0;
+	program_base_ = 0;
+
+	WRITE_REG(SDMMC1->ICR, SDMMC_STATIC_FLAGS);
+	WRITE_REG(SDMMC1->DTIMER, SDMMC_DATA_TIMEOUT);
+	WRITE_REG(SDMMC1->DLEN, run_blocks * BLOCK_SIZE);
+	WRITE_REG(SDMMC1->DCTRL, (BLOCK_SIZE_CODE << SDMMC_DCTRL_DBLOCKSIZE_Pos) |
+								 (run_write_ ? 0 : SDMMC_DCTRL_DTDIR));
+
+	uint32_t mask = SDMMC_COMMAND_ERRORS | SDMMC_DATA_ERRORS | SDMMC_STA_CMDREND |
+					SDMMC_STA_DATAEND | SDMMC_STA_BUSYD0END;
+
+	if(double_buffer_)
+	{
+		WRITE_REG(SDMMC1->IDMABSIZE, buffer_size_);
+		WRITE_REG(SDMMC1->IDMABASE0, nextBuffer());
+		WRITE_REG(SDMMC1->IDMABASE1, nextBuffer());
+		WRITE_REG(SDMMC1->IDMACTRL, SDMMC_IDMA_IDMAEN | SDMMC_IDMA_IDMABMODE);
+		mask |= SDMMC_STA_IDMABTC;
+	}
+	else
+	{
+		WRITE_REG(SDMMC1->IDMABASE0, nextBuffer());
+		WRITE_REG(SDMMC1->IDMACTRL, SDMMC_IDMA_IDMAEN);
+	}
+
+	WRITE_REG(SDMMC1->MASK, mask);
+	state_ = run_state::transfer;
+
+	WRITE_REG(SDMMC1->ARG, high_capacity_ ? first.block : first.block * BLOCK_SIZE);
+	WRITE_REG(SDMMC1->CMD, (run_write_ ? CMD_WRITE_MULTIPLE_BLOCK : CMD_READ_MULTIPLE_BLOCK) |
+							   RESPONSE_SHORT | SDMMC_CMD_CMDTRANS | SDMMC_CMD_CPSMEN);
+}
+
+uint32_t STM32SDMMC::nextBuffer() noexcept
+{
+	if(program_index_ >= run_length_)
+	{
+		return 0;
+	}
+
+	const auto& r = queue_[program_index_].request;
+	auto address = reinterpret_cast<uintptr_t>(r.buffer) + program_offset_;
+
+	program_offset_ += buffer_size_;
+	if(program_offset_ == r.count * BLOCK_SIZE)
+	{
+		program_index_++;
+		program_offset_ = 0;
+	}
+
+	return static_cast<uint32_t>(address);
+}
+
+// Called from the SDMMC ISR
+void STM32SDMMC::bufferComplete() noexcept
+{
+	// The IDMA has moved on to the other buffer, so the completed one is reused first
+	auto next = nextBuffer();
+	if(next)
+	{
+		if(program_base_ == 0)
+		{
+			WRITE_REG(SDMMC1->IDMABASE0, next);
+		}
+		else
+		{
+			WRITE_REG(SDMMC1->IDMABASE1, next);
+		}
+	}
+
+	program_base_ ^= 1;
+	done_offset_ += buffer_size_;
+
+	// The last request of the run completes once the card has accepted the stop command
+	if(run_length_ > 1 && done_offset_ == queue_.front().request.count * BLOCK_SIZE)
+	{
+		done_offset_ = 0;
+		requestComplete(status::ok);
+	}
+}
+
+void STM32SDMMC::requestComplete(status s) noexcept
+{
+	queued_request_t completed;
+
+	{
+		STM32InterruptLock lock;
+
+		completed = std::move(queue_.front());
+		queue_.pop();
+		run_length_--;
+
+		if(program_index_)
+		{
+			program_index_--;
+		}
+	}
+
+	if(s == status::ok)
+	{
+		bytes_transferred_ += completed.request.count * BLOCK_SIZE;
+	}
+
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(completed.cb)
+	{
+		completed.cb(completed.request, s);
+	}
+}
+
+void STM32SDMMC::runComplete(status s) noexcept
+{
+	while(run_length_ > 1)
+	{
+		requestComplete(s);
+	}
+
+	queued_request_t completed;
+
+	{
+		STM32InterruptLock lock;
+
+		WRITE_REG(SDMMC1->MASK, 0);
+		WRITE_REG(SDMMC1->IDMACTRL, 0);
+		state_ = run_state::idle;
+
+		completed = std::move(queue_.front());
+		queue_.pop();
+		run_length_ = 0;
+
+		// Start the next run before running the callback to keep the bus busy
+		if(queue_.empty())
+		{
+			active_ = false;
+		}
+		else
+		{
+			startNextRun();
+		}
+	}
+
+	if(s == status::ok)
+	{
+		bytes_transferred_ += completed.request.count * BLOCK_SIZE;
+	}
+
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(completed.cb)
+	{
+		completed.cb(completed.request, s);
+	}
+}
+
+// Called from the SDMMC ISR
+void STM32SDMMC::recover() noexcept
+{
+	WRITE_REG(SDMMC1->MASK, 0);
+	WRITE_REG(SDMMC1->IDMACTRL, 0);
+
+	// CMDSTOP aborts the data path
+	send_command(CMD_STOP_TRANSMISSION, 0, RESPONSE_SHORT, SDMMC_CMD_CMDSTOP);
+
+	while(READ_BIT(SDMMC1->STA, SDMMC_STA_DPSMACT))
+	{
+	}
+
+	WRITE_REG(SDMMC1->DCTRL, SDMMC_DCTRL_FIFORST);
+	WRITE_REG(SDMMC1->DCTRL, 0);
+
+	// A card which was receiving data must finish programming before the next command
+	for(unsigned i = 0; i < STATUS_RETRIES; i++)
+	{
+		if(send_command(CMD_SEND_STATUS, rca_, RESPONSE_SHORT) &&
+		   card_state(READ_REG(SDMMC1->RESP1)) == CARD_STATE_TRANSFER)
+		{
+			break;
+		}
+	}
+
+	WRITE_REG(SDMMC1->ICR, SDMMC_STATIC_FLAGS);
+}
+
+// Called from the SDMMC ISR
+void STM32SDMMC::interruptHandler(uint32_t flags) noexcept
+{
+	if(state_ == run_state::idle)
+	{
+		return;
+	}
+
+	if(flags & (SDMMC_COMMAND_ERRORS | SDMMC_DATA_ERRORS))
+	{
+		recover();
+		runComplete(status::error);
+		return;
+	}
+
+	switch(state_)
+	{
+		case run_state::transfer:
+			// Errors such as an address beyond the card are reported in the R1 response
+			if((flags & SDMMC_STA_CMDREND) && (READ_REG(SDMMC1->RESP1) & R1_ERRORS))
+			{
+				recover();
+				runComplete(status::error);
+				return;
+			}
+
+			if(flags & SDMMC_STA_IDMABTC)
+			{
+				bufferComplete();
+			}
+
+			if(flags & SDMMC_STA_DATAEND)
+			{
+				WRITE_REG(SDMMC1->IDMACTRL, 0);
+				state_ = run_state::stopping;
+				WRITE_REG(SDMMC1->ARG, 0);
+				WRITE_REG(SDMMC1->CMD, CMD_STOP_TRANSMISSION | RESPONSE_SHORT |
+										   SDMMC_CMD_CMDSTOP | SDMMC_CMD_CPSMEN);
+			}
+			break;
+		case run_state::stopping:
+			if(flags & SDMMC_STA_CMDREND)
+			{
+				if(run_write_ && !(flags & SDMMC_STA_BUSYD0END) &&
+				   READ_BIT(SDMMC1->STA, SDMMC_STA_BUSYD0))
+				{
+					state_ = run_state::programming;
+				}
+				else
+				{
+					runComplete(status::ok);
+				}
+			}
+			break;
+		case run_state::programming:
+			if(flags & SDMMC_STA_BUSYD0END)
+			{
+				runComplete(status::ok);
+			}
+			break;
+		default:
+			break;
+	}
+}
@@ -0,0 +1,283 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_SDMMC_HPP_
+#define STM32_SDMMC_HPP_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <driver/driver.hpp>
+#include <driver/gpio.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <static_queue.hpp>
+
+// TODO: Handle interrupt priority - as a constructor parameter
+// TODO: support eMMC and SDIO cards, and high speed (50 MHz) mode
+
+/** STM32L4+ SDMMC driver for SD memory cards.
+ *
+ * The card is used as a block device with 512-byte blocks. Data is moved by the SDMMC's
+ * internal DMA (IDMA), over a 4-bit bus clocked at 24 MHz.
+ *
+ * Reads and writes are queued, and the driver streams them to the card:
+ *
+ *	- Queued requests in the same direction, for consecutive blocks, are merged into a run
+ *		which is sent to the card as a single multi-block command. The card only has to
+ *		process one command (and, for writes, one final busy period) for the whole run.
+ *	- Within a run, the IDMA works in double-buffer mode: while one buffer is transferred,
+ *		the driver points the other buffer register at the next part of the run. Each
+ *		request's callback is invoked as soon as its data has been transferred, so the
+ *		buffer can be refilled and queued again while the rest of the run continues.
+ *
+ * For example, a data logger can keep the bus busy with two (or more) buffers:
+ *
+ * @code
+ * void bufferDone(const STM32SDMMC::request_t& r, STM32SDMMC::status s)
+ * {
+ *	// r.buffer can be refilled, and queued again at the next block
+ * }
+ *
+ * sd.write(next_block, buffer_a, 16, bufferDone);
+ * next_block += 16;
+ * sd.write(next_block, buffer_b, 16, bufferDone);
+ * next_block += 16;
+ * @endcode
+ *
+ * Merged requests must have sizes that can be split into equal IDMA buffers (at most 8 KiB
+ * each), so the simplest approach is to use the same size for every request.
+ *
+ * The card must be identified with initializeCard() before it can be used. Identification
+ * is polled, and takes up to a second.
+ *
+ * Pins depend on the board design, so they are supplied with configurePins(). The GPIO bank
+ * clocks must be enabled in the hardware platform. The SDMMC clock is managed by this driver,
+ * and the SDMMC kernel clock is the 48 MHz clock (CLK48).
+ */
+class STM32SDMMC final : public embvm::DriverBase
+{
+  public:
+	enum class status : uint8_t
+	{
+		/// The request completed successfully
+		ok = 0,
+		/// The request was added to the queue
+		enqueued,
+		/// The request queue is full
+		busy,
+		/// The request failed (e.g., a CRC error, a timeout, or an address beyond the card)
+		error,
+		/// No supported card responded during identification
+		no_card,
+	};
+
+	enum class request_type : uint8_t
+	{
+		read = 0,
+		write,
+	};
+
+	/// Describes a single block transfer
+	struct request_t
+	{
+		request_type type = request_type::read;
+		/// The first block to transfer
+		uint32_t block = 0;
+		/// The data to write, or the buffer for read data. Must be word aligned.
+		void* buffer = nullptr;
+		/// Number of blocks to transfer
+		size_t count = 0;
+	};
+
+	/// Request callback. This is invoked from an interrupt context.
+	using cb_t = stdext::inplace_function<void(const request_t&, status)>;
+
+	/// An SDMMC pin (CK, CMD, or D0-D3)
+	struct pin_t
+	{
+		embvm::gpio::port port;
+		uint8_t pin;
+		/// Alternate function number which connects the pin to the SDMMC
+		uint8_t af;
+	};
+
+	/// Size of a block, in bytes
+	static constexpr size_t BLOCK_SIZE = 512;
+
+	/// Maximum number of requests which can be queued.
+	static constexpr size_t QUEUE_DEPTH = 8;
+
+	/// Maximum number of blocks in a request (limited by the data length register).
+	static constexpr size_t MAX_REQUEST_BLOCKS = 65535;
+
+  public:
+	STM32SDMMC() noexcept : embvm::DriverBase(embvm::DriverType::Undefined) {}
+	~STM32SDMMC() noexcept = default;
+
+	/** Set the pins used by the interface.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] pins The CK, CMD, and D0-D3 pins. The array must remain valid while the
+	 *	driver is in use.
+	 * @param [in] count The number of pins.
+	 */
+	void configurePins(const pin_t* pins, size_t count) noexcept
+	{
+		assert(started() == false);
+		assert(pins && count);
+		pins_ = pins;
+		pin_count_ = count;
+	}
+
+	/** Identify the card, and switch to the 4-bit bus at the transfer clock rate.
+	 *
+	 * This must be called again after the card is replaced.
+	 *
+	 * @precondition The driver is started, and no requests are queued.
+	 * @returns status::ok if the card is ready, or status::no_card.
+	 */
+	status initializeCard() noexcept;
+
+	/// Check whether a card was identified with initializeCard().
+	bool cardReady() const noexcept
+	{
+		return card_ready_;
+	}
+
+	/// The capacity of the card, in blocks.
+	uint32_t blockCount() const noexcept
+	{
+		return block_count_;
+	}
+
+	/** Queue an asynchronous read.
+	 *
+	 * @precondition cardReady() is true.
+	 * @precondition 0 < count <= MAX_REQUEST_BLOCKS, and buffer is word aligned.
+	 *
+	 * @param [in] block The first block to read.
+	 * @param [in] buffer The buffer for the data. It must remain valid until the callback is
+	 *	invoked.
+	 * @param [in] count The number of blocks to read.
+	 * @param [in] cb Callback invoked (in interrupt context) when the request completes.
+	 * @returns status::enqueued if the request was queued, status::busy if the queue is full.
+	 */
+	status read(uint32_t block, void* buffer, size_t count, const cb_t& cb) noexcept;
+
+	/** Queue an asynchronous write.
+	 *
+	 * @precondition cardReady() is true.
+	 * @precondition 0 < count <= MAX_REQUEST_BLOCKS, and buffer is word aligned.
+	 *
+	 * @param [in] block The first block to write.
+	 * @param [in] buffer The data to write. It must remain valid until the callback is invoked.
+	 * @param [in] count The number of blocks to write.
+	 * @param [in] cb Callback invoked (in interrupt context) when the request completes.
+	 * @returns status::enqueued if the request was queued, status::busy if the queue is full.
+	 */
+	status write(uint32_t block, const void* buffer, size_t count, const cb_t& cb) noexcept;
+
+	/** Perform a blocking read.
+	 *
+	 * The request is queued behind any pending requests. When built with RTOS support, the
+	 * calling task is blocked (not spinning) until the request completes.
+	 *
+	 * @precondition This is not called from an interrupt context.
+	 * @returns The request result, or status::busy if the queue is full.
+	 */
+	status read(uint32_t block, void* buffer, size_t count) noexcept;
+
+	/** Perform a blocking write.
+	 *
+	 * The request is queued behind any pending requests. It completes once the card has
+	 * finished programming the data.
+	 *
+	 * @precondition This is not called from an interrupt context.
+	 * @returns The request result, or status::busy if the queue is full.
+	 */
+	status write(uint32_t block, const void* buffer, size_t count) noexcept;
+
+	/// Check whether a request is in progress.
+	bool busy() const noexcept
+	{
+		return active_;
+	}
+
+	/// The number of bytes transferred by successful requests
+	uint64_t bytesTransferred() const noexcept
+	{
+		return bytes_transferred_;
+	}
+
+  private:
+	/// Progress of the active run
+	enum class run_state : uint8_t
+	{
+		idle = 0,
+		/// The data is being transferred
+		transfer,
+		/// Waiting for the stop command response
+		stopping,
+		/// Waiting for the card to finish programming (writes)
+		programming,
+	};
+
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	status enqueue(const request_t& request, const cb_t& cb) noexcept;
+	/// Queue a request and block until it completes
+	status enqueueAndWait(const request_t& request) noexcept;
+	/// Merge the requests at the front of the queue into a run, and start it
+	void startNextRun() noexcept;
+	/// Return the address of the next IDMA buffer in the run, or 0 if the run is fully
+	/// programmed
+	uint32_t nextBuffer() noexcept;
+	/// An IDMA buffer was transferred (double-buffer mode)
+	void bufferComplete() noexcept;
+	/// Complete the request at the front of the queue
+	void requestComplete(status s) noexcept;
+	/// Complete the remaining requests in the run and start the next run
+	void runComplete(status s) noexcept;
+	/// Stop the transfer and return the card to the transfer state after an error
+	void recover() noexcept;
+	void interruptHandler(uint32_t flags) noexcept;
+
+  private:
+	struct queued_request_t
+	{
+		request_t request;
+		cb_t cb;
+	};
+
+	const pin_t* pins_ = nullptr;
+	size_t pin_count_ = 0;
+
+	bool card_ready_ = false;
+	/// SDHC/SDXC cards are addressed in blocks, SDSC cards in bytes
+	bool high_capacity_ = false;
+	/// Relative card address, shifted into the command argument position
+	uint32_t rca_ = 0;
+	uint32_t block_count_ = 0;
+
+	StaticQueue<queued_request_t, QUEUE_DEPTH> queue_;
+	volatile bool active_ = false;
+	run_state state_ = run_state::idle;
+	/// Number of requests in the active run which have not completed
+	size_t run_length_ = 0;
+	bool run_write_ = false;
+	bool double_buffer_ = false;
+	/// Size of each IDMA buffer in the run, in bytes
+	size_t buffer_size_ = 0;
+	/// Bytes of the front request which have been transferred
+	size_t done_offset_ = 0;
+	/// Queue position and offset of the next part of the run to give to the IDMA
+	size_t program_index_ = 0;
+	size_t program_offset_ = 0;
+	/// The IDMA buffer register (0 or 1) which is programmed next
+	uint8_t program_base_ = 0;
+	volatile uint64_t bytes_transferred_ = 0;
+};
+
+#endif // STM32_SDMMC_HPP_
@@ -0,0 +1,104 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_SECTIONS_HPP_
+#define STM32_SECTIONS_HPP_
+
+/** @file stm32_sections.hpp
+ *
+ * Attribute macros for placing code and data into the named linker script sections.
+ *
+ * The section names must match those provided by the platform linker script
+ * (e.g., blinky_gcc_nucleo_l4rzi.ld). If a platform linker script does not provide
+ * a section, the input section will be placed wherever the default rules put it.
+ */
+
+/** Place a function in SRAM.
+ *
+ * Functions marked with this attribute are linked into the `.ramfunc` section, which
+ * is loaded from flash and copied into SRAM by the startup code (see Reset_Handler).
+ * Code executed from SRAM does not incur flash wait states when the ART cache misses,
+ * which gives us deterministic timing for interrupt handlers and driver fast paths.
+ *
+ * The function is marked `noinline` so that it is not folded back into a caller that
+ * lives in flash.
+ *
+ * @code
+ * STM32_RAMFUNC static void dma_handler(STM32DMA::device dev, STM32DMA::channel ch);
+ * @endcode
+ *
+ * @note Calls from SRAM into flash (and vice versa) exceed the range of a Thumb BL
+ * instruction. The linker automatically inserts long-branch veneers for these calls.
+ */
+#define STM32_RAMFUNC __attribute__((section(".ramfunc"), noinline))
+
+/** Place an object in the SRAM vector table section.
+ *
+ * This section is only used when the vector table is relocated to SRAM.
+ * @see stm32l4r5::installInterruptHandler()
+ */
+#define STM32_RAM_VECTOR_TABLE __attribute__((section(".ram_vector_table"), aligned(512)))
+
+/** Place a DMA transfer buffer in a dedicated SRAM bank.
+ *
+ * The `.dma_buffers` section lives in an SRAM bank that the CPU does not use for its
+ * stack and general data, which reduces bus matrix contention between the CPU and the
+ * DMA controllers. Buffers are aligned to 4 bytes so that word-sized DMA transfers are
+ * possible.
+ *
+ * The section is not zeroed at startup. Objects must be initialized before use.
+ *
+ * @code
+ * STM32_DMA_BUFFER static uint8_t i2c_rx_buffer[256];
+ * @endcode
+ */
+#define STM32_DMA_BUFFER __attribute__((section(".dma_buffers"), aligned(4)))
+
+/** Place an object in SRAM2, which is retained in Standby mode.
+ *
+ * The `.sram2_retained` section is neither loaded nor zeroed at startup, so its contents
+ * persist across resets. SRAM2 has hardware parity, so the contents must be written
+ * before they are read after a cold boot.
+ */
+#define STM32_SRAM2_RETAINED __attribute__((section(".sram2_retained")))
+
+/** Place a large, infrequently used object in SRAM3.
+ *
+ * The `.sram3_bulk` section is not zeroed at startup.
+ */
+#define STM32_SRAM3_BULK __attribute__((section(".sram3_bulk")))
+
+/** Place a function in external flash, to be executed in place through the OCTOSPI.
+ *
+ * Functions in the `.ext_flash` section can only be called once the OCTOSPI attached to the
+ * flash is in memory-mapped mode. Each cache miss is a read command on the external bus, so
+ * this is best suited to large, infrequently executed code (e.g., UI screens or self tests).
+ *
+ * Like STM32_RAMFUNC, the function is marked `noinline`, and calls to and from internal flash
+ * go through long-branch veneers.
+ *
+ * @code
+ * STM32_EXT_FLASH_FUNC void run_self_test();
+ * @endcode
+ */
+#define STM32_EXT_FLASH_FUNC __attribute__((section(".ext_flash.text"), noinline))
+
+/** Place read-only data (e.g., fonts, images, or lookup tables) in external flash.
+ *
+ * The object must be const. It can only be read once the OCTOSPI attached to the flash is
+ * in memory-mapped mode.
+ *
+ * @code
+ * STM32_EXT_FLASH_DATA const uint8_t splash_image[] = {...};
+ * @endcode
+ */
+#define STM32_EXT_FLASH_DATA __attribute__((section(".ext_flash.rodata")))
+
+/** Place a large object in external PSRAM.
+ *
+ * The `.psram` section is not zeroed at startup, and it can only be accessed once the
+ * OCTOSPI attached to the PSRAM is in memory-mapped mode.
+ */
+#define STM32_PSRAM __attribute__((section(".psram")))
+
+#endif // STM32_SECTIONS_HPP_
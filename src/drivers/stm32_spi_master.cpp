@@ -0,0 +1,495 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_spi_master.hpp"
+#include <array>
+#include <cassert>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_gpio.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+#include <stm32l4xx_ll_gpio.h> // TODO: break dependency
+#include <stm32l4xx_ll_spi.h>
+
+/* Useful Developer Notes
+ *
+ * Full-duplex DMA sequence (RM0432, "Communication using DMA"):
+ *   1. Enable the RX DMA request (RXDMAEN)
+ *   2. Enable the DMA channels
+ *   3. Enable the TX DMA request (TXDMAEN)
+ *   4. Enable the SPI (SPE)
+ *
+ * The RX channel completes after the final frame has been clocked in, so its transfer
+ * complete interrupt marks the end of the transaction. The TX FIFO is drained and BSY is
+ * cleared before SPE is disabled.
+ *
+ * The data size (DS) and FIFO threshold (FRXTH) must be configured while SPE = 0, so the
+ * SPI is disabled between transactions. FRXTH must match the frame size, otherwise RXNE
+ * (and the RX DMA request) is only raised every other 8-bit frame.
+ */
+
+#pragma mark - Definitions -
+
+using STM32SPI_cb_t = stdext::inplace_function<void(STM32SPIMaster::status)>;
+
+#pragma mark - Types and Declarations -
+
+struct STM32_SPI_Pins_t
+{
+	embvm::gpio::port sck_port;
+	uint8_t sck_pin;
+	embvm::gpio::port miso_port;
+	uint8_t miso_pin;
+	embvm::gpio::port mosi_port;
+	uint8_t mosi_pin;
+	uint8_t alt_func;
+} __attribute__((packed));
+
+// TODO: how can we make this more configurable for users, since the pins will
+// really change based on the board design?
+// clang-format off
+constexpr std::array<STM32_SPI_Pins_t, 3> spi_pins =
+{
+  // SPI1 GPIO (Nucleo-144 Arduino header: D13, D12, D11)
+  STM32_SPI_Pins_t{
+    .sck_port = embvm::gpio::port::A,
+    .sck_pin = 5,
+    .miso_port = embvm::gpio::port::A,
+    .miso_pin = 6,
+    .mosi_port = embvm::gpio::port::A,
+    .mosi_pin = 7,
+    .alt_func = LL_GPIO_AF_5
+  },
+  // TODO: SPI2 GPIO - PB13/PB14/PB15 conflicts with LED3 on the Nucleo-144
+  STM32_SPI_Pins_t{
+    .sck_port = embvm::gpio::port::A,
+    .sck_pin = 0,
+    .miso_port = embvm::gpio::port::A,
+    .miso_pin = 0,
+    .mosi_port = embvm::gpio::port::A,
+    .mosi_pin = 0,
+    .alt_func = LL_GPIO_AF_0
+  },
+  // SPI3 GPIO
+  STM32_SPI_Pins_t{
+    .sck_port = embvm::gpio::port::C,
+    .sck_pin = 10,
+    .miso_port = embvm::gpio::port::C,
+    .miso_pin = 11,
+    .mosi_port = embvm::gpio::port::C,
+    .mosi_pin = 12,
+    .alt_func = LL_GPIO_AF_6
+  },
+};
+// clang-format on
+
+constexpr unsigned SPI_COUNT = STM32SPIMaster::device::NUM_SPI_DEVICES;
+
+constexpr std::array<SPI_TypeDef* const, SPI_COUNT> spi_instance = {SPI1, SPI2, SPI3};
+
+constexpr std::array<uint32_t, SPI_COUNT> dma_tx_routing = {
+	LL_DMAMUX_REQ_SPI1_TX, LL_DMAMUX_REQ_SPI2_TX, LL_DMAMUX_REQ_SPI3_TX};
+
+constexpr std::array<uint32_t, SPI_COUNT> dma_rx_routing = {
+	LL_DMAMUX_REQ_SPI1_RX, LL_DMAMUX_REQ_SPI2_RX, LL_DMAMUX_REQ_SPI3_RX};
+
+constexpr std::array<uint8_t, SPI_COUNT> spi_irq_num = {SPI1_IRQn, SPI2_IRQn, SPI3_IRQn};
+
+/// Baud rate prescalers, indexed by log2(divider) - 1
+constexpr std::array<uint32_t, 8> baud_prescaler = {
+	LL_SPI_BAUDRATEPRESCALER_DIV2,	LL_SPI_BAUDRATEPRESCALER_DIV4,
+	LL_SPI_BAUDRATEPRESCALER_DIV8,	LL_SPI_BAUDRATEPRESCALER_DIV16,
+	LL_SPI_BAUDRATEPRESCALER_DIV32, LL_SPI_BAUDRATEPRESCALER_DIV64,
+	LL_SPI_BAUDRATEPRESCALER_DIV128, LL_SPI_BAUDRATEPRESCALER_DIV256};
+
+static std::array<STM32SPI_cb_t, SPI_COUNT> spi_error_callbacks = {nullptr};
+
+/// Source for transmit-less transfers. Shared between devices since it is only read.
+static uint16_t spi_tx_fill = STM32SPIMaster::TX_FILL_VALUE;
+/// Destination for receive-less transfers. Shared between devices since it is never read.
+static uint16_t spi_rx_discard;
+
+#pragma mark - Helpers -
+
+/// Select the prescaler index for the fastest rate <= baud
+static size_t select_prescaler(uint32_t kernel_clock, uint32_t baud)
+{
+	size_t index = 0;
+	while((index < (baud_prescaler.size() - 1)) && ((kernel_clock >> (index + 1)) > baud))
+	{
+		index++;
+	}
+
+	return index;
+}
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void SPI1_IRQHandler(void);
+extern "C" void SPI2_IRQHandler(void);
+extern "C" void SPI3_IRQHandler(void);
+
+// Only error interrupts are enabled; data is moved by DMA
+static void spi_error_handler(STM32SPIMaster::device dev)
+{
+	auto inst = spi_instance[dev];
+	assert(inst); // invalid instance
+	auto cb = spi_error_callbacks[dev];
+
+	if(LL_SPI_IsActiveFlag_OVR(inst))
+	{
+		LL_SPI_ClearFlag_OVR(inst);
+	}
+
+	if(LL_SPI_IsActiveFlag_MODF(inst))
+	{
+		LL_SPI_ClearFlag_MODF(inst);
+	}
+
+	if(cb)
+	{
+		cb(STM32SPIMaster::status::error);
+	}
+}
+
+void SPI1_IRQHandler()
+{
+	spi_error_handler(STM32SPIMaster::device::spi1);
+}
+
+void SPI2_IRQHandler()
+{
+	spi_error_handler(STM32SPIMaster::device::spi2);
+}
+
+void SPI3_IRQHandler()
+{
+	spi_error_handler(STM32SPIMaster::device::spi3);
+}
+
+#pragma mark - Driver APIs -
+
+void STM32SPIMaster::start_() noexcept
+{
+	auto spi_inst = spi_instance[device_];
+	assert(spi_inst); // if failed, device is invalid
+
+	configure_spi_pins_();
+
+	STM32ClockControl::spiEnable(device_);
+
+	// Disable before modifying configuration registers
+	LL_SPI_Disable(spi_inst);
+
+	LL_SPI_InitTypeDef initializer = {
+		.TransferDirection = LL_SPI_FULL_DUPLEX,
+		.Mode = LL_SPI_MODE_MASTER,
+		.DataWidth = LL_SPI_DATAWIDTH_8BIT,
+		.ClockPolarity = LL_SPI_POLARITY_LOW,
+		.ClockPhase = LL_SPI_PHASE_1EDGE,
+		.NSS = LL_SPI_NSS_SOFT,
+		.BaudRate = LL_SPI_BAUDRATEPRESCALER_DIV256,
+		.BitOrder = LL_SPI_MSB_FIRST,
+		.CRCCalculation = LL_SPI_CRCCALCULATION_DISABLE,
+		.CRCPoly = 7,
+	};
+
+	auto r = LL_SPI_Init(spi_inst, &initializer);
+	assert(r == 0);
+
+	LL_SPI_SetStandard(spi_inst, LL_SPI_PROTOCOL_MOTOROLA);
+	LL_SPI_DisableNSSPulseMgt(spi_inst);
+	applyConfiguration();
+
+	configureDMA();
+
+	spi_error_callbacks[device_] = [this](status s) { transferComplete(s); };
+
+	enableInterrupts();
+}
+
+void STM32SPIMaster::stop_() noexcept
+{
+	auto spi_inst = spi_instance[device_];
+	assert(spi_inst); // if failed, device is invalid
+
+	disableInterrupts();
+
+	LL_SPI_Disable(spi_inst);
+	LL_SPI_DisableDMAReq_RX(spi_inst);
+	LL_SPI_DisableDMAReq_TX(spi_inst);
+
+	tx_channel_.stop();
+	rx_channel_.stop();
+
+	{
+		STM32InterruptLock lock;
+		queue_.clear();
+		active_ = false;
+	}
+
+	spi_error_callbacks[device_] = nullptr;
+
+	LL_SPI_DeInit(spi_inst);
+	STM32ClockControl::spiDisable(device_);
+}
+
+void STM32SPIMaster::configureDMA() noexcept
+{
+	tx_channel_.setConfiguration(LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_HIGH |
+									 LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT |
+									 LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
+									 LL_DMA_MDATAALIGN_BYTE,
+								 dma_tx_routing[device_]);
+	// RX is given a higher priority than TX so that the RX FIFO cannot overrun
+	rx_channel_.setConfiguration(LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_VERYHIGH |
+									 LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT |
+									 LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
+									 LL_DMA_MDATAALIGN_BYTE,
+								 dma_rx_routing[device_]);
+
+	tx_channel_.registerCallback([this](STM32DMA::status status) {
+		if(status != STM32DMA::status::ok)
+		{
+			transferComplete(STM32SPIMaster::status::error);
+		}
+	});
+
+	// The RX channel finishes last, so it marks the end of the transaction
+	rx_channel_.registerCallback([this](STM32DMA::status status) {
+		transferComplete((status == STM32DMA::status::ok) ? STM32SPIMaster::status::ok
+														  : STM32SPIMaster::status::error);
+	});
+
+	tx_channel_.start();
+	rx_channel_.start();
+}
+
+void STM32SPIMaster::configure_spi_pins_() noexcept
+{
+	// Others not currently supported
+	assert(device_ == STM32SPIMaster::device::spi1 || device_ == STM32SPIMaster::device::spi3);
+
+	// TODO: move out of here and into hardware platform??
+	auto pins = spi_pins[device_];
+	STM32GPIOTranslator::configure_alternate(pins.sck_port, pins.sck_pin, pins.alt_func);
+	STM32GPIOTranslator::configure_alternate(pins.miso_port, pins.miso_pin, pins.alt_func);
+	STM32GPIOTranslator::configure_alternate(pins.mosi_port, pins.mosi_pin, pins.alt_func);
+}
+
+void STM32SPIMaster::applyConfiguration() noexcept
+{
+	auto inst = spi_instance[device_];
+	assert(inst);
+	assert(LL_SPI_IsEnabled(inst) == false);
+
+	// All SPI kernel clocks run at the core clock (APB1 and APB2 are undivided)
+	LL_SPI_SetBaudRatePrescaler(inst, baud_prescaler[select_prescaler(SystemCoreClock, baud_)]);
+
+	auto m = static_cast<uint8_t>(mode_);
+	LL_SPI_SetClockPolarity(inst, (m & 0x2) ? LL_SPI_POLARITY_HIGH : LL_SPI_POLARITY_LOW);
+	LL_SPI_SetClockPhase(inst, (m & 0x1) ? LL_SPI_PHASE_2EDGE : LL_SPI_PHASE_1EDGE);
+	LL_SPI_SetTransferBitOrder(inst,
+							   (order_ == order::lsbFirst) ? LL_SPI_LSB_FIRST : LL_SPI_MSB_FIRST);
+}
+
+uint32_t STM32SPIMaster::baudrate(uint32_t baud) noexcept
+{
+	assert(baud);
+	assert(queue_.empty()); // Cannot change configuration with transfers pending
+
+	baud_ = baud;
+	if(started())
+	{
+		applyConfiguration();
+	}
+
+	return SystemCoreClock >> (select_prescaler(SystemCoreClock, baud) + 1);
+}
+
+void STM32SPIMaster::configure(mode m, order o) noexcept
+{
+	assert(queue_.empty()); // Cannot change configuration with transfers pending
+
+	mode_ = m;
+	order_ = o;
+	if(started())
+	{
+		applyConfiguration();
+	}
+}
+
+void STM32SPIMaster::enableInterrupts() noexcept
+{
+	uint8_t irq = spi_irq_num[device_];
+	auto inst = spi_instance[device_];
+	assert(irq && inst); // Check that channel is supported
+
+	// The error ISR completes transfers, so it must be compatible with the RTOS (if used)
+	NVICControl::priority(irq, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(irq);
+
+	LL_SPI_EnableIT_ERR(inst); // Enables overrun and mode fault interrupts
+}
+
+void STM32SPIMaster::disableInterrupts() noexcept
+{
+	uint8_t irq = spi_irq_num[device_];
+	auto inst = spi_instance[device_];
+	assert(irq && inst); // Check that channel is supported
+
+	LL_SPI_DisableIT_ERR(inst);
+	NVICControl::disable(irq);
+}
+
+STM32SPIMaster::status STM32SPIMaster::transfer(const op_t& op, const cb_t& cb) noexcept
+{
+	assert(started());
+	assert(op.length > 0 && op.length <= MAX_TRANSFER_FRAMES);
+
+	STM32InterruptLock lock;
+
+	if(!queue_.push({op, cb}))
+	{
+		return status::busy;
+	}
+
+	if(!active_)
+	{
+		active_ = true;
+		startNextTransfer();
+	}
+
+	return status::enqueued;
+}
+
+// When built with RTOS support, the calling task is blocked (not spinning) until the ISR
+// signals that the transfer is complete. The completion and result belong to this call, so
+// several tasks can block on the queue at the same time.
+STM32SPIMaster::status STM32SPIMaster::transfer(const op_t& op) noexcept
+{
+	STM32Completion completion;
+	volatile status result = status::ok;
+
+	completion.arm();
+
+	auto r = transfer(op, [&completion, &result](const op_t&, status s) {
+		result = s;
+		completion.signal();
+	});
+
+	if(r != status::enqueued)
+	{
+		return r;
+	}
+
+	completion.wait();
+	return result;
+}
+
+// Called with interrupts masked, or from the driver's ISRs
+void STM32SPIMaster::startNextTransfer() noexcept
+{
+	auto inst = spi_instance[device_];
+	assert(inst);
+	auto& op = queue_.front().op;
+
+	bool wide = (op.frame_size == frame::bits16);
+	auto width = wide ? STM32DMA::width::halfword : STM32DMA::width::byte;
+
+	LL_SPI_SetDataWidth(inst, wide ? LL_SPI_DATAWIDTH_16BIT : LL_SPI_DATAWIDTH_8BIT);
+	LL_SPI_SetRxFIFOThreshold(inst, wide ? LL_SPI_RX_FIFO_TH_HALF : LL_SPI_RX_FIFO_TH_QUARTER);
+
+	auto data_reg = reinterpret_cast<void*>(LL_SPI_DMA_GetRegAddr(inst));
+
+	rx_channel_.setDataWidth(width, width);
+	rx_channel_.setMemoryIncrement(op.rx_buffer != nullptr);
+	rx_channel_.setAddresses(data_reg, op.rx_buffer ? op.rx_buffer : &spi_rx_discard, op.length);
+
+	tx_channel_.setDataWidth(width, width);
+	tx_channel_.setMemoryIncrement(op.tx_buffer != nullptr);
+	// The underlying STM32 code doesn't take const.
+	tx_channel_.setAddresses(op.tx_buffer ? const_cast<void*>(op.tx_buffer) : &spi_tx_fill,
+							 data_reg, op.length);
+
+	if(op.chip_select)
+	{
+		op.chip_select->set(false);
+	}
+
+	LL_SPI_EnableDMAReq_RX(inst);
+	rx_channel_.enable();
+	tx_channel_.enable();
+	LL_SPI_EnableDMAReq_TX(inst);
+	LL_SPI_Enable(inst);
+}
+
+void STM32SPIMaster::transferComplete(status s) noexcept
+{
+	auto inst = spi_instance[device_];
+	assert(inst);
+	queued_op_t completed;
+
+	{
+		STM32InterruptLock lock;
+
+		if(!active_)
+		{
+			// A DMA error and an SPI error can both be reported for the same transfer
+			return;
+		}
+
+		if(s == status::ok)
+		{
+			while(LL_SPI_GetTxFIFOLevel(inst) != LL_SPI_TX_FIFO_EMPTY)
+			{
+			}
+
+			while(LL_SPI_IsActiveFlag_BSY(inst))
+			{
+			}
+		}
+
+		LL_SPI_Disable(inst);
+		LL_SPI_DisableDMAReq_TX(inst);
+		LL_SPI_DisableDMAReq_RX(inst);
+		tx_channel_.disable();
+		rx_channel_.disable();
+
+		if(s != status::ok)
+		{
+			// Drain any stale data so that the next transfer starts clean
+			while(LL_SPI_GetRxFIFOLevel(inst) != LL_SPI_RX_FIFO_EMPTY)
+			{
+				(void)LL_SPI_ReceiveData8(inst);
+			}
+		}
+
+		completed = std::move(queue_.front());
+		queue_.pop();
+
+		if(completed.op.chip_select)
+		{
+			completed.op.chip_select->set(true);
+		}
+
+		// Start the next transaction before running the callback to keep the bus busy
+		if(queue_.empty())
+		{
+			active_ = false;
+		}
+		else
+		{
+			startNextTransfer();
+		}
+	}
+
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(completed.cb)
+	{
+		completed.cb(completed.op, s);
+	}
+}
@@ -0,0 +1,217 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_SPI_MASTER_HPP_
+#define STM32_SPI_MASTER_HPP_
+
+#include <driver/driver.hpp>
+#include <driver/gpio.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <static_queue.hpp>
+#include <stm32_dma.hpp>
+
+// TODO: Handle interrupt priority - as a constructor parameter
+// TODO: support the TI frame format and hardware NSS management
+
+/** STM32 SPI master driver.
+ *
+ * Transfers are always full-duplex and are performed entirely with DMA: the RX channel
+ * completing marks the end of a transaction. Transactions are queued, so multiple
+ * transfers (e.g., to different chip selects) can be submitted back-to-back. The next
+ * transaction is started from the DMA interrupt before the previous transaction's callback
+ * is invoked, which keeps the bus busy.
+ *
+ * Note that this class is implemented using DMA, so you need to create
+ * DMA instances for the tx_channel and rx_channel in order to use this driver.
+ *
+ * @code
+ * STM32DMA dma_ch_spi_tx{STM32DMA::device::dma1, STM32DMA::channel::CH3};
+ * STM32DMA dma_ch_spi_rx{STM32DMA::device::dma1, STM32DMA::channel::CH4};
+ * STM32SPIMaster spi1{STM32SPIMaster::device::spi1, dma_ch_spi_tx, dma_ch_spi_rx};
+ * @endcode
+ *
+ * Each transaction can specify a chip-select GPIO, which is driven low for the duration
+ * of the transfer. The GPIO must already be configured as an output.
+ *
+ * @code
+ * STM32SPIMaster::op_t op = {
+ *	.tx_buffer = cmd, .rx_buffer = response, .length = 4, .chip_select = &flash_cs};
+ * spi1.transfer(op, [](const STM32SPIMaster::op_t& op, STM32SPIMaster::status status) {
+ *	// Runs in interrupt context
+ * });
+ * @endcode
+ *
+ * The SPI driver will handle its specific configuration, interrupt handlers, and
+ * starting/stopping of the driver internally. You must, however, enable the appropriate
+ * DMA device clock in the hardware platform; the SPI driver will not handle that.
+ *
+ * @see STM32DMA
+ */
+class STM32SPIMaster final : public embvm::DriverBase
+{
+  public:
+	enum device : uint8_t
+	{
+		spi1 = 0,
+		spi2,
+		spi3,
+		NUM_SPI_DEVICES
+	};
+
+	enum class status : uint8_t
+	{
+		/// The transfer completed successfully
+		ok = 0,
+		/// The transfer was added to the queue
+		enqueued,
+		/// The transfer queue is full
+		busy,
+		/// The transfer failed (e.g., RX overrun or DMA error)
+		error,
+	};
+
+	/// SPI clock polarity and phase
+	enum class mode : uint8_t
+	{
+		/// CPOL = 0, CPHA = 0
+		mode0 = 0,
+		/// CPOL = 0, CPHA = 1
+		mode1,
+		/// CPOL = 1, CPHA = 0
+		mode2,
+		/// CPOL = 1, CPHA = 1
+		mode3,
+	};
+
+	enum class order : uint8_t
+	{
+		msbFirst = 0,
+		lsbFirst,
+	};
+
+	/// Size of each frame on the bus
+	enum class frame : uint8_t
+	{
+		bits8 = 0,
+		bits16,
+	};
+
+	/// Describes a single full-duplex SPI transaction
+	struct op_t
+	{
+		/// Data to transmit. If nullptr, TX_FILL_VALUE is transmitted.
+		/// For 16-bit frames, the buffer must be 2-byte aligned.
+		const void* tx_buffer = nullptr;
+		/// Buffer for received data. If nullptr, received data is discarded.
+		/// For 16-bit frames, the buffer must be 2-byte aligned.
+		void* rx_buffer = nullptr;
+		/// Number of frames to transfer (not bytes).
+		size_t length = 0;
+		frame frame_size = frame::bits8;
+		/// Active-low chip select to assert for this transaction. nullptr if unused.
+		embvm::gpio::base* chip_select = nullptr;
+	};
+
+	/// Transfer callback. This is invoked from the DMA interrupt context.
+	using cb_t = stdext::inplace_function<void(const op_t&, status)>;
+
+	/// Maximum number of transactions which can be queued.
+	static constexpr size_t QUEUE_DEPTH = 8;
+
+	/// Maximum number of frames in a single transaction (limited by the DMA counter).
+	static constexpr size_t MAX_TRANSFER_FRAMES = 65535;
+
+	/// Value transmitted when op_t::tx_buffer is nullptr.
+	static constexpr uint16_t TX_FILL_VALUE = 0xFFFF;
+
+  public:
+	explicit STM32SPIMaster(STM32SPIMaster::device dev, STM32DMA& tx_channel,
+							STM32DMA& rx_channel) noexcept
+		: embvm::DriverBase(embvm::DriverType::SPI), device_(dev), tx_channel_(tx_channel),
+		  rx_channel_(rx_channel)
+	{
+	}
+	~STM32SPIMaster() noexcept = default;
+
+	void enableInterrupts() noexcept;
+	void disableInterrupts() noexcept;
+
+	/** Queue an asynchronous transfer.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition 0 < op.length <= MAX_TRANSFER_FRAMES
+	 *
+	 * @param [in] op The transaction to perform. Buffers must remain valid until the callback
+	 *	is invoked.
+	 * @param [in] cb Callback invoked (in interrupt context) when the transfer completes.
+	 * @returns status::enqueued if the transfer was queued, status::busy if the queue is full.
+	 */
+	status transfer(const op_t& op, const cb_t& cb) noexcept;
+
+	/** Perform a blocking transfer.
+	 *
+	 * The transfer is queued behind any pending transfers. When built with RTOS support, the
+	 * calling task is blocked (not spinning) until the transfer completes.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition This is not called from an interrupt context.
+	 *
+	 * @param [in] op The transaction to perform.
+	 * @returns The transfer result, or status::busy if the queue is full.
+	 */
+	status transfer(const op_t& op) noexcept;
+
+	/** Set the SPI clock rate.
+	 *
+	 * The fastest supported rate which does not exceed the requested rate is selected. The
+	 * SPI kernel clock is divided by a power of two between 2 and 256.
+	 *
+	 * @precondition No transfers are queued.
+	 * @param [in] baud The desired SCK frequency in Hz.
+	 * @returns The actual SCK frequency in Hz.
+	 */
+	uint32_t baudrate(uint32_t baud) noexcept;
+
+	/** Set the clock mode and bit order.
+	 *
+	 * @precondition No transfers are queued.
+	 */
+	void configure(mode m, order o) noexcept;
+
+	/// Check whether a transfer is in progress.
+	bool busy() const noexcept
+	{
+		return active_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	void configure_spi_pins_() noexcept;
+	void configureDMA() noexcept;
+	void applyConfiguration() noexcept;
+	/// Start the transfer at the front of the queue
+	void startNextTransfer() noexcept;
+	/// Finish the active transfer and start the next one
+	void transferComplete(status s) noexcept;
+
+  private:
+	struct queued_op_t
+	{
+		op_t op;
+		cb_t cb;
+	};
+
+	const STM32SPIMaster::device device_;
+	STM32DMA& tx_channel_;
+	STM32DMA& rx_channel_;
+	StaticQueue<queued_op_t, QUEUE_DEPTH> queue_;
+	volatile bool active_ = false;
+	uint32_t baud_ = 1000000;
+	mode mode_ = mode::mode0;
+	order order_ = order::msbFirst;
+};
+
+#endif // STM32_SPI_MASTER_HPP_
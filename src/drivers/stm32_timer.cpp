@@ -2,100 +2,23 @@
 // SPDX-License-Identifier: MIT
 
 #include "stm32_timer.hpp"
+#include "helpers/timer_helper.hpp"
 #include "stm32_rcc.hpp"
 #include <array>
-#include <nvic.hpp>
+#include <cassert>
 #include <stm32l4xx_ll_bus.h>
 #include <stm32l4xx_ll_tim.h>
-#include <volatile/volatile.hpp>
 
 // TODO: decouple RCC from this class, handle instead in the hardware platform?
 
-extern "C" void TIM1_CC_IRQHandler();
-extern "C" void TIM2_IRQHandler();
-extern "C" void TIM3_IRQHandler();
-extern "C" void TIM4_IRQHandler();
-extern "C" void TIM5_IRQHandler();
-extern "C" void TIM6_IRQHandler();
-extern "C" void TIM7_IRQHandler();
-extern "C" void TIM8_CC_IRQHandler();
-
 namespace
 {
 constexpr std::array<TIM_TypeDef* const, 9> timer_instance = {nullptr, TIM1, TIM2, TIM3, TIM4,
 															  TIM5,	   TIM6, TIM7, TIM8};
 
 static std::array<embvm::timer::cb_t, 9> tim_callbacks = {nullptr};
-
-constexpr std::array<uint8_t, 9> irq_num = {
-	0, // invalid for CH0
-	TIM1_CC_IRQn, // TODO: Figure out proper use here
-				  // Note that options are: TIM1_UP_TIM16_IRQN, TIM1_BRK_TIM15_IRQn,
-				  // TIM1_TRG_COM_TIM17_IRQn, TIM1_CC_IRQn, LPTIM1_IRQn
-	TIM2_IRQn, // Can also pick: LPTIM2_IRQn
-	TIM3_IRQn, TIM4_IRQn, TIM5_IRQn,
-	TIM6_IRQn, // Also: TIM6_DAC_IRQn
-	TIM7_IRQn,
-	TIM8_CC_IRQn, // TODO: Figure out proper use here
-				  // Options are: TIM8_BRK_IRQn, TIM8_UP_IRQn, TIM8_TRG_COM_IRQn, TIM8_CC_IRQn
-};
 } // namespace
 
-// TODO: should this be handled with a bottom half handler instead, using
-// an interrupt queue?
-static void timer_interrupt_handler(embvm::timer::channel ch)
-{
-	// TODO: do we need to check for the appropiate flags?
-	// Right now we are just blanket-clearing
-	volatile TIM_TypeDef* const reg = timer_instance[ch];
-	embutil::volatile_store(&reg->SR, UINT32_C(0));
-
-	if(tim_callbacks[ch])
-	{
-		tim_callbacks[ch]();
-	}
-}
-
-extern "C" void TIM1_CC_IRQHandler()
-{
-	timer_interrupt_handler(embvm::timer::channel::CH1);
-}
-
-extern "C" void TIM2_IRQHandler()
-{
-	timer_interrupt_handler(embvm::timer::channel::CH2);
-}
-
-extern "C" void TIM3_IRQHandler()
-{
-	timer_interrupt_handler(embvm::timer::channel::CH3);
-}
-
-extern "C" void TIM4_IRQHandler()
-{
-	timer_interrupt_handler(embvm::timer::channel::CH4);
-}
-
-extern "C" void TIM5_IRQHandler()
-{
-	timer_interrupt_handler(embvm::timer::channel::CH5);
-}
-
-extern "C" void TIM6_IRQHandler()
-{
-	timer_interrupt_handler(embvm::timer::channel::CH6);
-}
-
-extern "C" void TIM7_IRQHandler()
-{
-	timer_interrupt_handler(embvm::timer::channel::CH7);
-}
-
-extern "C" void TIM8_CC_IRQHandler()
-{
-	timer_interrupt_handler(embvm::timer::channel::CH8);
-}
-
 /**
  * @file stm32_timer.cpp
  *
@@ -165,6 +88,14 @@ void STM32Timer::start_() noexcept
 	/* event (UEV).                                                             */
 	LL_TIM_EnableARRPreload(timer_instance[channel_]);
 
+	if(trigger_output_)
+	{
+		// The timer only paces other peripherals, so no channel or interrupt is configured
+		LL_TIM_SetTriggerOutput(timer_instance[channel_], LL_TIM_TRGO_UPDATE);
+		LL_TIM_EnableCounter(timer_instance[channel_]);
+		return;
+	}
+
 	/* Enable TIM2_CCR1 register preload. Read/Write operations access the      */
 	/* preload register. TIM2_CCR1 preload value is loaded in the active        */
 	/* at each update event.                                                    */
@@ -192,6 +123,12 @@ void STM32Timer::start_() noexcept
 	enableInterrupts();
 }
 
+void STM32Timer::triggerOutput(bool enable) noexcept
+{
+	assert(started() == false);
+	trigger_output_ = enable;
+}
+
 void STM32Timer::registerCallback(const embvm::timer::cb_t& cb) noexcept
 {
 	tim_callbacks[channel_] = cb;
@@ -212,15 +149,20 @@ void STM32Timer::stop_() noexcept
 
 void STM32Timer::enableInterrupts() noexcept
 {
-	auto inst = irq_num[channel_];
-	assert(inst); // Check that channel is supported
-	NVICControl::priority(inst, 0); // TODO: how to configure priority for the driver?
-	NVICControl::enable(inst);
+	// The interrupt lines are shared with other drivers for this timer device, so the
+	// callback is dispatched through the timer helper
+	STM32TimerHelper::registerInterruptHandler(channel_, [ch = channel_](uint32_t) {
+		if(tim_callbacks[ch])
+		{
+			tim_callbacks[ch]();
+		}
+	});
+
+	STM32TimerHelper::enableInterrupts(channel_, priority_);
 }
 
 void STM32Timer::disableInterrupts() noexcept
 {
-	auto inst = irq_num[channel_];
-	assert(inst); // Check that channel is supported
-	NVICControl::disable(inst);
+	STM32TimerHelper::disableInterrupts(channel_);
+	STM32TimerHelper::registerInterruptHandler(channel_, nullptr);
 }
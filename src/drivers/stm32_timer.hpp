@@ -5,6 +5,7 @@
 #define STM32_TIMER_HPP_
 
 #include <driver/timer.hpp>
+#include <stm32_completion.hpp>
 //#include <driver/hal_driver.hpp>
 
 // TODO: maybe this driver just needs to be set to a "Capture-Compare driver", indicating that
@@ -14,10 +15,6 @@
 // TODO: does this need to derive from HAL base?
 // Threading is not supported, so that causes an error...
 // TODO: support multiple callbacks? Use templates for that?
-// TODO: how to set interrupt priority? look at nrf52 I2C driver - takes it as a constructor param
-// Does that need to be part of the HAL base?
-// Does the user need to manually dot hat in the HW platform?
-// Is that just a processor-level API somehow?
 // TODO: we can convert this to being compile-time setting of the period/clock,
 // which we can use for constexpr calculations. We'll need a helper class probably.
 // TODO: support one-shot timers
@@ -42,8 +39,13 @@ class STM32Timer final : public embvm::timer::Timer //, public embvm::HALDriverB
 	 * 	embvm::timer::channel::CH1 corresponds to TIM1. Since the Embedded VM channel counters
 	 * 	start at 0, embvm::timer::channel::CH0 is invalid. Using this channel will result
 	 * 	in a program assertion being triggered.
+	 * @param [in] priority The NVIC priority for the timer's interrupt lines.
 	 */
-	explicit STM32Timer(embvm::timer::channel ch) noexcept : channel_(ch) {}
+	explicit STM32Timer(embvm::timer::channel ch,
+						uint8_t priority = STM32_COMPLETION_IRQ_PRIORITY) noexcept
+		: channel_(ch), priority_(priority)
+	{
+	}
 
 	/** Construct an STM32 Timer Object with a stated period
 	 *
@@ -53,9 +55,11 @@ class STM32Timer final : public embvm::timer::Timer //, public embvm::HALDriverB
 	 * 	start at 0, embvm::timer::channel::CH0 is invalid. Using this channel will result
 	 * 	in a program assertion being triggered.
 	 * @param [in] p The timer period to use when starting the timer driver.
+	 * @param [in] priority The NVIC priority for the timer's interrupt lines.
 	 */
-	explicit STM32Timer(embvm::timer::channel ch, embvm::timer::timer_period_t p) noexcept
-		: channel_(ch)
+	explicit STM32Timer(embvm::timer::channel ch, embvm::timer::timer_period_t p,
+						uint8_t priority = STM32_COMPLETION_IRQ_PRIORITY) noexcept
+		: channel_(ch), priority_(priority)
 	{
 		period(p);
 	}
@@ -69,6 +73,19 @@ class STM32Timer final : public embvm::timer::Timer //, public embvm::HALDriverB
 	void registerCallback(embvm::timer::cb_t&& cb) noexcept final;
 	embvm::timer::timer_period_t count() const noexcept final;
 
+	/** Drive the timer's trigger output (TRGO) on each update event.
+	 *
+	 * This lets the timer pace other peripherals in hardware (e.g., STM32ADC conversions).
+	 * In this mode, the capture/compare interrupt is not enabled, so the timer causes no CPU
+	 * load and a registered callback is not invoked.
+	 *
+	 * Since the timer counts in 1 microsecond ticks, the maximum trigger rate is 1 MHz.
+	 *
+	 * @precondition The timer is stopped.
+	 * @param [in] enable True to drive TRGO from the update event.
+	 */
+	void triggerOutput(bool enable) noexcept;
+
 	/*
 	 * HAL base class required interfaces
 	 */
@@ -93,6 +110,8 @@ class STM32Timer final : public embvm::timer::Timer //, public embvm::HALDriverB
 
   private:
 	const embvm::timer::channel channel_;
+	const uint8_t priority_;
+	bool trigger_output_ = false;
 };
 
 #endif // STM32_TIMER_HPP_
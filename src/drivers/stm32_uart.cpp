@@ -0,0 +1,523 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_uart.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_gpio.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+#include <stm32l4xx_ll_gpio.h> // TODO: break dependency
+#include <stm32l4xx_ll_usart.h>
+
+/* Useful Developer Notes
+ *
+ * LPUART1 shares the USART register layout (it is declared as a USART_TypeDef), so the
+ * LL_USART functions are used for both. The exceptions are:
+ *   - BRR: LPUART uses BRR = 256 * fck / baud, USART (16x oversampling) uses fck / baud
+ *   - LPUART has no oversampling selection
+ *
+ * The IDLE flag is set when the RX line has been idle for one frame after receiving data.
+ * Combined with the DMA half/full transfer interrupts, this lets us notify the application
+ * at the end of each variable-length frame without per-byte interrupts.
+ */
+
+#pragma mark - Definitions -
+
+using STM32UART_cb_t = stdext::inplace_function<void()>;
+
+#pragma mark - Types and Declarations -
+
+struct STM32_UART_Pins_t
+{
+	embvm::gpio::port tx_port;
+	uint8_t tx_pin;
+	embvm::gpio::port rx_port;
+	uint8_t rx_pin;
+	uint8_t alt_func;
+} __attribute__((packed));
+
+// TODO: how can we make this more configurable for users, since the pins will
+// really change based on the board design?
+// clang-format off
+constexpr std::array<STM32_UART_Pins_t, 6> uart_pins =
+{
+  // TODO: USART1 GPIO
+  STM32_UART_Pins_t{
+    .tx_port = embvm::gpio::port::A,
+    .tx_pin = 0,
+    .rx_port = embvm::gpio::port::A,
+    .rx_pin = 0,
+    .alt_func = LL_GPIO_AF_0
+  },
+  // USART2 GPIO
+  STM32_UART_Pins_t{
+    .tx_port = embvm::gpio::port::D,
+    .tx_pin = 5,
+    .rx_port = embvm::gpio::port::D,
+    .rx_pin = 6,
+    .alt_func = LL_GPIO_AF_7
+  },
+  // USART3 GPIO
+  STM32_UART_Pins_t{
+    .tx_port = embvm::gpio::port::D,
+    .tx_pin = 8,
+    .rx_port = embvm::gpio::port::D,
+    .rx_pin = 9,
+    .alt_func = LL_GPIO_AF_7
+  },
+  // TODO: UART4 GPIO
+  STM32_UART_Pins_t{
+    .tx_port = embvm::gpio::port::A,
+    .tx_pin = 0,
+    .rx_port = embvm::gpio::port::A,
+    .rx_pin = 0,
+    .alt_func = LL_GPIO_AF_0
+  },
+  // TODO: UART5 GPIO
+  STM32_UART_Pins_t{
+    .tx_port = embvm::gpio::port::A,
+    .tx_pin = 0,
+    .rx_port = embvm::gpio::port::A,
+    .rx_pin = 0,
+    .alt_func = LL_GPIO_AF_0
+  },
+  // LPUART1 GPIO (ST-LINK virtual COM port). Requires VDDIO2.
+  STM32_UART_Pins_t{
+    .tx_port = embvm::gpio::port::G,
+    .tx_pin = 7,
+    .rx_port = embvm::gpio::port::G,
+    .rx_pin = 8,
+    .alt_func = LL_GPIO_AF_8
+  },
+};
+// clang-format on
+
+constexpr unsigned UART_COUNT = STM32UART::device::NUM_UART_DEVICES;
+
+constexpr std::array<USART_TypeDef* const, UART_COUNT> uart_instance = {
+	USART1, USART2, USART3, UART4, UART5, LPUART1};
+
+constexpr std::array<uint32_t, UART_COUNT> dma_tx_routing = {
+	LL_DMAMUX_REQ_USART1_TX, LL_DMAMUX_REQ_USART2_TX, LL_DMAMUX_REQ_USART3_TX,
+	LL_DMAMUX_REQ_UART4_TX,	 LL_DMAMUX_REQ_UART5_TX,  LL_DMAMUX_REQ_LPUART1_TX};
+
+constexpr std::array<uint32_t, UART_COUNT> dma_rx_routing = {
+	LL_DMAMUX_REQ_USART1_RX, LL_DMAMUX_REQ_USART2_RX, LL_DMAMUX_REQ_USART3_RX,
+	LL_DMAMUX_REQ_UART4_RX,	 LL_DMAMUX_REQ_UART5_RX,  LL_DMAMUX_REQ_LPUART1_RX};
+
+constexpr std::array<uint8_t, UART_COUNT> uart_irq_num = {
+	USART1_IRQn, USART2_IRQn, USART3_IRQn, UART4_IRQn, UART5_IRQn, LPUART1_IRQn};
+
+static std::array<STM32UART_cb_t, UART_COUNT> uart_callbacks = {nullptr};
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void USART1_IRQHandler(void);
+extern "C" void USART2_IRQHandler(void);
+extern "C" void USART3_IRQHandler(void);
+extern "C" void UART4_IRQHandler(void);
+extern "C" void UART5_IRQHandler(void);
+extern "C" void LPUART1_IRQHandler(void);
+
+static void uart_handler(STM32UART::device dev)
+{
+	auto cb = uart_callbacks[dev];
+	assert(cb); // check to see if a valid handler is registered
+	cb();
+}
+
+void USART1_IRQHandler()
+{
+	uart_handler(STM32UART::device::usart1);
+}
+
+void USART2_IRQHandler()
+{
+	uart_handler(STM32UART::device::usart2);
+}
+
+void USART3_IRQHandler()
+{
+	uart_handler(STM32UART::device::usart3);
+}
+
+void UART4_IRQHandler()
+{
+	uart_handler(STM32UART::device::uart4);
+}
+
+void UART5_IRQHandler()
+{
+	uart_handler(STM32UART::device::uart5);
+}
+
+void LPUART1_IRQHandler()
+{
+	uart_handler(STM32UART::device::lpuart1);
+}
+
+#pragma mark - Driver APIs -
+
+void STM32UART::start_() noexcept
+{
+	auto inst = uart_instance[device_];
+	assert(inst); // if failed, device is invalid
+
+	configure_uart_pins_();
+
+	STM32ClockControl::uartEnable(device_);
+
+	// Disable before modifying configuration registers
+	LL_USART_Disable(inst);
+
+	LL_USART_ConfigCharacter(inst, LL_USART_DATAWIDTH_8B, LL_USART_PARITY_NONE,
+							 LL_USART_STOPBITS_1);
+	LL_USART_SetHWFlowCtrl(inst, LL_USART_HWCONTROL_NONE);
+	LL_USART_SetTransferDirection(inst, LL_USART_DIRECTION_TX_RX);
+	if(device_ != device::lpuart1)
+	{
+		LL_USART_SetOverSampling(inst, LL_USART_OVERSAMPLING_16);
+	}
+	applyBaudrate();
+
+	rx_tail_ = 0;
+	tx_head_ = 0;
+	tx_tail_ = 0;
+	tx_count_ = 0;
+	tx_inflight_ = 0;
+	error_count_ = 0;
+
+	configureDMA();
+
+	LL_USART_EnableDMAReq_RX(inst);
+	LL_USART_EnableDMAReq_TX(inst);
+
+	uart_callbacks[device_] = [this]() { handleInterrupt(); };
+	enableInterrupts();
+
+	LL_USART_Enable(inst);
+	rx_channel_.enable();
+}
+
+void STM32UART::stop_() noexcept
+{
+	auto inst = uart_instance[device_];
+	assert(inst); // if failed, device is invalid
+
+	disableInterrupts();
+
+	LL_USART_Disable(inst);
+	LL_USART_DisableDMAReq_RX(inst);
+	LL_USART_DisableDMAReq_TX(inst);
+
+	tx_channel_.stop();
+	rx_channel_.stop();
+
+	uart_callbacks[device_] = nullptr;
+
+	STM32ClockControl::uartDisable(device_);
+}
+
+void STM32UART::configureDMA() noexcept
+{
+	tx_channel_.setConfiguration(LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_MEDIUM |
+									 LL_DMA_MODE_NORMAL | LL_DMA_PERIPH_NOINCREMENT |
+									 LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
+									 LL_DMA_MDATAALIGN_BYTE,
+								 dma_tx_routing[device_]);
+	rx_channel_.setConfiguration(LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_HIGH |
+									 LL_DMA_MODE_CIRCULAR | LL_DMA_PERIPH_NOINCREMENT |
+									 LL_DMA_MEMORY_INCREMENT | LL_DMA_PDATAALIGN_BYTE |
+									 LL_DMA_MDATAALIGN_BYTE,
+								 dma_rx_routing[device_]);
+
+	tx_channel_.registerCallback([this](STM32DMA::status status) {
+		assert(status == STM32DMA::status::ok); // transfer failed
+		txComplete();
+	});
+
+	rx_channel_.registerCallback([this](STM32DMA::status status) {
+		assert(status != STM32DMA::status::error); // transfer failed
+		notifyRx();
+	});
+
+	tx_channel_.start();
+	rx_channel_.start();
+
+	// The RX channel runs continuously, so it is only configured once
+	auto inst = uart_instance[device_];
+	rx_channel_.enableHalfTransferInterrupt(true);
+	rx_channel_.setAddresses(
+		reinterpret_cast<void*>(LL_USART_DMA_GetRegAddr(inst, LL_USART_DMA_REG_DATA_RECEIVE)),
+		rx_buffer_.data(), rx_buffer_.size());
+}
+
+void STM32UART::configure_uart_pins_() noexcept
+{
+	// Others not currently supported
+	assert(device_ == STM32UART::device::usart2 || device_ == STM32UART::device::usart3 ||
+		   device_ == STM32UART::device::lpuart1);
+
+	// TODO: move out of here and into hardware platform??
+	auto pins = uart_pins[device_];
+	STM32GPIOTranslator::configure_alternate(pins.tx_port, pins.tx_pin, pins.alt_func);
+	STM32GPIOTranslator::configure_alternate(pins.rx_port, pins.rx_pin, pins.alt_func);
+}
+
+void STM32UART::applyBaudrate() noexcept
+{
+	auto inst = uart_instance[device_];
+	assert(inst && baud_);
+
+	// All UART kernel clocks run at the core clock (APB1 and APB2 are undivided)
+	uint64_t clock = SystemCoreClock;
+	uint64_t brr;
+	if(device_ == device::lpuart1)
+	{
+		brr = ((clock * 256) + (baud_ / 2)) / baud_;
+		assert(brr >= 0x300 && brr <= 0xFFFFF); // baud out of range for LPUART
+	}
+	else
+	{
+		brr = (clock + (baud_ / 2)) / baud_;
+		assert(brr >= 16 && brr <= 0xFFFF); // baud out of range for USART
+	}
+
+	inst->BRR = static_cast<uint32_t>(brr);
+}
+
+void STM32UART::baudrate(uint32_t baud) noexcept
+{
+	assert(baud);
+	baud_ = baud;
+
+	if(started())
+	{
+		auto inst = uart_instance[device_];
+		LL_USART_Disable(inst);
+		applyBaudrate();
+		LL_USART_Enable(inst);
+	}
+}
+
+void STM32UART::enableInterrupts() noexcept
+{
+	uint8_t irq = uart_irq_num[device_];
+	auto inst = uart_instance[device_];
+	assert(inst); // Check that channel is supported
+
+	NVICControl::priority(irq, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(irq);
+
+	LL_USART_EnableIT_IDLE(inst);
+	LL_USART_EnableIT_ERROR(inst); // Enables framing, noise, and overrun interrupts
+}
+
+void STM32UART::disableInterrupts() noexcept
+{
+	uint8_t irq = uart_irq_num[device_];
+	auto inst = uart_instance[device_];
+	assert(inst); // Check that channel is supported
+
+	LL_USART_DisableIT_IDLE(inst);
+	LL_USART_DisableIT_ERROR(inst);
+	NVICControl::disable(irq);
+}
+
+void STM32UART::handleInterrupt() noexcept
+{
+	auto inst = uart_instance[device_];
+	bool idle = false;
+
+	if(LL_USART_IsActiveFlag_ORE(inst))
+	{
+		LL_USART_ClearFlag_ORE(inst);
+		error_count_ = error_count_ + 1;
+	}
+
+	if(LL_USART_IsActiveFlag_FE(inst))
+	{
+		LL_USART_ClearFlag_FE(inst);
+		error_count_ = error_count_ + 1;
+	}
+
+	if(LL_USART_IsActiveFlag_NE(inst))
+	{
+		LL_USART_ClearFlag_NE(inst);
+		error_count_ = error_count_ + 1;
+	}
+
+	if(LL_USART_IsActiveFlag_IDLE(inst))
+	{
+		LL_USART_ClearFlag_IDLE(inst);
+		idle = true;
+	}
+
+	if(idle)
+	{
+		notifyRx();
+	}
+}
+
+#pragma mark - Receive -
+
+size_t STM32UART::available() const noexcept
+{
+	size_t head = RX_BUFFER_SIZE - rx_channel_.remaining();
+	if(head == RX_BUFFER_SIZE)
+	{
+		// The counter reloads on the transfer complete event
+		head = 0;
+	}
+
+	return (head + RX_BUFFER_SIZE - rx_tail_) % RX_BUFFER_SIZE;
+}
+
+size_t STM32UART::read(uint8_t* buffer, size_t length) noexcept
+{
+	assert(buffer || length == 0);
+
+	size_t count = std::min(length, available());
+	size_t tail = rx_tail_;
+
+	// Copy in up to two pieces to handle wrap-around
+	size_t first = std::min(count, RX_BUFFER_SIZE - tail);
+	memcpy(buffer, &rx_buffer_[tail], first);
+	memcpy(buffer + first, &rx_buffer_[0], count - first);
+
+	rx_tail_ = (tail + count) % RX_BUFFER_SIZE;
+	return count;
+}
+
+void STM32UART::notifyRx() noexcept
+{
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(rx_cb_)
+	{
+		auto count = available();
+		if(count)
+		{
+			rx_cb_(count);
+		}
+	}
+}
+
+#pragma mark - Transmit -
+
+size_t STM32UART::write(const uint8_t* data, size_t length) noexcept
+{
+	assert(started());
+	assert(data || length == 0);
+
+	STM32InterruptLock lock;
+
+	size_t count = std::min(length, TX_BUFFER_SIZE - tx_count_);
+
+	// Copy in up to two pieces to handle wrap-around
+	size_t first = std::min(count, TX_BUFFER_SIZE - tx_head_);
+	memcpy(&tx_buffer_[tx_head_], data, first);
+	memcpy(&tx_buffer_[0], data + first, count - first);
+
+	tx_head_ = (tx_head_ + count) % TX_BUFFER_SIZE;
+	tx_count_ = tx_count_ + count;
+
+	if(count && tx_inflight_ == 0)
+	{
+		startTx();
+	}
+
+	return count;
+}
+
+void STM32UART::writeBlocking(const uint8_t* data, size_t length) noexcept
+{
+	// Waiting for ring space would deadlock if the TX DMA interrupt cannot run
+	if(!STM32InterruptLock::canWaitForInterrupt())
+	{
+		writePolled(data, length);
+		return;
+	}
+
+	while(length)
+	{
+		auto sent = write(data, length);
+		data += sent;
+		length -= sent;
+	}
+}
+
+void STM32UART::writePolled(const uint8_t* data, size_t length) noexcept
+{
+	assert(started());
+	assert(data || length == 0);
+
+	auto inst = uart_instance[device_];
+
+	STM32InterruptLock lock;
+
+	// Let the active transfer finish. Its DMA interrupt still runs later, and only accounts
+	// for the bytes in tx_inflight_, so the ring is left in that state.
+	while(tx_inflight_ && tx_channel_.remaining())
+	{
+	}
+
+	// Send the queued data which follows the active transfer
+	size_t position = (tx_tail_ + tx_inflight_) % TX_BUFFER_SIZE;
+	for(size_t queued = tx_count_ - tx_inflight_; queued > 0; queued--)
+	{
+		while(!LL_USART_IsActiveFlag_TXE(inst))
+		{
+		}
+
+		LL_USART_TransmitData8(inst, tx_buffer_[position]);
+		position = (position + 1) % TX_BUFFER_SIZE;
+	}
+
+	// The ring now only holds the active transfer
+	tx_count_ = tx_inflight_;
+	tx_head_ = (tx_tail_ + tx_inflight_) % TX_BUFFER_SIZE;
+
+	for(size_t i = 0; i < length; i++)
+	{
+		while(!LL_USART_IsActiveFlag_TXE(inst))
+		{
+		}
+
+		LL_USART_TransmitData8(inst, data[i]);
+	}
+}
+
+// Called with interrupts masked, or from the TX DMA ISR
+void STM32UART::startTx() noexcept
+{
+	auto inst = uart_instance[device_];
+	tx_inflight_ = std::min(static_cast<size_t>(tx_count_), TX_BUFFER_SIZE - tx_tail_);
+
+	tx_channel_.setAddresses(
+		&tx_buffer_[tx_tail_],
+		reinterpret_cast<void*>(LL_USART_DMA_GetRegAddr(inst, LL_USART_DMA_REG_DATA_TRANSMIT)),
+		tx_inflight_);
+	tx_channel_.enable();
+}
+
+void STM32UART::txComplete() noexcept
+{
+	STM32InterruptLock lock;
+
+	tx_channel_.disable();
+
+	tx_tail_ = (tx_tail_ + tx_inflight_) % TX_BUFFER_SIZE;
+	tx_count_ = tx_count_ - tx_inflight_;
+	tx_inflight_ = 0;
+
+	if(tx_count_)
+	{
+		startTx();
+	}
+}
@@ -0,0 +1,191 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_UART_HPP_
+#define STM32_UART_HPP_
+
+#include <array>
+#include <driver/driver.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <stm32_dma.hpp>
+
+// TODO: Handle interrupt priority - as a constructor parameter
+// TODO: support hardware flow control, parity, and alternate frame formats
+
+/** STM32 USART/LPUART driver.
+ *
+ * Both directions are handled by DMA, so the CPU is not interrupted for each byte:
+ *
+ *	- RX: The RX channel runs in circular mode, continuously filling an internal ring buffer.
+ *		The RX callback is invoked when the line goes idle (the end of a frame) and when
+ *		the DMA reaches the middle or end of the buffer. Data is consumed with read().
+ *	- TX: write() copies data into an internal transmit ring and returns immediately. The
+ *		TX channel sends the contiguous portion of the ring, and the DMA complete
+ *		interrupt starts the next portion.
+ *
+ * The application must call read() often enough to keep up with incoming data. If the
+ * ring wraps before data is read, the oldest data is overwritten.
+ *
+ * Note that this class is implemented using DMA, so you need to create
+ * DMA instances for the tx_channel and rx_channel in order to use this driver.
+ *
+ * @code
+ * STM32DMA dma_ch_uart_tx{STM32DMA::device::dma1, STM32DMA::channel::CH5};
+ * STM32DMA dma_ch_uart_rx{STM32DMA::device::dma1, STM32DMA::channel::CH6};
+ * STM32UART vcp{STM32UART::device::lpuart1, dma_ch_uart_tx, dma_ch_uart_rx, 115200};
+ * @endcode
+ *
+ * You must enable the appropriate DMA device clock in the hardware platform; the UART
+ * driver will not handle that.
+ *
+ * @see STM32DMA
+ */
+class STM32UART final : public embvm::DriverBase
+{
+  public:
+	enum device : uint8_t
+	{
+		usart1 = 0,
+		usart2,
+		usart3,
+		uart4,
+		uart5,
+		lpuart1,
+		NUM_UART_DEVICES
+	};
+
+	/// Size of the internal receive ring buffer, in bytes.
+	static constexpr size_t RX_BUFFER_SIZE = 256;
+
+	/// Size of the internal transmit ring buffer, in bytes.
+	static constexpr size_t TX_BUFFER_SIZE = 512;
+
+	/** RX notification callback.
+	 *
+	 * This is invoked from an interrupt context when data is received.
+	 * The parameter is the number of bytes available to read().
+	 */
+	using rx_cb_t = stdext::inplace_function<void(size_t)>;
+
+  public:
+	explicit STM32UART(STM32UART::device dev, STM32DMA& tx_channel, STM32DMA& rx_channel,
+					   uint32_t baud = 115200) noexcept
+		: embvm::DriverBase(embvm::DriverType::UART), device_(dev), tx_channel_(tx_channel),
+		  rx_channel_(rx_channel), baud_(baud)
+	{
+	}
+	~STM32UART() noexcept = default;
+
+	void enableInterrupts() noexcept;
+	void disableInterrupts() noexcept;
+
+	/** Set the baud rate.
+	 *
+	 * If the driver is started, the UART is briefly disabled to apply the change.
+	 *
+	 * @param [in] baud The desired baud rate.
+	 */
+	void baudrate(uint32_t baud) noexcept;
+
+	/** Queue data for transmission.
+	 *
+	 * Data is copied into the transmit ring, so the buffer can be reused immediately.
+	 * This function never blocks and can be called from an interrupt context.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] data The data to send.
+	 * @param [in] length The number of bytes to send.
+	 * @returns The number of bytes accepted, which is less than length if the ring is full.
+	 */
+	size_t write(const uint8_t* data, size_t length) noexcept;
+
+	/** Queue data for transmission, waiting for space in the ring if needed.
+	 *
+	 * Space in the ring is freed by the DMA interrupt. If that interrupt cannot run (the
+	 * caller has masked interrupts, or is an interrupt handler), the data is written with
+	 * writePolled() instead.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] data The data to send.
+	 * @param [in] length The number of bytes to send.
+	 */
+	void writeBlocking(const uint8_t* data, size_t length) noexcept;
+
+	/** Write data to the UART by polling, without using the DMA interrupt.
+	 *
+	 * The active DMA transfer is allowed to finish, and the rest of the transmit ring is sent
+	 * before data, so output stays in order. This can be called from any context, including
+	 * with interrupts masked.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] data The data to send.
+	 * @param [in] length The number of bytes to send.
+	 */
+	void writePolled(const uint8_t* data, size_t length) noexcept;
+
+	/// Check whether all queued data has been handed to the UART.
+	bool txIdle() const noexcept
+	{
+		return tx_count_ == 0;
+	}
+
+	/** Read received data from the ring buffer.
+	 *
+	 * @param [out] buffer The destination for the received data.
+	 * @param [in] length The maximum number of bytes to read.
+	 * @returns The number of bytes copied into buffer.
+	 */
+	size_t read(uint8_t* buffer, size_t length) noexcept;
+
+	/// The number of received bytes waiting to be read.
+	size_t available() const noexcept;
+
+	/// Register a callback which is invoked when data is received.
+	void registerRxCallback(const rx_cb_t& cb) noexcept
+	{
+		rx_cb_ = cb;
+	}
+
+	/// The number of framing, noise, and overrun errors seen since the driver started.
+	uint32_t errorCount() const noexcept
+	{
+		return error_count_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	void configure_uart_pins_() noexcept;
+	void configureDMA() noexcept;
+	void applyBaudrate() noexcept;
+	/// Start a DMA transfer of the next contiguous block of the transmit ring
+	void startTx() noexcept;
+	void txComplete() noexcept;
+	void notifyRx() noexcept;
+	/// Handle IDLE and error events from the UART interrupt
+	void handleInterrupt() noexcept;
+
+  private:
+	const STM32UART::device device_;
+	STM32DMA& tx_channel_;
+	STM32DMA& rx_channel_;
+	uint32_t baud_;
+	rx_cb_t rx_cb_;
+
+	std::array<uint8_t, RX_BUFFER_SIZE> rx_buffer_{};
+	/// Read position in rx_buffer_. The write position is tracked by the DMA.
+	volatile size_t rx_tail_ = 0;
+
+	std::array<uint8_t, TX_BUFFER_SIZE> tx_buffer_{};
+	size_t tx_head_ = 0;
+	size_t tx_tail_ = 0;
+	volatile size_t tx_count_ = 0;
+	/// Number of bytes in the active DMA transfer
+	size_t tx_inflight_ = 0;
+
+	volatile uint32_t error_count_ = 0;
+};
+
+#endif // STM32_UART_HPP_
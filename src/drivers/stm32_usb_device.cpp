@@ -0,0 +1,1284 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_usb_device.hpp"
+#include "helpers/gpio_helper.hpp"
+#include <algorithm>
+#include <cstring>
+#include <nvic.hpp>
+#include <processor_includes.hpp>
+#include <stm32_completion.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+
+/* Useful Developer Notes
+ *
+ * There is no LL driver in use for the OTG FS peripheral, so the registers are programmed
+ * directly. The FS core has no DMA, so the CPU moves all data through the FIFOs.
+ *
+ * All OUT endpoints share a single RX FIFO. Each received packet is announced by RXFLVL, and
+ * GRXSTSP returns its endpoint, byte count, and type (OUT data or SETUP data). The packet
+ * must then be read completely from the FIFO, which is where it is copied into the caller's
+ * buffer.
+ *
+ * Each IN endpoint has its own TX FIFO. A transfer is programmed with its total size and packet
+ * count (DIEPTSIZ), then the packets are written to the FIFO as space becomes available: the
+ * TXFE interrupt (enabled per endpoint with DIEPEMPMSK) fires while the FIFO is at least half
+ * empty. XFRC is set once every packet has been sent. PKTCNT is 10 bits wide, so longer
+ * transfers are programmed in several parts.
+ *
+ * An OUT transfer is programmed with a size that is a multiple of the packet size. XFRC is set
+ * when the size is reached, or when the host sends a short packet.
+ *
+ * After a transfer completes, the endpoint NAKs until it is enabled again (EPENA).
+ *
+ * SETUP packets are always accepted on endpoint 0 (STUPCNT allows up to three back-to-back).
+ * STUP is set once the SETUP stage is complete. A STALL on endpoint 0 is cleared by the
+ * hardware when the next SETUP packet arrives.
+ *
+ * The FIFOs share 1.25 KiB of RAM (320 words), which is divided by configure_fifos().
+ *
+ * Global interrupt flags are cleared by writing 1 to GINTSTS. The endpoint flags are cleared
+ * by writing 1 to DIEPINTx/DOEPINTx, except TXFE, which is read only.
+ */
+
+#pragma mark - Definitions -
+
+using STM32USBDevice_cb_t = stdext::inplace_function<void()>;
+
+/// Endpoints used by the device. Endpoint 0 is the control endpoint.
+constexpr uint8_t NOTIFICATION_ENDPOINT = 1;
+constexpr uint8_t NUM_ENDPOINTS = 4;
+/// Device endpoints provided by the OTG FS peripheral
+constexpr uint8_t NUM_DEVICE_ENDPOINTS = 6;
+
+constexpr size_t CONTROL_PACKET_SIZE = 64;
+constexpr size_t NOTIFICATION_PACKET_SIZE = 16;
+/// The largest part of a transfer which can be programmed at once (PKTCNT limit)
+constexpr size_t MAX_CHUNK = 1023 * STM32USBDevice::PACKET_SIZE;
+
+/// FIFO sizes in words. The TX FIFOs of the bulk endpoints hold at least two packets, and the
+/// vendor stream has the largest FIFO so that several packets can be sent per frame.
+constexpr uint32_t RX_FIFO_WORDS = 128;
+constexpr std::array<uint32_t, NUM_ENDPOINTS> TX_FIFO_WORDS = {16, 16, 32, 128};
+constexpr uint32_t FIFO_RAM_WORDS = 320;
+
+static_assert(RX_FIFO_WORDS + TX_FIFO_WORDS[0] + TX_FIFO_WORDS[1] + TX_FIFO_WORDS[2] +
+					  TX_FIFO_WORDS[3] <=
+				  FIFO_RAM_WORDS,
+			  "FIFO allocation exceeds the OTG FS RAM");
+
+/// GRSTCTL.TXFNUM value which flushes every TX FIFO
+constexpr uint32_t ALL_TX_FIFOS = 0x10;
+/// DIEPCTL/DOEPCTL.EPTYP values
+constexpr uint32_t EP_TYPE_BULK = 2;
+constexpr uint32_t EP_TYPE_INTERRUPT = 3;
+/// GUSBCFG.TRDT for an AHB clock above 32 MHz
+constexpr uint32_t TURNAROUND_TIME = 6;
+/// GRXSTSP.PKTSTS values
+constexpr uint32_t PKTSTS_OUT_DATA = 2;
+constexpr uint32_t PKTSTS_SETUP_DATA = 6;
+/// All DIEPINT/DOEPINT flags
+constexpr uint32_t EP_INTERRUPT_FLAGS = 0xFB7F;
+/// The core must stay in device mode for 25 ms before it is used
+constexpr uint32_t FORCE_MODE_DELAY_MS = 25;
+
+/// bmRequestType fields
+constexpr uint8_t REQUEST_DIRECTION_IN = 0x80;
+constexpr uint8_t REQUEST_TYPE_MASK = 0x60;
+constexpr uint8_t REQUEST_TYPE_STANDARD = 0x00;
+constexpr uint8_t REQUEST_TYPE_CLASS = 0x20;
+constexpr uint8_t RECIPIENT_MASK = 0x1F;
+constexpr uint8_t RECIPIENT_DEVICE = 0;
+constexpr uint8_t RECIPIENT_INTERFACE = 1;
+constexpr uint8_t RECIPIENT_ENDPOINT = 2;
+
+/// Standard requests
+constexpr uint8_t GET_STATUS = 0;
+constexpr uint8_t CLEAR_FEATURE = 1;
+constexpr uint8_t SET_FEATURE = 3;
+constexpr uint8_t SET_ADDRESS = 5;
+constexpr uint8_t GET_DESCRIPTOR = 6;
+constexpr uint8_t GET_CONFIGURATION = 8;
+constexpr uint8_t SET_CONFIGURATION = 9;
+constexpr uint8_t GET_INTERFACE = 10;
+constexpr uint8_t SET_INTERFACE = 11;
+constexpr uint16_t FEATURE_ENDPOINT_HALT = 0;
+
+/// CDC class requests
+constexpr uint8_t CDC_SET_LINE_CODING = 0x20;
+constexpr uint8_t CDC_GET_LINE_CODING = 0x21;
+constexpr uint8_t CDC_SET_CONTROL_LINE_STATE = 0x22;
+constexpr uint8_t CDC_SEND_BREAK = 0x23;
+constexpr size_t LINE_CODING_SIZE = 7;
+
+/// Descriptor types
+constexpr uint8_t DESCRIPTOR_DEVICE = 1;
+constexpr uint8_t DESCRIPTOR_CONFIGURATION = 2;
+constexpr uint8_t DESCRIPTOR_STRING = 3;
+
+/// String descriptor indices
+constexpr uint8_t STRING_MANUFACTURER = 1;
+constexpr uint8_t STRING_PRODUCT = 2;
+constexpr uint8_t STRING_SERIAL = 3;
+constexpr uint8_t STRING_VENDOR_INTERFACE = 4;
+
+constexpr uint8_t CDC_COMM_INTERFACE = 0;
+constexpr uint8_t NUM_INTERFACES = 3;
+
+/// Device descriptor. The vendor and product IDs are filled in from the configuration.
+constexpr std::array<uint8_t, 18> device_descriptor = {
+	18, DESCRIPTOR_DEVICE,
+	0x00, 0x02, // USB 2.0
+	0xEF, 0x02, 0x01, // Miscellaneous class, with interface association descriptors
+	CONTROL_PACKET_SIZE,
+	0x00, 0x00, // idVendor
+	0x00, 0x00, // idProduct
+	0x00, 0x01, // bcdDevice 1.00
+	STRING_MANUFACTURER, STRING_PRODUCT, STRING_SERIAL,
+	1, // Configurations
+};
+
+/// Configuration descriptor: CDC-ACM (interfaces 0 and 1) and a vendor bulk interface (2)
+constexpr std::array<uint8_t, 98> configuration_descriptor = {
+	// Configuration: 3 interfaces, bus powered, 100 mA
+	9, DESCRIPTOR_CONFIGURATION, 98, 0, NUM_INTERFACES, 1, 0, 0x80, 50,
+	// Interface association: CDC communication and data interfaces
+	8, 0x0B, 0, 2, 0x02, 0x02, 0x00, 0,
+	// Interface 0: CDC communication, abstract control model
+	9, 0x04, 0, 0, 1, 0x02, 0x02, 0x00, 0,
+	// Header functional descriptor: CDC 1.10
+	5, 0x24, 0x00, 0x10, 0x01,
+	// Call management functional descriptor: no call management, data interface 1
+	5, 0x24, 0x01, 0x00, 1,
+	// ACM functional descriptor: line coding and control line state requests
+	4, 0x24, 0x02, 0x02,
+	// Union functional descriptor: interface 0 controls interface 1
+	5, 0x24, 0x06, 0, 1,
+	// Endpoint 1 IN: notifications (interrupt)
+	7, 0x05, 0x80 | NOTIFICATION_ENDPOINT, 0x03, NOTIFICATION_PACKET_SIZE, 0, 16,
+	// Interface 1: CDC data
+	9, 0x04, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+	// Endpoint 2 OUT and IN (bulk)
+	7, 0x05, 0x02, 0x02, STM32USBDevice::PACKET_SIZE, 0, 0,
+	7, 0x05, 0x82, 0x02, STM32USBDevice::PACKET_SIZE, 0, 0,
+	// Interface 2: vendor specific
+	9, 0x04, 2, 0, 2, 0xFF, 0x00, 0x00, STRING_VENDOR_INTERFACE,
+	// Endpoint 3 OUT and IN (bulk)
+	7, 0x05, 0x03, 0x02, STM32USBDevice::PACKET_SIZE, 0, 0,
+	7, 0x05, 0x83, 0x02, STM32USBDevice::PACKET_SIZE, 0, 0,
+};
+
+#pragma mark - Variables -
+
+static STM32USBDevice_cb_t usb_callback = nullptr;
+
+#pragma mark - Helpers -
+
+static void spin_cycles(uint32_t cycles)
+{
+	// Each iteration takes at least 4 cycles
+	for(volatile uint32_t i = (cycles / 4) + 1; i > 0; i--)
+	{
+	}
+}
+
+static inline USB_OTG_DeviceTypeDef* usb_device()
+{
+	return reinterpret_cast<USB_OTG_DeviceTypeDef*>(USB_OTG_FS_PERIPH_BASE + USB_OTG_DEVICE_BASE);
+}
+
+static inline USB_OTG_INEndpointTypeDef* usb_in(uint8_t ep)
+{
+	return reinterpret_cast<USB_OTG_INEndpointTypeDef*>(
+		USB_OTG_FS_PERIPH_BASE + USB_OTG_IN_ENDPOINT_BASE + (ep * USB_OTG_EP_REG_SIZE));
+}
+
+static inline USB_OTG_OUTEndpointTypeDef* usb_out(uint8_t ep)
+{
+	return reinterpret_cast<USB_OTG_OUTEndpointTypeDef*>(
+		USB_OTG_FS_PERIPH_BASE + USB_OTG_OUT_ENDPOINT_BASE + (ep * USB_OTG_EP_REG_SIZE));
+}
+
+/// The FIFO push (IN) or pop (OUT, any endpoint) register for an endpoint
+static inline volatile uint32_t* usb_fifo(uint8_t ep)
+{
+	return reinterpret_cast<volatile uint32_t*>(USB_OTG_FS_PERIPH_BASE + USB_OTG_FIFO_BASE +
+												(ep * USB_OTG_FIFO_SIZE));
+}
+
+static inline volatile uint32_t* usb_pcgcctl()
+{
+	return reinterpret_cast<volatile uint32_t*>(USB_OTG_FS_PERIPH_BASE + USB_OTG_PCGCCTL_BASE);
+}
+
+static constexpr uint8_t stream_endpoint(STM32USBDevice::stream s)
+{
+	return static_cast<uint8_t>(s + 2);
+}
+
+/// Write a packet to an endpoint's TX FIFO. The FIFO is written a word at a time.
+static void write_fifo(uint8_t ep, const uint8_t* data, size_t length)
+{
+	auto fifo = usb_fifo(ep);
+
+	for(size_t i = 0; i < length; i += sizeof(uint32_t))
+	{
+		uint32_t word = 0;
+		memcpy(&word, &data[i], std::min(sizeof(word), length - i));
+		*fifo = word;
+	}
+}
+
+/** Read a packet from the RX FIFO.
+ *
+ * @param [in] data The destination, which receives the first length bytes of the packet.
+ * @param [in] length The number of bytes to keep.
+ * @param [in] count The size of the packet. All of it must be read from the FIFO.
+ */
+static void read_fifo(uint8_t* data, size_t length, size_t count)
+{
+	auto fifo = usb_fifo(0);
+
+	for(size_t i = 0; i < count; i += sizeof(uint32_t))
+	{
+		uint32_t word = *fifo;
+		if(i < length)
+		{
+			memcpy(&data[i], &word, std::min(sizeof(word), length - i));
+		}
+	}
+}
+
+static void flush_tx_fifo(uint32_t fifo)
+{
+	WRITE_REG(USB_OTG_FS->GRSTCTL,
+			  USB_OTG_GRSTCTL_TXFFLSH | (fifo << USB_OTG_GRSTCTL_TXFNUM_Pos));
+	while(READ_BIT(USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_TXFFLSH))
+	{
+	}
+}
+
+static void flush_rx_fifo()
+{
+	WRITE_REG(USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_RXFFLSH);
+	while(READ_BIT(USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_RXFFLSH))
+	{
+	}
+}
+
+static void core_reset()
+{
+	while(!READ_BIT(USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_AHBIDL))
+	{
+	}
+
+	SET_BIT(USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_CSRST);
+	while(READ_BIT(USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_CSRST))
+	{
+	}
+}
+
+/// The RX FIFO is at the start of the FIFO RAM, followed by the TX FIFOs for endpoints 0-3
+static void configure_fifos()
+{
+	uint32_t start = RX_FIFO_WORDS;
+
+	WRITE_REG(USB_OTG_FS->GRXFSIZ, RX_FIFO_WORDS);
+	WRITE_REG(USB_OTG_FS->DIEPTXF0_HNPTXFSIZ, (TX_FIFO_WORDS[0] << 16) | start);
+	start += TX_FIFO_WORDS[0];
+
+	for(size_t i = 1; i < TX_FIFO_WORDS.size(); i++)
+	{
+		WRITE_REG(USB_OTG_FS->DIEPTXF[i - 1], (TX_FIFO_WORDS[i] << 16) | start);
+		start += TX_FIFO_WORDS[i];
+	}
+}
+
+/// Arm endpoint 0 to receive SETUP packets
+static void control_setup_start()
+{
+	WRITE_REG(usb_out(0)->DOEPTSIZ, (3U << USB_OTG_DOEPTSIZ_STUPCNT_Pos) |
+										(1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | (3U * 8U));
+}
+
+/// Write the 96-bit unique device ID as 24 hex digits
+static void format_serial_number(char* serial)
+{
+	constexpr char digits[] = "0123456789ABCDEF";
+	auto uid = reinterpret_cast<const uint32_t*>(UID_BASE);
+	size_t n = 0;
+
+	for(size_t word = 0; word < 3; word++)
+	{
+		uint32_t value = uid[word];
+		for(int shift = 28; shift >= 0; shift -= 4)
+		{
+			serial[n++] = digits[(value >> shift) & 0xF];
+		}
+	}
+
+	serial[n] = '\0';
+}
+
+#pragma mark - Interrupt Handlers -
+
+extern "C" void OTG_FS_IRQHandler(void);
+
+void OTG_FS_IRQHandler()
+{
+	if(usb_callback)
+	{
+		usb_callback();
+	}
+	else
+	{
+		CLEAR_BIT(USB_OTG_FS->GAHBCFG, USB_OTG_GAHBCFG_GINT);
+	}
+}
+
+#pragma mark - Driver APIs -
+
+void STM32USBDevice::start_() noexcept
+{
+	assert(pins_); // Pins must be configured with configurePins()
+
+	for(size_t i = 0; i < pin_count_; i++)
+	{
+		STM32GPIOTranslator::configure_alternate(pins_[i].port, pins_[i].pin, pins_[i].af);
+	}
+
+	STM32ClockControl::usbEnable();
+
+	auto usb = USB_OTG_FS;
+	auto dev = usb_device();
+
+	CLEAR_BIT(usb->GAHBCFG, USB_OTG_GAHBCFG_GINT);
+	core_reset();
+
+	// Power up the embedded full-speed transceiver, and force device mode
+	SET_BIT(usb->GCCFG, USB_OTG_GCCFG_PWRDWN);
+	MODIFY_REG(usb->GUSBCFG,
+			   USB_OTG_GUSBCFG_FHMOD | USB_OTG_GUSBCFG_FDMOD | USB_OTG_GUSBCFG_TRDT,
+			   USB_OTG_GUSBCFG_FDMOD | (TURNAROUND_TIME << USB_OTG_GUSBCFG_TRDT_Pos));
+	spin_cycles(FORCE_MODE_DELAY_MS * (SystemCoreClock / 1000));
+
+	// VBUS is not sensed, so the B-session valid signal is forced
+	CLEAR_BIT(usb->GCCFG, USB_OTG_GCCFG_VBDEN);
+	SET_BIT(usb->GOTGCTL, USB_OTG_GOTGCTL_BVALOEN | USB_OTG_GOTGCTL_BVALOVAL);
+
+	*usb_pcgcctl() = 0;
+
+	// Stay disconnected until the core is configured
+	SET_BIT(dev->DCTL, USB_OTG_DCTL_SDIS);
+	SET_BIT(dev->DCFG, USB_OTG_DCFG_DSPD); // Full speed, embedded PHY
+
+	configure_fifos();
+	flush_tx_fifo(ALL_TX_FIFOS);
+	flush_rx_fifo();
+
+	WRITE_REG(dev->DIEPMSK, 0);
+	WRITE_REG(dev->DOEPMSK, 0);
+	WRITE_REG(dev->DAINTMSK, 0);
+	WRITE_REG(dev->DIEPEMPMSK, 0);
+
+	for(uint8_t i = 0; i < NUM_DEVICE_ENDPOINTS; i++)
+	{
+		auto in = usb_in(i);
+		auto out = usb_out(i);
+
+		WRITE_REG(in->DIEPCTL, READ_BIT(in->DIEPCTL, USB_OTG_DIEPCTL_EPENA)
+								   ? (USB_OTG_DIEPCTL_EPDIS | USB_OTG_DIEPCTL_SNAK)
+								   : 0);
+		WRITE_REG(in->DIEPTSIZ, 0);
+		WRITE_REG(in->DIEPINT, EP_INTERRUPT_FLAGS);
+
+		WRITE_REG(out->DOEPCTL, READ_BIT(out->DOEPCTL, USB_OTG_DOEPCTL_EPENA)
+									? (USB_OTG_DOEPCTL_EPDIS | USB_OTG_DOEPCTL_SNAK)
+									: 0);
+		WRITE_REG(out->DOEPTSIZ, 0);
+		WRITE_REG(out->DOEPINT, EP_INTERRUPT_FLAGS);
+	}
+
+	WRITE_REG(usb->GINTMSK, 0);
+	WRITE_REG(usb->GINTSTS, 0xBFFFFFFF);
+	WRITE_REG(usb->GINTMSK, USB_OTG_GINTMSK_USBRST | USB_OTG_GINTMSK_ENUMDNEM |
+								USB_OTG_GINTMSK_RXFLVLM | USB_OTG_GINTMSK_OEPINT |
+								USB_OTG_GINTMSK_IEPINT | USB_OTG_GINTMSK_USBSUSPM |
+								USB_OTG_GINTMSK_WUIM);
+
+	usb_callback = [this]() { interruptHandler(); };
+
+	// The ISR completes transfers, so it must be compatible with the RTOS (if used)
+	NVICControl::priority(OTG_FS_IRQn, STM32_COMPLETION_IRQ_PRIORITY);
+	NVICControl::enable(OTG_FS_IRQn);
+
+	SET_BIT(usb->GAHBCFG, USB_OTG_GAHBCFG_GINT);
+
+	// Connect the DP pull-up, so the host detects the device
+	CLEAR_BIT(dev->DCTL, USB_OTG_DCTL_SDIS);
+}
+
+void STM32USBDevice::stop_() noexcept
+{
+	auto usb = USB_OTG_FS;
+
+	SET_BIT(usb_device()->DCTL, USB_OTG_DCTL_SDIS);
+	CLEAR_BIT(usb->GAHBCFG, USB_OTG_GAHBCFG_GINT);
+	NVICControl::disable(OTG_FS_IRQn);
+	usb_callback = nullptr;
+
+	setConfiguration(0);
+	dtr_ = false;
+
+	flush_tx_fifo(ALL_TX_FIFOS);
+	flush_rx_fifo();
+	CLEAR_BIT(usb->GCCFG, USB_OTG_GCCFG_PWRDWN);
+
+	STM32ClockControl::usbDisable();
+
+	for(size_t i = 0; i < pin_count_; i++)
+	{
+		STM32GPIOTranslator::configure_default(pins_[i].port, pins_[i].pin);
+	}
+}
+
+STM32USBDevice::status STM32USBDevice::write(stream s, const void* data, size_t length,
+											 const cb_t& cb) noexcept
+{
+	// The buffer is only read by the driver
+	return enqueue(s, true, const_cast<void*>(data), length, cb);
+}
+
+STM32USBDevice::status STM32USBDevice::read(stream s, void* data, size_t length,
+											const cb_t& cb) noexcept
+{
+	assert(length > 0 && (length % PACKET_SIZE) == 0);
+	return enqueue(s, false, data, length, cb);
+}
+
+#pragma mark - Transfers -
+
+STM32USBDevice::status STM32USBDevice::enqueue(stream s, bool in, void* data, size_t length,
+											   const cb_t& cb) noexcept
+{
+	assert(started());
+	assert(s < NUM_STREAMS);
+	assert(data || length == 0);
+
+	STM32InterruptLock lock;
+
+	if(!configured())
+	{
+		return status::not_configured;
+	}
+
+	auto& ep = in ? in_[s] : out_[s];
+
+	if(!ep.queue.push({{data, length, 0}, cb}))
+	{
+		return status::busy;
+	}
+
+	if(!ep.active)
+	{
+		ep.active = true;
+		startTransfer(s, in);
+	}
+
+	return status::enqueued;
+}
+
+// Called with interrupts masked, or from the USB ISR
+void STM32USBDevice::startTransfer(stream s, bool in) noexcept
+{
+	auto& ep = in ? in_[s] : out_[s];
+	const auto& t = ep.queue.front().transfer;
+	uint8_t n = stream_endpoint(s);
+	size_t chunk = std::min(t.length - ep.offset, MAX_CHUNK);
+
+	ep.chunk_end = ep.offset + chunk;
+
+	if(in)
+	{
+		// A zero-length chunk sends a zero-length packet
+		uint32_t packets = chunk ? static_cast<uint32_t>((chunk + PACKET_SIZE - 1) / PACKET_SIZE)
+								 : 1;
+
+		WRITE_REG(usb_in(n)->DIEPTSIZ, (packets << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | chunk);
+		SET_BIT(usb_in(n)->DIEPCTL, USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA);
+
+		// The FIFO is filled from the TXFE interrupt
+		if(chunk)
+		{
+			SET_BIT(usb_device()->DIEPEMPMSK, 1U << n);
+		}
+	}
+	else
+	{
+		auto packets = static_cast<uint32_t>(chunk / PACKET_SIZE);
+
+		WRITE_REG(usb_out(n)->DOEPTSIZ, (packets << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | chunk);
+		SET_BIT(usb_out(n)->DOEPCTL, USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA);
+	}
+}
+
+// Called from the USB ISR
+void STM32USBDevice::fillTxFifo(stream s) noexcept
+{
+	auto& ep = in_[s];
+	uint8_t n = stream_endpoint(s);
+
+	if(ep.active)
+	{
+		auto data = static_cast<const uint8_t*>(ep.queue.front().transfer.buffer);
+
+		while(ep.offset < ep.chunk_end)
+		{
+			size_t length = std::min(PACKET_SIZE, ep.chunk_end - ep.offset);
+			size_t words = (length + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+			if((READ_REG(usb_in(n)->DTXFSTS) & USB_OTG_DTXFSTS_INEPTFSAV) < words)
+			{
+				return;
+			}
+
+			write_fifo(n, &data[ep.offset], length);
+			ep.offset += length;
+		}
+	}
+
+	CLEAR_BIT(usb_device()->DIEPEMPMSK, 1U << n);
+}
+
+void STM32USBDevice::transferComplete(stream s, bool in, status st) noexcept
+{
+	auto& ep = in ? in_[s] : out_[s];
+	queued_transfer_t completed;
+
+	{
+		STM32InterruptLock lock;
+
+		completed = std::move(ep.queue.front());
+		completed.transfer.actual = ep.offset;
+		ep.queue.pop();
+		ep.offset = 0;
+		ep.short_packet = false;
+
+		// Start the next transfer before running the callback to keep the endpoint busy
+		if(ep.queue.empty())
+		{
+			ep.active = false;
+		}
+		else
+		{
+			startTransfer(s, in);
+		}
+	}
+
+	// TODO: dispatch this to an IRQ bottom-half handler
+	if(completed.cb)
+	{
+		completed.cb(completed.transfer, st);
+	}
+}
+
+void STM32USBDevice::abortTransfers() noexcept
+{
+	for(uint8_t s = 0; s < NUM_STREAMS; s++)
+	{
+		for(auto ep : {&in_[s], &out_[s]})
+		{
+			while(true)
+			{
+				queued_transfer_t aborted;
+
+				{
+					STM32InterruptLock lock;
+
+					ep->active = false;
+					if(ep->queue.empty())
+					{
+						break;
+					}
+
+					aborted = std::move(ep->queue.front());
+					aborted.transfer.actual = ep->offset;
+					ep->queue.pop();
+					ep->offset = 0;
+					ep->short_packet = false;
+				}
+
+				if(aborted.cb)
+				{
+					aborted.cb(aborted.transfer, status::error);
+				}
+			}
+		}
+	}
+}
+
+void STM32USBDevice::setConfiguration(uint8_t configuration) noexcept
+{
+	auto dev = usb_device();
+	bool was_configured = configured();
+
+	if(was_configured)
+	{
+		configuration_ = 0;
+
+		for(uint8_t n = 1; n < NUM_ENDPOINTS; n++)
+		{
+			auto in = usb_in(n);
+			auto out = usb_out(n);
+
+			if(READ_BIT(in->DIEPCTL, USB_OTG_DIEPCTL_EPENA))
+			{
+				SET_BIT(in->DIEPCTL, USB_OTG_DIEPCTL_EPDIS | USB_OTG_DIEPCTL_SNAK);
+			}
+			CLEAR_BIT(in->DIEPCTL, USB_OTG_DIEPCTL_USBAEP);
+
+			if(READ_BIT(out->DOEPCTL, USB_OTG_DOEPCTL_EPENA))
+			{
+				SET_BIT(out->DOEPCTL, USB_OTG_DOEPCTL_EPDIS | USB_OTG_DOEPCTL_SNAK);
+			}
+			CLEAR_BIT(out->DOEPCTL, USB_OTG_DOEPCTL_USBAEP);
+
+			CLEAR_BIT(dev->DAINTMSK, (1U << n) | (1U << (n + 16)));
+			CLEAR_BIT(dev->DIEPEMPMSK, 1U << n);
+			flush_tx_fifo(n);
+		}
+
+		abortTransfers();
+	}
+
+	if(configuration)
+	{
+		WRITE_REG(usb_in(NOTIFICATION_ENDPOINT)->DIEPCTL,
+				  NOTIFICATION_PACKET_SIZE | (EP_TYPE_INTERRUPT << USB_OTG_DIEPCTL_EPTYP_Pos) |
+					  (uint32_t(NOTIFICATION_ENDPOINT) << USB_OTG_DIEPCTL_TXFNUM_Pos) |
+					  USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_USBAEP |
+					  USB_OTG_DIEPCTL_SNAK);
+		SET_BIT(dev->DAINTMSK, 1U << NOTIFICATION_ENDPOINT);
+
+		for(uint8_t s = 0; s < NUM_STREAMS; s++)
+		{
+			uint32_t n = stream_endpoint(static_cast<stream>(s));
+
+			WRITE_REG(usb_in(n)->DIEPCTL,
+					  PACKET_SIZE | (EP_TYPE_BULK << USB_OTG_DIEPCTL_EPTYP_Pos) |
+						  (n << USB_OTG_DIEPCTL_TXFNUM_Pos) | USB_OTG_DIEPCTL_SD0PID_SEVNFRM |
+						  USB_OTG_DIEPCTL_USBAEP | USB_OTG_DIEPCTL_SNAK);
+			WRITE_REG(usb_out(n)->DOEPCTL,
+					  PACKET_SIZE | (EP_TYPE_BULK << USB_OTG_DOEPCTL_EPTYP_Pos) |
+						  USB_OTG_DOEPCTL_SD0PID_SEVNFRM | USB_OTG_DOEPCTL_USBAEP |
+						  USB_OTG_DOEPCTL_SNAK);
+			SET_BIT(dev->DAINTMSK, (1U << n) | (1U << (n + 16)));
+		}
+
+		configuration_ = configuration;
+	}
+
+	if(configured_cb_ && (configuration || was_configured))
+	{
+		configured_cb_(configuration != 0);
+	}
+}
+
+bool STM32USBDevice::setEndpointHalt(uint16_t endpoint, bool halt) noexcept
+{
+	uint8_t n = endpoint & 0x7F;
+
+	if(n == 0 || n >= NUM_ENDPOINTS || !configured())
+	{
+		// Endpoint 0 halts are cleared by the next SETUP packet
+		return n == 0;
+	}
+
+	// Clearing a halt also resets the data toggle
+	if(endpoint & 0x80)
+	{
+		auto in = usb_in(n);
+		if(halt)
+		{
+			SET_BIT(in->DIEPCTL, USB_OTG_DIEPCTL_STALL);
+		}
+		else
+		{
+			CLEAR_BIT(in->DIEPCTL, USB_OTG_DIEPCTL_STALL);
+			SET_BIT(in->DIEPCTL, USB_OTG_DIEPCTL_SD0PID_SEVNFRM);
+		}
+	}
+	else
+	{
+		auto out = usb_out(n);
+		if(halt)
+		{
+			SET_BIT(out->DOEPCTL, USB_OTG_DOEPCTL_STALL);
+		}
+		else
+		{
+			CLEAR_BIT(out->DOEPCTL, USB_OTG_DOEPCTL_STALL);
+			SET_BIT(out->DOEPCTL, USB_OTG_DOEPCTL_SD0PID_SEVNFRM);
+		}
+	}
+
+	return true;
+}
+
+#pragma mark - Interrupt Handling -
+
+// Called from the USB ISR
+void STM32USBDevice::interruptHandler() noexcept
+{
+	auto usb = USB_OTG_FS;
+	uint32_t flags = READ_REG(usb->GINTSTS) & READ_REG(usb->GINTMSK);
+
+	if(flags & USB_OTG_GINTSTS_USBRST)
+	{
+		WRITE_REG(usb->GINTSTS, USB_OTG_GINTSTS_USBRST);
+		handleReset();
+	}
+
+	if(flags & USB_OTG_GINTSTS_ENUMDNE)
+	{
+		WRITE_REG(usb->GINTSTS, USB_OTG_GINTSTS_ENUMDNE);
+		handleEnumerationDone();
+	}
+
+	if(flags & USB_OTG_GINTSTS_RXFLVL)
+	{
+		CLEAR_BIT(usb->GINTMSK, USB_OTG_GINTMSK_RXFLVLM);
+		while(READ_BIT(usb->GINTSTS, USB_OTG_GINTSTS_RXFLVL))
+		{
+			handleRxFifo();
+		}
+		SET_BIT(usb->GINTMSK, USB_OTG_GINTMSK_RXFLVLM);
+	}
+
+	if(flags & USB_OTG_GINTSTS_OEPINT)
+	{
+		handleOutEndpoints();
+	}
+
+	if(flags & USB_OTG_GINTSTS_IEPINT)
+	{
+		handleInEndpoints();
+	}
+
+	// Queued transfers wait for the host to resume the bus (or reset it)
+	WRITE_REG(usb->GINTSTS, flags & (USB_OTG_GINTSTS_USBSUSP | USB_OTG_GINTSTS_WKUINT));
+}
+
+void STM32USBDevice::handleReset() noexcept
+{
+	auto dev = usb_device();
+
+	setConfiguration(0);
+	dtr_ = false;
+
+	CLEAR_BIT(dev->DCTL, USB_OTG_DCTL_RWUSIG);
+	flush_tx_fifo(ALL_TX_FIFOS);
+
+	for(uint8_t i = 0; i < NUM_ENDPOINTS; i++)
+	{
+		WRITE_REG(usb_in(i)->DIEPINT, EP_INTERRUPT_FLAGS);
+		CLEAR_BIT(usb_in(i)->DIEPCTL, USB_OTG_DIEPCTL_STALL);
+		WRITE_REG(usb_out(i)->DOEPINT, EP_INTERRUPT_FLAGS);
+		CLEAR_BIT(usb_out(i)->DOEPCTL, USB_OTG_DOEPCTL_STALL);
+		SET_BIT(usb_out(i)->DOEPCTL, USB_OTG_DOEPCTL_SNAK);
+	}
+
+	WRITE_REG(dev->DAINTMSK, (1U << 0) | (1U << 16));
+	WRITE_REG(dev->DOEPMSK, USB_OTG_DOEPMSK_STUPM | USB_OTG_DOEPMSK_XFRCM);
+	WRITE_REG(dev->DIEPMSK, USB_OTG_DIEPMSK_XFRCM);
+	WRITE_REG(dev->DIEPEMPMSK, 0);
+	CLEAR_BIT(dev->DCFG, USB_OTG_DCFG_DAD);
+
+	control_state_ = control_state::idle;
+	control_setup_start();
+}
+
+void STM32USBDevice::handleEnumerationDone() noexcept
+{
+	// MPSIZ = 0 selects 64-byte packets on endpoint 0
+	CLEAR_BIT(usb_in(0)->DIEPCTL, USB_OTG_DIEPCTL_MPSIZ);
+	SET_BIT(usb_device()->DCTL, USB_OTG_DCTL_CGINAK);
+}
+
+void STM32USBDevice::handleRxFifo() noexcept
+{
+	static_assert(sizeof(setup_t) == 8, "SETUP packets are 8 bytes");
+
+	uint32_t rx_status = READ_REG(USB_OTG_FS->GRXSTSP);
+	auto n = static_cast<uint8_t>(rx_status & USB_OTG_GRXSTSP_EPNUM);
+	size_t count = (rx_status & USB_OTG_GRXSTSP_BCNT) >> USB_OTG_GRXSTSP_BCNT_Pos;
+	uint32_t packet_status = (rx_status & USB_OTG_GRXSTSP_PKTSTS) >> USB_OTG_GRXSTSP_PKTSTS_Pos;
+
+	if(packet_status == PKTSTS_SETUP_DATA)
+	{
+		read_fifo(reinterpret_cast<uint8_t*>(&setup_), sizeof(setup_), count);
+	}
+	else if(packet_status == PKTSTS_OUT_DATA && n == 0)
+	{
+		size_t length = std::min(count, ep0_buffer_.size() - control_received_);
+		read_fifo(&ep0_buffer_[control_received_], length, count);
+		control_received_ += length;
+	}
+	else if(packet_status == PKTSTS_OUT_DATA && n >= stream_endpoint(cdc) &&
+			n < stream_endpoint(NUM_STREAMS))
+	{
+		auto& ep = out_[n - stream_endpoint(cdc)];
+
+		if(ep.active)
+		{
+			auto data = static_cast<uint8_t*>(ep.queue.front().transfer.buffer);
+			size_t length = std::min(count, ep.chunk_end - ep.offset);
+
+			read_fifo(&data[ep.offset], length, count);
+			ep.offset += length;
+		}
+		else
+		{
+			read_fifo(nullptr, 0, count);
+		}
+
+		// A short packet ends the transfer
+		if(count < PACKET_SIZE)
+		{
+			ep.short_packet = true;
+		}
+	}
+	else
+	{
+		read_fifo(nullptr, 0, count);
+	}
+}
+
+void STM32USBDevice::handleInEndpoints() noexcept
+{
+	auto dev = usb_device();
+	uint32_t pending = READ_REG(dev->DAINT) & READ_REG(dev->DAINTMSK) & 0xFFFF;
+
+	for(uint8_t n = 0; pending; n++, pending >>= 1)
+	{
+		if(!(pending & 1))
+		{
+			continue;
+		}
+
+		auto in = usb_in(n);
+		uint32_t flags = READ_REG(in->DIEPINT) & READ_REG(dev->DIEPMSK);
+		WRITE_REG(in->DIEPINT, flags);
+
+		if(n == 0)
+		{
+			if(flags & USB_OTG_DIEPINT_XFRC)
+			{
+				controlInComplete();
+			}
+			continue;
+		}
+
+		if(n < stream_endpoint(cdc))
+		{
+			continue;
+		}
+
+		auto s = static_cast<stream>(n - stream_endpoint(cdc));
+		auto& ep = in_[s];
+
+		if((flags & USB_OTG_DIEPINT_XFRC) && ep.active)
+		{
+			const auto& t = ep.queue.front().transfer;
+
+			if(ep.offset < t.length)
+			{
+				startTransfer(s, true);
+			}
+			else if(s == cdc && t.length && (t.length % PACKET_SIZE) == 0 && !ep.short_packet)
+			{
+				// Terminate the CDC transfer with a zero-length packet
+				ep.short_packet = true;
+				startTransfer(s, true);
+			}
+			else
+			{
+				transferComplete(s, true, status::ok);
+			}
+		}
+
+		if(READ_BIT(dev->DIEPEMPMSK, 1U << n))
+		{
+			fillTxFifo(s);
+		}
+	}
+}
+
+void STM32USBDevice::handleOutEndpoints() noexcept
+{
+	auto dev = usb_device();
+	uint32_t pending = (READ_REG(dev->DAINT) & READ_REG(dev->DAINTMSK)) >> 16;
+
+	for(uint8_t n = 0; pending; n++, pending >>= 1)
+	{
+		if(!(pending & 1))
+		{
+			continue;
+		}
+
+		auto out = usb_out(n);
+		uint32_t flags = READ_REG(out->DOEPINT) & READ_REG(dev->DOEPMSK);
+		WRITE_REG(out->DOEPINT, flags);
+
+		if(n == 0)
+		{
+			if(flags & USB_OTG_DOEPINT_XFRC)
+			{
+				controlOutComplete();
+			}
+
+			if(flags & USB_OTG_DOEPINT_STUP)
+			{
+				handleSetup();
+			}
+			continue;
+		}
+
+		if(n < stream_endpoint(cdc) || !(flags & USB_OTG_DOEPINT_XFRC))
+		{
+			continue;
+		}
+
+		auto s = static_cast<stream>(n - stream_endpoint(cdc));
+		auto& ep = out_[s];
+
+		if(ep.active)
+		{
+			if(!ep.short_packet && ep.offset < ep.queue.front().transfer.length)
+			{
+				startTransfer(s, false);
+			}
+			else
+			{
+				transferComplete(s, false, status::ok);
+			}
+		}
+	}
+}
+
+#pragma mark - Control Transfers -
+
+void STM32USBDevice::handleSetup() noexcept
+{
+	bool handled = false;
+
+	control_setup_start();
+	control_state_ = control_state::idle;
+	control_zlp_ = false;
+
+	switch(setup_.request_type & REQUEST_TYPE_MASK)
+	{
+		case REQUEST_TYPE_STANDARD:
+			handled = standardRequest();
+			break;
+		case REQUEST_TYPE_CLASS:
+			handled = classRequest();
+			break;
+		default:
+			break;
+	}
+
+	if(!handled)
+	{
+		controlStall();
+	}
+	else if(control_state_ == control_state::idle)
+	{
+		// No data stage: acknowledge with a zero-length status packet
+		control_data_ = nullptr;
+		control_remaining_ = 0;
+		control_state_ = control_state::status_in;
+		controlSendPacket();
+	}
+}
+
+bool STM32USBDevice::standardRequest() noexcept
+{
+	uint8_t recipient = setup_.request_type & RECIPIENT_MASK;
+
+	switch(setup_.request)
+	{
+		case GET_STATUS:
+			ep0_buffer_[0] = 0;
+			ep0_buffer_[1] = 0;
+
+			if(recipient == RECIPIENT_ENDPOINT)
+			{
+				uint8_t n = setup_.index & 0x7F;
+				if(n >= NUM_ENDPOINTS)
+				{
+					return false;
+				}
+
+				uint32_t ctl = (setup_.index & 0x80) ? READ_REG(usb_in(n)->DIEPCTL)
+													 : READ_REG(usb_out(n)->DOEPCTL);
+				ep0_buffer_[0] = (ctl & USB_OTG_DIEPCTL_STALL) ? 1 : 0;
+			}
+
+			controlSend(ep0_buffer_.data(), 2);
+			return true;
+		case CLEAR_FEATURE:
+		case SET_FEATURE:
+			// Remote wakeup is not supported, so only endpoint halts can be changed
+			return recipient == RECIPIENT_ENDPOINT && setup_.value == FEATURE_ENDPOINT_HALT &&
+				   setEndpointHalt(setup_.index, setup_.request == SET_FEATURE);
+		case SET_ADDRESS:
+			// The new address takes effect after the status stage
+			MODIFY_REG(usb_device()->DCFG, USB_OTG_DCFG_DAD,
+					   (setup_.value & 0x7FU) << USB_OTG_DCFG_DAD_Pos);
+			return true;
+		case GET_DESCRIPTOR:
+			return getDescriptor();
+		case GET_CONFIGURATION:
+			ep0_buffer_[0] = configuration_;
+			controlSend(ep0_buffer_.data(), 1);
+			return true;
+		case SET_CONFIGURATION:
+			if(setup_.value > 1)
+			{
+				return false;
+			}
+			setConfiguration(static_cast<uint8_t>(setup_.value));
+			return true;
+		case GET_INTERFACE:
+			if(!configured() || setup_.index >= NUM_INTERFACES)
+			{
+				return false;
+			}
+			ep0_buffer_[0] = 0;
+			controlSend(ep0_buffer_.data(), 1);
+			return true;
+		case SET_INTERFACE:
+			// Each interface only has the default alternate setting
+			return configured() && setup_.index < NUM_INTERFACES && setup_.value == 0;
+		default:
+			return false;
+	}
+}
+
+bool STM32USBDevice::classRequest() noexcept
+{
+	if((setup_.request_type & RECIPIENT_MASK) != RECIPIENT_INTERFACE ||
+	   (setup_.index & 0xFF) != CDC_COMM_INTERFACE)
+	{
+		return false;
+	}
+
+	switch(setup_.request)
+	{
+		case CDC_SET_LINE_CODING:
+			if(setup_.length < LINE_CODING_SIZE || setup_.length > ep0_buffer_.size())
+			{
+				return false;
+			}
+			control_state_ = control_state::data_out;
+			controlReceive();
+			return true;
+		case CDC_GET_LINE_CODING:
+			memcpy(&ep0_buffer_[0], &line_coding_.baudrate, sizeof(line_coding_.baudrate));
+			ep0_buffer_[4] = line_coding_.stop_bits;
+			ep0_buffer_[5] = line_coding_.parity;
+			ep0_buffer_[6] = line_coding_.data_bits;
+			controlSend(ep0_buffer_.data(), LINE_CODING_SIZE);
+			return true;
+		case CDC_SET_CONTROL_LINE_STATE:
+			dtr_ = (setup_.value & 0x1) != 0;
+			return true;
+		case CDC_SEND_BREAK:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void STM32USBDevice::controlDataReceived() noexcept
+{
+	if(setup_.request == CDC_SET_LINE_CODING && control_received_ >= LINE_CODING_SIZE)
+	{
+		memcpy(&line_coding_.baudrate, &ep0_buffer_[0], sizeof(line_coding_.baudrate));
+		line_coding_.stop_bits = ep0_buffer_[4];
+		line_coding_.parity = ep0_buffer_[5];
+		line_coding_.data_bits = ep0_buffer_[6];
+	}
+}
+
+bool STM32USBDevice::getDescriptor() noexcept
+{
+	auto type = static_cast<uint8_t>(setup_.value >> 8);
+	auto index = static_cast<uint8_t>(setup_.value & 0xFF);
+
+	switch(type)
+	{
+		case DESCRIPTOR_DEVICE:
+			std::copy(device_descriptor.begin(), device_descriptor.end(), ep0_buffer_.begin());
+			ep0_buffer_[8] = config_.vendor_id & 0xFF;
+			ep0_buffer_[9] = config_.vendor_id >> 8;
+			ep0_buffer_[10] = config_.product_id & 0xFF;
+			ep0_buffer_[11] = config_.product_id >> 8;
+			controlSend(ep0_buffer_.data(), device_descriptor.size());
+			return true;
+		case DESCRIPTOR_CONFIGURATION:
+			// Sent directly from flash
+			controlSend(configuration_descriptor.data(), configuration_descriptor.size());
+			return true;
+		case DESCRIPTOR_STRING:
+		{
+			size_t length = stringDescriptor(index);
+			if(length == 0)
+			{
+				return false;
+			}
+			controlSend(ep0_buffer_.data(), length);
+			return true;
+		}
+		default:
+			// e.g., the device qualifier, which full-speed only devices do not have
+			return false;
+	}
+}
+
+size_t STM32USBDevice::stringDescriptor(uint8_t index) noexcept
+{
+	char serial[25];
+	const char* text = nullptr;
+
+	switch(index)
+	{
+		case 0:
+			// Supported languages: US English
+			ep0_buffer_[0] = 4;
+			ep0_buffer_[1] = DESCRIPTOR_STRING;
+			ep0_buffer_[2] = 0x09;
+			ep0_buffer_[3] = 0x04;
+			return 4;
+		case STRING_MANUFACTURER:
+			text = config_.manufacturer;
+			break;
+		case STRING_PRODUCT:
+			text = config_.product;
+			break;
+		case STRING_SERIAL:
+			format_serial_number(serial);
+			text = serial;
+			break;
+		case STRING_VENDOR_INTERFACE:
+			text = "Bulk Stream";
+			break;
+		default:
+			return 0;
+	}
+
+	// Strings are UTF-16LE. Longer strings are truncated to fit in a single packet.
+	size_t length = 2;
+	for(size_t i = 0; text && text[i] && (length + 2) <= ep0_buffer_.size(); i++)
+	{
+		ep0_buffer_[length++] = static_cast<uint8_t>(text[i]);
+		ep0_buffer_[length++] = 0;
+	}
+
+	ep0_buffer_[0] = static_cast<uint8_t>(length);
+	ep0_buffer_[1] = DESCRIPTOR_STRING;
+	return length;
+}
+
+void STM32USBDevice::controlSend(const uint8_t* data, size_t length) noexcept
+{
+	assert(setup_.request_type & REQUEST_DIRECTION_IN);
+
+	control_data_ = data;
+	control_remaining_ = std::min(length, static_cast<size_t>(setup_.length));
+	// The host expects more data, so a final full packet is followed by a zero-length packet
+	control_zlp_ = (control_remaining_ < setup_.length) &&
+				   (control_remaining_ % CONTROL_PACKET_SIZE) == 0;
+	control_state_ = control_state::data_in;
+	controlSendPacket();
+}
+
+void STM32USBDevice::controlSendPacket() noexcept
+{
+	auto in = usb_in(0);
+	size_t length = std::min(control_remaining_, CONTROL_PACKET_SIZE);
+
+	WRITE_REG(in->DIEPTSIZ, (1U << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | length);
+	SET_BIT(in->DIEPCTL, USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA);
+
+	// TX FIFO 0 holds a full packet, and it is empty since the previous packet was sent
+	if(length)
+	{
+		write_fifo(0, control_data_, length);
+		control_data_ += length;
+		control_remaining_ -= length;
+	}
+}
+
+void STM32USBDevice::controlReceive() noexcept
+{
+	auto out = usb_out(0);
+
+	control_received_ = 0;
+	WRITE_REG(out->DOEPTSIZ, (3U << USB_OTG_DOEPTSIZ_STUPCNT_Pos) |
+								 (1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | CONTROL_PACKET_SIZE);
+	SET_BIT(out->DOEPCTL, USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA);
+}
+
+void STM32USBDevice::controlStall() noexcept
+{
+	// Both directions are stalled, since the host may be in the data or status stage
+	SET_BIT(usb_in(0)->DIEPCTL, USB_OTG_DIEPCTL_STALL);
+	SET_BIT(usb_out(0)->DOEPCTL, USB_OTG_DOEPCTL_STALL);
+	control_state_ = control_state::idle;
+}
+
+void STM32USBDevice::controlInComplete() noexcept
+{
+	switch(control_state_)
+	{
+		case control_state::data_in:
+			if(control_remaining_ || control_zlp_)
+			{
+				control_zlp_ = control_remaining_ ? control_zlp_ : false;
+				controlSendPacket();
+			}
+			else
+			{
+				control_state_ = control_state::status_out;
+				controlReceive();
+			}
+			break;
+		case control_state::status_in:
+			control_state_ = control_state::idle;
+			break;
+		default:
+			break;
+	}
+}
+
+void STM32USBDevice::controlOutComplete() noexcept
+{
+	switch(control_state_)
+	{
+		case control_state::data_out:
+			controlDataReceived();
+			control_data_ = nullptr;
+			control_remaining_ = 0;
+			control_state_ = control_state::status_in;
+			controlSendPacket();
+			break;
+		case control_state::status_out:
+			control_state_ = control_state::idle;
+			break;
+		default:
+			break;
+	}
+}
@@ -0,0 +1,320 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_USB_DEVICE_HPP_
+#define STM32_USB_DEVICE_HPP_
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <driver/driver.hpp>
+#include <driver/gpio.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <static_queue.hpp>
+
+// TODO: Handle interrupt priority - as a constructor parameter
+// TODO: VBUS sensing, remote wakeup, and MS OS 2.0 descriptors (so that Windows binds WinUSB to
+// the vendor interface without an INF file)
+
+/** STM32L4+ USB OTG FS device driver.
+ *
+ * The device is a full-speed composite device with two data streams:
+ *	- stream::cdc: a CDC-ACM virtual COM port (interfaces 0 and 1), which works with the
+ *		operating system's serial driver.
+ *	- stream::vendor: a vendor-specific interface (interface 2) with a bulk IN and a bulk OUT
+ *		endpoint, for use with libusb (or WinUSB). This avoids the serial driver overhead for
+ *		high-throughput streaming.
+ *
+ * Endpoint buffers are zero-copy: write() and read() take the caller's buffer, and the driver
+ * moves data directly between that buffer and the USB FIFOs. The buffer must remain valid (and,
+ * for writes, unchanged) until the callback is invoked. Buffers can have any alignment and
+ * size, and transfers larger than the endpoint's packet size are split into packets by the
+ * hardware.
+ *
+ * Each stream has a queue of transfers in each direction. The next transfer starts as soon as
+ * the previous one completes, before its callback runs. The IN FIFOs hold at least two packets,
+ * so the next packet is already in the FIFO while the current one is sent. Full-speed bulk
+ * endpoints can move about 1.2 MB/s. To reach that, keep two or more transfers of a few KiB
+ * queued, and refill each buffer from its callback:
+ *
+ * @code
+ * void sent(const STM32USBDevice::transfer_t& t, STM32USBDevice::status s)
+ * {
+ *	// t.buffer can be refilled with new samples, and queued again
+ * }
+ *
+ * usb.write(STM32USBDevice::stream::vendor, buffer_a, sizeof(buffer_a), sent);
+ * usb.write(STM32USBDevice::stream::vendor, buffer_b, sizeof(buffer_b), sent);
+ * @endcode
+ *
+ * Transfers can only be queued while the device is configured by the host. When the host
+ * resets or deconfigures the device, queued transfers complete with status::error.
+ *
+ * CDC writes whose length is a multiple of PACKET_SIZE are terminated with a zero-length
+ * packet, so the host's serial driver returns the data immediately. Vendor writes are not,
+ * since the host reads the stream in large blocks.
+ *
+ * VBUS sensing is not used, so the device connects to the bus when the driver is started. VDDUSB
+ * must be enabled (stm32l4r5::enableVddUSB()) and the GPIO bank clock must be enabled in the
+ * hardware platform. The USB clock (CLK48, trimmed by the CRS) is managed by this driver.
+ */
+class STM32USBDevice final : public embvm::DriverBase
+{
+  public:
+	enum class status : uint8_t
+	{
+		/// The transfer completed successfully
+		ok = 0,
+		/// The transfer was added to the queue
+		enqueued,
+		/// The transfer queue is full
+		busy,
+		/// The transfer was aborted by a bus reset, deconfiguration, or driver stop
+		error,
+		/// The device has not been configured by the host
+		not_configured,
+	};
+
+	/// Data streams provided by the device
+	enum stream : uint8_t
+	{
+		cdc = 0,
+		vendor,
+		NUM_STREAMS
+	};
+
+	/// Describes a single transfer
+	struct transfer_t
+	{
+		void* buffer = nullptr;
+		size_t length = 0;
+		/// Number of bytes transferred. A read completes early (actual < length) when the host
+		/// sends a short packet.
+		size_t actual = 0;
+	};
+
+	/// Transfer callback. This is invoked from an interrupt context.
+	using cb_t = stdext::inplace_function<void(const transfer_t&, status)>;
+
+	/// Invoked (from an interrupt context) when the host configures or deconfigures the device.
+	using configured_cb_t = stdext::inplace_function<void(bool)>;
+
+	/// CDC line coding set by the host. It has no effect on the data, but applications can use
+	/// it as a control channel (e.g., to select a sample rate).
+	struct line_coding_t
+	{
+		uint32_t baudrate = 115200;
+		/// 0: 1 stop bit, 1: 1.5 stop bits, 2: 2 stop bits
+		uint8_t stop_bits = 0;
+		/// 0: none, 1: odd, 2: even, 3: mark, 4: space
+		uint8_t parity = 0;
+		uint8_t data_bits = 8;
+	};
+
+	/// Device identification
+	struct config_t
+	{
+		uint16_t vendor_id = 0x0483;
+		uint16_t product_id = 0x5740;
+		/// Manufacturer and product strings, at most 31 characters each
+		const char* manufacturer = "Embedded Artistry";
+		const char* product = "STM32L4R5 Streaming Device";
+	};
+
+	/// A USB pin (DM or DP)
+	struct pin_t
+	{
+		embvm::gpio::port port;
+		uint8_t pin;
+		/// Alternate function number which connects the pin to the OTG FS peripheral
+		uint8_t af;
+	};
+
+	/// Maximum packet size of the bulk endpoints
+	static constexpr size_t PACKET_SIZE = 64;
+
+	/// Maximum number of transfers which can be queued, per stream and direction.
+	static constexpr size_t QUEUE_DEPTH = 4;
+
+  public:
+	explicit STM32USBDevice(const config_t& config) noexcept
+		: embvm::DriverBase(embvm::DriverType::Undefined), config_(config)
+	{
+	}
+
+	/// Construct a USB device with the default identification.
+	STM32USBDevice() noexcept : STM32USBDevice(config_t{}) {}
+	~STM32USBDevice() noexcept = default;
+
+	/** Set the pins used by the interface.
+	 *
+	 * @precondition The driver is stopped.
+	 * @param [in] pins The DM and DP pins. The array must remain valid while the driver is in
+	 *	use.
+	 * @param [in] count The number of pins.
+	 */
+	void configurePins(const pin_t* pins, size_t count) noexcept
+	{
+		assert(started() == false);
+		assert(pins && count);
+		pins_ = pins;
+		pin_count_ = count;
+	}
+
+	/** Queue data to send to the host.
+	 *
+	 * @precondition The driver is started.
+	 * @param [in] s The stream to write to.
+	 * @param [in] data The data to send. It must remain valid until the callback is invoked.
+	 * @param [in] length The number of bytes to send. 0 sends a zero-length packet.
+	 * @param [in] cb Callback invoked (in interrupt context) when the data has been sent.
+	 * @returns status::enqueued if the transfer was queued, status::busy if the queue is full,
+	 *	or status::not_configured.
+	 */
+	status write(stream s, const void* data, size_t length, const cb_t& cb) noexcept;
+
+	/** Queue a buffer to receive data from the host.
+	 *
+	 * @precondition The driver is started.
+	 * @precondition length is a non-zero multiple of PACKET_SIZE.
+	 * @param [in] s The stream to read from.
+	 * @param [in] data The buffer for the data. It must remain valid until the callback is
+	 *	invoked.
+	 * @param [in] length The size of the buffer.
+	 * @param [in] cb Callback invoked (in interrupt context) when the buffer is full, or when
+	 *	the host ends the transfer with a short packet.
+	 * @returns status::enqueued if the transfer was queued, status::busy if the queue is full,
+	 *	or status::not_configured.
+	 */
+	status read(stream s, void* data, size_t length, const cb_t& cb) noexcept;
+
+	/// Set the callback invoked when the device is configured or deconfigured.
+	void registerConfiguredCallback(const configured_cb_t& cb) noexcept
+	{
+		configured_cb_ = cb;
+	}
+
+	/// Check whether the host has configured the device, so that transfers can be queued.
+	bool configured() const noexcept
+	{
+		return configuration_ != 0;
+	}
+
+	/// Check whether a terminal has opened the CDC port (DTR is set).
+	bool terminalConnected() const noexcept
+	{
+		return dtr_;
+	}
+
+	line_coding_t lineCoding() const noexcept
+	{
+		return line_coding_;
+	}
+
+  private:
+	/// Progress of a control transfer on endpoint 0
+	enum class control_state : uint8_t
+	{
+		/// Waiting for a SETUP packet
+		idle = 0,
+		data_in,
+		data_out,
+		status_in,
+		status_out,
+	};
+
+	struct setup_t
+	{
+		uint8_t request_type;
+		uint8_t request;
+		uint16_t value;
+		uint16_t index;
+		uint16_t length;
+	};
+
+	struct queued_transfer_t
+	{
+		transfer_t transfer;
+		cb_t cb;
+	};
+
+	/// State of one direction of a stream's endpoint
+	struct endpoint_t
+	{
+		StaticQueue<queued_transfer_t, QUEUE_DEPTH> queue;
+		volatile bool active = false;
+		/// Bytes of the active transfer which have been moved through the FIFO
+		size_t offset = 0;
+		/// End of the part of the active transfer which is programmed into the endpoint
+		size_t chunk_end = 0;
+		/// IN: the terminating zero-length packet was sent. OUT: a short packet was received.
+		bool short_packet = false;
+	};
+
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	status enqueue(stream s, bool in, void* data, size_t length, const cb_t& cb) noexcept;
+	/// Program the next part of the active transfer into the endpoint
+	void startTransfer(stream s, bool in) noexcept;
+	/// Write packets of the active IN transfer into the TX FIFO while there is room
+	void fillTxFifo(stream s) noexcept;
+	void transferComplete(stream s, bool in, status st) noexcept;
+	/// Complete all queued transfers with status::error
+	void abortTransfers() noexcept;
+	void setConfiguration(uint8_t configuration) noexcept;
+	bool setEndpointHalt(uint16_t endpoint, bool halt) noexcept;
+
+	void handleReset() noexcept;
+	void handleEnumerationDone() noexcept;
+	void handleRxFifo() noexcept;
+	void handleInEndpoints() noexcept;
+	void handleOutEndpoints() noexcept;
+	void controlInComplete() noexcept;
+	void controlOutComplete() noexcept;
+	void interruptHandler() noexcept;
+
+	/// Handle a SETUP packet on endpoint 0
+	void handleSetup() noexcept;
+	bool standardRequest() noexcept;
+	bool classRequest() noexcept;
+	/// Handle the data stage of a control write
+	void controlDataReceived() noexcept;
+	bool getDescriptor() noexcept;
+	/// Build a string descriptor in ep0_buffer_
+	size_t stringDescriptor(uint8_t index) noexcept;
+	/// Start the data stage of a control read
+	void controlSend(const uint8_t* data, size_t length) noexcept;
+	/// Send the next control IN packet (which may be a zero-length packet)
+	void controlSendPacket() noexcept;
+	/// Arm endpoint 0 to receive a data or status stage packet
+	void controlReceive() noexcept;
+	void controlStall() noexcept;
+
+  private:
+	const config_t config_;
+	const pin_t* pins_ = nullptr;
+	size_t pin_count_ = 0;
+
+	std::array<endpoint_t, NUM_STREAMS> in_;
+	std::array<endpoint_t, NUM_STREAMS> out_;
+	configured_cb_t configured_cb_;
+	volatile uint8_t configuration_ = 0;
+	volatile bool dtr_ = false;
+	line_coding_t line_coding_{};
+
+	control_state control_state_ = control_state::idle;
+	setup_t setup_{};
+	/// Remaining data of a control read
+	const uint8_t* control_data_ = nullptr;
+	size_t control_remaining_ = 0;
+	/// A zero-length packet ends a control read which is shorter than requested
+	bool control_zlp_ = false;
+	/// Bytes received in the data stage of a control write
+	size_t control_received_ = 0;
+	alignas(uint32_t) std::array<uint8_t, PACKET_SIZE> ep0_buffer_{};
+};
+
+#endif // STM32_USB_DEVICE_HPP_
@@ -0,0 +1,180 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "stm32_waveform.hpp"
+#include "helpers/gpio_helper.hpp"
+#include "helpers/timer_helper.hpp"
+#include <cassert>
+#include <processor_includes.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32l4xx_ll_dma.h> // For configuration of DMA channel; TODO: break dependency
+#include <stm32l4xx_ll_tim.h>
+
+/* Useful Developer Notes
+ *
+ * The update DMA request (UDE) is issued at every counter overflow. The first sample is
+ * written one sample period after the counter is enabled.
+ *
+ * The DMA transfer complete interrupt fires once the last sample has been written, so the
+ * timer can be stopped from the DMA callback without cutting the waveform short.
+ *
+ * Circular mode is part of the channel configuration, which can only be changed while the
+ * DMA channel driver is stopped, so the channel is restarted when switching between play()
+ * and loop().
+ */
+
+#pragma mark - Helpers -
+
+static inline TIM_TypeDef* timer_instance(embvm::timer::channel ch)
+{
+	return static_cast<TIM_TypeDef*>(STM32TimerHelper::instance(ch));
+}
+
+#pragma mark - Driver APIs -
+
+void STM32Waveform::start_() noexcept
+{
+	auto inst = timer_instance(timer_);
+
+	STM32ClockControl::timerEnable(timer_);
+
+	auto base = STM32TimerHelper::timeBase(timer_, rate_);
+	LL_TIM_SetPrescaler(inst, base.prescaler);
+	LL_TIM_SetAutoReload(inst, base.autoreload);
+	LL_TIM_SetCounterMode(inst, LL_TIM_COUNTERMODE_UP);
+	LL_TIM_GenerateEvent_UPDATE(inst);
+	LL_TIM_ClearFlag_UPDATE(inst);
+
+	actual_rate_ = STM32TimerHelper::clockFrequency(timer_) /
+				   ((base.prescaler + 1U) * (base.autoreload + 1U));
+
+	channel_.registerCallback([this](STM32DMA::status s) { transferComplete(s); });
+}
+
+void STM32Waveform::stop_() noexcept
+{
+	halt();
+	channel_.stop();
+	channel_.registerCallback(nullptr);
+
+	LL_TIM_DeInit(timer_instance(timer_));
+	STM32ClockControl::timerDisable(timer_);
+}
+
+void STM32Waveform::setSampleRate(uint32_t rate) noexcept
+{
+	assert(!active_);
+	assert(rate > 0);
+
+	rate_ = rate;
+
+	if(started())
+	{
+		auto inst = timer_instance(timer_);
+		auto base = STM32TimerHelper::timeBase(timer_, rate_);
+		LL_TIM_SetPrescaler(inst, base.prescaler);
+		LL_TIM_SetAutoReload(inst, base.autoreload);
+		LL_TIM_GenerateEvent_UPDATE(inst);
+		LL_TIM_ClearFlag_UPDATE(inst);
+
+		actual_rate_ = STM32TimerHelper::clockFrequency(timer_) /
+					   ((base.prescaler + 1U) * (base.autoreload + 1U));
+	}
+}
+
+STM32Waveform::status STM32Waveform::play(const uint32_t* samples, size_t count,
+										  const cb_t& cb) noexcept
+{
+	{
+		STM32InterruptLock lock;
+		if(active_)
+		{
+			return status::busy;
+		}
+
+		cb_ = cb;
+	}
+
+	return begin(samples, count, false);
+}
+
+STM32Waveform::status STM32Waveform::loop(const uint32_t* samples, size_t count) noexcept
+{
+	{
+		STM32InterruptLock lock;
+		if(active_)
+		{
+			return status::busy;
+		}
+
+		cb_ = nullptr;
+	}
+
+	return begin(samples, count, true);
+}
+
+STM32Waveform::status STM32Waveform::begin(const uint32_t* samples, size_t count,
+										   bool circular) noexcept
+{
+	assert(started());
+	assert(samples && count > 0 && count <= MAX_SAMPLES);
+
+	auto inst = timer_instance(timer_);
+
+	channel_.stop();
+	channel_.setConfiguration(LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_VERYHIGH |
+								  (circular ? LL_DMA_MODE_CIRCULAR : LL_DMA_MODE_NORMAL) |
+								  LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+								  LL_DMA_PDATAALIGN_WORD | LL_DMA_MDATAALIGN_WORD,
+							  STM32TimerHelper::updateRequest(timer_));
+	channel_.start();
+
+	// The underlying STM32 code doesn't take const.
+	channel_.setAddresses(const_cast<uint32_t*>(samples),
+						  STM32GPIOTranslator::bsrr_address(static_cast<uint8_t>(port_)), count);
+
+	active_ = true;
+	circular_ = circular;
+
+	LL_TIM_SetCounter(inst, 0);
+	LL_TIM_ClearFlag_UPDATE(inst);
+	channel_.enable();
+	LL_TIM_EnableDMAReq_UPDATE(inst);
+	LL_TIM_EnableCounter(inst);
+
+	return status::ok;
+}
+
+void STM32Waveform::halt() noexcept
+{
+	auto inst = timer_instance(timer_);
+
+	LL_TIM_DisableCounter(inst);
+	LL_TIM_DisableDMAReq_UPDATE(inst);
+	channel_.disable();
+
+	active_ = false;
+}
+
+// Called from the DMA ISR
+void STM32Waveform::transferComplete(STM32DMA::status s) noexcept
+{
+	if(s == STM32DMA::status::half_transfer || !active_)
+	{
+		return;
+	}
+
+	// A looping waveform wraps around at each transfer complete
+	if(circular_ && s == STM32DMA::status::ok)
+	{
+		return;
+	}
+
+	halt();
+
+	if(cb_)
+	{
+		cb_((s == STM32DMA::status::ok) ? status::ok : status::error);
+	}
+}
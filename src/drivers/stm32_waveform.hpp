@@ -0,0 +1,143 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STM32_WAVEFORM_HPP_
+#define STM32_WAVEFORM_HPP_
+
+#include <driver/driver.hpp>
+#include <driver/gpio.hpp>
+#include <driver/timer.hpp>
+#include <inplace_function/inplace_function.hpp>
+#include <stm32_dma.hpp>
+
+/** GPIO waveform engine which streams BSRR words to a port with DMA.
+ *
+ * A timer's update event issues a DMA request once per sample period. Each request makes
+ * the DMA channel write the next word of a waveform buffer to the port's bit set/reset
+ * register (BSRR). Any combination of pins on the port can be set or cleared by each
+ * sample, with timer-accurate edges and no CPU involvement.
+ *
+ * Use the helpers in bsrr_waveform.hpp to build the waveform (e.g., ws2812Encode() for
+ * WS2812 LED strings, or encodePulses() for stepper step pulses).
+ *
+ * The pins must be configured as outputs (e.g., with an STM32GPIO driver) before playback.
+ *
+ * @code
+ * STM32Waveform ws2812{embvm::timer::channel::CH3, embvm::gpio::port::B, dma_ch};
+ * STM32_DMA_BUFFER static uint32_t wave[encodedLength(3 * LEDS, WS2812_TIMING)];
+ *
+ * ws2812.setSampleRate(WS2812_SAMPLE_RATE);
+ * ws2812.start();
+ * auto n = ws2812Encode(wave, std::size(wave), colors, LEDS, 1 << 4);
+ * ws2812.play(wave, n, [](STM32Waveform::status s) {
+ *	// Runs in interrupt context
+ * });
+ * @endcode
+ *
+ * Both DMA controllers can reach the GPIO ports on the STM32L4. At high sample rates, keep
+ * the waveform in a different SRAM bank from the CPU's working data (STM32_DMA_BUFFER) so the
+ * DMA requests are not delayed by bus contention. Sample rates of a few MHz are practical.
+ *
+ * The timer is dedicated to this engine while it is started. You must enable the DMA
+ * device clock in the hardware platform; the timer clock is managed by this driver.
+ *
+ * @see bsrr_waveform.hpp
+ * @see STM32DMA
+ */
+class STM32Waveform final : public embvm::DriverBase
+{
+  public:
+	enum class status : uint8_t
+	{
+		/// The waveform was played to completion
+		ok = 0,
+		/// A waveform is already playing
+		busy,
+		/// A DMA transfer error occurred
+		error,
+	};
+
+	/// Playback callback. This is invoked from the DMA interrupt context.
+	using cb_t = stdext::inplace_function<void(status)>;
+
+	/// Maximum number of samples in a waveform (limited by the DMA counter).
+	static constexpr size_t MAX_SAMPLES = 65535;
+
+  public:
+	/** Construct a waveform engine.
+	 *
+	 * @param [in] timer The timer which paces the samples. Any timer with an update DMA
+	 *	request can be used, including the basic timers TIM6/TIM7.
+	 * @param [in] port The GPIO port that the waveform is written to.
+	 * @param [in] channel The DMA channel dedicated to this engine.
+	 */
+	STM32Waveform(embvm::timer::channel timer, embvm::gpio::port port, STM32DMA& channel) noexcept
+		: embvm::DriverBase(embvm::DriverType::DMA), timer_(timer), port_(port), channel_(channel)
+	{
+	}
+	~STM32Waveform() noexcept = default;
+
+	/** Set the sample rate.
+	 *
+	 * The rate is rounded to the nearest achievable rate (see sampleRate()).
+	 *
+	 * @precondition No waveform is playing.
+	 * @param [in] rate The number of samples per second.
+	 */
+	void setSampleRate(uint32_t rate) noexcept;
+
+	/// The achieved sample rate, in Hz. Valid once the engine is started.
+	uint32_t sampleRate() const noexcept
+	{
+		return actual_rate_;
+	}
+
+	/** Play a waveform once.
+	 *
+	 * @precondition The engine is started.
+	 * @precondition 0 < count <= MAX_SAMPLES
+	 * @param [in] samples The BSRR words to write. The buffer must remain valid until the
+	 *	callback is invoked.
+	 * @param [in] count The number of samples.
+	 * @param [in] cb Optional callback invoked when the last sample has been written.
+	 * @returns status::ok if playback started, status::busy if a waveform is playing.
+	 */
+	status play(const uint32_t* samples, size_t count, const cb_t& cb = nullptr) noexcept;
+
+	/** Play a waveform repeatedly until halt() is called.
+	 *
+	 * @precondition The engine is started.
+	 * @precondition 0 < count <= MAX_SAMPLES
+	 * @returns status::ok if playback started, status::busy if a waveform is playing.
+	 */
+	status loop(const uint32_t* samples, size_t count) noexcept;
+
+	/// Stop playback immediately. The pins keep their current levels.
+	void halt() noexcept;
+
+	/// Check whether a waveform is playing.
+	bool busy() const noexcept
+	{
+		return active_;
+	}
+
+  private:
+	// Driver base functions
+	void start_() noexcept final;
+	void stop_() noexcept final;
+
+	status begin(const uint32_t* samples, size_t count, bool circular) noexcept;
+	void transferComplete(STM32DMA::status s) noexcept;
+
+  private:
+	const embvm::timer::channel timer_;
+	const embvm::gpio::port port_;
+	STM32DMA& channel_;
+	uint32_t rate_ = 1000000;
+	uint32_t actual_rate_ = 0;
+	volatile bool active_ = false;
+	bool circular_ = false;
+	cb_t cb_;
+};
+
+#endif // STM32_WAVEFORM_HPP_
@@ -2,9 +2,50 @@
 // SPDX-License-Identifier: MIT
 
 #include "NucleoL4R5ZI_HWPlatform.hpp"
+#include <array>
 #include <stm32_rcc.hpp>
+#include <stm32_sections.hpp>
 
-// TODO: shoudl I check/increae clock speed?
+namespace
+{
+/// ADC scan sequence: Arduino A0 (PA3), A1 (PC0), A2 (PC3), and the internal reference
+constexpr std::array<STM32ADC::sequence_entry_t, 4> adc_sequence = {{
+	{8, STM32ADC::sample_time::cycles24_5},
+	{1, STM32ADC::sample_time::cycles24_5},
+	{4, STM32ADC::sample_time::cycles24_5},
+	{0, STM32ADC::sample_time::cycles247_5}, // VREFINT requires >= 4 us sampling
+}};
+
+/// Each half of the buffer holds 32 sequences (3.2 ms at the default sample period)
+constexpr size_t ADC_BUFFER_LENGTH = adc_sequence.size() * 64;
+
+STM32_DMA_BUFFER uint16_t adc_buffer[ADC_BUFFER_LENGTH];
+
+/// SDMMC1 pins on CN8: D0-D3 (PC8-PC11), CK (PC12), and CMD (PD2)
+constexpr std::array<STM32SDMMC::pin_t, 6> sdmmc_pins = {{
+	{embvm::gpio::port::C, 8, 12},
+	{embvm::gpio::port::C, 9, 12},
+	{embvm::gpio::port::C, 10, 12},
+	{embvm::gpio::port::C, 11, 12},
+	{embvm::gpio::port::C, 12, 12},
+	{embvm::gpio::port::D, 2, 12},
+}};
+
+/// USB OTG FS pins on CN13: DM (PA11) and DP (PA12)
+constexpr std::array<STM32USBDevice::pin_t, 2> usb_pins = {{
+	{embvm::gpio::port::A, 11, 10},
+	{embvm::gpio::port::A, 12, 10},
+}};
+
+/// Number of brightness steps in one LED breathing cycle
+constexpr size_t BREATHING_FRAMES = 128;
+
+/// PWM compare values for the breathing LED, streamed by DMA
+STM32_DMA_BUFFER uint32_t breathing_frames[BREATHING_FRAMES];
+
+/// PWM channel which drives each LED pin (LED3 uses the complementary output)
+constexpr uint8_t LED_PWM_CHANNEL = 2;
+} // namespace
 
 NucleoL4R5ZI_HWPlatform::NucleoL4R5ZI_HWPlatform() noexcept
 {
@@ -16,19 +57,32 @@ NucleoL4R5ZI_HWPlatform::NucleoL4R5ZI_HWPlatform() noexcept
 
 NucleoL4R5ZI_HWPlatform::~NucleoL4R5ZI_HWPlatform() noexcept {}
 
-void NucleoL4R5ZI_HWPlatform::earlyInitHook_() noexcept {}
+void NucleoL4R5ZI_HWPlatform::earlyInitHook_() noexcept
+{
+	stm32l4r5::earlyInitHook();
+}
 
 void NucleoL4R5ZI_HWPlatform::init_() noexcept
 {
 	// We need to turn on the GPIO clocks before we start the gpio/led drivers.
+	STM32ClockControl::gpioEnable(embvm::gpio::port::A);
 	STM32ClockControl::gpioEnable(embvm::gpio::port::B);
 	STM32ClockControl::gpioEnable(embvm::gpio::port::C);
+	STM32ClockControl::gpioEnable(embvm::gpio::port::D);
 	STM32ClockControl::gpioEnable(embvm::gpio::port::F);
+	STM32ClockControl::gpioEnable(embvm::gpio::port::G);
+
+	// The console UART pins (PG7/PG8) are powered from VDDIO2
+	stm32l4r5::enableVddIO2();
 
 	// We need to turn on the DMA clocks before we start/stop the dma drivers
 	STM32ClockControl::dmaEnable(STM32DMA::device::dma1);
+	STM32ClockControl::dmaEnable(STM32DMA::device::dma2);
 	STM32ClockControl::dmaMuxEnable();
 
+	// Start the console first so that output from the remaining drivers is visible
+	console_uart.start();
+
 	// start all LEDs
 	// turn them off? Or just trust that they start off?
 	led1.start();
@@ -41,16 +95,183 @@ void NucleoL4R5ZI_HWPlatform::init_() noexcept
 		led3.toggle();
 	});
 
+	led1_pwm.configureChannel(LED_PWM_CHANNEL, {embvm::gpio::port::C, 7, 2});
+	led2_pwm.configureChannel(LED_PWM_CHANNEL, {embvm::gpio::port::B, 7, 2});
+	led3_pwm.configureComplementaryChannel(LED_PWM_CHANNEL, {embvm::gpio::port::B, 14, 1});
+
 	i2c2.start();
+	memcpy_engine.start();
+	dma2d.start();
+	internal_flash.start();
+	crc_unit.start();
+	trng.start();
+
+	sdmmc1.configurePins(sdmmc_pins.data(), sdmmc_pins.size());
+	sdmmc1.start();
+
+	// The USB transceiver is powered from VDDUSB
+	stm32l4r5::enableVddUSB();
+	usb_device.configurePins(usb_pins.data(), usb_pins.size());
+	usb_device.start();
+
+	spi1.baudrate(30000000);
+	spi1.start();
+
+	// 4x hardware oversampling with a 2-bit shift averages each 12-bit sample.
+	// One oversampled sequence takes ~25 us, which fits within ADC_SAMPLE_PERIOD.
+	adc1.setSequence(adc_sequence.data(), adc_sequence.size());
+	adc1.setTrigger(STM32ADC::trigger::tim6_trgo);
+	adc1.setOversampling(STM32ADC::oversample_ratio::x4, 2);
+	adc1.setBuffer(adc_buffer, ADC_BUFFER_LENGTH);
+	adc_timer.triggerOutput(true);
+}
+
+void NucleoL4R5ZI_HWPlatform::startAnalogSampling() noexcept
+{
+	adc1.start();
+	adc_timer.start();
 }
 
 void NucleoL4R5ZI_HWPlatform::leds_off() noexcept
 {
+	if(led_drive_ == led_drive::timer)
+	{
+		for(uint8_t i = 0; i < LED_COUNT; i++)
+		{
+			setLEDBrightness(i, 0);
+		}
+
+		return;
+	}
+
 	led1.off();
 	led2.off();
 	led3.off();
 }
 
+void NucleoL4R5ZI_HWPlatform::setLEDDrive(led_drive drive) noexcept
+{
+	if(drive == led_drive_)
+	{
+		return;
+	}
+
+	if(drive == led_drive::timer)
+	{
+		// The software blink would fight with the timer outputs
+		if(timer0.started())
+		{
+			timer0.stop();
+		}
+
+		// The PWM drivers switch the pins to their alternate functions, with the LEDs off
+		led1_pwm.start();
+		led2_pwm.start();
+		led3_pwm.start();
+	}
+	else
+	{
+		led1_pwm.stop();
+		led2_pwm.stop();
+		led3_pwm.stop();
+
+		led1_pin.setMode(embvm::gpio::mode::output);
+		led2_pin.setMode(embvm::gpio::mode::output);
+		led3_pin.setMode(embvm::gpio::mode::output);
+	}
+
+	led_drive_ = drive;
+
+	if(drive == led_drive::gpio)
+	{
+		leds_off();
+	}
+}
+
+STM32PWM& NucleoL4R5ZI_HWPlatform::ledPWM(uint8_t index) noexcept
+{
+	switch(index)
+	{
+		case 0:
+			return led1_pwm;
+		case 1:
+			return led2_pwm;
+		default:
+			assert(index == 2); // Invalid LED
+			return led3_pwm;
+	}
+}
+
+void NucleoL4R5ZI_HWPlatform::blinkLED(uint8_t index, uint32_t frequency,
+									   uint16_t on_time) noexcept
+{
+	assert(led_drive_ == led_drive::timer);
+
+	auto& pwm = ledPWM(index);
+
+	if(index == BREATHING_LED)
+	{
+		pwm.stopStream();
+		pwm.setRepetition(0);
+	}
+
+	pwm.setFrequency(frequency);
+	pwm.setDuty(LED_PWM_CHANNEL, on_time);
+}
+
+void NucleoL4R5ZI_HWPlatform::setLEDBrightness(uint8_t index, uint16_t brightness) noexcept
+{
+	blinkLED(index, LED_PWM_FREQUENCY, brightness);
+}
+
+bool NucleoL4R5ZI_HWPlatform::startBreathing(std::chrono::milliseconds period) noexcept
+{
+	assert(led_drive_ == led_drive::timer);
+
+	auto& pwm = led3_pwm;
+
+	pwm.stopStream();
+	pwm.setFrequency(LED_PWM_FREQUENCY);
+
+	// Each frame is held for (repetition + 1) PWM periods
+	auto pwm_periods = (static_cast<uint64_t>(period.count()) * LED_PWM_FREQUENCY) / 1000;
+	auto frame_periods = pwm_periods / BREATHING_FRAMES;
+	frame_periods = (frame_periods < 1) ? 1 : ((frame_periods > 65536) ? 65536 : frame_periods);
+
+	// Brightness is perceived roughly logarithmically, so the duty cycle follows a square
+	// law to make the fade look linear
+	constexpr uint64_t half = BREATHING_FRAMES / 2;
+	for(size_t i = 0; i < BREATHING_FRAMES; i++)
+	{
+		uint64_t step = (i < half) ? i : (BREATHING_FRAMES - i);
+		auto duty = static_cast<uint16_t>((step * step * STM32PWM::DUTY_MAX) / (half * half));
+		breathing_frames[i] = STM32PWM::dutyToCompare(duty, pwm.period());
+	}
+
+	pwm.setRepetition(static_cast<uint16_t>(frame_periods - 1));
+	return pwm.streamCompare(LED_PWM_CHANNEL, 1, breathing_frames, BREATHING_FRAMES, true);
+}
+
+void NucleoL4R5ZI_HWPlatform::toggleLED(uint8_t index) noexcept
+{
+	assert(led_drive_ == led_drive::gpio);
+
+	switch(index)
+	{
+		case 0:
+			led1.toggle();
+			break;
+		case 1:
+			led2.toggle();
+			break;
+		case 2:
+			led3.toggle();
+			break;
+		default:
+			assert(0); // Invalid LED
+	}
+}
+
 void NucleoL4R5ZI_HWPlatform::hard_reset_() noexcept
 {
 	// We cannot perform a hard reset from software, so perform
@@ -70,6 +291,17 @@ void NucleoL4R5ZI_HWPlatform::initProcessor_() noexcept
 
 void NucleoL4R5ZI_HWPlatform::startBlink() noexcept
 {
+	if(led_drive_ == led_drive::timer)
+	{
+		// 1 Hz heartbeat, with no interrupts
+		for(uint8_t i = 0; i < LED_COUNT; i++)
+		{
+			blinkLED(i, 1);
+		}
+
+		return;
+	}
+
 	led1.on();
 	led2.off();
 	led3.on();
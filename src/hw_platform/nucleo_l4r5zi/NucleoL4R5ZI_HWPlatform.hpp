@@ -4,12 +4,25 @@
 #ifndef NUCLEO_L4R5ZI_HW_PLATFORM_HPP_
 #define NUCLEO_L4R5ZI_HW_PLATFORM_HPP_
 
+#include <array>
 #include <driver/led.hpp>
 #include <hw_platform/virtual_hw_platform.hpp>
+#include <stm32_adc.hpp>
+#include <stm32_crc.hpp>
 #include <stm32_dma.hpp>
+#include <stm32_dma2d.hpp>
+#include <stm32_dma_memcpy.hpp>
+#include <stm32_dma_pool.hpp>
 #include <stm32_gpio.hpp>
 #include <stm32_i2c_master.hpp>
+#include <stm32_internal_flash.hpp>
+#include <stm32_pwm.hpp>
+#include <stm32_rng.hpp>
+#include <stm32_sdmmc.hpp>
+#include <stm32_spi_master.hpp>
 #include <stm32_timer.hpp>
+#include <stm32_uart.hpp>
+#include <stm32_usb_device.hpp>
 #include <stm32l4r5.hpp>
 
 class NucleoL4R5ZI_HWPlatform : public embvm::VirtualHwPlatformBase<NucleoL4R5ZI_HWPlatform>
@@ -34,6 +47,161 @@ class NucleoL4R5ZI_HWPlatform : public embvm::VirtualHwPlatformBase<NucleoL4R5ZI
 	void leds_off() noexcept;
 	void startBlink() noexcept;
 
+	/// Number of user LEDs on the board
+	static constexpr uint8_t LED_COUNT = 3;
+
+	/// How the user LEDs are driven
+	enum class led_drive : uint8_t
+	{
+		/// GPIO outputs, switched by software (toggleLED(), or the TIM2 callback used by
+		/// startBlink())
+		gpio = 0,
+		/// Timer PWM outputs. Blink, brightness, and breathing patterns run in hardware,
+		/// without interrupts.
+		timer,
+	};
+
+	/// PWM frequency used for LED brightness control in led_drive::timer mode
+	static constexpr uint32_t LED_PWM_FREQUENCY = 1000;
+
+	/// The LED which supports startBreathing() (LED3, on the advanced timer TIM1)
+	static constexpr uint8_t BREATHING_LED = 2;
+
+	/** Select how the user LEDs are driven.
+	 *
+	 * The LED pins are connected to timer channels (LED1 PC7 = TIM3_CH2, LED2 PB7 =
+	 * TIM4_CH2, LED3 PB14 = TIM1_CH2N). In led_drive::timer mode, the pins are switched to
+	 * their timer alternate functions, and the LEDs are controlled with setLEDBrightness(),
+	 * blinkLED(), and startBreathing(). The LEDs start off.
+	 *
+	 * @param [in] drive The drive mode.
+	 */
+	void setLEDDrive(led_drive drive) noexcept;
+
+	/// The current LED drive mode.
+	led_drive ledDrive() const noexcept
+	{
+		return led_drive_;
+	}
+
+	/// Toggle one of the user LEDs
+	/// @precondition The LEDs are in led_drive::gpio mode.
+	/// @param [in] index The LED to toggle, [0..LED_COUNT).
+	void toggleLED(uint8_t index) noexcept;
+
+	/** Set the brightness of an LED.
+	 *
+	 * @precondition The LEDs are in led_drive::timer mode.
+	 * @param [in] index The LED, [0..LED_COUNT).
+	 * @param [in] brightness The PWM duty cycle, where STM32PWM::DUTY_MAX is fully on.
+	 */
+	void setLEDBrightness(uint8_t index, uint16_t brightness) noexcept;
+
+	/** Blink an LED in hardware.
+	 *
+	 * @precondition The LEDs are in led_drive::timer mode.
+	 * @param [in] index The LED, [0..LED_COUNT).
+	 * @param [in] frequency The blink frequency, in Hz.
+	 * @param [in] on_time The fraction of each blink period that the LED is on, where
+	 *	STM32PWM::DUTY_MAX is always on.
+	 */
+	void blinkLED(uint8_t index, uint32_t frequency,
+				  uint16_t on_time = STM32PWM::DUTY_MAX / 2) noexcept;
+
+	/** Fade BREATHING_LED in and out continuously.
+	 *
+	 * A DMA stream updates the PWM duty cycle from a brightness table, and the timer's
+	 * repetition counter stretches each table entry over several PWM periods. The stream's
+	 * DMA channel is taken from dmaPool(), and returned when blinkLED(), setLEDBrightness(), or
+	 * setLEDDrive(led_drive::gpio) stops the stream.
+	 *
+	 * @precondition The LEDs are in led_drive::timer mode.
+	 * @param [in] period The duration of one fade in/fade out cycle.
+	 * @returns true if breathing started, false if no pool channel was free.
+	 */
+	bool startBreathing(std::chrono::milliseconds period) noexcept;
+
+	/// The UART connected to the ST-LINK virtual COM port.
+	STM32UART& console() noexcept
+	{
+		return console_uart;
+	}
+
+	/** The ADC, configured to scan the Arduino A0-A2 inputs and VREFINT.
+	 *
+	 * Register a callback before calling startAnalogSampling() to process the samples.
+	 */
+	STM32ADC& adc() noexcept
+	{
+		return adc1;
+	}
+
+	/// DMA engine for memory-to-memory copies and fills.
+	STM32DMAMemcpy& memcpyEngine() noexcept
+	{
+		return memcpy_engine;
+	}
+
+	/// DMA2D graphics accelerator for framebuffer fills, copies, and blending.
+	STM32DMA2D& graphics() noexcept
+	{
+		return dma2d;
+	}
+
+	/// Internal flash, for persistent storage outside of the image.
+	STM32InternalFlash& internalFlash() noexcept
+	{
+		return internal_flash;
+	}
+
+	/// CRC calculation unit, fed by a DMA channel from dmaPool().
+	STM32CRC& crc() noexcept
+	{
+		return crc_unit;
+	}
+
+	/// True random number generator, for nonces, keys, and seeds.
+	STM32RNG& rng() noexcept
+	{
+		return trng;
+	}
+
+	/** SD card interface.
+	 *
+	 * The card must be identified with initializeCard() before it is used.
+	 */
+	STM32SDMMC& sdCard() noexcept
+	{
+		return sdmmc1;
+	}
+
+	/** USB device with a CDC-ACM port and a vendor bulk stream.
+	 *
+	 * Transfers can be queued once the host has configured the device.
+	 */
+	STM32USBDevice& usb() noexcept
+	{
+		return usb_device;
+	}
+
+	/** Pool of DMA channels which are not dedicated to a driver.
+	 *
+	 * Drivers and applications can acquire a channel for the duration of a transfer.
+	 */
+	STM32DMAPool& dmaPool() noexcept
+	{
+		return dma_pool;
+	}
+
+	/// Start sampling the ADC sequence at ADC_SAMPLE_PERIOD.
+	void startAnalogSampling() noexcept;
+
+	/// Period of the timer which triggers each ADC sequence
+	static constexpr auto ADC_SAMPLE_PERIOD = std::chrono::microseconds(100);
+
+  private:
+	STM32PWM& ledPWM(uint8_t index) noexcept;
+
   private:
 	// TODO: maybe all of this can be hidden in the .cpp file, meaning we dont' need to
 	// Expose any dependnecies or non-portable headers here!!!!
@@ -50,9 +218,63 @@ class NucleoL4R5ZI_HWPlatform : public embvm::VirtualHwPlatformBase<NucleoL4R5ZI
 	// TODO: this isn't actually quite 1s right now...
 	STM32Timer timer0{embvm::timer::channel::CH2, std::chrono::seconds(1)};
 
+	// Timer outputs for the LED pins (led_drive::timer). TIM1 repeats each breathing frame
+	// over several periods, so the breathing LED is on TIM1. Its stream channel comes from
+	// dma_pool (declared below; only its address is taken here).
+	STM32PWM led1_pwm{embvm::timer::channel::CH3, LED_PWM_FREQUENCY};
+	STM32PWM led2_pwm{embvm::timer::channel::CH4, LED_PWM_FREQUENCY};
+	STM32PWM led3_pwm{embvm::timer::channel::CH1, LED_PWM_FREQUENCY, dma_pool};
+	led_drive led_drive_ = led_drive::gpio;
+
 	STM32DMA dma_ch_i2c_tx{STM32DMA::device::dma1, STM32DMA::channel::CH1};
 	STM32DMA dma_ch_i2c_rx{STM32DMA::device::dma1, STM32DMA::channel::CH2};
 	STM32I2CMaster i2c2{STM32I2CMaster::device::i2c2, dma_ch_i2c_tx, dma_ch_i2c_rx};
+
+	// SPI1 is routed to the Arduino header (D11-D13)
+	STM32DMA dma_ch_spi_tx{STM32DMA::device::dma1, STM32DMA::channel::CH3};
+	STM32DMA dma_ch_spi_rx{STM32DMA::device::dma1, STM32DMA::channel::CH4};
+	STM32SPIMaster spi1{STM32SPIMaster::device::spi1, dma_ch_spi_tx, dma_ch_spi_rx};
+
+	// ADC1 sequences are triggered by TIM6, which has no other use on this board
+	STM32Timer adc_timer{embvm::timer::channel::CH6, ADC_SAMPLE_PERIOD};
+	STM32DMA dma_ch_adc{STM32DMA::device::dma2, STM32DMA::channel::CH1};
+	STM32ADC adc1{dma_ch_adc};
+
+	// Dedicated channel for memory-to-memory copies and fills
+	STM32DMA dma_ch_memcpy{STM32DMA::device::dma2, STM32DMA::channel::CH2};
+	STM32DMAMemcpy memcpy_engine{dma_ch_memcpy};
+
+	STM32DMA2D dma2d;
+
+	STM32InternalFlash internal_flash;
+
+	STM32RNG trng;
+
+	// SDMMC1 is routed to the SDMMC pins on CN8 (PC8-PC12, PD2), for an SD card breakout
+	STM32SDMMC sdmmc1;
+
+	// USB OTG FS is connected to the USB user connector (CN13)
+	STM32USBDevice usb_device;
+
+	// LPUART1 is connected to the ST-LINK virtual COM port
+	STM32DMA dma_ch_console_tx{STM32DMA::device::dma1, STM32DMA::channel::CH5};
+	STM32DMA dma_ch_console_rx{STM32DMA::device::dma1, STM32DMA::channel::CH6};
+	STM32UART console_uart{STM32UART::device::lpuart1, dma_ch_console_tx, dma_ch_console_rx,
+						   115200};
+
+	// The remaining channels are shared through the DMA pool
+	STM32DMA dma1_ch7{STM32DMA::device::dma1, STM32DMA::channel::CH7};
+	STM32DMA dma2_ch3{STM32DMA::device::dma2, STM32DMA::channel::CH3};
+	STM32DMA dma2_ch4{STM32DMA::device::dma2, STM32DMA::channel::CH4};
+	STM32DMA dma2_ch5{STM32DMA::device::dma2, STM32DMA::channel::CH5};
+	STM32DMA dma2_ch6{STM32DMA::device::dma2, STM32DMA::channel::CH6};
+	STM32DMA dma2_ch7{STM32DMA::device::dma2, STM32DMA::channel::CH7};
+	const std::array<STM32DMA*, 6> dma_pool_channels = {&dma2_ch3, &dma2_ch4, &dma2_ch5,
+														&dma2_ch6, &dma2_ch7, &dma1_ch7};
+	STM32DMAPool dma_pool{dma_pool_channels.data(), dma_pool_channels.size()};
+
+	// The CRC unit acquires a pool channel for each DMA calculation
+	STM32CRC crc_unit{dma_pool};
 };
 
 #if 0
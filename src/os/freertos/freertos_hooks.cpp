@@ -0,0 +1,41 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include <FreeRTOS.h>
+#include <cassert>
+#include <task.h>
+
+/// Application hooks required by the FreeRTOS configuration in FreeRTOSConfig.h.
+/// Since configSUPPORT_DYNAMIC_ALLOCATION is disabled, we must supply the memory for the
+/// idle and timer tasks.
+
+namespace
+{
+StaticTask_t idle_task_tcb_;
+StackType_t idle_task_stack_[configMINIMAL_STACK_SIZE];
+StaticTask_t timer_task_tcb_;
+StackType_t timer_task_stack_[configTIMER_TASK_STACK_DEPTH];
+} // namespace
+
+extern "C" void vApplicationGetIdleTaskMemory(StaticTask_t** tcb, StackType_t** stack,
+											  uint32_t* stack_size)
+{
+	*tcb = &idle_task_tcb_;
+	*stack = idle_task_stack_;
+	*stack_size = configMINIMAL_STACK_SIZE;
+}
+
+extern "C" void vApplicationGetTimerTaskMemory(StaticTask_t** tcb, StackType_t** stack,
+											   uint32_t* stack_size)
+{
+	*tcb = &timer_task_tcb_;
+	*stack = timer_task_stack_;
+	*stack_size = configTIMER_TASK_STACK_DEPTH;
+}
+
+extern "C" void vApplicationStackOverflowHook(TaskHandle_t task, char* name)
+{
+	(void)task;
+	(void)name;
+	assert(0); // Stack overflow detected
+}
@@ -0,0 +1,79 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include <FreeRTOS.h>
+#include <stm32_completion.hpp>
+#include <task.h>
+
+/// FreeRTOS implementation: the waiting task blocks on a task notification, which the ISR
+/// gives when the operation completes. Task notifications act as a lightweight binary
+/// semaphore that does not require a separate kernel object.
+///
+/// Completions use their own notification index, so that clearing a stale notification in
+/// arm() cannot consume one that application code sent on the default index (0).
+///
+/// If the scheduler has not been started (e.g., drivers used during boot), we fall back to
+/// spinning on the completion flag.
+
+/// Task notification index reserved for STM32Completion
+constexpr UBaseType_t COMPLETION_NOTIFY_INDEX = 1;
+
+static_assert(COMPLETION_NOTIFY_INDEX < configTASK_NOTIFICATION_ARRAY_ENTRIES,
+			  "configTASK_NOTIFICATION_ARRAY_ENTRIES must reserve an index for completions");
+
+void STM32Completion::arm() noexcept
+{
+	complete_ = false;
+
+	if(xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+	{
+		// Clear any stale notification left over from a previous operation
+		ulTaskNotifyTakeIndexed(COMPLETION_NOTIFY_INDEX, pdTRUE, 0);
+		waiter_ = xTaskGetCurrentTaskHandle();
+	}
+	else
+	{
+		waiter_ = nullptr;
+	}
+}
+
+void STM32Completion::signal() noexcept
+{
+	// The waiter may return (and destroy the completion) as soon as complete_ is set, so the
+	// handle must be read first
+	auto task = static_cast<TaskHandle_t>(waiter_);
+	complete_ = true;
+
+	if(task == nullptr)
+	{
+		return;
+	}
+
+	if(xPortIsInsideInterrupt())
+	{
+		BaseType_t higher_priority_task_woken = pdFALSE;
+		vTaskNotifyGiveIndexedFromISR(task, COMPLETION_NOTIFY_INDEX, &higher_priority_task_woken);
+		portYIELD_FROM_ISR(higher_priority_task_woken);
+	}
+	else
+	{
+		xTaskNotifyGiveIndexed(task, COMPLETION_NOTIFY_INDEX);
+	}
+}
+
+void STM32Completion::wait() noexcept
+{
+	if(waiter_ == nullptr)
+	{
+		while(!complete_)
+			;
+		return;
+	}
+
+	while(!complete_)
+	{
+		ulTaskNotifyTakeIndexed(COMPLETION_NOTIFY_INDEX, pdTRUE, portMAX_DELAY);
+	}
+
+	waiter_ = nullptr;
+}
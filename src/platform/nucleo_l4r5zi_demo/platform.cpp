@@ -2,71 +2,406 @@
 // SPDX-License-Identifier: MIT
 
 #include "platform.hpp"
+#include <cassert>
+#include <malloc.h>
+#include <cstring>
 #include <printf.h> // for putchar_ definition
-// TODO: test memory setup with linker scripts
-//#include <malloc.h>
+#include <stm32_rcc.hpp>
 
-// extern int __HeapBase;
-// extern int __HeapLimit;
+extern int __HeapBase;
+extern int __HeapLimit;
 
-void putchar_(char c)
+// Provided by blinky_gcc_nucleo_l4rzi.ld
+extern int __ramfunc_start__;
+extern int __ramfunc_end__;
+extern int __sram2_retained_start__;
+extern int __sram2_retained_end__;
+extern int __dma_buffers_start__;
+extern int __dma_buffers_end__;
+extern int __sram3_bulk_start__;
+extern int __sram3_bulk_end__;
+extern int __block_pool_start__;
+extern int __block_pool_end__;
+extern int __ext_flash_start__;
+extern int __ext_flash_end__;
+extern int __psram_start__;
+extern int __psram_end__;
+extern int __psram_heap_start__;
+extern int __psram_heap_end__;
+extern int __kv_store_start__;
+extern int __kv_store_end__;
+extern "C" const char __start_log_fmt[];
+
+namespace
+{
+/// Console used by putchar_. Output is dropped until the hardware platform is initialized.
+STM32UART* console_ = nullptr;
+
+/* Block pool size classes:
+ *	- 32 bytes: event records and small messages
+ *	- 128 bytes: I2C op descriptors and short DMA transfers
+ *	- 512 bytes: DMA buffers
+ */
+constexpr std::array<PlatformBlockPool::size_class_t, PlatformBlockPool::size_classes()>
+	block_pool_classes = {{
+		{32, 256},
+		{128, 128},
+		{512, 64},
+	}};
+
+PlatformBlockPool block_pool_;
+
+/// Reset_Handler raises the clock before any of the C runtime startup runs, so the interval
+/// from reset to the first phase is counted at the full clock. The few cycles spent on the
+/// 4 MHz MSI beforehand (SystemInit and the PLL lock) are undercounted, so that interval, and
+/// the times since reset, are approximate.
+constexpr uint32_t BOOT_CLOCK_HZ = STM32ClockControl::SYSTEM_CLOCK_HZ;
+
+PlatformBootTimeline boot_timeline_{BOOT_CLOCK_HZ};
+
+PlatformLogger logger_{__start_log_fmt};
+
+/// Size of the buffers used by printMemcpyBenchmark()
+constexpr size_t MEMCPY_BENCHMARK_SIZE = 8192;
+
+// The source is in SRAM1 and the destination is in SRAM3, so the copy crosses banks
+uint8_t memcpy_benchmark_src_[MEMCPY_BENCHMARK_SIZE];
+STM32_SRAM3_BULK uint8_t memcpy_benchmark_dest_[MEMCPY_BENCHMARK_SIZE];
+
+/// Algorithms compared by printCRCBenchmark(). The tables are computed at compile time.
+struct crc_benchmark_t
+{
+	const char* name;
+	const crc_params_t& params;
+	const SoftwareCRC& software;
+};
+
+constexpr SoftwareCRC crc32_software_{CRC32_IEEE};
+constexpr SoftwareCRC crc16_software_{CRC16_CCITT_FALSE};
+
+const std::array<crc_benchmark_t, 2> crc_benchmarks_ = {{
+	{"CRC-32", CRC32_IEEE, crc32_software_},
+	{"CRC-16", CRC16_CCITT_FALSE, crc16_software_},
+}};
+
+/// Convert a byte count and elapsed cycles into MB/s
+unsigned throughput_mbps(size_t bytes, uint32_t cycles)
 {
-	(void)c;
-	// TODO: implement
+	uint64_t bytes_per_second =
+		(static_cast<uint64_t>(bytes) * stm32l4r5::coreClockFrequency()) / (cycles ? cycles : 1);
+	return static_cast<unsigned>(bytes_per_second / 1000000);
 }
 
-namespace
+/// Longest formatted log message; longer messages are truncated
+constexpr size_t LOG_LINE_LENGTH = 128;
+
+/// Write text to the console, translating line endings for terminals
+void console_write_text(const char* text, size_t length)
 {
-// TODO: FreeRTOS threaded support
-// static constexpr size_t MAIN_THREAD_STACK_SIZE = 4096; // bytes
-// static constexpr size_t LED_THREAD_STACK_SIZE = 2048;
-// static embvm::VirtualThread* main_thread_ = nullptr;
+	size_t start = 0;
+
+	for(size_t i = 0; i < length; i++)
+	{
+		if(text[i] == '\n')
+		{
+			console_->writeBlocking(reinterpret_cast<const uint8_t*>(&text[start]), i - start);
+			console_->writeBlocking(reinterpret_cast<const uint8_t*>("\r\n"), 2);
+			start = i + 1;
+		}
+	}
+
+	console_->writeBlocking(reinterpret_cast<const uint8_t*>(&text[start]), length - start);
+}
+
+void print_section(const char* name, const int* start, const int* end)
+{
+	auto start_addr = reinterpret_cast<uintptr_t>(start);
+	auto end_addr = reinterpret_cast<uintptr_t>(end);
+
+	printf("  %-16s 0x%08x - 0x%08x (%u bytes)\n", name, static_cast<unsigned>(start_addr),
+		   static_cast<unsigned>(end_addr), static_cast<unsigned>(end_addr - start_addr));
+}
 } // namespace
 
+void putchar_(char c)
+{
+	if(console_ == nullptr)
+	{
+		return;
+	}
+
+	// Terminals expect CRLF line endings
+	if(c == '\n')
+	{
+		console_->writeBlocking(reinterpret_cast<const uint8_t*>("\r"), 1);
+	}
+
+	console_->writeBlocking(reinterpret_cast<const uint8_t*>(&c), 1);
+}
+
+NucleoL4RZI_DemoPlatform::NucleoL4RZI_DemoPlatform() noexcept
+	: kv_store_(hw_platform_.internalFlash(), reinterpret_cast<uintptr_t>(&__kv_store_start__)),
+	  firmware_update_(hw_platform_.internalFlash(), hw_platform_.crc(),
+					   reinterpret_cast<uintptr_t>(&__kv_store_start__),
+					   reinterpret_cast<uintptr_t>(&__kv_store_end__) -
+						   reinterpret_cast<uintptr_t>(&__kv_store_start__))
+{
+}
+
 void NucleoL4RZI_DemoPlatform::earlyInitHook_() noexcept
 {
-	// malloc_addblock(&__HeapBase, reinterpret_cast<uintptr_t>(&__HeapLimit) -
-	//								 reinterpret_cast<uintptr_t>(&__HeapBase));
+	recordBootPhase("early init");
 
+	// The hardware platform updates SystemCoreClock, so it runs before any heavy init
 	NucleoL4R5ZI_HWPlatform::earlyInitHook();
+
+	malloc_addblock(&__HeapBase, reinterpret_cast<uintptr_t>(&__HeapLimit) -
+									 reinterpret_cast<uintptr_t>(&__HeapBase));
+
+	block_pool_.init(&__block_pool_start__,
+					 reinterpret_cast<uintptr_t>(&__block_pool_end__) -
+						 reinterpret_cast<uintptr_t>(&__block_pool_start__),
+					 block_pool_classes);
+	recordBootPhase("memory init");
 }
 
 void NucleoL4RZI_DemoPlatform::initOS_() noexcept
 {
-	// TODO: freertos threaded support
+	// This platform is threadless. See nucleo_l4r5zi_freertos for the threaded variant.
 }
 
 void NucleoL4RZI_DemoPlatform::initHWPlatform_() noexcept
 {
 	hw_platform_.init();
+	console_ = &hw_platform_.console();
+	recordBootPhase("drivers started");
+
+	assert((reinterpret_cast<uintptr_t>(&__kv_store_end__) -
+			reinterpret_cast<uintptr_t>(&__kv_store_start__)) ==
+		   PlatformKVStore::PAGES * PlatformKVStore::PAGE_SIZE);
+
+	// A store which cannot be mounted is erased, so that the platform can still save settings
+	if(kv_store_.mount() != PlatformKVStore::status::ok)
+	{
+		kv_store_.format();
+	}
+
+	recordBootPhase("kv store mounted");
 }
 
 void NucleoL4RZI_DemoPlatform::initProcessor_() noexcept
 {
 	hw_platform_.initProcessor();
+	recordBootPhase("processor init");
 }
 
 void NucleoL4RZI_DemoPlatform::init_() noexcept {}
 
 void NucleoL4RZI_DemoPlatform::startBlink() noexcept
 {
+	// The heartbeat runs on the timer outputs, so it costs no interrupts
+	hw_platform_.setLEDDrive(NucleoL4R5ZI_HWPlatform::led_drive::timer);
 	hw_platform_.startBlink();
 }
 
-// TODO: freeRTOS threaded support
-#if 0
-void nRF52DK_FrameworkDemoPlatform::led_blink_thread_() noexcept
+void NucleoL4RZI_DemoPlatform::printMemoryMap() noexcept
+{
+	printf("Memory map:\n");
+	print_section(".ramfunc", &__ramfunc_start__, &__ramfunc_end__);
+	print_section(".sram2_retained", &__sram2_retained_start__, &__sram2_retained_end__);
+	print_section(".dma_buffers", &__dma_buffers_start__, &__dma_buffers_end__);
+	print_section(".sram3_bulk", &__sram3_bulk_start__, &__sram3_bulk_end__);
+	print_section("block pools", &__block_pool_start__, &__block_pool_end__);
+	print_section(".ext_flash", &__ext_flash_start__, &__ext_flash_end__);
+	print_section(".psram", &__psram_start__, &__psram_end__);
+	print_section("PSRAM heap", &__psram_heap_start__, &__psram_heap_end__);
+	print_section("KV store", &__kv_store_start__, &__kv_store_end__);
+}
+
+void NucleoL4RZI_DemoPlatform::addPSRAMHeap(const STM32OctoSPI& psram) noexcept
 {
-	static const auto led_list = hw_platform_.getLEDInstances();
-	static const auto delay = std::chrono::milliseconds(500);
+	static bool added = false;
+	assert(!added);
+	assert(psram.memoryMapped());
 
-	while(1)
+	auto start = reinterpret_cast<uintptr_t>(&__psram_heap_start__);
+	auto end = reinterpret_cast<uintptr_t>(&__psram_heap_end__);
+	auto base = reinterpret_cast<uintptr_t>(psram.mappedAddress());
+
+	// The linker script region must be within the memory which is actually fitted
+	assert(start >= base && (end - base) <= psram.size());
+
+	if(end > start)
 	{
-		for(const auto& led : led_list)
-		{
-			led->toggle();
-			embvm::this_thread::sleep_for(delay);
-		}
+		malloc_addblock(&__psram_heap_start__, end - start);
+	}
+
+	added = true;
+}
+
+PlatformBlockPool& NucleoL4RZI_DemoPlatform::blockPool() noexcept
+{
+	return block_pool_;
+}
+
+void NucleoL4RZI_DemoPlatform::printBlockPoolStats() noexcept
+{
+	printf("Block pools:\n");
+	for(size_t i = 0; i < PlatformBlockPool::size_classes(); i++)
+	{
+		auto stats = block_pool_.stats(i);
+		printf("  %4u B: %u/%u in use, high water mark %u, %u failed\n",
+			   static_cast<unsigned>(stats.block_size), static_cast<unsigned>(stats.in_use),
+			   static_cast<unsigned>(stats.capacity), static_cast<unsigned>(stats.high_water_mark),
+			   static_cast<unsigned>(stats.failed_allocations));
+	}
+}
+
+void NucleoL4RZI_DemoPlatform::recordBootPhase(const char* name) noexcept
+{
+	boot_timeline_.record(name, stm32l4r5::cycleCount(), stm32l4r5::coreClockFrequency());
+}
+
+void NucleoL4RZI_DemoPlatform::printBootTimeline() noexcept
+{
+	printf("Boot timeline:\n");
+	for(size_t i = 0; i < boot_timeline_.size(); i++)
+	{
+		auto& phase = boot_timeline_[i];
+		printf("  %-18s %8u us (+%u us) @ %u MHz\n", phase.name,
+			   static_cast<unsigned>(boot_timeline_.elapsedMicroseconds(i)),
+			   static_cast<unsigned>(boot_timeline_.intervalMicroseconds(i)),
+			   static_cast<unsigned>(phase.clock_hz / 1000000));
+	}
+}
+
+void NucleoL4RZI_DemoPlatform::printMemcpyBenchmark() noexcept
+{
+	auto& engine = hw_platform_.memcpyEngine();
+
+	for(size_t i = 0; i < MEMCPY_BENCHMARK_SIZE; i++)
+	{
+		memcpy_benchmark_src_[i] = static_cast<uint8_t>(i);
 	}
+
+	auto start = stm32l4r5::cycleCount();
+	memcpy(memcpy_benchmark_dest_, memcpy_benchmark_src_, MEMCPY_BENCHMARK_SIZE);
+	uint32_t memcpy_cycles = stm32l4r5::cycleCount() - start;
+
+	memset(memcpy_benchmark_dest_, 0, MEMCPY_BENCHMARK_SIZE);
+
+	start = stm32l4r5::cycleCount();
+	auto r = engine.copy(memcpy_benchmark_dest_, memcpy_benchmark_src_, MEMCPY_BENCHMARK_SIZE);
+	uint32_t dma_copy_cycles = stm32l4r5::cycleCount() - start;
+	bool valid = (r == STM32DMAMemcpy::status::ok) &&
+				 (memcmp(memcpy_benchmark_dest_, memcpy_benchmark_src_, MEMCPY_BENCHMARK_SIZE) == 0);
+
+	start = stm32l4r5::cycleCount();
+	memset(memcpy_benchmark_dest_, 0xA5, MEMCPY_BENCHMARK_SIZE);
+	uint32_t memset_cycles = stm32l4r5::cycleCount() - start;
+
+	start = stm32l4r5::cycleCount();
+	r = engine.fill(memcpy_benchmark_dest_, 0x5A, MEMCPY_BENCHMARK_SIZE);
+	uint32_t dma_fill_cycles = stm32l4r5::cycleCount() - start;
+	valid = valid && (r == STM32DMAMemcpy::status::ok) &&
+			(memcpy_benchmark_dest_[0] == 0x5A) &&
+			(memcpy_benchmark_dest_[MEMCPY_BENCHMARK_SIZE - 1] == 0x5A);
+
+	printf("Memory copy benchmark (%u bytes, SRAM1 -> SRAM3):\n",
+		   static_cast<unsigned>(MEMCPY_BENCHMARK_SIZE));
+	printf("  memcpy: %8u cycles, %4u MB/s\n", static_cast<unsigned>(memcpy_cycles),
+		   throughput_mbps(MEMCPY_BENCHMARK_SIZE, memcpy_cycles));
+	printf("  DMA copy: %6u cycles, %4u MB/s\n", static_cast<unsigned>(dma_copy_cycles),
+		   throughput_mbps(MEMCPY_BENCHMARK_SIZE, dma_copy_cycles));
+	printf("  memset: %8u cycles, %4u MB/s\n", static_cast<unsigned>(memset_cycles),
+		   throughput_mbps(MEMCPY_BENCHMARK_SIZE, memset_cycles));
+	printf("  DMA fill: %6u cycles, %4u MB/s\n", static_cast<unsigned>(dma_fill_cycles),
+		   throughput_mbps(MEMCPY_BENCHMARK_SIZE, dma_fill_cycles));
+	printf("  DMA results %s\n", valid ? "verified" : "INVALID");
+}
+
+void NucleoL4RZI_DemoPlatform::printCRCBenchmark() noexcept
+{
+	auto& crc = hw_platform_.crc();
+	bool valid = true;
+
+	for(size_t i = 0; i < MEMCPY_BENCHMARK_SIZE; i++)
+	{
+		memcpy_benchmark_src_[i] = static_cast<uint8_t>(i * 7);
+	}
+
+	printf("CRC benchmark (%u bytes, SRAM1):\n", static_cast<unsigned>(MEMCPY_BENCHMARK_SIZE));
+
+	for(const auto& benchmark : crc_benchmarks_)
+	{
+		auto start = stm32l4r5::cycleCount();
+		auto software_crc =
+			benchmark.software.calculate(memcpy_benchmark_src_, MEMCPY_BENCHMARK_SIZE);
+		uint32_t software_cycles = stm32l4r5::cycleCount() - start;
+
+		start = stm32l4r5::cycleCount();
+		auto cpu_crc =
+			crc.calculate(benchmark.params, memcpy_benchmark_src_, MEMCPY_BENCHMARK_SIZE);
+		uint32_t cpu_cycles = stm32l4r5::cycleCount() - start;
+
+		uint32_t dma_crc = 0;
+		start = stm32l4r5::cycleCount();
+		auto r = crc.calculate(benchmark.params, memcpy_benchmark_src_, MEMCPY_BENCHMARK_SIZE,
+							   dma_crc);
+		uint32_t dma_cycles = stm32l4r5::cycleCount() - start;
+
+		valid = valid && (r == STM32CRC::status::ok) && (cpu_crc == software_crc) &&
+				(dma_crc == software_crc);
+
+		printf("  %s software: %8u cycles, %4u MB/s\n", benchmark.name,
+			   static_cast<unsigned>(software_cycles),
+			   throughput_mbps(MEMCPY_BENCHMARK_SIZE, software_cycles));
+		printf("  %s CPU-fed:  %8u cycles, %4u MB/s\n", benchmark.name,
+			   static_cast<unsigned>(cpu_cycles),
+			   throughput_mbps(MEMCPY_BENCHMARK_SIZE, cpu_cycles));
+		printf("  %s DMA-fed:  %8u cycles, %4u MB/s\n", benchmark.name,
+			   static_cast<unsigned>(dma_cycles),
+			   throughput_mbps(MEMCPY_BENCHMARK_SIZE, dma_cycles));
+	}
+
+	printf("  CRC results %s\n", valid ? "verified" : "INVALID");
+}
+
+void NucleoL4RZI_DemoPlatform::printDmaPoolStats() noexcept
+{
+	constexpr std::array<const char*, 4> priority_names = {"low", "medium", "high", "very high"};
+	auto stats = hw_platform_.dmaPool().stats();
+
+	printf("DMA pool: %u/%u channels in use, high water mark %u, %u waiters woken\n",
+		   static_cast<unsigned>(stats.in_use), static_cast<unsigned>(stats.channels),
+		   static_cast<unsigned>(stats.high_water_mark),
+		   static_cast<unsigned>(stats.waiters_woken));
+	for(size_t i = 0; i < priority_names.size(); i++)
+	{
+		printf("  %-10s %u acquired, %u contended\n", priority_names[i],
+			   static_cast<unsigned>(stats.acquisitions[i]),
+			   static_cast<unsigned>(stats.contention[i]));
+	}
+}
+
+PlatformLogger& NucleoL4RZI_DemoPlatform::logger() noexcept
+{
+	return logger_;
+}
+
+size_t NucleoL4RZI_DemoPlatform::drainLog(bool binary) noexcept
+{
+	if(console_ == nullptr)
+	{
+		return 0;
+	}
+
+	if(binary)
+	{
+		return logger_.drainBinary(
+			[](const uint8_t* data, size_t length) { console_->writeBlocking(data, length); });
+	}
+
+	static char line[LOG_LINE_LENGTH];
+	return logger_.drainText(console_write_text, line, sizeof(line));
 }
-#endif
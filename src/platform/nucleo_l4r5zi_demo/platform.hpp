@@ -5,13 +5,54 @@
 #define NUCLEO_L4RZI_DEMO_PLATFORM_HPP_
 
 #include <NucleoL4R5ZI_HWPlatform.hpp>
+#include <block_pool.hpp>
 #include <boot/boot_sequencer.hpp>
+#include <boot_timeline.hpp>
+#include <deferred_log.hpp>
+#include <kv_store.hpp>
 #include <platform/virtual_platform.hpp>
+#include <stm32_firmware_update.hpp>
+#include <stm32_interrupt_lock.hpp>
+#include <stm32_octospi.hpp>
 
 /// Signal variable to exit the main() loop
 /// Declared in main.cpp
 extern volatile bool abort_program_;
 
+/** Fixed-block pool allocator used by the platform.
+ *
+ * The pools are carved out of the otherwise unused portion of SRAM3 during early init.
+ * Use this allocator for objects that are created and destroyed at runtime, especially
+ * in or near interrupt context: I2C operation descriptors, DMA buffers, and event records.
+ * The general purpose heap (malloc) should only be used during initialization.
+ */
+using PlatformBlockPool = BlockPoolAllocator<3, STM32InterruptLock>;
+
+/** Boot-phase timeline recorded by the platform.
+ *
+ * The platform records the end of early init, processor init, and driver startup.
+ * Applications can add their own phases (e.g., entry to main()) with recordBootPhase().
+ */
+using PlatformBootTimeline = BootTimeline<8>;
+
+/** Deferred-formatting logger owned by the platform.
+ *
+ * Logging only copies the format string ID and arguments into a lock-free ring, so it is
+ * safe and cheap to use from ISRs. The application must call drainLog() periodically from
+ * a low priority context (e.g., the main loop) to emit the records.
+ */
+using PlatformLogger = DeferredLogger<1024>;
+
+/** Persistent key-value store owned by the platform.
+ *
+ * The store uses the 16 internal flash pages of the KV_STORE linker region, and holds up to
+ * 64 keys. Applications should assign keys from an enum.
+ */
+using PlatformKVStore = KVStore<STM32InternalFlash, 16, 64>;
+
+/// Log a message with the platform's deferred logger. See DLOG for argument restrictions.
+#define PLATFORM_LOG(fmt, ...) DLOG(VirtualPlatform::logger(), fmt, ##__VA_ARGS__)
+
 class NucleoL4RZI_DemoPlatform final
 	: public embvm::VirtualPlatformBase<NucleoL4RZI_DemoPlatform, NucleoL4R5ZI_HWPlatform>
 {
@@ -29,9 +70,93 @@ class NucleoL4RZI_DemoPlatform final
 	// Platform APIs
 	void startBlink() noexcept;
 
+	/// Print the address and size of each of the linker script memory sections.
+	void printMemoryMap() noexcept;
+
+	/** Add the unused part of the external PSRAM region to the heap.
+	 *
+	 * The PSRAM is not mapped during early init, so it cannot be added with the internal heap.
+	 * Call this once, after the OCTOSPI driver attached to the PSRAM is in memory-mapped mode
+	 * with a write command. Afterward, malloc() can return PSRAM, which is slower than SRAM.
+	 *
+	 * @param [in] psram The OCTOSPI driver for the PSRAM.
+	 */
+	static void addPSRAMHeap(const STM32OctoSPI& psram) noexcept;
+
+	/// Access the platform's fixed-block pool allocator
+	static PlatformBlockPool& blockPool() noexcept;
+
+	/// Print the usage and high water mark of each block pool size class.
+	void printBlockPoolStats() noexcept;
+
+	/** Record that a boot phase has been reached.
+	 *
+	 * Phases are timestamped with the DWT cycle counter, which is started at reset.
+	 *
+	 * @param [in] name The name of the phase. Must have static storage duration.
+	 */
+	static void recordBootPhase(const char* name) noexcept;
+
+	/// Print the time at which each boot phase was reached, relative to reset.
+	void printBootTimeline() noexcept;
+
+	/** Compare the throughput of DMA copies and fills against memcpy() and memset().
+	 *
+	 * Data is copied from SRAM1 to SRAM3, and the results are printed in MB/s.
+	 */
+	void printMemcpyBenchmark() noexcept;
+
+	/** Compare the throughput of the CRC unit against a table-driven software CRC.
+	 *
+	 * CRC-32 (reflected, fed in words) and CRC-16/CCITT-FALSE (unreflected, fed in bytes)
+	 * are calculated over the same SRAM1 buffer, with the CPU and with the DMA feeding the
+	 * CRC unit. The results are printed in MB/s.
+	 */
+	void printCRCBenchmark() noexcept;
+
+	/// Print the usage and contention statistics of the shared DMA channel pool.
+	void printDmaPoolStats() noexcept;
+
+	/// Access the platform's deferred logger
+	static PlatformLogger& logger() noexcept;
+
+	/** Emit all pending log records on the console UART.
+	 *
+	 * Call this from a single, low priority context.
+	 *
+	 * @param [in] binary If false, records are formatted on the target. If true, the raw
+	 *	records are sent instead, which must be formatted on the host with log_decoder.
+	 *	Binary output should not be mixed with printf output on the same link.
+	 * @returns The number of records emitted.
+	 */
+	static size_t drainLog(bool binary = false) noexcept;
+
+	/** Access the platform's key-value store.
+	 *
+	 * The store is mounted when the hardware platform is initialized.
+	 */
+	PlatformKVStore& kvStore() noexcept
+	{
+		return kv_store_;
+	}
+
+	/** Access the platform's firmware updater.
+	 *
+	 * Images are written to the second bank, below the key-value store pages. The store is
+	 * carried over to the new image when it is activated.
+	 */
+	STM32FirmwareUpdate& firmwareUpdate() noexcept
+	{
+		return firmware_update_;
+	}
+
 	// Constructor/destructor
-	NucleoL4RZI_DemoPlatform() noexcept {}
+	NucleoL4RZI_DemoPlatform() noexcept;
 	~NucleoL4RZI_DemoPlatform() noexcept = default;
+
+  private:
+	PlatformKVStore kv_store_;
+	STM32FirmwareUpdate firmware_update_;
 };
 
 using VirtualPlatform = NucleoL4RZI_DemoPlatform;
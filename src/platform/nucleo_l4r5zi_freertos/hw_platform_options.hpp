@@ -0,0 +1,11 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef NUCLEO_L4R5ZI_FREERTOS_HW_PLATFORM_OPTIONS_HPP
+#define NUCLEO_L4R5ZI_FREERTOS_HW_PLATFORM_OPTIONS_HPP
+
+#include <driver/driver_registry.hpp>
+
+using PlatformDriverRegistry = embvm::StaticDriverRegistry<8>;
+
+#endif // NUCLEO_L4R5ZI_FREERTOS_HW_PLATFORM_OPTIONS_HPP
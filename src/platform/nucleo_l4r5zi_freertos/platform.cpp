@@ -0,0 +1,150 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#include "platform.hpp"
+#include <FreeRTOS.h>
+#include <malloc.h>
+#include <printf.h> // for putchar_ definition
+#include <task.h>
+
+extern int __HeapBase;
+extern int __HeapLimit;
+
+namespace
+{
+/// Console used by putchar_. Output is dropped until the hardware platform is initialized.
+STM32UART* console_ = nullptr;
+
+constexpr size_t LED_TASK_STACK_SIZE = 256; // words
+constexpr unsigned LED_TASK_PRIORITY = 1;
+constexpr size_t BENCHMARK_TASK_STACK_SIZE = 128; // words
+
+StaticTask_t led_task_tcb_;
+StackType_t led_task_stack_[LED_TASK_STACK_SIZE];
+
+StaticTask_t benchmark_task_tcb_;
+StackType_t benchmark_task_stack_[BENCHMARK_TASK_STACK_SIZE];
+TaskHandle_t benchmark_responder_ = nullptr;
+TaskHandle_t volatile benchmark_requester_ = nullptr;
+
+/// Responds to each notification from the benchmark requester with a notification of its own.
+void benchmark_responder_task(void* param)
+{
+	(void)param;
+
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		xTaskNotifyGive(benchmark_requester_);
+	}
+}
+} // namespace
+
+void putchar_(char c)
+{
+	if(console_ == nullptr)
+	{
+		return;
+	}
+
+	// Terminals expect CRLF line endings
+	if(c == '\n')
+	{
+		console_->writeBlocking(reinterpret_cast<const uint8_t*>("\r"), 1);
+	}
+
+	console_->writeBlocking(reinterpret_cast<const uint8_t*>(&c), 1);
+}
+
+void NucleoL4RZI_FreeRTOSPlatform::earlyInitHook_() noexcept
+{
+	// The hardware platform updates SystemCoreClock, so it runs before any heavy init
+	NucleoL4R5ZI_HWPlatform::earlyInitHook();
+
+	malloc_addblock(&__HeapBase, reinterpret_cast<uintptr_t>(&__HeapLimit) -
+									 reinterpret_cast<uintptr_t>(&__HeapBase));
+}
+
+void NucleoL4RZI_FreeRTOSPlatform::initOS_() noexcept
+{
+	// All kernel objects are statically allocated, so no heap needs to be handed to FreeRTOS.
+	// The benchmark responder blocks until it is needed.
+	benchmark_responder_ =
+		xTaskCreateStatic(benchmark_responder_task, "ctx_bench", BENCHMARK_TASK_STACK_SIZE,
+						  nullptr, BENCHMARK_TASK_PRIORITY, benchmark_task_stack_,
+						  &benchmark_task_tcb_);
+	assert(benchmark_responder_);
+}
+
+void NucleoL4RZI_FreeRTOSPlatform::initHWPlatform_() noexcept
+{
+	hw_platform_.init();
+	console_ = &hw_platform_.console();
+}
+
+void NucleoL4RZI_FreeRTOSPlatform::initProcessor_() noexcept
+{
+	hw_platform_.initProcessor();
+}
+
+void NucleoL4RZI_FreeRTOSPlatform::init_() noexcept {}
+
+void NucleoL4RZI_FreeRTOSPlatform::startBlink() noexcept
+{
+	auto handle = xTaskCreateStatic(led_blink_task_, "led_blink", LED_TASK_STACK_SIZE, this,
+									LED_TASK_PRIORITY, led_task_stack_, &led_task_tcb_);
+	assert(handle);
+}
+
+void NucleoL4RZI_FreeRTOSPlatform::startScheduler() noexcept
+{
+	vTaskStartScheduler();
+
+	// We only get here if the idle or timer task could not be created
+	assert(0);
+	while(1)
+		;
+}
+
+uint32_t NucleoL4RZI_FreeRTOSPlatform::measureContextSwitchLatency(uint32_t iterations) noexcept
+{
+	assert(iterations > 0);
+	assert(xTaskGetSchedulerState() == taskSCHEDULER_RUNNING);
+	assert(uxTaskPriorityGet(nullptr) < BENCHMARK_TASK_PRIORITY);
+
+	benchmark_requester_ = xTaskGetCurrentTaskHandle();
+	ulTaskNotifyTake(pdTRUE, 0); // Clear any stale notification
+
+	auto start = stm32l4r5::cycleCount();
+
+	for(uint32_t i = 0; i < iterations; i++)
+	{
+		// Giving the notification switches to the responder, which immediately notifies us
+		// and blocks again, switching back to this task.
+		xTaskNotifyGive(benchmark_responder_);
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+
+	auto elapsed = stm32l4r5::cycleCount() - start;
+
+	return elapsed / (iterations * 2);
+}
+
+void NucleoL4RZI_FreeRTOSPlatform::led_blink_task_(void* param) noexcept
+{
+	static_cast<NucleoL4RZI_FreeRTOSPlatform*>(param)->led_blink_thread_();
+}
+
+void NucleoL4RZI_FreeRTOSPlatform::led_blink_thread_() noexcept
+{
+	static const auto delay = pdMS_TO_TICKS(500);
+
+	while(1)
+	{
+		for(uint8_t i = 0; i < NucleoL4R5ZI_HWPlatform::LED_COUNT; i++)
+		{
+			hw_platform_.toggleLED(i);
+			vTaskDelay(delay);
+		}
+	}
+}
@@ -0,0 +1,70 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef NUCLEO_L4RZI_FREERTOS_PLATFORM_HPP_
+#define NUCLEO_L4RZI_FREERTOS_PLATFORM_HPP_
+
+#include <NucleoL4R5ZI_HWPlatform.hpp>
+#include <boot/boot_sequencer.hpp>
+#include <platform/virtual_platform.hpp>
+
+/** Threaded variant of the NUCLEO-L4R5ZI demo platform, built on FreeRTOS.
+ *
+ * Drivers are built with the FreeRTOS STM32Completion implementation, so blocking driver
+ * APIs (e.g., STM32I2CMaster transfers) suspend the calling task until the ISR signals
+ * completion instead of spinning.
+ *
+ * The application is responsible for creating its tasks and then calling startScheduler().
+ */
+class NucleoL4RZI_FreeRTOSPlatform final
+	: public embvm::VirtualPlatformBase<NucleoL4RZI_FreeRTOSPlatform, NucleoL4R5ZI_HWPlatform>
+{
+	using PlatformBase =
+		embvm::VirtualPlatformBase<NucleoL4RZI_FreeRTOSPlatform, NucleoL4R5ZI_HWPlatform>;
+
+  public:
+	// APIs to required by base class
+	static void earlyInitHook_() noexcept;
+	static void initOS_() noexcept;
+	void init_() noexcept;
+	void initProcessor_() noexcept;
+	void initHWPlatform_() noexcept;
+
+	// Platform APIs
+
+	/// Create the LED blink task. The LEDs will blink once the scheduler is started.
+	void startBlink() noexcept;
+
+	/// Start the FreeRTOS scheduler. This function does not return.
+	[[noreturn]] void startScheduler() noexcept;
+
+	/** Measure the context switch latency.
+	 *
+	 * The calling task and a higher-priority responder task ping-pong task notifications.
+	 * Each round trip involves two context switches. The result includes the cost of the
+	 * notification APIs, which is the cost a driver pays when blocking on a transfer.
+	 *
+	 * @precondition The scheduler is running, and this is called from a task with a priority
+	 *	lower than BENCHMARK_TASK_PRIORITY.
+	 *
+	 * @param [in] iterations The number of round trips to perform.
+	 * @returns The average number of CPU cycles per context switch.
+	 */
+	uint32_t measureContextSwitchLatency(uint32_t iterations) noexcept;
+
+	/// Priority of the context switch benchmark responder task
+	static constexpr unsigned BENCHMARK_TASK_PRIORITY = 4;
+
+	// Constructor/destructor
+	NucleoL4RZI_FreeRTOSPlatform() noexcept {}
+	~NucleoL4RZI_FreeRTOSPlatform() noexcept = default;
+
+  private:
+	static void led_blink_task_(void* param) noexcept;
+	void led_blink_thread_() noexcept;
+};
+
+using VirtualPlatform = NucleoL4RZI_FreeRTOSPlatform;
+using PlatformBootSequencer = embvm::BootSequencer<embvm::DefaultBootStrategy<VirtualPlatform>>;
+
+#endif // NUCLEO_L4RZI_FREERTOS_PLATFORM_HPP_
@@ -49,9 +49,28 @@
 Reset_Handler:
   ldr   sp, =__StackTop    /* Set stack pointer to top of stack. */
 
+/* Start the DWT cycle counter so that boot phases can be timestamped relative to reset.
+ * The counter runs at the core clock, which is the 4 MHz MSI until the clock is raised.
+ */
+    ldr r0, =0xE000EDFC     /* CoreDebug->DEMCR */
+    ldr r1, [r0]
+    orr r1, r1, #0x01000000 /* TRCENA */
+    str r1, [r0]
+    ldr r0, =0xE0001000     /* DWT->CTRL */
+    movs r1, #0
+    str r1, [r0, #4]        /* DWT->CYCCNT */
+    ldr r1, [r0]
+    orr r1, r1, #1          /* CYCCNTENA */
+    str r1, [r0]
+
 /* Call the clock system initialization function.*/
     bl  SystemInit
 
+/* Raise the core clock before the copy loops, so that they and the C runtime startup in
+ * _start (which zeroes .bss) run at full speed instead of the 4 MHz reset clock.
+ */
+    bl  stm32l4r5_early_clock_init
+
 /* Loop to copy data from read only memory to RAM.
  * The ranges of copy from/to are specified by following symbols:
  *      __data_start_in_flash: LMA of start of the section to copy from.
@@ -79,7 +98,30 @@ Reset_Handler:
 .L_loop1_done:
 #endif
 
-/* Call the libc entry point.*/
+/* Loop to copy functions placed in the .ramfunc section from flash into SRAM.
+ * The ranges of copy from/to are specified by following symbols:
+ *      __ramfunc_start_in_flash: LMA of start of the section to copy from.
+ *      __ramfunc_start__: VMA of start of the section to copy to.
+ *      __ramfunc_end__: VMA of end of the section to copy to.
+ *
+ * All addresses must be aligned to 4 bytes boundary.
+ */
+    ldr r1, =__ramfunc_start_in_flash
+    ldr r2, =__ramfunc_start__
+    ldr r3, =__ramfunc_end__
+
+    subs r3, r3, r2
+    ble .L_loop2_done
+
+.L_loop2:
+    subs r3, r3, #4
+    ldr r0, [r1,r3]
+    str r0, [r2,r3]
+    bgt .L_loop2
+
+.L_loop2_done:
+
+/* Call the libc entry point, which zeroes .bss before running the static constructors.*/
 	bl	_start
 
 LoopForever:
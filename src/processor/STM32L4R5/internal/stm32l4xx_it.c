@@ -104,12 +104,16 @@ void UsageFault_Handler(void)
 	}
 }
 
+/* When FreeRTOS is used, the SVCall, PendSV, and SysTick handlers are supplied by the
+ * FreeRTOS port (see FreeRTOSConfig.h). */
+#ifndef STM32L4R5_USE_FREERTOS
 /**
  * @brief  This function handles SVCall exception.
  * @param  None
  * @retval None
  */
 void SVC_Handler(void) {}
+#endif
 
 /**
  * @brief  This function handles Debug Monitor exception.
@@ -118,6 +122,7 @@ void SVC_Handler(void) {}
  */
 void DebugMon_Handler(void) {}
 
+#ifndef STM32L4R5_USE_FREERTOS
 /**
  * @brief  This function handles PendSVC exception.
  * @param  None
@@ -134,6 +139,7 @@ void SysTick_Handler(void)
 {
 	HAL_IncTick();
 }
+#endif
 
 /******************************************************************************/
 /*                 STM32L4xx Peripherals Interrupt Handlers                   */
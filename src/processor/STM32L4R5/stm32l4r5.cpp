@@ -3,7 +3,11 @@
 
 #include "stm32l4r5.hpp"
 #include <processor_architecture.hpp>
+#include <array>
+#include <cstring>
 #include <processor_includes.hpp>
+#include <stm32_rcc.hpp>
+#include <stm32_sections.hpp>
 
 #include <nvic.hpp> // for assert
 
@@ -25,17 +29,107 @@ void __assert_fail(const char* expr, const char* file,
 
 #pragma mark - Definitions -
 
+/// The first 16 entries are the Cortex-M core exceptions, followed by the device IRQs.
+/// DMAMUX1_OVR_IRQn is the final entry in the STM32L4R5 vector table.
+constexpr size_t CORE_EXCEPTION_COUNT = 16;
+constexpr size_t VECTOR_TABLE_ENTRIES = CORE_EXCEPTION_COUNT + DMAMUX1_OVR_IRQn + 1;
+
+/// Vector table defined in startup_stm32l4r5xx.s
+extern "C" const uint32_t g_pfnVectors[VECTOR_TABLE_ENTRIES];
+
+/// Called by Reset_Handler in startup_stm32l4r5xx.s
+extern "C" void stm32l4r5_early_clock_init() noexcept;
+
+#ifdef STM32L4R5_RELOCATE_VECTOR_TABLE
+/// SRAM copy of the vector table, which can be modified at runtime
+STM32_RAM_VECTOR_TABLE static std::array<uint32_t, VECTOR_TABLE_ENTRIES> ram_vector_table;
+#endif
+
 #pragma mark - Helpers -
 
+#ifdef STM32L4R5_RELOCATE_VECTOR_TABLE
+static void relocate_vector_table()
+{
+	memcpy(ram_vector_table.data(), g_pfnVectors, sizeof(ram_vector_table));
+	__DSB();
+	SCB->VTOR = reinterpret_cast<uint32_t>(ram_vector_table.data());
+	__DSB();
+	__ISB();
+}
+#endif
+
+#pragma mark - Startup -
+
+/// This runs before .data and .bss are initialized, so it must only touch registers.
+void stm32l4r5_early_clock_init() noexcept
+{
+	STM32ClockControl::configureSystemClock();
+}
+
 #pragma mark - Interface Functions -
 
 stm32l4r5::~stm32l4r5() {}
 
-void stm32l4r5::earlyInitHook_() noexcept {}
+void stm32l4r5::earlyInitHook_() noexcept
+{
+	// Reset_Handler raised the clock, but the .data copy restored the reset value of
+	// SystemCoreClock
+	SystemCoreClockUpdate();
 
-void stm32l4r5::init_() noexcept {}
+#ifdef STM32L4R5_RELOCATE_VECTOR_TABLE
+	relocate_vector_table();
+#endif
+}
+
+void stm32l4r5::init_() noexcept
+{
+	enableCycleCounter();
+}
 
 void stm32l4r5::reset_() noexcept
 {
 	ProcessorArch::systemReset();
 }
+
+void stm32l4r5::installInterruptHandler(int32_t irq, void (*handler)()) noexcept
+{
+#ifdef STM32L4R5_RELOCATE_VECTOR_TABLE
+	auto index = static_cast<size_t>(irq + static_cast<int32_t>(CORE_EXCEPTION_COUNT));
+	assert(handler && index < VECTOR_TABLE_ENTRIES);
+
+	ram_vector_table[index] = reinterpret_cast<uint32_t>(handler);
+	__DSB();
+#else
+	(void)irq;
+	(void)handler;
+	assert(0); // The vector table lives in flash, so it can't be patched
+#endif
+}
+
+void stm32l4r5::enableCycleCounter() noexcept
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t stm32l4r5::cycleCount() noexcept
+{
+	return DWT->CYCCNT;
+}
+
+void stm32l4r5::enableVddIO2() noexcept
+{
+	// The PWR clock is enabled by STM32ClockControl::configureSystemClock()
+	SET_BIT(PWR->CR2, PWR_CR2_IOSV);
+}
+
+void stm32l4r5::enableVddUSB() noexcept
+{
+	// The PWR clock is enabled by STM32ClockControl::configureSystemClock()
+	SET_BIT(PWR->CR2, PWR_CR2_USV);
+}
+
+uint32_t stm32l4r5::coreClockFrequency() noexcept
+{
+	return SystemCoreClock;
+}
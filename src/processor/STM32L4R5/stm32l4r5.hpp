@@ -25,6 +25,51 @@ class stm32l4r5 : public embvm::VirtualProcessorBase<stm32l4r5>
 	void reset_() noexcept;
 
 #pragma mark - Custom Functions -
+
+	/** Install an interrupt handler in the SRAM vector table.
+	 *
+	 * This allows handlers to be patched at runtime. The vector table is only located in
+	 * SRAM when the `relocate-vector-table` build option is enabled, which copies the flash
+	 * vector table into SRAM and points VTOR at the copy during earlyInitHook_().
+	 *
+	 * @precondition The vector table has been relocated to SRAM.
+	 * @precondition irq is a valid STM32L4R5 IRQ number (negative values are core exceptions).
+	 *
+	 * @param [in] irq The IRQ number (IRQn_Type) to install the handler for.
+	 * @param [in] handler The new interrupt handler.
+	 */
+	static void installInterruptHandler(int32_t irq, void (*handler)()) noexcept;
+
+	/** Enable the DWT cycle counter.
+	 *
+	 * The cycle counter is used for profiling and benchmarking. Reset_Handler starts the
+	 * counter at reset so that boot phases can be timestamped; this call ensures that the
+	 * counter is still running (e.g., after a debugger has modified DEMCR).
+	 * The counter value is not reset.
+	 *
+	 * @postcondition cycleCount() returns the number of core clock cycles since reset.
+	 */
+	static void enableCycleCounter() noexcept;
+
+	/// Read the DWT cycle counter. The counter wraps every 2^32 core clock cycles.
+	static uint32_t cycleCount() noexcept;
+
+	/** Enable the independent I/O supply for port G.
+	 *
+	 * PG[15:2] are powered from VDDIO2, which is isolated after reset. This must be called
+	 * before using those pins (e.g., the LPUART1 virtual COM port on PG7/PG8).
+	 */
+	static void enableVddIO2() noexcept;
+
+	/** Enable the independent USB supply.
+	 *
+	 * The USB transceiver is powered from VDDUSB, which is isolated after reset. This must be
+	 * called before starting the USB OTG FS driver.
+	 */
+	static void enableVddUSB() noexcept;
+
+	/// Get the current core clock frequency in Hz.
+	static uint32_t coreClockFrequency() noexcept;
 };
 
 #endif // STM32L4R5_PROCESSOR_HPP_
@@ -0,0 +1,331 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef BLOCK_POOL_HPP_
+#define BLOCK_POOL_HPP_
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+/** Default lock type for BlockPool, which performs no locking.
+ *
+ * This is suitable for single-context use and native testing. On target, use a lock that
+ * masks interrupts (e.g., STM32InterruptLock) so that pools can be shared with ISRs.
+ */
+struct BlockPoolNoLock
+{
+};
+
+/** Fixed-size block pool.
+ *
+ * A region of memory is divided into equally sized blocks, which are kept on an intrusive
+ * free list. Allocation and release are O(1) and never fragment.
+ *
+ * The pool is constant-initialized, so it can be declared as a global and initialized
+ * from an early init hook before static constructors run.
+ *
+ * @code
+ * static BlockPool<STM32InterruptLock> pool;
+ * pool.init(&__block_pool_start__, region_size, 64, 32);
+ * auto block = pool.allocate();
+ * pool.release(block);
+ * @endcode
+ *
+ * @tparam TLock RAII lock type which is held for the duration of each allocate/release call.
+ *	Use a lock that masks interrupts if the pool is used from an ISR.
+ */
+template<typename TLock = BlockPoolNoLock>
+class BlockPool
+{
+  public:
+	/// All blocks are aligned to this value.
+	static constexpr size_t BLOCK_ALIGNMENT = alignof(std::max_align_t);
+
+	/// Usage statistics for a pool
+	struct stats_t
+	{
+		/// The size of each block in bytes (after alignment adjustment).
+		size_t block_size;
+		/// The number of blocks in the pool.
+		size_t capacity;
+		/// The number of blocks currently allocated.
+		size_t in_use;
+		/// The largest number of blocks that have been allocated at the same time.
+		size_t high_water_mark;
+		/// The number of allocation requests that failed because the pool was empty.
+		size_t failed_allocations;
+	};
+
+	constexpr BlockPool() noexcept = default;
+	~BlockPool() noexcept = default;
+
+	BlockPool(const BlockPool&) = delete;
+	const BlockPool& operator=(const BlockPool&) = delete;
+
+	/** Carve a memory region into blocks.
+	 *
+	 * @precondition The pool has not been initialized.
+	 * @precondition The region is large enough to hold block_count blocks after alignment.
+	 * @postcondition All blocks are on the free list.
+	 *
+	 * @param [in] region The start of the memory region to use for the pool.
+	 * @param [in] region_size The size of the memory region, in bytes.
+	 * @param [in] block_size The requested size of each block, in bytes. This value is rounded
+	 * 	up to a multiple of BLOCK_ALIGNMENT.
+	 * @param [in] block_count The number of blocks to create.
+	 * @returns The number of bytes of the region consumed by the pool, including any padding
+	 *	needed to align the start of the region.
+	 */
+	size_t init(void* region, size_t region_size, size_t block_size, size_t block_count) noexcept
+	{
+		assert(region && block_size && block_count);
+		assert(capacity_ == 0); // Pool already initialized
+
+		auto region_start = reinterpret_cast<uintptr_t>(region);
+		start_ = align(region_start);
+		block_size_ = align(block_size);
+		capacity_ = block_count;
+		end_ = start_ + (block_size_ * block_count);
+		assert(end_ <= region_start + region_size); // Region is too small
+
+		// Build the list in reverse so that the lowest address is allocated first
+		for(size_t i = block_count; i > 0; i--)
+		{
+			auto block = reinterpret_cast<block_t*>(start_ + ((i - 1) * block_size_));
+			block->next = free_list_;
+			free_list_ = block;
+		}
+
+		return end_ - region_start;
+	}
+
+	/** Allocate a block from the pool.
+	 *
+	 * @returns A pointer to a block of block_size() bytes, or nullptr if the pool is empty.
+	 */
+	void* allocate() noexcept
+	{
+		[[maybe_unused]] TLock lock;
+
+		auto block = free_list_;
+		if(block)
+		{
+			free_list_ = block->next;
+			in_use_++;
+			if(in_use_ > high_water_mark_)
+			{
+				high_water_mark_ = in_use_;
+			}
+		}
+		else
+		{
+			failed_allocations_++;
+		}
+
+		return block;
+	}
+
+	/** Return a block to the pool.
+	 *
+	 * @precondition block was allocated from this pool and has not been released.
+	 * @param [in] block The block to release. nullptr is ignored.
+	 */
+	void release(void* block) noexcept
+	{
+		if(block == nullptr)
+		{
+			return;
+		}
+
+		assert(owns(block));
+		assert(((reinterpret_cast<uintptr_t>(block) - start_) % block_size_) == 0);
+
+		[[maybe_unused]] TLock lock;
+
+		assert(in_use_ > 0); // Double free
+		auto b = reinterpret_cast<block_t*>(block);
+		b->next = free_list_;
+		free_list_ = b;
+		in_use_--;
+	}
+
+	/// Check whether a pointer lies within this pool's memory region.
+	bool owns(const void* ptr) const noexcept
+	{
+		auto addr = reinterpret_cast<uintptr_t>(ptr);
+		return (addr >= start_) && (addr < end_);
+	}
+
+	/// The usable size of each block, in bytes.
+	size_t block_size() const noexcept
+	{
+		return block_size_;
+	}
+
+	/// Get the current usage statistics for the pool.
+	stats_t stats() const noexcept
+	{
+		[[maybe_unused]] TLock lock;
+		return {block_size_, capacity_, in_use_, high_water_mark_, failed_allocations_};
+	}
+
+	/// Reset the high water mark and failure count to the current usage.
+	void resetStats() noexcept
+	{
+		[[maybe_unused]] TLock lock;
+		high_water_mark_ = in_use_;
+		failed_allocations_ = 0;
+	}
+
+  private:
+	struct block_t
+	{
+		block_t* next;
+	};
+
+	static constexpr uintptr_t align(uintptr_t value) noexcept
+	{
+		return (value + (BLOCK_ALIGNMENT - 1)) & ~(BLOCK_ALIGNMENT - 1);
+	}
+
+  private:
+	block_t* free_list_ = nullptr;
+	uintptr_t start_ = 0;
+	uintptr_t end_ = 0;
+	size_t block_size_ = 0;
+	size_t capacity_ = 0;
+	size_t in_use_ = 0;
+	size_t high_water_mark_ = 0;
+	size_t failed_allocations_ = 0;
+};
+
+/** Allocator which manages several BlockPool size classes.
+ *
+ * Requests are served by the smallest size class that fits. If that class is exhausted,
+ * the next larger class is tried. Since the number of classes is fixed at compile time,
+ * allocation and release are both O(TClassCount).
+ *
+ * @code
+ * static BlockPoolAllocator<3, STM32InterruptLock> pools;
+ * pools.init(region, region_size, {{{32, 128}, {128, 64}, {512, 32}}});
+ * auto op = pools.allocate(sizeof(embvm::i2c::op_t));
+ * pools.release(op);
+ * @endcode
+ *
+ * @tparam TClassCount The number of block size classes.
+ * @tparam TLock RAII lock type used by the underlying pools.
+ */
+template<size_t TClassCount, typename TLock = BlockPoolNoLock>
+class BlockPoolAllocator
+{
+  public:
+	using pool_t = BlockPool<TLock>;
+	using stats_t = typename pool_t::stats_t;
+
+	/// Describes a single size class
+	struct size_class_t
+	{
+		/// The size of each block in bytes.
+		size_t block_size;
+		/// The number of blocks of this size.
+		size_t block_count;
+	};
+
+	constexpr BlockPoolAllocator() noexcept = default;
+	~BlockPoolAllocator() noexcept = default;
+
+	/** Divide a memory region between the size classes.
+	 *
+	 * @precondition classes are sorted by increasing block_size.
+	 * @precondition The region is large enough to hold all of the requested blocks.
+	 *
+	 * @param [in] region The start of the memory region to use for the pools.
+	 * @param [in] region_size The size of the memory region, in bytes.
+	 * @param [in] classes The block size and count for each size class.
+	 * @returns The number of bytes of the region that were consumed.
+	 */
+	size_t init(void* region, size_t region_size,
+				const std::array<size_class_t, TClassCount>& classes) noexcept
+	{
+		auto cursor = reinterpret_cast<uintptr_t>(region);
+		size_t remaining = region_size;
+
+		for(size_t i = 0; i < TClassCount; i++)
+		{
+			assert(i == 0 || classes[i].block_size > classes[i - 1].block_size);
+
+			auto used = pools_[i].init(reinterpret_cast<void*>(cursor), remaining,
+									   classes[i].block_size, classes[i].block_count);
+			cursor += used;
+			remaining -= used;
+		}
+
+		return region_size - remaining;
+	}
+
+	/** Allocate a block that can hold at least size bytes.
+	 *
+	 * @param [in] size The number of bytes required.
+	 * @returns A pointer to the block, or nullptr if no class can satisfy the request.
+	 */
+	void* allocate(size_t size) noexcept
+	{
+		for(auto& pool : pools_)
+		{
+			if(size <= pool.block_size())
+			{
+				auto block = pool.allocate();
+				if(block)
+				{
+					return block;
+				}
+			}
+		}
+
+		return nullptr;
+	}
+
+	/** Return a block to its owning pool.
+	 *
+	 * @precondition ptr was allocated from this allocator.
+	 * @param [in] ptr The block to release. nullptr is ignored.
+	 */
+	void release(void* ptr) noexcept
+	{
+		if(ptr == nullptr)
+		{
+			return;
+		}
+
+		for(auto& pool : pools_)
+		{
+			if(pool.owns(ptr))
+			{
+				pool.release(ptr);
+				return;
+			}
+		}
+
+		assert(0); // Pointer does not belong to this allocator
+	}
+
+	/// Get the usage statistics for a size class.
+	stats_t stats(size_t size_class) const noexcept
+	{
+		assert(size_class < TClassCount);
+		return pools_[size_class].stats();
+	}
+
+	/// The number of size classes managed by this allocator.
+	static constexpr size_t size_classes() noexcept
+	{
+		return TClassCount;
+	}
+
+  private:
+	std::array<pool_t, TClassCount> pools_{};
+};
+
+#endif // BLOCK_POOL_HPP_
@@ -0,0 +1,126 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef BOOT_TIMELINE_HPP_
+#define BOOT_TIMELINE_HPP_
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+/** Records timestamps for the phases of the boot process.
+ *
+ * Each phase is stored with the value of a free-running cycle counter and the core clock
+ * frequency at the time it was recorded. The counter is assumed to start at 0 on reset.
+ * Since the core clock changes during boot, each interval is converted to microseconds
+ * using the clock frequency in effect at the start of that interval. The interval from reset
+ * to the first phase uses the reset_clock_hz passed to the constructor, so it is approximate
+ * if the clock changes before the first phase is recorded.
+ *
+ * The timeline is constant-initialized, so phases can be recorded from an early init
+ * hook before static constructors run.
+ *
+ * @code
+ * static BootTimeline<8> timeline{4000000};
+ * timeline.record("main", stm32l4r5::cycleCount(), stm32l4r5::coreClockFrequency());
+ * auto t = timeline.elapsedMicroseconds(0);
+ * @endcode
+ *
+ * @tparam TMaxPhases The maximum number of phases that can be recorded. Additional phases
+ *	are dropped.
+ */
+template<size_t TMaxPhases>
+class BootTimeline
+{
+  public:
+	/// A single recorded boot phase
+	struct phase_t
+	{
+		/// Name of the phase. Must point to a string with static storage duration.
+		const char* name;
+		/// Cycle counter value when the phase was reached.
+		uint32_t cycles;
+		/// Core clock frequency (Hz) when the phase was reached.
+		uint32_t clock_hz;
+	};
+
+	/** Construct a timeline.
+	 *
+	 * @param [in] reset_clock_hz The core clock frequency coming out of reset.
+	 */
+	explicit constexpr BootTimeline(uint32_t reset_clock_hz) noexcept
+		: reset_clock_hz_(reset_clock_hz)
+	{
+	}
+
+	~BootTimeline() noexcept = default;
+
+	/** Record that a boot phase has been reached.
+	 *
+	 * @param [in] name The name of the phase. Must have static storage duration.
+	 * @param [in] cycles The current cycle counter value.
+	 * @param [in] clock_hz The current core clock frequency.
+	 */
+	void record(const char* name, uint32_t cycles, uint32_t clock_hz) noexcept
+	{
+		if(count_ < TMaxPhases)
+		{
+			phases_[count_] = {name, cycles, clock_hz};
+			count_++;
+		}
+	}
+
+	/// The number of phases that have been recorded.
+	size_t size() const noexcept
+	{
+		return count_;
+	}
+
+	/// Access a recorded phase.
+	const phase_t& operator[](size_t index) const noexcept
+	{
+		assert(index < count_);
+		return phases_[index];
+	}
+
+	/** Get the time between the previous phase (or reset) and this phase.
+	 *
+	 * @param [in] index The phase to check.
+	 * @returns The duration of the interval ending at this phase, in microseconds.
+	 */
+	uint64_t intervalMicroseconds(size_t index) const noexcept
+	{
+		assert(index < count_);
+
+		uint32_t start_cycles = 0;
+		uint32_t start_clock = reset_clock_hz_;
+		if(index > 0)
+		{
+			start_cycles = phases_[index - 1].cycles;
+			start_clock = phases_[index - 1].clock_hz;
+		}
+
+		auto delta = static_cast<uint64_t>(phases_[index].cycles - start_cycles);
+		return (delta * 1000000) / start_clock;
+	}
+
+	/// Get the time from reset to this phase, in microseconds.
+	uint64_t elapsedMicroseconds(size_t index) const noexcept
+	{
+		uint64_t elapsed = 0;
+		for(size_t i = 0; i <= index; i++)
+		{
+			elapsed += intervalMicroseconds(i);
+		}
+
+		return elapsed;
+	}
+
+  private:
+	std::array<phase_t, TMaxPhases> phases_{};
+	size_t count_ = 0;
+	const uint32_t reset_clock_hz_;
+};
+
+#endif // BOOT_TIMELINE_HPP_
@@ -0,0 +1,160 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef BSRR_WAVEFORM_HPP_
+#define BSRR_WAVEFORM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+/** Helpers for building GPIO waveforms as arrays of BSRR words.
+ *
+ * A GPIO bit set/reset register (BSRR) sets the pins in its lower 16 bits and clears the pins
+ * in its upper 16 bits. Writing 0 leaves every pin unchanged. A waveform is an array of BSRR
+ * words, one per sample period, which is written to the port at a fixed rate by DMA (see
+ * STM32Waveform).
+ *
+ * Because an all-zero word leaves the port unchanged, waveforms for different pins of the
+ * same port can be merged with a bitwise OR. This lets several LED strings or pulse trains
+ * be driven in parallel from a single buffer.
+ */
+
+/// BSRR word which sets the pins in the mask
+constexpr uint32_t bsrrSet(uint16_t pins) noexcept
+{
+	return pins;
+}
+
+/// BSRR word which clears the pins in the mask
+constexpr uint32_t bsrrReset(uint16_t pins) noexcept
+{
+	return static_cast<uint32_t>(pins) << 16;
+}
+
+/** Timing of a pulse-width encoded bit, in samples.
+ *
+ * Each bit starts high, stays high for zero_high (0 bit) or one_high (1 bit) samples, and is
+ * low for the rest of samples_per_bit.
+ */
+struct bit_timing_t
+{
+	uint8_t samples_per_bit;
+	uint8_t zero_high;
+	uint8_t one_high;
+};
+
+/** WS2812 timing at WS2812_SAMPLE_RATE (417 ns per sample).
+ *
+ * A 0 bit is high for 417 ns, and a 1 bit is high for 833 ns, in a 1.25 us bit period.
+ */
+constexpr bit_timing_t WS2812_TIMING = {3, 1, 2};
+
+/// Waveform sample rate for WS2812_TIMING, in Hz
+constexpr uint32_t WS2812_SAMPLE_RATE = 2400000;
+
+/// Number of BSRR words needed to encode a number of bytes
+constexpr size_t encodedLength(size_t bytes, const bit_timing_t& timing) noexcept
+{
+	return bytes * 8 * timing.samples_per_bit;
+}
+
+/** Encode bytes as pulse-width modulated bits, MSB first.
+ *
+ * @precondition 0 < zero_high < samples_per_bit and 0 < one_high < samples_per_bit
+ * @param [out] out The waveform buffer.
+ * @param [in] out_length The number of words in the waveform buffer.
+ * @param [in] data The bytes to encode.
+ * @param [in] length The number of bytes to encode.
+ * @param [in] pins The GPIO pins which carry the signal.
+ * @param [in] timing The bit timing.
+ * @param [in] merge If true, the encoded words are ORed into the buffer instead of
+ *	overwriting it. Use this to add a second signal on other pins of the same port.
+ * @returns The number of words written, or 0 if the buffer is too small.
+ */
+constexpr size_t encodeBits(uint32_t* out, size_t out_length, const uint8_t* data, size_t length,
+							uint16_t pins, const bit_timing_t& timing, bool merge = false) noexcept
+{
+	size_t words = encodedLength(length, timing);
+	if(words > out_length)
+	{
+		return 0;
+	}
+
+	uint32_t* word = out;
+	for(size_t i = 0; i < length; i++)
+	{
+		for(uint8_t bit = 0x80; bit; bit >>= 1)
+		{
+			auto high = (data[i] & bit) ? timing.one_high : timing.zero_high;
+
+			for(uint8_t sample = 0; sample < timing.samples_per_bit; sample++, word++)
+			{
+				uint32_t value = 0;
+				if(sample == 0)
+				{
+					value = bsrrSet(pins);
+				}
+				else if(sample == high)
+				{
+					value = bsrrReset(pins);
+				}
+
+				*word = merge ? (*word | value) : value;
+			}
+		}
+	}
+
+	return words;
+}
+
+/** Encode WS2812 (NeoPixel) LED colors.
+ *
+ * Play the result at WS2812_SAMPLE_RATE. The string latches the colors once the line has
+ * been low for at least 50 us (280 us for newer parts) after the waveform ends.
+ *
+ * @param [out] out The waveform buffer. It needs encodedLength(3 * leds, WS2812_TIMING) words.
+ * @param [in] out_length The number of words in the waveform buffer.
+ * @param [in] grb The LED colors, 3 bytes per LED in green, red, blue order.
+ * @param [in] leds The number of LEDs.
+ * @param [in] pins The GPIO pin(s) connected to the string's data input.
+ * @param [in] merge If true, the string is ORed into the buffer (see encodeBits()).
+ * @returns The number of words written, or 0 if the buffer is too small.
+ */
+constexpr size_t ws2812Encode(uint32_t* out, size_t out_length, const uint8_t* grb, size_t leds,
+							  uint16_t pins, bool merge = false) noexcept
+{
+	return encodeBits(out, out_length, grb, leds * 3, pins, WS2812_TIMING, merge);
+}
+
+/** Encode a train of identical pulses (e.g., stepper motor step pulses).
+ *
+ * @precondition high > 0 and low > 0
+ * @param [out] out The waveform buffer. It needs count * (high + low) words.
+ * @param [in] out_length The number of words in the waveform buffer.
+ * @param [in] count The number of pulses.
+ * @param [in] high The number of samples each pulse is high.
+ * @param [in] low The number of samples between pulses.
+ * @param [in] pins The GPIO pins which carry the pulses.
+ * @param [in] merge If true, the pulses are ORed into the buffer (see encodeBits()).
+ * @returns The number of words written, or 0 if the buffer is too small.
+ */
+constexpr size_t encodePulses(uint32_t* out, size_t out_length, size_t count, size_t high,
+							  size_t low, uint16_t pins, bool merge = false) noexcept
+{
+	size_t words = count * (high + low);
+	if(words > out_length)
+	{
+		return 0;
+	}
+
+	for(size_t i = 0; i < words; i++)
+	{
+		size_t sample = i % (high + low);
+		uint32_t value = (sample == 0) ? bsrrSet(pins) : ((sample == high) ? bsrrReset(pins) : 0);
+		out[i] = merge ? (out[i] | value) : value;
+	}
+
+	return words;
+}
+
+#endif // BSRR_WAVEFORM_HPP_
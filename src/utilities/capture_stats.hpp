@@ -0,0 +1,174 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef CAPTURE_STATS_HPP_
+#define CAPTURE_STATS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+/** Helpers for analyzing timer input capture timestamps.
+ *
+ * An input capture buffer holds the counter value latched at each edge of a signal. The
+ * counter wraps around, so intervals are computed modulo the counter width (counter_mask is
+ * 0xFFFF for 16-bit timers and 0xFFFFFFFF for 32-bit timers). An interval is only correct if
+ * the counter wraps at most once between two edges.
+ */
+
+/// Number of counter ticks between two captures
+constexpr uint32_t captureInterval(uint32_t earlier, uint32_t later, uint32_t counter_mask) noexcept
+{
+	return (later - earlier) & counter_mask;
+}
+
+/// Interval statistics for a sequence of captures, in counter ticks
+struct capture_stats_t
+{
+	/// Number of intervals measured (one less than the number of captures)
+	size_t intervals;
+	/// Sum of all intervals
+	uint64_t total;
+	/// Shortest interval
+	uint32_t min;
+	/// Longest interval
+	uint32_t max;
+	/// Mean interval, rounded to the nearest tick
+	uint32_t mean;
+	/// Standard deviation of the intervals (RMS jitter), rounded down
+	uint32_t stddev;
+
+	/// Peak-to-peak jitter
+	constexpr uint32_t jitter() const noexcept
+	{
+		return max - min;
+	}
+};
+
+/// Integer square root, rounded down
+constexpr uint32_t isqrt64(uint64_t value) noexcept
+{
+	uint64_t root = 0;
+	uint64_t bit = uint64_t(1) << 62;
+
+	while(bit > value)
+	{
+		bit >>= 2;
+	}
+
+	while(bit)
+	{
+		if(value >= root + bit)
+		{
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+
+		bit >>= 2;
+	}
+
+	return static_cast<uint32_t>(root);
+}
+
+/** Compute interval statistics from a circular capture buffer.
+ *
+ * @param [in] captures The capture buffer.
+ * @param [in] buffer_length The number of entries in the buffer.
+ * @param [in] first The index of the oldest capture to analyze. Indexes wrap around at
+ *	buffer_length.
+ * @param [in] count The number of captures to analyze, <= buffer_length.
+ * @param [in] counter_mask The counter width mask.
+ * @returns The statistics. All fields are 0 if fewer than two captures are analyzed.
+ */
+constexpr capture_stats_t captureStatistics(const uint32_t* captures, size_t buffer_length,
+											size_t first, size_t count,
+											uint32_t counter_mask) noexcept
+{
+	capture_stats_t stats = {0, 0, 0, 0, 0, 0};
+
+	if(count < 2 || count > buffer_length)
+	{
+		return stats;
+	}
+
+	stats.intervals = count - 1;
+	stats.min = UINT32_MAX;
+
+	auto interval = [&](size_t i) {
+		return captureInterval(captures[(first + i) % buffer_length],
+							   captures[(first + i + 1) % buffer_length], counter_mask);
+	};
+
+	for(size_t i = 0; i < stats.intervals; i++)
+	{
+		auto value = interval(i);
+		stats.total += value;
+		stats.min = (value < stats.min) ? value : stats.min;
+		stats.max = (value > stats.max) ? value : stats.max;
+	}
+
+	stats.mean = static_cast<uint32_t>((stats.total + (stats.intervals / 2)) / stats.intervals);
+
+	// Second pass, so the squared deviations stay small for low-jitter signals
+	uint64_t squares = 0;
+	for(size_t i = 0; i < stats.intervals; i++)
+	{
+		auto value = interval(i);
+		uint64_t deviation = (value > stats.mean) ? (value - stats.mean) : (stats.mean - value);
+		auto square = deviation * deviation;
+
+		// Saturate rather than wrap for pathological inputs
+		squares = (squares > UINT64_MAX - square) ? UINT64_MAX : squares + square;
+	}
+
+	stats.stddev = isqrt64(squares / stats.intervals);
+
+	return stats;
+}
+
+/** Convert a measured period to a frequency.
+ *
+ * @param [in] tick_frequency The counter tick frequency, in Hz.
+ * @param [in] ticks The total duration of the periods, in counter ticks.
+ * @param [in] periods The number of periods in ticks. Averaging over many periods (e.g.,
+ *	capture_stats_t::total and intervals) improves the resolution.
+ * @param [in] scale Result multiplier. Use 1000 to get millihertz for slow signals.
+ * @returns The frequency multiplied by scale, rounded to the nearest unit, or 0 if ticks is 0.
+ */
+constexpr uint64_t captureFrequency(uint32_t tick_frequency, uint64_t ticks, uint32_t periods = 1,
+									uint32_t scale = 1) noexcept
+{
+	if(ticks == 0)
+	{
+		return 0;
+	}
+
+	auto numerator = static_cast<uint64_t>(tick_frequency) * periods * scale;
+	return (numerator + (ticks / 2)) / ticks;
+}
+
+/** Convert a measured pulse width to a duty cycle.
+ *
+ * @param [in] high The active time, in counter ticks.
+ * @param [in] period The period, in counter ticks.
+ * @returns The duty cycle, where UINT16_MAX is 100%. The result is clamped to 100%.
+ */
+constexpr uint16_t captureDutyCycle(uint32_t high, uint32_t period) noexcept
+{
+	if(period == 0)
+	{
+		return 0;
+	}
+
+	if(high >= period)
+	{
+		return UINT16_MAX;
+	}
+
+	return static_cast<uint16_t>((static_cast<uint64_t>(high) * UINT16_MAX) / period);
+}
+
+#endif // CAPTURE_STATS_HPP_
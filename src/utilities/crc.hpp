@@ -0,0 +1,175 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef CRC_HPP_
+#define CRC_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/** Parameters of a CRC algorithm, in the usual catalogue form.
+ *
+ * The register is shifted most significant bit first. Each input byte is bit-reflected
+ * before it is processed if reflect_in is set, and the final register value is reflected
+ * (over width bits) if reflect_out is set, before it is XORed with xor_out.
+ *
+ * The polynomial, init, and xor_out values are width bits wide, and the implicit top bit
+ * of the polynomial is omitted (e.g., 0x04C11DB7 for CRC-32).
+ */
+struct crc_params_t
+{
+	/// CRC width, in bits [1..32]
+	uint8_t width;
+	uint32_t polynomial;
+	uint32_t init;
+	bool reflect_in;
+	bool reflect_out;
+	uint32_t xor_out;
+
+	/// Mask of the valid CRC bits
+	constexpr uint32_t mask() const noexcept
+	{
+		return (width >= 32) ? UINT32_MAX : ((UINT32_C(1) << width) - 1);
+	}
+};
+
+/// CRC-32 (IEEE 802.3, zlib). Check value: 0xCBF43926
+constexpr crc_params_t CRC32_IEEE = {32, 0x04C11DB7, 0xFFFFFFFF, true, true, 0xFFFFFFFF};
+/// CRC-32C (Castagnoli, iSCSI). Check value: 0xE3069283
+constexpr crc_params_t CRC32_C = {32, 0x1EDC6F41, 0xFFFFFFFF, true, true, 0xFFFFFFFF};
+/// CRC-16/CCITT-FALSE. Check value: 0x29B1
+constexpr crc_params_t CRC16_CCITT_FALSE = {16, 0x1021, 0xFFFF, false, false, 0};
+/// CRC-16/MODBUS. Check value: 0x4B37
+constexpr crc_params_t CRC16_MODBUS = {16, 0x8005, 0xFFFF, true, true, 0};
+/// CRC-8/SMBUS. Check value: 0xF4
+constexpr crc_params_t CRC8_SMBUS = {8, 0x07, 0x00, false, false, 0};
+/// CRC-7/MMC, used by SD card commands. Check value: 0x75
+constexpr crc_params_t CRC7_MMC = {7, 0x09, 0x00, false, false, 0};
+
+/// Reverse the order of the low `bits` bits of a value
+constexpr uint32_t crcReflect(uint32_t value, uint8_t bits) noexcept
+{
+	uint32_t result = 0;
+
+	for(uint8_t i = 0; i < bits; i++)
+	{
+		result = (result << 1) | (value & 1U);
+		value >>= 1;
+	}
+
+	return result;
+}
+
+/** Table-driven software CRC.
+ *
+ * A 256-entry table is computed from the parameters when the object is constructed, and
+ * each input byte costs one table lookup. Any width from 1 to 32 bits is supported.
+ *
+ *	- Reflected algorithms keep the register reflected in the low bits, and shift right.
+ *	- Other algorithms keep the register aligned to the top of 32 bits, and shift left.
+ *
+ * Calculations can be split across calls with begin(), update(), and finish():
+ *
+ * @code
+ * SoftwareCRC crc{CRC16_CCITT_FALSE};
+ * auto value = crc.begin();
+ * value = crc.update(value, header, sizeof(header));
+ * value = crc.update(value, payload, payload_length);
+ * auto result = crc.finish(value);
+ * @endcode
+ */
+class SoftwareCRC
+{
+  public:
+	explicit constexpr SoftwareCRC(const crc_params_t& params) noexcept : params_(params)
+	{
+		for(uint32_t i = 0; i < table_.size(); i++)
+		{
+			uint32_t value = 0;
+
+			if(params_.reflect_in)
+			{
+				auto polynomial = crcReflect(params_.polynomial, params_.width);
+				value = i;
+				for(int bit = 0; bit < 8; bit++)
+				{
+					value = (value >> 1) ^ ((value & 1U) ? polynomial : 0U);
+				}
+			}
+			else
+			{
+				auto polynomial = params_.polynomial << (32 - params_.width);
+				value = i << 24;
+				for(int bit = 0; bit < 8; bit++)
+				{
+					value = (value << 1) ^ ((value & 0x80000000U) ? polynomial : 0U);
+				}
+			}
+
+			table_[i] = value;
+		}
+	}
+
+	/// The parameters of the algorithm
+	constexpr const crc_params_t& params() const noexcept
+	{
+		return params_;
+	}
+
+	/// The initial register value for update()
+	constexpr uint32_t begin() const noexcept
+	{
+		return params_.reflect_in ? crcReflect(params_.init, params_.width)
+								  : (params_.init << (32 - params_.width));
+	}
+
+	/// Process data, and return the new register value
+	uint32_t update(uint32_t reg, const void* data, size_t length) const noexcept
+	{
+		auto bytes = static_cast<const uint8_t*>(data);
+
+		if(params_.reflect_in)
+		{
+			for(size_t i = 0; i < length; i++)
+			{
+				reg = table_[(reg ^ bytes[i]) & 0xFF] ^ (reg >> 8);
+			}
+		}
+		else
+		{
+			for(size_t i = 0; i < length; i++)
+			{
+				reg = table_[(reg >> 24) ^ bytes[i]] ^ (reg << 8);
+			}
+		}
+
+		return reg;
+	}
+
+	/// Convert a register value into the CRC
+	constexpr uint32_t finish(uint32_t reg) const noexcept
+	{
+		// Normalize to the unreflected register, then apply the output reflection
+		uint32_t value = params_.reflect_in ? crcReflect(reg, params_.width)
+											: (reg >> (32 - params_.width));
+		if(params_.reflect_out)
+		{
+			value = crcReflect(value, params_.width);
+		}
+
+		return (value ^ params_.xor_out) & params_.mask();
+	}
+
+	/// Compute the CRC of a buffer
+	uint32_t calculate(const void* data, size_t length) const noexcept
+	{
+		return finish(update(begin(), data, length));
+	}
+
+  private:
+	const crc_params_t params_;
+	std::array<uint32_t, 256> table_{};
+};
+
+#endif // CRC_HPP_
@@ -0,0 +1,183 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef DEFERRED_LOG_HPP_
+#define DEFERRED_LOG_HPP_
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <log_format.hpp>
+#include <log_ring.hpp>
+
+/** Log a message with deferred formatting.
+ *
+ * The format string is placed in the `log_fmt` section, and only its offset within that
+ * section and the raw argument words are stored in the logger's ring. Formatting happens
+ * later, when the logger is drained, or on a host when the binary output is used.
+ *
+ * Safe to call from any context, including ISRs.
+ *
+ * - Arguments must be integers, enums, pointers, or floating point values
+ * - Floating point values are stored as float
+ * - %s arguments must point to strings with static storage duration, since the
+ *	string is not read until the logger is drained
+ *
+ * @code
+ * DLOG(logger, "ADC sample %u: %d mV\n", index, millivolts);
+ * @endcode
+ *
+ * @param logger The DeferredLogger instance.
+ * @param fmt The format string. Must be a string literal.
+ */
+#define DLOG(logger, fmt, ...)                                                              \
+	do                                                                                      \
+	{                                                                                       \
+		static const char dlog_fmt_[] __attribute__((section("log_fmt"), used)) = fmt;     \
+		(logger).log(dlog_fmt_, ##__VA_ARGS__);                                             \
+	} while(0)
+
+/** Logger which defers formatting to a low priority context or to a host.
+ *
+ * Producers (DLOG) only copy a format string ID and the raw argument words into a
+ * lock-free LogRing, which takes a small, bounded amount of time regardless of the
+ * format string. The consumer drains the ring in one of two ways:
+ *
+ *	- drainText() formats each record on the target with formatLogRecord()
+ *	- drainBinary() emits the raw records, which are formatted on a host by LogDecoder
+ *		using the contents of the log_fmt section extracted from the firmware image
+ *
+ * Only one context may drain the logger.
+ *
+ * @tparam TCapacityWords The size of the record ring in 32-bit words. Must be a power of two.
+ */
+template<size_t TCapacityWords>
+class DeferredLogger
+{
+	using Ring = LogRing<TCapacityWords>;
+
+  public:
+	using record_t = typename Ring::record_t;
+
+	/** Construct a logger.
+	 *
+	 * @param [in] fmt_base The start of the log_fmt section. Format string IDs are offsets
+	 *	from this address.
+	 */
+	explicit constexpr DeferredLogger(const char* fmt_base) noexcept : fmt_base_(fmt_base) {}
+	~DeferredLogger() noexcept = default;
+
+	/** Add a record to the log.
+	 *
+	 * Prefer the DLOG macro, which places the format string in the log_fmt section.
+	 *
+	 * @precondition fmt is located in the log_fmt section.
+	 * @param [in] fmt The format string.
+	 * @param [in] args The arguments to the format string.
+	 * @returns true if the record was added, false if it was dropped because the ring is full.
+	 */
+	template<typename... TArgs>
+	bool log(const char* fmt, TArgs... args) noexcept
+	{
+		static_assert(sizeof...(TArgs) <= Ring::MAX_ARGS, "Too many arguments for a log record");
+		assert(fmt >= fmt_base_);
+
+		const std::array<uint32_t, sizeof...(TArgs)> words = {{toLogArg(args)...}};
+		return ring_.push(formatId(fmt), words.data(), words.size());
+	}
+
+	/// Convert a format string pointer into its ID.
+	uint32_t formatId(const char* fmt) const noexcept
+	{
+		return static_cast<uint32_t>(fmt - fmt_base_);
+	}
+
+	/// Convert a format string ID into a pointer to the format string.
+	const char* formatString(uint32_t id) const noexcept
+	{
+		return &fmt_base_[id];
+	}
+
+	/** Format and emit all published records.
+	 *
+	 * @param [in] sink Callable invoked as sink(const char* text, size_t length) for each record.
+	 * @param [in] scratch Buffer used to format each record.
+	 * @param [in] scratch_size The size of the scratch buffer. Longer messages are truncated.
+	 * @returns The number of records emitted.
+	 */
+	template<typename TSink>
+	size_t drainText(TSink&& sink, char* scratch, size_t scratch_size) noexcept
+	{
+		size_t count = 0;
+		record_t record;
+
+		while(ring_.pop(record))
+		{
+			auto length = formatLogRecord(scratch, scratch_size, formatString(record.id),
+										  record.args.data(), record.arg_count, true);
+			sink(static_cast<const char*>(scratch), length);
+			count++;
+		}
+
+		return count;
+	}
+
+	/** Emit all published records in the binary LogRing format.
+	 *
+	 * Each record is emitted as a header word followed by its argument words, in
+	 * little-endian byte order. Use LogDecoder to format the stream on a host.
+	 *
+	 * @param [in] sink Callable invoked as sink(const uint8_t* data, size_t length) for each record.
+	 * @returns The number of records emitted.
+	 */
+	template<typename TSink>
+	size_t drainBinary(TSink&& sink) noexcept
+	{
+		size_t count = 0;
+		record_t record;
+		std::array<uint8_t, (Ring::MAX_ARGS + 1) * sizeof(uint32_t)> bytes;
+
+		while(ring_.pop(record))
+		{
+			putWord(&bytes[0], Ring::makeHeader(record.id, record.arg_count));
+			for(size_t i = 0; i < record.arg_count; i++)
+			{
+				putWord(&bytes[(i + 1) * sizeof(uint32_t)], record.args[i]);
+			}
+
+			sink(static_cast<const uint8_t*>(bytes.data()),
+				 (record.arg_count + 1) * sizeof(uint32_t));
+			count++;
+		}
+
+		return count;
+	}
+
+	/// Check whether any records are waiting to be drained.
+	bool empty() const noexcept
+	{
+		return ring_.empty();
+	}
+
+	/// The number of records dropped because the ring was full.
+	uint32_t dropped() const noexcept
+	{
+		return ring_.dropped();
+	}
+
+  private:
+	static void putWord(uint8_t* bytes, uint32_t word) noexcept
+	{
+		bytes[0] = static_cast<uint8_t>(word);
+		bytes[1] = static_cast<uint8_t>(word >> 8);
+		bytes[2] = static_cast<uint8_t>(word >> 16);
+		bytes[3] = static_cast<uint8_t>(word >> 24);
+	}
+
+  private:
+	const char* const fmt_base_;
+	Ring ring_;
+};
+
+#endif // DEFERRED_LOG_HPP_
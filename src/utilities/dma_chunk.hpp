@@ -0,0 +1,86 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef DMA_CHUNK_HPP_
+#define DMA_CHUNK_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+/// A single DMA transfer within a larger memory copy or fill
+struct dma_chunk_t
+{
+	/// Size of each data item, in bytes (1, 2, or 4)
+	size_t width;
+	/// Number of data items to transfer
+	size_t items;
+
+	constexpr size_t bytes() const noexcept
+	{
+		return width * items;
+	}
+};
+
+/** Select the next DMA transfer for a memory copy or fill.
+ *
+ * DMA controllers transfer fixed-size items, and the item count is limited (65535 on STM32).
+ * A copy is split into chunks so that the widest possible item size is used for the bulk of
+ * the data:
+ *
+ *	- The item width is the largest of 4, 2, or 1 bytes for which both addresses are aligned
+ *		and at least one item remains.
+ *	- If the addresses could reach a wider alignment (their difference is a multiple of a wider
+ *		item size), the chunk stops at that alignment boundary so the next chunk can use the
+ *		wider items. At most 3 bytes are transferred with narrow items at each end of a copy.
+ *	- Otherwise the chunk covers as much of the remaining data as the item limit allows.
+ *
+ * Call this repeatedly, advancing the addresses by chunk.bytes(), until no data remains.
+ *
+ * @precondition remaining > 0
+ * @precondition max_items > 0
+ * @param [in] dest The destination address.
+ * @param [in] src The source address. Ignored for fills.
+ * @param [in] remaining The number of bytes left to transfer.
+ * @param [in] fill True if the source is a single fill value rather than a buffer.
+ *	Fills only need the destination to be aligned.
+ * @param [in] max_items The maximum number of items in a single transfer.
+ * @returns The next chunk to transfer.
+ */
+constexpr dma_chunk_t nextDmaChunk(uintptr_t dest, uintptr_t src, size_t remaining, bool fill,
+								   size_t max_items) noexcept
+{
+	// Widest alignment that the addresses can share
+	size_t reachable = 4;
+	if(!fill)
+	{
+		auto offset = dest - src;
+		reachable = ((offset & 0x3) == 0) ? 4 : (((offset & 0x1) == 0) ? 2 : 1);
+	}
+
+	size_t width = reachable;
+	while(width > 1 && (((dest & (width - 1)) != 0) || remaining < width))
+	{
+		width >>= 1;
+	}
+
+	size_t items = remaining / width;
+
+	if(width < reachable)
+	{
+		// Stop at the next wider alignment boundary
+		size_t to_boundary = (reachable - (dest & (reachable - 1))) & (reachable - 1);
+		if(to_boundary > 0 && to_boundary < remaining)
+		{
+			items = to_boundary / width;
+		}
+	}
+
+	if(items > max_items)
+	{
+		items = max_items;
+	}
+
+	return {width, items};
+}
+
+#endif // DMA_CHUNK_HPP_
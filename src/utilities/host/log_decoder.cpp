@@ -0,0 +1,97 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+/* Host tool which formats binary deferred log output.
+ *
+ * Usage:
+ *	log_decoder <log_fmt.bin> [log.bin]
+ *
+ * log_fmt.bin is the log_fmt section extracted from the firmware image:
+ *	arm-none-eabi-objcopy -O binary --only-section=log_fmt app.elf log_fmt.bin
+ *
+ * The binary log stream is read from log.bin, or from stdin if no file is given
+ * (e.g., piped from a serial port).
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <log_format.hpp>
+#include <vector>
+
+namespace
+{
+bool read_file(const char* path, std::vector<char>& contents)
+{
+	FILE* f = fopen(path, "rb");
+	if(f == nullptr)
+	{
+		return false;
+	}
+
+	char buffer[4096];
+	size_t n;
+	while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+	{
+		contents.insert(contents.end(), buffer, buffer + n);
+	}
+
+	fclose(f);
+	return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "Usage: %s <log_fmt.bin> [log.bin]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<char> fmt_table;
+	if(!read_file(argv[1], fmt_table))
+	{
+		fprintf(stderr, "Unable to read format table: %s\n", argv[1]);
+		return 1;
+	}
+
+	FILE* input = stdin;
+	if(argc == 3)
+	{
+		input = fopen(argv[2], "rb");
+		if(input == nullptr)
+		{
+			fprintf(stderr, "Unable to open log: %s\n", argv[2]);
+			return 1;
+		}
+	}
+
+	LogDecoder decoder{fmt_table.data(), fmt_table.size()};
+	std::vector<uint8_t> pending;
+	uint8_t buffer[1024];
+	size_t n;
+
+	// Records can be split across reads, so unconsumed bytes are carried over
+	while((n = fread(buffer, 1, sizeof(buffer), input)) > 0)
+	{
+		pending.insert(pending.end(), buffer, buffer + n);
+		auto consumed =
+			decoder.decode(pending.data(), pending.size(), [](const char* text, size_t length) {
+				fwrite(text, 1, length, stdout);
+				fflush(stdout);
+			});
+		pending.erase(pending.begin(), pending.begin() + static_cast<std::ptrdiff_t>(consumed));
+	}
+
+	if(input != stdin)
+	{
+		fclose(input);
+	}
+
+	if(decoder.skippedWords() > 0)
+	{
+		fprintf(stderr, "Skipped %zu invalid words\n", decoder.skippedWords());
+	}
+
+	return 0;
+}
@@ -0,0 +1,869 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef KV_STORE_HPP_
+#define KV_STORE_HPP_
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/** Wear-levelled, append-only key-value store for page-erasable flash.
+ *
+ * The store occupies a fixed number of flash pages, which are used as a log. Each write
+ * appends a record with the new value to the newest page (the head), so a value is never
+ * modified in place. When the head is full, the next erased page becomes the head. Once no
+ * erased page remains, the oldest page is reclaimed: its live records are copied to the head,
+ * and the page is erased. Pages are opened in ring order, so erases are spread evenly over the
+ * whole region.
+ *
+ * An in-RAM index holds the location of the latest record for every key, so lookups are O(1)
+ * and never scan the flash. The index is rebuilt by mount() at startup.
+ *
+ * Records are protected by a CRC, and the header of a record is programmed before its value.
+ * If power is lost during a write, the partial record fails its CRC check at the next mount,
+ * and the previous value of the key is used. Power loss while a page is reclaimed leaves both
+ * copies of a record in flash, and the newer copy is used.
+ *
+ * Keys are integers in [0, MaxKeys), which are typically assigned from an enum.
+ *
+ * @code
+ * KVStore<STM32InternalFlash, 16, 64> settings{flash, KV_STORE_ADDRESS};
+ * settings.mount();
+ * settings.write(CALIBRATION_KEY, &calibration, sizeof(calibration));
+ * settings.read(CALIBRATION_KEY, &calibration, sizeof(calibration));
+ * @endcode
+ *
+ * The store is not internally locked. Use it from a single context.
+ *
+ * @tparam TFlash The flash driver type (e.g., STM32InternalFlash or RamFlash). It must provide
+ *	PAGE_SIZE, PROGRAM_SIZE, a status enum with an ok value, and blocking read(), program(),
+ *	and erasePage() functions.
+ * @tparam Pages The number of flash pages used by the store, >= 2.
+ * @tparam MaxKeys The number of keys, which sets the size of the RAM index (4 bytes per key).
+ */
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+class KVStore
+{
+  public:
+	enum class status : uint8_t
+	{
+		ok = 0,
+		/// The key has no value
+		not_found,
+		/// The key is >= MaxKeys
+		invalid_key,
+		/// The value is larger than MAX_VALUE_SIZE, or larger than the read buffer
+		too_large,
+		/// There is not enough space for the value, even after reclaiming pages
+		no_space,
+		/// A flash operation failed, or the store is corrupt
+		flash_error,
+	};
+
+	using key_t = uint16_t;
+
+	static constexpr size_t PAGES = Pages;
+	static constexpr size_t PAGE_SIZE = TFlash::PAGE_SIZE;
+	static constexpr size_t PAGE_HEADER_SIZE = 8;
+	static constexpr size_t RECORD_HEADER_SIZE = 8;
+
+	/// The largest value which can be stored
+	static constexpr size_t MAX_VALUE_SIZE =
+		((PAGE_SIZE - PAGE_HEADER_SIZE - RECORD_HEADER_SIZE) < 0xFFFE)
+			? (PAGE_SIZE - PAGE_HEADER_SIZE - RECORD_HEADER_SIZE)
+			: 0xFFFE;
+
+	/** The total size of the live records which fit in the store.
+	 *
+	 * One page is always kept erased for reclaiming. Records do not span pages, so storing
+	 * large values may leave some of this space unusable.
+	 */
+	static constexpr size_t CAPACITY = (Pages - 1) * (PAGE_SIZE - PAGE_HEADER_SIZE);
+
+	static_assert(Pages >= 2, "At least two pages are required to reclaim space");
+	static_assert(MaxKeys > 0 && MaxKeys < 0xFFFF, "Key 0xFFFF is reserved for erased flash");
+	static_assert((8 % TFlash::PROGRAM_SIZE) == 0, "Headers must be whole programming units");
+
+  public:
+	/** Construct a key-value store.
+	 *
+	 * @param [in] flash The flash driver.
+	 * @param [in] base The address of the first page of the store. It must be page aligned.
+	 */
+	KVStore(TFlash& flash, uintptr_t base) noexcept : flash_(flash), base_(base)
+	{
+		assert((base % PAGE_SIZE) == 0);
+	}
+	~KVStore() noexcept = default;
+
+	KVStore(const KVStore&) = delete;
+	const KVStore& operator=(const KVStore&) = delete;
+
+	/** Scan the flash and build the index.
+	 *
+	 * A region which has never been used (or which has no valid pages) is formatted. Pages
+	 * which were being erased when power was lost are erased again.
+	 *
+	 * @postcondition The store can be read and written.
+	 */
+	status mount() noexcept;
+
+	/// Erase all values.
+	status format() noexcept;
+
+	/** Read the value of a key.
+	 *
+	 * @precondition The store is mounted.
+	 * @param [in] key The key.
+	 * @param [out] value The buffer for the value.
+	 * @param [in] capacity The size of the buffer.
+	 * @param [out] length If not nullptr, receives the size of the value, even if the buffer is
+	 *	too small.
+	 * @returns status::ok, status::not_found, or status::too_large if the value does not fit in
+	 *	the buffer. Nothing is copied unless status::ok is returned.
+	 */
+	status read(key_t key, void* value, size_t capacity, size_t* length = nullptr) const noexcept;
+
+	/** Set the value of a key.
+	 *
+	 * Nothing is written if the key already has the same value.
+	 *
+	 * @precondition The store is mounted.
+	 * @param [in] key The key.
+	 * @param [in] value The value. May be nullptr if length is 0.
+	 * @param [in] length The size of the value, <= MAX_VALUE_SIZE.
+	 */
+	status write(key_t key, const void* value, size_t length) noexcept;
+
+	/// Remove the value of a key.
+	/// @precondition The store is mounted.
+	status remove(key_t key) noexcept;
+
+	/// Check whether a key has a value.
+	bool contains(key_t key) const noexcept
+	{
+		return (key < MaxKeys) && (index_[key] != NO_RECORD);
+	}
+
+	/// The number of keys which have a value.
+	size_t count() const noexcept
+	{
+		return count_;
+	}
+
+	/// The flash space used by the latest record of each key, in bytes.
+	size_t liveBytes() const noexcept
+	{
+		return live_bytes_;
+	}
+
+	/// The number of pages opened since the store was formatted, which tracks flash wear.
+	uint32_t sequence() const noexcept
+	{
+		return sequence_;
+	}
+
+  private:
+	struct page_header_t
+	{
+		uint32_t magic;
+		/// Incremented each time a page is opened, starting at 1. The head has the highest.
+		uint32_t sequence;
+	};
+
+	struct record_header_t
+	{
+		key_t key;
+		/// The size of the value, or TOMBSTONE for a removed key
+		uint16_t length;
+		/// CRC-32 of the key, length, and value
+		uint32_t crc;
+	};
+
+	static_assert(sizeof(page_header_t) == PAGE_HEADER_SIZE, "Unexpected page header size");
+	static_assert(sizeof(record_header_t) == RECORD_HEADER_SIZE, "Unexpected record size");
+
+	static constexpr uint32_t PAGE_MAGIC = 0x3153564B; // "KVS1"
+	static constexpr uint16_t TOMBSTONE = 0xFFFF;
+	/// Index value for a key without a record
+	static constexpr uint32_t NO_RECORD = UINT32_MAX;
+	/// Size of the buffer used to copy and check records
+	static constexpr size_t CHUNK_SIZE = 32;
+
+	static constexpr size_t recordSize(uint16_t length) noexcept
+	{
+		return RECORD_HEADER_SIZE + ((length == TOMBSTONE) ? 0 : ((length + 7U) & ~size_t(7)));
+	}
+
+	/// Bitwise CRC-32 (IEEE 802.3). Chain calls by passing the previous result.
+	static uint32_t crc32(uint32_t crc, const void* data, size_t length) noexcept
+	{
+		auto bytes = static_cast<const uint8_t*>(data);
+		crc = ~crc;
+
+		for(size_t i = 0; i < length; i++)
+		{
+			crc ^= bytes[i];
+			for(unsigned bit = 0; bit < 8; bit++)
+			{
+				crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+			}
+		}
+
+		return ~crc;
+	}
+
+	static uint32_t headerCRC(key_t key, uint16_t length) noexcept
+	{
+		const uint16_t fields[2] = {key, length};
+		return crc32(0, fields, sizeof(fields));
+	}
+
+	uintptr_t pageAddress(size_t page) const noexcept
+	{
+		return base_ + (page * PAGE_SIZE);
+	}
+
+	bool flashOk(typename TFlash::status s) const noexcept
+	{
+		return s == TFlash::status::ok;
+	}
+
+	bool readHeader(uint32_t offset, record_header_t& header) const noexcept
+	{
+		return flashOk(flash_.read(base_ + offset, &header, sizeof(header)));
+	}
+
+	status initialize() noexcept;
+	bool isPageErased(size_t page) const noexcept;
+	bool validRecord(uint32_t offset, const record_header_t& header) const noexcept;
+	bool valueEquals(uint32_t offset, const void* value, size_t length) const noexcept;
+	/// Apply a record to the index
+	void apply(key_t key, uint16_t length, uint32_t offset) noexcept;
+	/// Read the page headers and replay every page into the index
+	status load(bool& head_corrupt) noexcept;
+	/// Apply every valid record in a page. Returns the offset of the first free byte.
+	size_t scanPage(size_t page, bool& corrupt) noexcept;
+	status append(key_t key, uint16_t length, const void* value) noexcept;
+	status programRecord(uint32_t offset, key_t key, uint16_t length, const void* value) noexcept;
+	/// Open the next erased page as the head
+	status advance() noexcept;
+	/// Copy the live records of a page to the head, and erase the page
+	status reclaim(size_t page) noexcept;
+	size_t erasedPages() const noexcept;
+	size_t oldestPage() const noexcept;
+
+  private:
+	TFlash& flash_;
+	const uintptr_t base_;
+	/// Offset of the latest record for each key, relative to base_
+	std::array<uint32_t, MaxKeys> index_{};
+	/// Sequence number of each page, or 0 if the page is erased
+	std::array<uint32_t, Pages> page_sequence_{};
+	size_t head_ = 0;
+	/// Offset of the next record in the head page
+	size_t write_offset_ = 0;
+	uint32_t sequence_ = 0;
+	size_t count_ = 0;
+	size_t live_bytes_ = 0;
+	bool mounted_ = false;
+};
+
+#pragma mark - Public APIs -
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status KVStore<TFlash, Pages, MaxKeys>::mount() noexcept
+{
+	mounted_ = false;
+
+	bool head_corrupt = false;
+	auto r = load(head_corrupt);
+
+	// No erased page means power was lost while the oldest page was being reclaimed. The head
+	// was opened for that reclaim, so it only holds copies of records in the oldest page.
+	if(r == status::ok && erasedPages() == 0)
+	{
+		if(head_corrupt)
+		{
+			// A copy was interrupted, so the head has no room to finish. Discard the copies
+			// and let the next page change restart the reclaim.
+			if(!flashOk(flash_.erasePage(pageAddress(head_))))
+			{
+				return status::flash_error;
+			}
+
+			r = load(head_corrupt);
+		}
+		else
+		{
+			r = reclaim(oldestPage());
+		}
+	}
+
+	mounted_ = (r == status::ok);
+	return r;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status KVStore<TFlash, Pages, MaxKeys>::format() noexcept
+{
+	mounted_ = false;
+
+	for(size_t page = 0; page < Pages; page++)
+	{
+		if(!isPageErased(page) && !flashOk(flash_.erasePage(pageAddress(page))))
+		{
+			return status::flash_error;
+		}
+	}
+
+	return initialize();
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::read(key_t key, void* value, size_t capacity,
+										  size_t* length) const noexcept
+{
+	assert(mounted_);
+
+	if(key >= MaxKeys)
+	{
+		return status::invalid_key;
+	}
+
+	auto offset = index_[key];
+	if(offset == NO_RECORD)
+	{
+		return status::not_found;
+	}
+
+	record_header_t header;
+	if(!readHeader(offset, header))
+	{
+		return status::flash_error;
+	}
+
+	if(length)
+	{
+		*length = header.length;
+	}
+
+	if(header.length > capacity)
+	{
+		return status::too_large;
+	}
+
+	if(header.length &&
+	   !flashOk(flash_.read(base_ + offset + RECORD_HEADER_SIZE, value, header.length)))
+	{
+		return status::flash_error;
+	}
+
+	return status::ok;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::write(key_t key, const void* value, size_t length) noexcept
+{
+	assert(mounted_);
+	assert(value || length == 0);
+
+	if(key >= MaxKeys)
+	{
+		return status::invalid_key;
+	}
+
+	if(length > MAX_VALUE_SIZE)
+	{
+		return status::too_large;
+	}
+
+	size_t old_size = 0;
+	auto offset = index_[key];
+	if(offset != NO_RECORD)
+	{
+		record_header_t header;
+		if(!readHeader(offset, header))
+		{
+			return status::flash_error;
+		}
+
+		// Skip rewriting an unchanged value to save wear
+		if(header.length == length && valueEquals(offset, value, length))
+		{
+			return status::ok;
+		}
+
+		old_size = recordSize(header.length);
+	}
+
+	if(live_bytes_ - old_size + recordSize(static_cast<uint16_t>(length)) > CAPACITY)
+	{
+		return status::no_space;
+	}
+
+	return append(key, static_cast<uint16_t>(length), value);
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::remove(key_t key) noexcept
+{
+	assert(mounted_);
+
+	if(key >= MaxKeys)
+	{
+		return status::invalid_key;
+	}
+
+	if(index_[key] == NO_RECORD)
+	{
+		return status::not_found;
+	}
+
+	return append(key, TOMBSTONE, nullptr);
+}
+
+#pragma mark - Helpers -
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::load(bool& head_corrupt) noexcept
+{
+	index_.fill(NO_RECORD);
+	count_ = 0;
+	live_bytes_ = 0;
+
+	bool used = false;
+	for(size_t page = 0; page < Pages; page++)
+	{
+		page_header_t header;
+		if(!flashOk(flash_.read(pageAddress(page), &header, sizeof(header))))
+		{
+			return status::flash_error;
+		}
+
+		if(header.magic == PAGE_MAGIC && header.sequence != 0 && header.sequence != UINT32_MAX)
+		{
+			page_sequence_[page] = header.sequence;
+			used = true;
+			continue;
+		}
+
+		// A page may have been partially erased or opened when power was lost
+		page_sequence_[page] = 0;
+		if(!isPageErased(page) && !flashOk(flash_.erasePage(pageAddress(page))))
+		{
+			return status::flash_error;
+		}
+	}
+
+	if(!used)
+	{
+		return initialize();
+	}
+
+	// Replay the pages from oldest to newest, so that the newest record of each key wins
+	uint32_t last = 0;
+	while(true)
+	{
+		size_t next = Pages;
+		for(size_t page = 0; page < Pages; page++)
+		{
+			auto sequence = page_sequence_[page];
+			if(sequence > last && (next == Pages || sequence < page_sequence_[next]))
+			{
+				next = page;
+			}
+		}
+
+		if(next == Pages)
+		{
+			break;
+		}
+
+		head_ = next;
+		write_offset_ = scanPage(next, head_corrupt);
+		last = page_sequence_[next];
+	}
+
+	sequence_ = last;
+	return status::ok;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::initialize() noexcept
+{
+	index_.fill(NO_RECORD);
+	page_sequence_.fill(0);
+	count_ = 0;
+	live_bytes_ = 0;
+	sequence_ = 1;
+	head_ = 0;
+	write_offset_ = PAGE_HEADER_SIZE;
+
+	page_header_t header = {PAGE_MAGIC, sequence_};
+	if(!flashOk(flash_.program(pageAddress(0), &header, sizeof(header))))
+	{
+		return status::flash_error;
+	}
+
+	page_sequence_[0] = sequence_;
+	mounted_ = true;
+	return status::ok;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+bool KVStore<TFlash, Pages, MaxKeys>::isPageErased(size_t page) const noexcept
+{
+	uint8_t chunk[CHUNK_SIZE];
+
+	for(size_t offset = 0; offset < PAGE_SIZE; offset += CHUNK_SIZE)
+	{
+		auto size = ((PAGE_SIZE - offset) < CHUNK_SIZE) ? (PAGE_SIZE - offset) : CHUNK_SIZE;
+		if(!flashOk(flash_.read(pageAddress(page) + offset, chunk, size)))
+		{
+			return false;
+		}
+
+		for(size_t i = 0; i < size; i++)
+		{
+			if(chunk[i] != 0xFF)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+bool KVStore<TFlash, Pages, MaxKeys>::validRecord(uint32_t offset,
+												  const record_header_t& header) const noexcept
+{
+	if(header.length != TOMBSTONE && header.length > MAX_VALUE_SIZE)
+	{
+		return false;
+	}
+
+	// Records never span pages
+	if((offset % PAGE_SIZE) + recordSize(header.length) > PAGE_SIZE)
+	{
+		return false;
+	}
+
+	auto crc = headerCRC(header.key, header.length);
+	size_t length = (header.length == TOMBSTONE) ? 0 : header.length;
+	uint8_t chunk[CHUNK_SIZE];
+
+	for(size_t i = 0; i < length; i += CHUNK_SIZE)
+	{
+		auto size = ((length - i) < CHUNK_SIZE) ? (length - i) : CHUNK_SIZE;
+		if(!flashOk(flash_.read(base_ + offset + RECORD_HEADER_SIZE + i, chunk, size)))
+		{
+			return false;
+		}
+
+		crc = crc32(crc, chunk, size);
+	}
+
+	return crc == header.crc;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+bool KVStore<TFlash, Pages, MaxKeys>::valueEquals(uint32_t offset, const void* value,
+												  size_t length) const noexcept
+{
+	auto bytes = static_cast<const uint8_t*>(value);
+	uint8_t chunk[CHUNK_SIZE];
+
+	for(size_t i = 0; i < length; i += CHUNK_SIZE)
+	{
+		auto size = ((length - i) < CHUNK_SIZE) ? (length - i) : CHUNK_SIZE;
+		if(!flashOk(flash_.read(base_ + offset + RECORD_HEADER_SIZE + i, chunk, size)) ||
+		   memcmp(chunk, &bytes[i], size) != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+void KVStore<TFlash, Pages, MaxKeys>::apply(key_t key, uint16_t length, uint32_t offset) noexcept
+{
+	// Keys beyond the index (e.g., from a build with more keys) are dropped
+	if(key >= MaxKeys)
+	{
+		return;
+	}
+
+	auto previous = index_[key];
+	if(previous != NO_RECORD)
+	{
+		record_header_t header;
+		auto r = readHeader(previous, header);
+		assert(r);
+		(void)r;
+
+		live_bytes_ -= recordSize(header.length);
+		count_--;
+	}
+
+	if(length == TOMBSTONE)
+	{
+		index_[key] = NO_RECORD;
+	}
+	else
+	{
+		index_[key] = offset;
+		live_bytes_ += recordSize(length);
+		count_++;
+	}
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+size_t KVStore<TFlash, Pages, MaxKeys>::scanPage(size_t page, bool& corrupt) noexcept
+{
+	size_t offset = PAGE_HEADER_SIZE;
+	corrupt = false;
+
+	while(offset + RECORD_HEADER_SIZE <= PAGE_SIZE)
+	{
+		auto record = static_cast<uint32_t>((page * PAGE_SIZE) + offset);
+		record_header_t header;
+		if(!readHeader(record, header))
+		{
+			corrupt = true;
+			return PAGE_SIZE;
+		}
+
+		if(header.key == 0xFFFF && header.length == 0xFFFF && header.crc == UINT32_MAX)
+		{
+			// Erased space: the end of the log in this page
+			return offset;
+		}
+
+		if(!validRecord(record, header))
+		{
+			// A write was interrupted. Nothing more is appended to this page.
+			corrupt = true;
+			return PAGE_SIZE;
+		}
+
+		apply(header.key, header.length, record);
+		offset += recordSize(header.length);
+	}
+
+	return offset;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::append(key_t key, uint16_t length, const void* value) noexcept
+{
+	auto size = recordSize(length);
+
+	// Each attempt reclaims a page, so give up once every page has been tried
+	for(size_t attempt = 0; attempt <= Pages; attempt++)
+	{
+		if(write_offset_ + size <= PAGE_SIZE)
+		{
+			auto offset = static_cast<uint32_t>((head_ * PAGE_SIZE) + write_offset_);
+
+			// The space is consumed even if programming fails, since it may be partially written
+			write_offset_ += size;
+			auto r = programRecord(offset, key, length, value);
+			if(r == status::ok)
+			{
+				apply(key, length, offset);
+			}
+
+			return r;
+		}
+
+		auto r = advance();
+		if(r != status::ok)
+		{
+			return r;
+		}
+	}
+
+	return status::no_space;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::programRecord(uint32_t offset, key_t key, uint16_t length,
+												   const void* value) noexcept
+{
+	size_t value_length = (length == TOMBSTONE) ? 0 : length;
+	record_header_t header = {key, length, crc32(headerCRC(key, length), value, value_length)};
+
+	// The header is programmed first, so an interrupted write always fails the CRC check
+	auto address = base_ + offset;
+	if(!flashOk(flash_.program(address, &header, sizeof(header))))
+	{
+		return status::flash_error;
+	}
+
+	address += RECORD_HEADER_SIZE;
+	auto whole = value_length & ~size_t(7);
+	if(whole && !flashOk(flash_.program(address, value, whole)))
+	{
+		return status::flash_error;
+	}
+
+	if(value_length > whole)
+	{
+		// Pad the final double-word with the erased value
+		uint8_t last[8];
+		memset(last, 0xFF, sizeof(last));
+		memcpy(last, static_cast<const uint8_t*>(value) + whole, value_length - whole);
+		if(!flashOk(flash_.program(address + whole, last, sizeof(last))))
+		{
+			return status::flash_error;
+		}
+	}
+
+	return status::ok;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::advance() noexcept
+{
+	// Open erased pages in ring order, so that erases are spread over every page
+	size_t next = Pages;
+	for(size_t i = 1; i <= Pages; i++)
+	{
+		auto page = (head_ + i) % Pages;
+		if(page_sequence_[page] == 0)
+		{
+			next = page;
+			break;
+		}
+	}
+
+	if(next == Pages)
+	{
+		return status::flash_error; // An erased page is always kept
+	}
+
+	page_header_t header = {PAGE_MAGIC, sequence_ + 1};
+	if(!flashOk(flash_.program(pageAddress(next), &header, sizeof(header))))
+	{
+		// Leave the page erased so it can be used again
+		(void)flash_.erasePage(pageAddress(next));
+		return status::flash_error;
+	}
+
+	sequence_++;
+	page_sequence_[next] = sequence_;
+	head_ = next;
+	write_offset_ = PAGE_HEADER_SIZE;
+
+	if(erasedPages() == 0)
+	{
+		return reclaim(oldestPage());
+	}
+
+	return status::ok;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+typename KVStore<TFlash, Pages, MaxKeys>::status
+	KVStore<TFlash, Pages, MaxKeys>::reclaim(size_t page) noexcept
+{
+	assert(page != head_);
+
+	size_t offset = PAGE_HEADER_SIZE;
+	while(offset + RECORD_HEADER_SIZE <= PAGE_SIZE)
+	{
+		auto record = static_cast<uint32_t>((page * PAGE_SIZE) + offset);
+		record_header_t header;
+		if(!readHeader(record, header) || !validRecord(record, header))
+		{
+			break; // Erased space, or an interrupted write
+		}
+
+		auto size = recordSize(header.length);
+
+		// Only the latest record of each key is kept. Removed keys have no index entry, so
+		// their tombstones are dropped: any older record was in an older page, which has
+		// already been reclaimed.
+		if(header.key < MaxKeys && index_[header.key] == record)
+		{
+			if(write_offset_ + size > PAGE_SIZE)
+			{
+				return status::no_space;
+			}
+
+			auto destination = static_cast<uint32_t>((head_ * PAGE_SIZE) + write_offset_);
+			write_offset_ += size;
+
+			uint8_t chunk[CHUNK_SIZE];
+			for(size_t i = 0; i < size; i += CHUNK_SIZE)
+			{
+				auto chunk_size = ((size - i) < CHUNK_SIZE) ? (size - i) : CHUNK_SIZE;
+				if(!flashOk(flash_.read(base_ + record + i, chunk, chunk_size)) ||
+				   !flashOk(flash_.program(base_ + destination + i, chunk, chunk_size)))
+				{
+					return status::flash_error;
+				}
+			}
+
+			index_[header.key] = destination;
+		}
+
+		offset += size;
+	}
+
+	if(!flashOk(flash_.erasePage(pageAddress(page))))
+	{
+		return status::flash_error;
+	}
+
+	page_sequence_[page] = 0;
+	return status::ok;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+size_t KVStore<TFlash, Pages, MaxKeys>::erasedPages() const noexcept
+{
+	size_t count = 0;
+	for(auto sequence : page_sequence_)
+	{
+		count += (sequence == 0);
+	}
+
+	return count;
+}
+
+template<typename TFlash, size_t Pages, size_t MaxKeys>
+size_t KVStore<TFlash, Pages, MaxKeys>::oldestPage() const noexcept
+{
+	size_t oldest = Pages;
+	for(size_t page = 0; page < Pages; page++)
+	{
+		auto sequence = page_sequence_[page];
+		if(page != head_ && sequence &&
+		   (oldest == Pages || sequence < page_sequence_[oldest]))
+		{
+			oldest = page;
+		}
+	}
+
+	assert(oldest != Pages);
+	return oldest;
+}
+
+#endif // KV_STORE_HPP_
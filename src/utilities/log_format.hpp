@@ -0,0 +1,291 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef LOG_FORMAT_HPP_
+#define LOG_FORMAT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+/** Convert a log argument to its raw 32-bit representation.
+ *
+ * - Integers and enums are truncated to 32 bits
+ * - Pointers are stored as their address
+ * - Floating point values are stored as the bits of a float
+ */
+template<typename T>
+inline uint32_t toLogArg(T value) noexcept
+{
+	if constexpr(std::is_floating_point<T>::value)
+	{
+		auto f = static_cast<float>(value);
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		return bits;
+	}
+	else if constexpr(std::is_pointer<T>::value)
+	{
+		return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(value));
+	}
+	else
+	{
+		return static_cast<uint32_t>(value);
+	}
+}
+
+/** Format a deferred log record.
+ *
+ * Supports the printf conversions d, i, u, o, x, X, c, p, s, f, F, e, E, g, G, and %, with
+ * flags, width, and precision. Length modifiers (h, l, z, etc.) are accepted and ignored,
+ * since every argument is stored as 32 bits. Missing arguments are printed as "<?>".
+ *
+ * @param [out] out The output buffer. The result is always NUL-terminated.
+ * @param [in] size The size of the output buffer.
+ * @param [in] fmt The format string.
+ * @param [in] args The raw argument words.
+ * @param [in] arg_count The number of argument words.
+ * @param [in] resolve_strings If true, %s arguments are treated as pointers to strings.
+ *	Set this to false when formatting records away from the target (e.g., on a host),
+ *	in which case the address is printed instead.
+ * @returns The length of the formatted string, excluding the NUL terminator.
+ */
+inline size_t formatLogRecord(char* out, size_t size, const char* fmt, const uint32_t* args,
+							  size_t arg_count, bool resolve_strings) noexcept
+{
+	constexpr size_t MAX_SPEC_LENGTH = 16;
+	size_t pos = 0;
+	size_t arg = 0;
+
+	if(size == 0)
+	{
+		return 0;
+	}
+
+	auto append = [&](int written) {
+		if(written > 0)
+		{
+			pos += static_cast<size_t>(written);
+			if(pos >= size)
+			{
+				pos = size - 1;
+			}
+		}
+	};
+
+	while(*fmt && pos < (size - 1))
+	{
+		if(*fmt != '%')
+		{
+			out[pos++] = *fmt++;
+			continue;
+		}
+
+		// Collect the conversion specification, dropping length modifiers
+		char spec[MAX_SPEC_LENGTH];
+		size_t spec_len = 0;
+		spec[spec_len++] = *fmt++;
+
+		while(*fmt && strchr("-+ #0123456789.hlLqjzt", *fmt))
+		{
+			if(!strchr("hlLqjzt", *fmt) && spec_len < (MAX_SPEC_LENGTH - 2))
+			{
+				spec[spec_len++] = *fmt;
+			}
+			fmt++;
+		}
+
+		char conversion = *fmt;
+		if(conversion == '\0')
+		{
+			break;
+		}
+		fmt++;
+
+		spec[spec_len++] = conversion;
+		spec[spec_len] = '\0';
+
+		char* dest = &out[pos];
+		size_t remaining = size - pos;
+
+		if(conversion == '%')
+		{
+			out[pos++] = '%';
+			continue;
+		}
+
+		if(arg >= arg_count)
+		{
+			append(snprintf(dest, remaining, "<?>"));
+			continue;
+		}
+
+		uint32_t value = args[arg++];
+
+		switch(conversion)
+		{
+			case 'd':
+			case 'i':
+				append(snprintf(dest, remaining, spec, static_cast<int>(value)));
+				break;
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+			case 'c':
+				append(snprintf(dest, remaining, spec, static_cast<unsigned>(value)));
+				break;
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G': {
+				float f;
+				memcpy(&f, &value, sizeof(f));
+				append(snprintf(dest, remaining, spec, static_cast<double>(f)));
+				break;
+			}
+			case 's':
+				if(resolve_strings)
+				{
+					append(snprintf(dest, remaining, spec,
+									reinterpret_cast<const char*>(static_cast<uintptr_t>(value))));
+				}
+				else
+				{
+					append(snprintf(dest, remaining, "<0x%08x>", static_cast<unsigned>(value)));
+				}
+				break;
+			case 'p':
+				append(snprintf(dest, remaining, "0x%08x", static_cast<unsigned>(value)));
+				break;
+			default:
+				// Unsupported conversion: print it verbatim
+				append(snprintf(dest, remaining, "%s", spec));
+				break;
+		}
+	}
+
+	out[pos] = '\0';
+	return pos;
+}
+
+/** Decoder for binary deferred log streams.
+ *
+ * The binary stream is a sequence of little-endian 32-bit words, consisting of records in
+ * the LogRing format (a header word followed by its argument words). Format string IDs
+ * are offsets into the format string table, which is the contents of the `log_fmt` section
+ * extracted from the firmware image:
+ *
+ * @code
+ * arm-none-eabi-objcopy -O binary --only-section=log_fmt app.elf log_fmt.bin
+ * @endcode
+ *
+ * If a word is not a valid header (or refers to an invalid format string), it is skipped,
+ * so the decoder resynchronizes after corrupted or truncated data.
+ */
+class LogDecoder
+{
+  public:
+	static constexpr uint32_t VALID_FLAG = 1UL << 31;
+	static constexpr uint32_t ARG_COUNT_SHIFT = 24;
+	static constexpr uint32_t ARG_COUNT_MASK = 0x7F;
+	static constexpr uint32_t ID_MASK = 0xFFFFFF;
+	static constexpr size_t MAX_ARGS = 16;
+
+	/** Construct a decoder.
+	 *
+	 * @param [in] fmt_table The contents of the log_fmt section.
+	 * @param [in] table_size The size of fmt_table in bytes.
+	 */
+	LogDecoder(const char* fmt_table, size_t table_size) noexcept
+		: fmt_table_(fmt_table), table_size_(table_size)
+	{
+	}
+
+	/** Look up a format string.
+	 *
+	 * @returns The format string, or nullptr if the ID is not valid.
+	 */
+	const char* formatString(uint32_t id) const noexcept
+	{
+		if(id >= table_size_ || memchr(&fmt_table_[id], '\0', table_size_ - id) == nullptr)
+		{
+			return nullptr;
+		}
+
+		return &fmt_table_[id];
+	}
+
+	/** Decode records from a binary stream.
+	 *
+	 * @param [in] data The binary data.
+	 * @param [in] length The number of bytes of binary data.
+	 * @param [in] sink Callable invoked as sink(const char* text, size_t length) for each
+	 *	decoded record.
+	 * @returns The number of bytes consumed. Bytes belonging to an incomplete record at the
+	 *	end of the data are not consumed, so they can be passed again with more data.
+	 */
+	template<typename TSink>
+	size_t decode(const uint8_t* data, size_t length, TSink&& sink) const noexcept
+	{
+		size_t offset = 0;
+		char text[256];
+		uint32_t args[MAX_ARGS];
+
+		while((length - offset) >= sizeof(uint32_t))
+		{
+			uint32_t header = readWord(&data[offset]);
+			size_t arg_count = (header >> ARG_COUNT_SHIFT) & ARG_COUNT_MASK;
+			const char* fmt = formatString(header & ID_MASK);
+
+			if((header & VALID_FLAG) == 0 || arg_count > MAX_ARGS || fmt == nullptr)
+			{
+				// Not a header: skip a word and try to resynchronize
+				skipped_words_++;
+				offset += sizeof(uint32_t);
+				continue;
+			}
+
+			size_t record_size = (arg_count + 1) * sizeof(uint32_t);
+			if((length - offset) < record_size)
+			{
+				break;
+			}
+
+			for(size_t i = 0; i < arg_count; i++)
+			{
+				args[i] = readWord(&data[offset + ((i + 1) * sizeof(uint32_t))]);
+			}
+
+			auto text_length = formatLogRecord(text, sizeof(text), fmt, args, arg_count, false);
+			sink(static_cast<const char*>(text), text_length);
+			offset += record_size;
+		}
+
+		return offset;
+	}
+
+	/// The number of words skipped while resynchronizing.
+	size_t skippedWords() const noexcept
+	{
+		return skipped_words_;
+	}
+
+  private:
+	static uint32_t readWord(const uint8_t* bytes) noexcept
+	{
+		return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+			   (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+	}
+
+  private:
+	const char* fmt_table_;
+	size_t table_size_;
+	mutable size_t skipped_words_ = 0;
+};
+
+#endif // LOG_FORMAT_HPP_
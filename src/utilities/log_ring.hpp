@@ -0,0 +1,184 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef LOG_RING_HPP_
+#define LOG_RING_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/** Lock-free ring buffer of deferred log records.
+ *
+ * Each record is a header word followed by up to MAX_ARGS raw 32-bit argument words:
+ *
+ *	- bit 31: valid flag. Set when the record has been fully written.
+ *	- bits 30..24: number of argument words
+ *	- bits 23..0: format string ID
+ *
+ * Any number of producers (threads and ISRs of any priority) can push() concurrently.
+ * Space is reserved with a compare-and-swap on the write index, the arguments are written,
+ * and the header is published last. A single consumer removes records with pop().
+ * If a producer is preempted between reserving and publishing, the consumer waits for
+ * that record; records are always consumed in reservation order.
+ *
+ * When the ring is full, the record is dropped and counted. Producers never block.
+ *
+ * @tparam TCapacityWords The size of the ring in 32-bit words. Must be a power of two.
+ */
+template<size_t TCapacityWords>
+class LogRing
+{
+	static_assert((TCapacityWords & (TCapacityWords - 1)) == 0,
+				  "LogRing capacity must be a power of two");
+
+  public:
+	static constexpr uint32_t VALID_FLAG = 1UL << 31;
+	static constexpr uint32_t ARG_COUNT_SHIFT = 24;
+	static constexpr uint32_t ARG_COUNT_MASK = 0x7F;
+	static constexpr uint32_t ID_MASK = 0xFFFFFF;
+
+	/// Maximum number of argument words in a single record.
+	static constexpr size_t MAX_ARGS = 16;
+
+	static_assert(TCapacityWords > MAX_ARGS, "LogRing must be able to hold the largest record");
+
+	/// A record removed from the ring
+	struct record_t
+	{
+		uint32_t id;
+		size_t arg_count;
+		std::array<uint32_t, MAX_ARGS> args;
+	};
+
+	constexpr LogRing() noexcept = default;
+	~LogRing() noexcept = default;
+
+	LogRing(const LogRing&) = delete;
+	const LogRing& operator=(const LogRing&) = delete;
+
+	static constexpr uint32_t makeHeader(uint32_t id, size_t arg_count) noexcept
+	{
+		return VALID_FLAG | ((static_cast<uint32_t>(arg_count) & ARG_COUNT_MASK) << ARG_COUNT_SHIFT) |
+			   (id & ID_MASK);
+	}
+
+	static constexpr uint32_t headerId(uint32_t header) noexcept
+	{
+		return header & ID_MASK;
+	}
+
+	static constexpr size_t headerArgCount(uint32_t header) noexcept
+	{
+		return (header >> ARG_COUNT_SHIFT) & ARG_COUNT_MASK;
+	}
+
+	/** Add a record to the ring.
+	 *
+	 * Safe to call from any context, including ISRs.
+	 *
+	 * @param [in] id The format string ID. Only the lower 24 bits are stored.
+	 * @param [in] args The raw argument words.
+	 * @param [in] arg_count The number of argument words, [0..MAX_ARGS].
+	 * @returns true if the record was added, false if it was dropped because the ring is full.
+	 */
+	bool push(uint32_t id, const uint32_t* args, size_t arg_count) noexcept
+	{
+		if(arg_count > MAX_ARGS)
+		{
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		const auto words = static_cast<uint32_t>(arg_count + 1);
+		uint32_t head = head_.load(std::memory_order_relaxed);
+
+		do
+		{
+			if((head - tail_.load(std::memory_order_acquire)) + words > TCapacityWords)
+			{
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		} while(!head_.compare_exchange_weak(head, head + words, std::memory_order_relaxed,
+											 std::memory_order_relaxed));
+
+		for(size_t i = 0; i < arg_count; i++)
+		{
+			storage_[(head + 1 + i) & INDEX_MASK].store(args[i], std::memory_order_relaxed);
+		}
+
+		// Publish the record
+		storage_[head & INDEX_MASK].store(makeHeader(id, arg_count), std::memory_order_release);
+		return true;
+	}
+
+	/** Remove the oldest record from the ring.
+	 *
+	 * Only one context may consume records.
+	 *
+	 * @param [out] record Storage for the removed record.
+	 * @returns true if a record was removed, false if the ring is empty or the oldest record
+	 *	has not been published yet.
+	 */
+	bool pop(record_t& record) noexcept
+	{
+		uint32_t tail = tail_.load(std::memory_order_relaxed);
+		if(tail == head_.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		uint32_t header = storage_[tail & INDEX_MASK].load(std::memory_order_acquire);
+		if((header & VALID_FLAG) == 0)
+		{
+			return false;
+		}
+
+		record.id = headerId(header);
+		record.arg_count = headerArgCount(header);
+
+		// The whole record is cleared so that stale argument words are never mistaken
+		// for a published header
+		storage_[tail & INDEX_MASK].store(0, std::memory_order_relaxed);
+		for(size_t i = 0; i < record.arg_count; i++)
+		{
+			auto& word = storage_[(tail + 1 + i) & INDEX_MASK];
+			record.args[i] = word.load(std::memory_order_relaxed);
+			word.store(0, std::memory_order_relaxed);
+		}
+
+		tail_.store(tail + 1 + static_cast<uint32_t>(record.arg_count), std::memory_order_release);
+		return true;
+	}
+
+	/// Check whether the ring holds any reserved records.
+	bool empty() const noexcept
+	{
+		return tail_.load(std::memory_order_relaxed) == head_.load(std::memory_order_relaxed);
+	}
+
+	/// The number of records dropped because the ring was full.
+	uint32_t dropped() const noexcept
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+	static constexpr size_t capacity() noexcept
+	{
+		return TCapacityWords;
+	}
+
+  private:
+	static constexpr uint32_t INDEX_MASK = TCapacityWords - 1;
+
+	std::array<std::atomic<uint32_t>, TCapacityWords> storage_{};
+	/// Free-running reservation index; wraps at 2^32
+	std::atomic<uint32_t> head_{0};
+	/// Free-running consumer index; wraps at 2^32
+	std::atomic<uint32_t> tail_{0};
+	std::atomic<uint32_t> dropped_{0};
+};
+
+#endif // LOG_RING_HPP_
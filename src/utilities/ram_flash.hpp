@@ -0,0 +1,154 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef RAM_FLASH_HPP_
+#define RAM_FLASH_HPP_
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/** RAM-backed model of a page-erasable flash memory.
+ *
+ * This provides the same blocking interface as STM32InternalFlash, so that flash-based
+ * storage (e.g., KVStore) can be exercised natively. The model enforces the rules of the
+ * STM32 flash:
+ *
+ *	- Erased memory reads as 0xFF, and only whole pages can be erased.
+ *	- Data is programmed in aligned PROGRAM_SIZE units, and each unit can only be programmed
+ *		once after an erase.
+ *
+ * Power loss can be simulated with setProgramBudget(): once the budget of programming units is
+ * used up, the next unit is left partially programmed and every later program or erase fails.
+ *
+ * Addresses start at 0.
+ *
+ * @tparam PageSize The erase page size, in bytes.
+ * @tparam Pages The number of pages.
+ */
+template<size_t PageSize, size_t Pages>
+class RamFlash
+{
+  public:
+	enum class status : uint8_t
+	{
+		ok = 0,
+		busy,
+		error,
+	};
+
+	static constexpr size_t PAGE_SIZE = PageSize;
+	static constexpr size_t PROGRAM_SIZE = 8;
+	static constexpr size_t SIZE = PageSize * Pages;
+
+	static_assert((PageSize % PROGRAM_SIZE) == 0, "Pages must hold whole programming units");
+
+  public:
+	RamFlash() noexcept
+	{
+		memory_.fill(0xFF);
+	}
+
+	status read(uintptr_t address, void* data, size_t length) const noexcept
+	{
+		if(address + length > SIZE)
+		{
+			return status::error;
+		}
+
+		memcpy(data, &memory_[address], length);
+		return status::ok;
+	}
+
+	status program(uintptr_t address, const void* data, size_t length) noexcept
+	{
+		assert((address % PROGRAM_SIZE) == 0 && (length % PROGRAM_SIZE) == 0);
+
+		if(address + length > SIZE || powered_off_)
+		{
+			return status::error;
+		}
+
+		auto bytes = static_cast<const uint8_t*>(data);
+		for(size_t i = 0; i < length; i += PROGRAM_SIZE)
+		{
+			auto unit = &memory_[address + i];
+			for(size_t j = 0; j < PROGRAM_SIZE; j++)
+			{
+				if(unit[j] != 0xFF)
+				{
+					return status::error; // Programming an unerased unit (PROGERR)
+				}
+			}
+
+			if(program_budget_ == 0)
+			{
+				// Power is lost part way through the unit
+				memcpy(unit, &bytes[i], PROGRAM_SIZE / 2);
+				powered_off_ = true;
+				return status::error;
+			}
+
+			program_budget_--;
+			memcpy(unit, &bytes[i], PROGRAM_SIZE);
+			programmed_units_++;
+		}
+
+		return status::ok;
+	}
+
+	status erasePage(uintptr_t address) noexcept
+	{
+		if(address >= SIZE || powered_off_)
+		{
+			return status::error;
+		}
+
+		auto page = address / PAGE_SIZE;
+		memset(&memory_[page * PAGE_SIZE], 0xFF, PAGE_SIZE);
+		erase_counts_[page]++;
+		return status::ok;
+	}
+
+	/// Number of times a page has been erased
+	uint32_t eraseCount(size_t page) const noexcept
+	{
+		return erase_counts_[page];
+	}
+
+	/// Total number of programming units written
+	size_t programmedUnits() const noexcept
+	{
+		return programmed_units_;
+	}
+
+	/// Allow this many more programming units to be written before power is lost.
+	void setProgramBudget(size_t units) noexcept
+	{
+		program_budget_ = units;
+	}
+
+	/// Restore power after a simulated power loss. The flash contents are kept.
+	void powerOn() noexcept
+	{
+		powered_off_ = false;
+		program_budget_ = SIZE_MAX;
+	}
+
+	/// Direct access to the memory, e.g., to corrupt data in a test
+	uint8_t* data() noexcept
+	{
+		return memory_.data();
+	}
+
+  private:
+	std::array<uint8_t, SIZE> memory_;
+	std::array<uint32_t, Pages> erase_counts_{};
+	size_t programmed_units_ = 0;
+	size_t program_budget_ = SIZE_MAX;
+	bool powered_off_ = false;
+};
+
+#endif // RAM_FLASH_HPP_
@@ -0,0 +1,148 @@
+// Copyright 2020 Embedded Artistry LLC
+// SPDX-License-Identifier: MIT
+
+#ifndef STATIC_QUEUE_HPP_
+#define STATIC_QUEUE_HPP_
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+
+/** Fixed-capacity FIFO queue.
+ *
+ * Storage is allocated inline, so the queue never touches the heap. Drivers use this to
+ * hold pending asynchronous operations.
+ *
+ * The queue performs no locking. If it is shared between a thread and an ISR, the caller
+ * must hold a lock (e.g., STM32InterruptLock) around push()/pop() calls made outside of
+ * the ISR.
+ *
+ * @code
+ * StaticQueue<op_t, 8> queue;
+ * queue.push(op);
+ * auto& next = queue.front();
+ * queue.pop();
+ * @endcode
+ *
+ * @tparam T The element type. Must be default constructible.
+ * @tparam TCapacity The maximum number of elements that can be stored.
+ */
+template<typename T, size_t TCapacity>
+class StaticQueue
+{
+  public:
+	constexpr StaticQueue() noexcept = default;
+	~StaticQueue() noexcept = default;
+
+	/** Add an element to the back of the queue.
+	 *
+	 * @param [in] value The element to add.
+	 * @returns true if the element was added, false if the queue is full.
+	 */
+	bool push(const T& value) noexcept
+	{
+		if(full())
+		{
+			return false;
+		}
+
+		storage_[tail_] = value;
+		tail_ = next(tail_);
+		count_++;
+		return true;
+	}
+
+	/// @overload
+	bool push(T&& value) noexcept
+	{
+		if(full())
+		{
+			return false;
+		}
+
+		storage_[tail_] = std::move(value);
+		tail_ = next(tail_);
+		count_++;
+		return true;
+	}
+
+	/** Access the element at the front of the queue.
+	 *
+	 * @precondition The queue is not empty.
+	 */
+	T& front() noexcept
+	{
+		assert(!empty());
+		return storage_[head_];
+	}
+
+	/** Access an element by its position in the queue.
+	 *
+	 * This allows a driver to look ahead at the operations behind the front of the queue
+	 * (e.g., to merge them).
+	 *
+	 * @precondition index < size()
+	 * @param [in] index The position of the element, where 0 is the front.
+	 */
+	T& operator[](size_t index) noexcept
+	{
+		assert(index < size());
+		return storage_[(head_ + index) % TCapacity];
+	}
+
+	/** Remove the element at the front of the queue.
+	 *
+	 * @precondition The queue is not empty.
+	 */
+	void pop() noexcept
+	{
+		assert(!empty());
+		storage_[head_] = T{};
+		head_ = next(head_);
+		count_--;
+	}
+
+	/// Remove all elements from the queue.
+	void clear() noexcept
+	{
+		while(!empty())
+		{
+			pop();
+		}
+	}
+
+	bool empty() const noexcept
+	{
+		return count_ == 0;
+	}
+
+	bool full() const noexcept
+	{
+		return count_ == TCapacity;
+	}
+
+	size_t size() const noexcept
+	{
+		return count_;
+	}
+
+	static constexpr size_t capacity() noexcept
+	{
+		return TCapacity;
+	}
+
+  private:
+	static constexpr size_t next(size_t index) noexcept
+	{
+		return (index + 1) % TCapacity;
+	}
+
+  private:
+	std::array<T, TCapacity> storage_{};
+	size_t head_ = 0;
+	size_t tail_ = 0;
+	size_t count_ = 0;
+};
+
+#endif // STATIC_QUEUE_HPP_
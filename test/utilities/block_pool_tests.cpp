@@ -0,0 +1,137 @@
+#include <block_pool.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <set>
+
+namespace
+{
+alignas(std::max_align_t) uint8_t region[4096];
+}
+
+TEST_CASE("Block pool allocates and releases blocks", "[utilities/block_pool]")
+{
+	BlockPool<> pool;
+	auto used = pool.init(region, sizeof(region), 24, 8);
+
+	CHECK(pool.block_size() == 32);
+	CHECK(used == 8 * 32);
+
+	auto a = pool.allocate();
+	auto b = pool.allocate();
+	REQUIRE(a);
+	REQUIRE(b);
+	CHECK(a != b);
+	CHECK(pool.owns(a));
+	CHECK(pool.owns(b));
+	CHECK((reinterpret_cast<uintptr_t>(a) % BlockPool<>::BLOCK_ALIGNMENT) == 0);
+	// The lowest address is handed out first
+	CHECK(a == static_cast<void*>(region));
+	CHECK(pool.stats().in_use == 2);
+
+	pool.release(a);
+	CHECK(pool.stats().in_use == 1);
+
+	// The most recently released block is reused first
+	CHECK(pool.allocate() == a);
+
+	pool.release(nullptr);
+	CHECK(pool.stats().in_use == 2);
+	CHECK_FALSE(pool.owns(region + sizeof(region) - 1));
+}
+
+TEST_CASE("Block pool reports exhaustion", "[utilities/block_pool]")
+{
+	BlockPool<> pool;
+	pool.init(region, sizeof(region), 64, 4);
+
+	std::set<void*> blocks;
+	for(size_t i = 0; i < 4; i++)
+	{
+		auto block = pool.allocate();
+		REQUIRE(block);
+		blocks.insert(block);
+	}
+
+	CHECK(blocks.size() == 4);
+	CHECK(pool.allocate() == nullptr);
+	CHECK(pool.allocate() == nullptr);
+
+	auto stats = pool.stats();
+	CHECK(stats.capacity == 4);
+	CHECK(stats.in_use == 4);
+	CHECK(stats.failed_allocations == 2);
+
+	pool.release(*blocks.begin());
+	CHECK(pool.allocate() == *blocks.begin());
+}
+
+TEST_CASE("Block pool tracks the high water mark", "[utilities/block_pool]")
+{
+	BlockPool<> pool;
+	pool.init(region, sizeof(region), 16, 8);
+
+	auto a = pool.allocate();
+	auto b = pool.allocate();
+	auto c = pool.allocate();
+	pool.release(b);
+	pool.release(c);
+
+	auto stats = pool.stats();
+	CHECK(stats.in_use == 1);
+	CHECK(stats.high_water_mark == 3);
+
+	pool.allocate();
+	CHECK(pool.stats().high_water_mark == 3);
+
+	pool.resetStats();
+	CHECK(pool.stats().high_water_mark == 2);
+	CHECK(pool.stats().failed_allocations == 0);
+
+	pool.release(a);
+	CHECK(pool.stats().high_water_mark == 2);
+}
+
+TEST_CASE("Block pool allocator selects size classes", "[utilities/block_pool]")
+{
+	BlockPoolAllocator<3> pools;
+	auto used = pools.init(region, sizeof(region), {{{32, 2}, {128, 2}, {512, 1}}});
+	CHECK(used == (2 * 32) + (2 * 128) + 512);
+
+	SECTION("Requests use the smallest class that fits")
+	{
+		pools.allocate(1);
+		pools.allocate(32);
+		pools.allocate(33);
+		pools.allocate(512);
+
+		CHECK(pools.stats(0).in_use == 2);
+		CHECK(pools.stats(1).in_use == 1);
+		CHECK(pools.stats(2).in_use == 1);
+		CHECK(pools.allocate(513) == nullptr);
+	}
+
+	SECTION("An exhausted class falls back to the next larger class")
+	{
+		auto a = pools.allocate(16);
+		auto b = pools.allocate(16);
+		auto c = pools.allocate(16);
+		auto d = pools.allocate(16);
+		auto e = pools.allocate(16);
+
+		REQUIRE(e);
+		CHECK(pools.stats(0).in_use == 2);
+		CHECK(pools.stats(1).in_use == 2);
+		CHECK(pools.stats(2).in_use == 1);
+		CHECK(pools.allocate(16) == nullptr);
+
+		// Blocks are returned to the class that owns them
+		pools.release(c);
+		CHECK(pools.stats(1).in_use == 1);
+		pools.release(e);
+		CHECK(pools.stats(2).in_use == 0);
+		pools.release(a);
+		pools.release(b);
+		pools.release(d);
+		CHECK(pools.stats(0).in_use == 0);
+		CHECK(pools.stats(1).in_use == 0);
+	}
+}
@@ -0,0 +1,125 @@
+#include <bsrr_waveform.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <iterator>
+#include <vector>
+
+namespace
+{
+/// Replay a waveform on a port, and return the pin level during each sample
+std::vector<bool> replay(const uint32_t* words, size_t count, uint16_t pin)
+{
+	std::vector<bool> levels;
+	uint16_t port = 0;
+
+	for(size_t i = 0; i < count; i++)
+	{
+		port = static_cast<uint16_t>((port | (words[i] & 0xFFFF)) & ~(words[i] >> 16));
+		levels.push_back(port & pin);
+	}
+
+	return levels;
+}
+
+/// Measure the high time of each bit period
+std::vector<size_t> highTimes(const std::vector<bool>& levels, size_t samples_per_bit)
+{
+	std::vector<size_t> times;
+	for(size_t start = 0; start < levels.size(); start += samples_per_bit)
+	{
+		size_t high = 0;
+		for(size_t i = start; i < start + samples_per_bit && levels[i]; i++)
+		{
+			high++;
+		}
+
+		times.push_back(high);
+	}
+
+	return times;
+}
+} // namespace
+
+TEST_CASE("BSRR set and reset words", "[utilities/bsrr_waveform]")
+{
+	CHECK(bsrrSet(0x0001) == 0x00000001);
+	CHECK(bsrrSet(0x8000) == 0x00008000);
+	CHECK(bsrrReset(0x0001) == 0x00010000);
+	CHECK(bsrrReset(0x8000) == 0x80000000);
+}
+
+TEST_CASE("Bits are encoded MSB first with WS2812 timing", "[utilities/bsrr_waveform]")
+{
+	constexpr uint16_t pin = 1U << 5;
+	const uint8_t data[] = {0xA5, 0x0F};
+	uint32_t words[encodedLength(sizeof(data), WS2812_TIMING)] = {};
+
+	REQUIRE(encodeBits(words, std::size(words), data, sizeof(data), pin, WS2812_TIMING) ==
+			std::size(words));
+	CHECK(std::size(words) == 48);
+
+	// Each bit sets the pin at its start and clears it after the high time
+	CHECK(words[0] == bsrrSet(pin));
+	CHECK(words[1] == 0);
+	CHECK(words[2] == bsrrReset(pin));
+	CHECK(words[3] == bsrrSet(pin));
+	CHECK(words[4] == bsrrReset(pin));
+	CHECK(words[5] == 0);
+
+	auto levels = replay(words, std::size(words), pin);
+	const std::vector<size_t> expected = {2, 1, 2, 1, 1, 2, 1, 2, 1, 1, 1, 1, 2, 2, 2, 2};
+	CHECK(highTimes(levels, WS2812_TIMING.samples_per_bit) == expected);
+	CHECK_FALSE(levels.back());
+}
+
+TEST_CASE("WS2812 colors are encoded in GRB order", "[utilities/bsrr_waveform]")
+{
+	constexpr uint16_t pin = 1U << 0;
+	const uint8_t grb[] = {0xFF, 0x00, 0x80, 0x01, 0x02, 0x03};
+	uint32_t words[encodedLength(sizeof(grb), WS2812_TIMING)];
+
+	REQUIRE(ws2812Encode(words, std::size(words), grb, 2, pin) == 144);
+
+	auto times = highTimes(replay(words, std::size(words), pin), 3);
+	for(size_t byte = 0; byte < sizeof(grb); byte++)
+	{
+		for(size_t bit = 0; bit < 8; bit++)
+		{
+			bool one = grb[byte] & (0x80 >> bit);
+			CHECK(times[(byte * 8) + bit] == (one ? 2U : 1U));
+		}
+	}
+
+	CHECK(ws2812Encode(words, std::size(words) - 1, grb, 2, pin) == 0);
+}
+
+TEST_CASE("Waveforms for different pins can be merged", "[utilities/bsrr_waveform]")
+{
+	constexpr uint16_t pin_a = 1U << 2;
+	constexpr uint16_t pin_b = 1U << 9;
+	const uint8_t a = 0xF0;
+	const uint8_t b = 0x3C;
+	uint32_t words[encodedLength(1, WS2812_TIMING)];
+
+	encodeBits(words, std::size(words), &a, 1, pin_a, WS2812_TIMING);
+	encodeBits(words, std::size(words), &b, 1, pin_b, WS2812_TIMING, true);
+
+	const std::vector<size_t> expected_a = {2, 2, 2, 2, 1, 1, 1, 1};
+	const std::vector<size_t> expected_b = {1, 1, 2, 2, 2, 2, 1, 1};
+	CHECK(highTimes(replay(words, std::size(words), pin_a), 3) == expected_a);
+	CHECK(highTimes(replay(words, std::size(words), pin_b), 3) == expected_b);
+}
+
+TEST_CASE("Pulse trains", "[utilities/bsrr_waveform]")
+{
+	constexpr uint16_t pin = 1U << 3;
+	uint32_t words[12] = {};
+
+	REQUIRE(encodePulses(words, std::size(words), 3, 1, 3, pin) == 12);
+	auto levels = replay(words, std::size(words), pin);
+	const std::vector<bool> expected = {true, false, false, false, true, false,
+										false, false, true, false, false, false};
+	CHECK(levels == expected);
+
+	// Four 4-sample pulses do not fit in 12 words
+	CHECK(encodePulses(words, std::size(words), 4, 2, 2, pin) == 0);
+}
@@ -0,0 +1,85 @@
+#include <capture_stats.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("Capture intervals wrap with the counter", "[utilities/capture_stats]")
+{
+	CHECK(captureInterval(100, 350, 0xFFFF) == 250);
+	CHECK(captureInterval(0xFFF0, 0x0010, 0xFFFF) == 0x20);
+	CHECK(captureInterval(0xFFFFFFF0, 0x00000010, 0xFFFFFFFF) == 0x20);
+
+	// A 16-bit timer only compares the low bits
+	CHECK(captureInterval(0x1FFF0, 0x20010, 0xFFFF) == 0x20);
+}
+
+TEST_CASE("Capture statistics", "[utilities/capture_stats]")
+{
+	SECTION("Fewer than two captures give empty statistics")
+	{
+		const uint32_t captures[] = {10};
+		auto stats = captureStatistics(captures, 1, 0, 1, 0xFFFF);
+		CHECK(stats.intervals == 0);
+		CHECK(stats.total == 0);
+		CHECK(stats.mean == 0);
+	}
+
+	SECTION("A constant period has no jitter")
+	{
+		const uint32_t captures[] = {0, 1000, 2000, 3000, 4000};
+		auto stats = captureStatistics(captures, 5, 0, 5, 0xFFFF);
+		CHECK(stats.intervals == 4);
+		CHECK(stats.total == 4000);
+		CHECK(stats.min == 1000);
+		CHECK(stats.max == 1000);
+		CHECK(stats.mean == 1000);
+		CHECK(stats.stddev == 0);
+		CHECK(stats.jitter() == 0);
+	}
+
+	SECTION("Jitter is measured across a counter wrap")
+	{
+		// Intervals of 990, 1010, 990, 1010 ticks, wrapping the 16-bit counter
+		const uint32_t captures[] = {64000, 64990, 464, 1454, 2464};
+		auto stats = captureStatistics(captures, 5, 0, 5, 0xFFFF);
+		CHECK(stats.min == 990);
+		CHECK(stats.max == 1010);
+		CHECK(stats.mean == 1000);
+		CHECK(stats.stddev == 10);
+		CHECK(stats.jitter() == 20);
+	}
+
+	SECTION("The capture buffer is circular")
+	{
+		// The oldest capture is at index 3
+		const uint32_t captures[] = {3000, 4000, 5000, 500, 2000};
+		auto stats = captureStatistics(captures, 5, 3, 5, 0xFFFF);
+		CHECK(stats.intervals == 4);
+		CHECK(stats.total == 4500);
+		CHECK(stats.min == 1000);
+		CHECK(stats.max == 1500);
+	}
+}
+
+TEST_CASE("Capture frequency and duty cycle", "[utilities/capture_stats]")
+{
+	// A 1 kHz signal measured with a 1 MHz tick
+	CHECK(captureFrequency(1000000, 1000) == 1000);
+	CHECK(captureFrequency(1000000, 4000, 4) == 1000);
+	CHECK(captureFrequency(1000000, 3000, 1, 1000) == 333333);
+	CHECK(captureFrequency(1000000, 0) == 0);
+
+	CHECK(captureDutyCycle(0, 1000) == 0);
+	CHECK(captureDutyCycle(250, 1000) == UINT16_MAX / 4);
+	CHECK(captureDutyCycle(500, 1000) == UINT16_MAX / 2);
+	CHECK(captureDutyCycle(1000, 1000) == UINT16_MAX);
+	CHECK(captureDutyCycle(1200, 1000) == UINT16_MAX);
+	CHECK(captureDutyCycle(10, 0) == 0);
+
+	// The width and period of a PWM input measured across a 16-bit counter wrap
+	auto period = captureInterval(65000, 1464, 0xFFFF);
+	auto high = captureInterval(65000, 65500, 0xFFFF);
+	CHECK(period == 2000);
+	CHECK(captureDutyCycle(high, period) == UINT16_MAX / 4);
+}
+
+static_assert(captureInterval(0xFFFF, 0, 0xFFFF) == 1, "Interval is computed at compile time");
+static_assert(isqrt64(99) == 9 && isqrt64(100) == 10, "isqrt64 rounds down");
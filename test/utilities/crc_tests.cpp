@@ -0,0 +1,60 @@
+#include <catch2/catch_test_macros.hpp>
+#include <crc.hpp>
+#include <cstring>
+
+namespace
+{
+const char check_input[] = "123456789";
+constexpr size_t CHECK_LENGTH = sizeof(check_input) - 1;
+} // namespace
+
+TEST_CASE("CRC bit reflection", "[utilities/crc]")
+{
+	CHECK(crcReflect(0x1, 8) == 0x80);
+	CHECK(crcReflect(0x80, 8) == 0x01);
+	CHECK(crcReflect(0x04C11DB7, 32) == 0xEDB88320);
+	CHECK(crcReflect(0x8005, 16) == 0xA001);
+	CHECK(crcReflect(0x09, 7) == 0x48);
+}
+
+TEST_CASE("CRC presets match their check values", "[utilities/crc]")
+{
+	CHECK(SoftwareCRC{CRC32_IEEE}.calculate(check_input, CHECK_LENGTH) == 0xCBF43926);
+	CHECK(SoftwareCRC{CRC32_C}.calculate(check_input, CHECK_LENGTH) == 0xE3069283);
+	CHECK(SoftwareCRC{CRC16_CCITT_FALSE}.calculate(check_input, CHECK_LENGTH) == 0x29B1);
+	CHECK(SoftwareCRC{CRC16_MODBUS}.calculate(check_input, CHECK_LENGTH) == 0x4B37);
+	CHECK(SoftwareCRC{CRC8_SMBUS}.calculate(check_input, CHECK_LENGTH) == 0xF4);
+	CHECK(SoftwareCRC{CRC7_MMC}.calculate(check_input, CHECK_LENGTH) == 0x75);
+}
+
+TEST_CASE("CRC handles other parameter combinations", "[utilities/crc]")
+{
+	// CRC-32/MPEG-2: not reflected, no output XOR
+	constexpr crc_params_t mpeg2 = {32, 0x04C11DB7, 0xFFFFFFFF, false, false, 0};
+	CHECK(SoftwareCRC{mpeg2}.calculate(check_input, CHECK_LENGTH) == 0x0376E6E7);
+
+	// CRC-12/UMTS: the output is reflected, but the input is not
+	constexpr crc_params_t umts = {12, 0x80F, 0x000, false, true, 0};
+	CHECK(SoftwareCRC{umts}.calculate(check_input, CHECK_LENGTH) == 0xDAF);
+}
+
+TEST_CASE("CRC calculations can be split", "[utilities/crc]")
+{
+	for(auto params : {CRC32_IEEE, CRC16_CCITT_FALSE, CRC7_MMC})
+	{
+		SoftwareCRC crc{params};
+		auto expected = crc.calculate(check_input, CHECK_LENGTH);
+
+		for(size_t split = 0; split <= CHECK_LENGTH; split++)
+		{
+			auto reg = crc.begin();
+			reg = crc.update(reg, check_input, split);
+			reg = crc.update(reg, check_input + split, CHECK_LENGTH - split);
+			CHECK(crc.finish(reg) == expected);
+		}
+	}
+
+	// An empty input gives init ^ xor_out
+	CHECK(SoftwareCRC{CRC32_IEEE}.calculate(nullptr, 0) == 0);
+	CHECK(SoftwareCRC{CRC16_MODBUS}.calculate(nullptr, 0) == 0xFFFF);
+}
@@ -0,0 +1,117 @@
+#include <catch2/catch_test_macros.hpp>
+#include <dma_chunk.hpp>
+
+namespace
+{
+constexpr size_t MAX_ITEMS = 65535;
+}
+
+TEST_CASE("DMA chunks use word items for aligned copies", "[utilities/dma_chunk]")
+{
+	auto chunk = nextDmaChunk(0x20000000, 0x20010000, 1024, false, MAX_ITEMS);
+	CHECK(chunk.width == 4);
+	CHECK(chunk.items == 256);
+	CHECK(chunk.bytes() == 1024);
+
+	// The tail which does not fill a word uses narrower items
+	chunk = nextDmaChunk(0x20000000, 0x20010000, 7, false, MAX_ITEMS);
+	CHECK(chunk.width == 4);
+	CHECK(chunk.items == 1);
+	chunk = nextDmaChunk(0x20000004, 0x20010004, 3, false, MAX_ITEMS);
+	CHECK(chunk.width == 2);
+	CHECK(chunk.items == 1);
+	chunk = nextDmaChunk(0x20000006, 0x20010006, 1, false, MAX_ITEMS);
+	CHECK(chunk.width == 1);
+	CHECK(chunk.items == 1);
+}
+
+TEST_CASE("DMA chunks stop at the next reachable alignment", "[utilities/dma_chunk]")
+{
+	// Both addresses can be word aligned after 3 bytes
+	auto chunk = nextDmaChunk(0x20000001, 0x20010001, 100, false, MAX_ITEMS);
+	CHECK(chunk.width == 1);
+	CHECK(chunk.items == 3);
+
+	// After 2 bytes
+	chunk = nextDmaChunk(0x20000002, 0x20010002, 100, false, MAX_ITEMS);
+	CHECK(chunk.width == 2);
+	CHECK(chunk.items == 1);
+
+	// The addresses differ by 2, so halfwords are the widest shared alignment
+	chunk = nextDmaChunk(0x20000000, 0x20010002, 100, false, MAX_ITEMS);
+	CHECK(chunk.width == 2);
+	CHECK(chunk.items == 50);
+
+	// The addresses differ by an odd amount, so only bytes can be used
+	chunk = nextDmaChunk(0x20000000, 0x20010001, 100, false, MAX_ITEMS);
+	CHECK(chunk.width == 1);
+	CHECK(chunk.items == 100);
+}
+
+TEST_CASE("DMA fill chunks only depend on the destination", "[utilities/dma_chunk]")
+{
+	auto chunk = nextDmaChunk(0x20000000, 0x3, 64, true, MAX_ITEMS);
+	CHECK(chunk.width == 4);
+	CHECK(chunk.items == 16);
+
+	chunk = nextDmaChunk(0x20000003, 0x0, 64, true, MAX_ITEMS);
+	CHECK(chunk.width == 1);
+	CHECK(chunk.items == 1);
+}
+
+TEST_CASE("DMA chunks are limited by the item count", "[utilities/dma_chunk]")
+{
+	auto chunk = nextDmaChunk(0x20000000, 0x20040000, 4 * 100000, false, MAX_ITEMS);
+	CHECK(chunk.width == 4);
+	CHECK(chunk.items == MAX_ITEMS);
+
+	chunk = nextDmaChunk(0x20000000, 0x20040001, 100000, false, MAX_ITEMS);
+	CHECK(chunk.width == 1);
+	CHECK(chunk.items == MAX_ITEMS);
+}
+
+TEST_CASE("DMA chunks cover every copy exactly", "[utilities/dma_chunk]")
+{
+	constexpr size_t max_items = 5;
+
+	for(uintptr_t dest_offset = 0; dest_offset < 4; dest_offset++)
+	{
+		for(uintptr_t src_offset = 0; src_offset < 4; src_offset++)
+		{
+			for(size_t length = 1; length <= 64; length++)
+			{
+				uintptr_t dest = 0x20000000 + dest_offset;
+				uintptr_t src = 0x20010000 + src_offset;
+				size_t remaining = length;
+				size_t narrow_bytes = 0;
+				bool word_aligned = ((dest - src) & 0x3) == 0;
+
+				while(remaining)
+				{
+					auto chunk = nextDmaChunk(dest, src, remaining, false, max_items);
+
+					REQUIRE(chunk.items > 0);
+					REQUIRE(chunk.items <= max_items);
+					REQUIRE(chunk.bytes() <= remaining);
+					CHECK((dest % chunk.width) == 0);
+					CHECK((src % chunk.width) == 0);
+
+					if(chunk.width < 4)
+					{
+						narrow_bytes += chunk.bytes();
+					}
+
+					dest += chunk.bytes();
+					src += chunk.bytes();
+					remaining -= chunk.bytes();
+				}
+
+				// At most 3 bytes at each end use narrow items
+				if(word_aligned)
+				{
+					CHECK(narrow_bytes <= 6);
+				}
+			}
+		}
+	}
+}
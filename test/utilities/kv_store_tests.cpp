@@ -0,0 +1,269 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <kv_store.hpp>
+#include <map>
+#include <ram_flash.hpp>
+#include <vector>
+
+namespace
+{
+using Flash = RamFlash<256, 4>;
+using Store = KVStore<Flash, 4, 8>;
+
+std::vector<uint8_t> makeValue(size_t seed)
+{
+	std::vector<uint8_t> value(1 + ((seed * 5) % 24));
+	for(size_t i = 0; i < value.size(); i++)
+	{
+		value[i] = static_cast<uint8_t>((seed * 7) + i);
+	}
+
+	return value;
+}
+
+std::vector<uint8_t> readValue(const Store& store, Store::key_t key)
+{
+	uint8_t buffer[Store::MAX_VALUE_SIZE];
+	size_t length = 0;
+	auto r = store.read(key, buffer, sizeof(buffer), &length);
+	REQUIRE(r == Store::status::ok);
+	return std::vector<uint8_t>(buffer, buffer + length);
+}
+
+/// One step of the workload: a write, or a removal if value is empty
+struct step_t
+{
+	Store::key_t key;
+	std::vector<uint8_t> value;
+};
+
+/// Enough writes to open every page several times, which forces pages to be reclaimed
+std::vector<step_t> workload()
+{
+	std::vector<step_t> steps;
+	for(size_t i = 0; i < 60; i++)
+	{
+		auto key = static_cast<Store::key_t>(i % 6);
+		steps.push_back({key, ((i % 7) == 6) ? std::vector<uint8_t>{} : makeValue(i)});
+	}
+
+	return steps;
+}
+} // namespace
+
+TEST_CASE("Key-value store mounts blank flash", "[utilities/kv_store]")
+{
+	Flash flash;
+	Store store{flash, 0};
+
+	REQUIRE(store.mount() == Store::status::ok);
+	CHECK(store.count() == 0);
+	CHECK(store.liveBytes() == 0);
+	CHECK(store.sequence() == 1);
+
+	uint8_t buffer[4];
+	CHECK(store.read(0, buffer, sizeof(buffer)) == Store::status::not_found);
+	CHECK(store.read(8, buffer, sizeof(buffer)) == Store::status::invalid_key);
+	CHECK(store.remove(0) == Store::status::not_found);
+}
+
+TEST_CASE("Key-value store sets, gets, and removes values", "[utilities/kv_store]")
+{
+	Flash flash;
+	Store store{flash, 0};
+	REQUIRE(store.mount() == Store::status::ok);
+
+	const uint32_t a = 0x12345678;
+	const char b[] = "hello";
+
+	REQUIRE(store.write(1, &a, sizeof(a)) == Store::status::ok);
+	REQUIRE(store.write(2, b, sizeof(b)) == Store::status::ok);
+	CHECK(store.count() == 2);
+	CHECK(store.contains(1));
+	CHECK_FALSE(store.contains(3));
+
+	uint32_t a_read = 0;
+	CHECK(store.read(1, &a_read, sizeof(a_read)) == Store::status::ok);
+	CHECK(a_read == a);
+
+	char b_read[sizeof(b)] = {};
+	size_t length = 0;
+	CHECK(store.read(2, b_read, 2, &length) == Store::status::too_large);
+	CHECK(length == sizeof(b));
+	CHECK(store.read(2, b_read, sizeof(b_read)) == Store::status::ok);
+	CHECK(strcmp(b_read, b) == 0);
+
+	SECTION("Rewriting the same value does not program the flash")
+	{
+		auto units = flash.programmedUnits();
+		CHECK(store.write(1, &a, sizeof(a)) == Store::status::ok);
+		CHECK(flash.programmedUnits() == units);
+	}
+
+	SECTION("A new value replaces the old one")
+	{
+		const uint16_t c = 0xBEEF;
+		REQUIRE(store.write(1, &c, sizeof(c)) == Store::status::ok);
+		CHECK(store.count() == 2);
+
+		uint16_t c_read = 0;
+		CHECK(store.read(1, &c_read, sizeof(c_read), &length) == Store::status::ok);
+		CHECK(length == sizeof(c));
+		CHECK(c_read == c);
+	}
+
+	SECTION("Removed values are gone")
+	{
+		REQUIRE(store.remove(1) == Store::status::ok);
+		CHECK(store.count() == 1);
+		CHECK(store.read(1, &a_read, sizeof(a_read)) == Store::status::not_found);
+	}
+
+	SECTION("Values are kept across a remount")
+	{
+		REQUIRE(store.remove(2) == Store::status::ok);
+
+		Store remounted{flash, 0};
+		REQUIRE(remounted.mount() == Store::status::ok);
+		CHECK(remounted.count() == 1);
+		CHECK(remounted.liveBytes() == store.liveBytes());
+		CHECK(remounted.read(1, &a_read, sizeof(a_read)) == Store::status::ok);
+		CHECK(a_read == a);
+		CHECK_FALSE(remounted.contains(2));
+	}
+}
+
+TEST_CASE("Key-value store reclaims pages", "[utilities/kv_store]")
+{
+	Flash flash;
+	Store store{flash, 0};
+	REQUIRE(store.mount() == Store::status::ok);
+
+	std::map<Store::key_t, std::vector<uint8_t>> expected;
+	for(size_t i = 0; i < 200; i++)
+	{
+		auto key = static_cast<Store::key_t>(i % 8);
+		auto value = makeValue(i);
+		REQUIRE(store.write(key, value.data(), value.size()) == Store::status::ok);
+		expected[key] = value;
+	}
+
+	// Every page has been opened and reclaimed more than once
+	CHECK(store.sequence() > 8);
+	for(size_t page = 0; page < Store::PAGES; page++)
+	{
+		CHECK(flash.eraseCount(page) > 1);
+	}
+
+	Store remounted{flash, 0};
+	REQUIRE(remounted.mount() == Store::status::ok);
+	CHECK(remounted.count() == expected.size());
+	CHECK(remounted.sequence() == store.sequence());
+	for(const auto& entry : expected)
+	{
+		CHECK(readValue(remounted, entry.first) == entry.second);
+	}
+
+	SECTION("Writes which do not fit are rejected")
+	{
+		std::vector<uint8_t> large(Store::MAX_VALUE_SIZE + 1);
+		CHECK(remounted.write(0, large.data(), large.size()) == Store::status::too_large);
+
+		// Fill the store with maximum size values until it runs out of space
+		large.pop_back();
+		Store::status r = Store::status::ok;
+		for(Store::key_t key = 0; key < 8 && r == Store::status::ok; key++)
+		{
+			r = remounted.write(key, large.data(), large.size());
+		}
+
+		CHECK(r == Store::status::no_space);
+		CHECK(remounted.liveBytes() <= Store::CAPACITY);
+	}
+}
+
+TEST_CASE("Key-value store recovers from power loss at every program step",
+		  "[utilities/kv_store]")
+{
+	const auto steps = workload();
+	bool completed = false;
+
+	// Each budget loses power one programming unit later than the previous one
+	for(size_t budget = 0; !completed; budget++)
+	{
+		Flash flash;
+		std::map<Store::key_t, std::vector<uint8_t>> committed;
+		const step_t* interrupted = nullptr;
+
+		{
+			Store store{flash, 0};
+			REQUIRE(store.mount() == Store::status::ok);
+			flash.setProgramBudget(budget);
+
+			for(const auto& step : steps)
+			{
+				bool remove = step.value.empty();
+				if(remove && committed.count(step.key) == 0)
+				{
+					continue;
+				}
+
+				auto r = remove ? store.remove(step.key)
+								: store.write(step.key, step.value.data(), step.value.size());
+				if(r != Store::status::ok)
+				{
+					interrupted = &step;
+					break;
+				}
+
+				if(remove)
+				{
+					committed.erase(step.key);
+				}
+				else
+				{
+					committed[step.key] = step.value;
+				}
+			}
+		}
+
+		completed = (interrupted == nullptr);
+		flash.powerOn();
+
+		INFO("Power lost after " << budget << " programming units");
+		Store store{flash, 0};
+		REQUIRE(store.mount() == Store::status::ok);
+
+		for(Store::key_t key = 0; key < 8; key++)
+		{
+			auto found = committed.find(key);
+			bool in_flight = interrupted && interrupted->key == key;
+
+			if(in_flight && store.contains(key) != (found != committed.end()))
+			{
+				// The interrupted operation may only have taken effect as a whole
+				if(interrupted->value.empty())
+				{
+					CHECK_FALSE(store.contains(key));
+				}
+				else
+				{
+					CHECK(readValue(store, key) == interrupted->value);
+				}
+			}
+			else if(found == committed.end())
+			{
+				CHECK_FALSE(store.contains(key));
+			}
+			else if(!in_flight || readValue(store, key) != interrupted->value)
+			{
+				CHECK(readValue(store, key) == found->second);
+			}
+		}
+
+		// The store is still usable after recovery
+		auto value = makeValue(budget);
+		REQUIRE(store.write(7, value.data(), value.size()) == Store::status::ok);
+		CHECK(readValue(store, 7) == value);
+	}
+}
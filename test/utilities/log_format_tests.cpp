@@ -0,0 +1,172 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <log_format.hpp>
+#include <string>
+#include <vector>
+
+namespace
+{
+enum class color : uint8_t
+{
+	red = 1,
+	green = 2,
+};
+
+std::string format(const char* fmt, const std::vector<uint32_t>& args,
+				   bool resolve_strings = false)
+{
+	char out[128];
+	auto length = formatLogRecord(out, sizeof(out), fmt, args.data(), args.size(),
+								  resolve_strings);
+	CHECK(length == strlen(out));
+	return out;
+}
+
+void appendWord(std::vector<uint8_t>& stream, uint32_t word)
+{
+	for(size_t i = 0; i < sizeof(word); i++)
+	{
+		stream.push_back(static_cast<uint8_t>(word >> (i * 8)));
+	}
+}
+
+void appendRecord(std::vector<uint8_t>& stream, uint32_t id, const std::vector<uint32_t>& args)
+{
+	appendWord(stream, LogDecoder::VALID_FLAG |
+						   (static_cast<uint32_t>(args.size()) << LogDecoder::ARG_COUNT_SHIFT) |
+						   id);
+	for(auto arg : args)
+	{
+		appendWord(stream, arg);
+	}
+}
+} // namespace
+
+TEST_CASE("Log arguments are stored as 32-bit words", "[utilities/log_format]")
+{
+	CHECK(toLogArg(42) == 42);
+	CHECK(toLogArg(-1) == 0xFFFFFFFF);
+	CHECK(toLogArg(static_cast<int16_t>(-2)) == 0xFFFFFFFE);
+	CHECK(toLogArg(0xDEADBEEFU) == 0xDEADBEEF);
+	CHECK(toLogArg('A') == 0x41);
+	CHECK(toLogArg(true) == 1);
+	CHECK(toLogArg(color::green) == 2);
+	CHECK(toLogArg(1.5f) == 0x3FC00000);
+	// Doubles are stored as floats
+	CHECK(toLogArg(1.5) == 0x3FC00000);
+	CHECK(toLogArg(reinterpret_cast<const void*>(0x20001000)) == 0x20001000);
+}
+
+TEST_CASE("Log records format each argument type", "[utilities/log_format]")
+{
+	CHECK(format("plain text", {}) == "plain text");
+	CHECK(format("%d %i", {toLogArg(-42), toLogArg(7)}) == "-42 7");
+	CHECK(format("%u", {toLogArg(-1)}) == "4294967295");
+	CHECK(format("%o %x %X", {8, 0xBEEF, 0xBEEF}) == "10 beef BEEF");
+	CHECK(format("%c%c", {'o', 'k'}) == "ok");
+	CHECK(format("%p", {0x20001000}) == "0x20001000");
+	CHECK(format("%f", {toLogArg(1.5f)}) == "1.500000");
+	CHECK(format("%.2F", {toLogArg(-0.25f)}) == "-0.25");
+	CHECK(format("%.1e %.1E", {toLogArg(1500.0f), toLogArg(1500.0f)}) == "1.5e+03 1.5E+03");
+	CHECK(format("%g %G", {toLogArg(0.5f), toLogArg(1e-10f)}) == "0.5 1E-10");
+	CHECK(format("%s", {0x08001234}) == "<0x08001234>");
+	CHECK(format("100%%", {}) == "100%");
+	CHECK(format("%d", {static_cast<uint32_t>(color::red)}) == "1");
+}
+
+TEST_CASE("Log records resolve strings on the target", "[utilities/log_format]")
+{
+	static const char text[] = "hello";
+	auto address = reinterpret_cast<uintptr_t>(text);
+
+	// Only addresses which fit in an argument word can be resolved
+	if(address <= UINT32_MAX)
+	{
+		CHECK(format("%s!", {static_cast<uint32_t>(address)}, true) == "hello!");
+	}
+}
+
+TEST_CASE("Log records apply flags, width, and precision", "[utilities/log_format]")
+{
+	CHECK(format("[%5d]", {42}) == "[   42]");
+	CHECK(format("[%-5d]", {42}) == "[42   ]");
+	CHECK(format("[%05d]", {42}) == "[00042]");
+	CHECK(format("[%+d]", {42}) == "[+42]");
+	CHECK(format("[%#x]", {255}) == "[0xff]");
+	CHECK(format("[%08.3f]", {toLogArg(3.14159f)}) == "[0003.142]");
+	// Length modifiers are ignored, since every argument is 32 bits
+	CHECK(format("%ld %lu %zu %hhx", {toLogArg(-5), 6, 7, 0x1FF}) == "-5 6 7 1ff");
+}
+
+TEST_CASE("Log records handle missing arguments and truncation", "[utilities/log_format]")
+{
+	CHECK(format("%d %d", {1}) == "1 <?>");
+	CHECK(format("%k", {1}) == "%k");
+	CHECK(format("trailing %", {}) == "trailing ");
+
+	char out[8];
+	uint32_t value = 123456;
+	auto length = formatLogRecord(out, sizeof(out), "value: %d", &value, 1, false);
+	CHECK(length == sizeof(out) - 1);
+	CHECK(std::string(out) == "value: ");
+
+	CHECK(formatLogRecord(out, 0, "unused", nullptr, 0, false) == 0);
+}
+
+TEST_CASE("Log decoder formats binary records", "[utilities/log_format]")
+{
+	// IDs are offsets into the format string table
+	static const char table[] = "boot\0count=%u\0%s at %p";
+	constexpr uint32_t BOOT_ID = 0;
+	constexpr uint32_t COUNT_ID = 5;
+	constexpr uint32_t STRING_ID = 14;
+
+	LogDecoder decoder(table, sizeof(table));
+	CHECK(std::string(decoder.formatString(COUNT_ID)) == "count=%u");
+	CHECK(decoder.formatString(sizeof(table)) == nullptr);
+
+	std::vector<uint8_t> stream;
+	appendRecord(stream, BOOT_ID, {});
+	appendRecord(stream, COUNT_ID, {3});
+	appendRecord(stream, STRING_ID, {0x08000100, 0x20000000});
+
+	std::vector<std::string> lines;
+	auto consumed =
+		decoder.decode(stream.data(), stream.size(),
+					   [&](const char* text, size_t length) { lines.emplace_back(text, length); });
+
+	CHECK(consumed == stream.size());
+	REQUIRE(lines.size() == 3);
+	CHECK(lines[0] == "boot");
+	CHECK(lines[1] == "count=3");
+	CHECK(lines[2] == "<0x08000100> at 0x20000000");
+	CHECK(decoder.skippedWords() == 0);
+}
+
+TEST_CASE("Log decoder resynchronizes and waits for incomplete records",
+		  "[utilities/log_format]")
+{
+	static const char table[] = "a=%d b=%d";
+	LogDecoder decoder(table, sizeof(table));
+	std::vector<std::string> lines;
+	auto sink = [&](const char* text, size_t length) { lines.emplace_back(text, length); };
+
+	std::vector<uint8_t> stream;
+	appendWord(stream, 0x12345678); // Not a header
+	appendWord(stream, LogDecoder::VALID_FLAG | 0x1000); // Invalid format ID
+	appendRecord(stream, 0, {1, 2});
+	appendRecord(stream, 0, {3, 4});
+
+	// The last record is missing its final argument word
+	auto consumed = decoder.decode(stream.data(), stream.size() - sizeof(uint32_t), sink);
+	CHECK(consumed == stream.size() - (3 * sizeof(uint32_t)));
+	CHECK(decoder.skippedWords() == 2);
+	REQUIRE(lines.size() == 1);
+	CHECK(lines[0] == "a=1 b=2");
+
+	// The rest of the record is decoded once the data is complete
+	consumed += decoder.decode(&stream[consumed], stream.size() - consumed, sink);
+	CHECK(consumed == stream.size());
+	REQUIRE(lines.size() == 2);
+	CHECK(lines[1] == "a=3 b=4");
+}
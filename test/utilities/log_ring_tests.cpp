@@ -0,0 +1,115 @@
+#include <catch2/catch_test_macros.hpp>
+#include <log_ring.hpp>
+
+namespace
+{
+using ring_t = LogRing<32>;
+
+void pushSequence(ring_t& ring, uint32_t id, size_t arg_count)
+{
+	uint32_t args[ring_t::MAX_ARGS];
+	for(size_t i = 0; i < arg_count; i++)
+	{
+		args[i] = (id << 8) + static_cast<uint32_t>(i);
+	}
+
+	REQUIRE(ring.push(id, args, arg_count));
+}
+
+void checkSequence(ring_t& ring, uint32_t id, size_t arg_count)
+{
+	ring_t::record_t record{};
+	REQUIRE(ring.pop(record));
+	CHECK(record.id == id);
+	REQUIRE(record.arg_count == arg_count);
+	for(size_t i = 0; i < arg_count; i++)
+	{
+		CHECK(record.args[i] == (id << 8) + static_cast<uint32_t>(i));
+	}
+}
+} // namespace
+
+TEST_CASE("Log ring headers encode the ID and argument count", "[utilities/log_ring]")
+{
+	auto header = ring_t::makeHeader(0x123456, 5);
+
+	CHECK((header & ring_t::VALID_FLAG) != 0);
+	CHECK(ring_t::headerId(header) == 0x123456);
+	CHECK(ring_t::headerArgCount(header) == 5);
+
+	// IDs are limited to 24 bits
+	CHECK(ring_t::headerId(ring_t::makeHeader(0xAB123456, 0)) == 0x123456);
+}
+
+TEST_CASE("Log ring returns records in order", "[utilities/log_ring]")
+{
+	ring_t ring;
+	ring_t::record_t record{};
+
+	CHECK(ring.empty());
+	CHECK_FALSE(ring.pop(record));
+
+	pushSequence(ring, 1, 0);
+	pushSequence(ring, 2, 3);
+	pushSequence(ring, 3, ring_t::MAX_ARGS);
+	CHECK_FALSE(ring.empty());
+
+	checkSequence(ring, 1, 0);
+	checkSequence(ring, 2, 3);
+	checkSequence(ring, 3, ring_t::MAX_ARGS);
+
+	CHECK(ring.empty());
+	CHECK_FALSE(ring.pop(record));
+	CHECK(ring.dropped() == 0);
+}
+
+TEST_CASE("Log ring records wrap around the end of the storage", "[utilities/log_ring]")
+{
+	ring_t ring;
+
+	// Records of 3 words don't divide the capacity evenly, so records are split
+	// across the end of the storage on later passes
+	for(uint32_t id = 0; id < 100; id++)
+	{
+		pushSequence(ring, id, 2);
+		pushSequence(ring, id + 1000, 4);
+		checkSequence(ring, id, 2);
+		checkSequence(ring, id + 1000, 4);
+	}
+
+	CHECK(ring.empty());
+	CHECK(ring.dropped() == 0);
+}
+
+TEST_CASE("Log ring drops and counts records when full", "[utilities/log_ring]")
+{
+	ring_t ring;
+	uint32_t args[ring_t::MAX_ARGS + 1] = {};
+
+	// 8 records of 4 words fill the ring exactly
+	for(uint32_t id = 0; id < 8; id++)
+	{
+		pushSequence(ring, id, 3);
+	}
+
+	CHECK_FALSE(ring.push(100, args, 0));
+	CHECK_FALSE(ring.push(101, args, 3));
+	CHECK(ring.dropped() == 2);
+
+	// Records which are too large are always dropped
+	CHECK_FALSE(ring.push(102, args, ring_t::MAX_ARGS + 1));
+	CHECK(ring.dropped() == 3);
+
+	// Consuming a record makes room for another one of the same size
+	checkSequence(ring, 0, 3);
+	pushSequence(ring, 8, 3);
+	CHECK_FALSE(ring.push(103, args, 0));
+	CHECK(ring.dropped() == 4);
+
+	for(uint32_t id = 1; id <= 8; id++)
+	{
+		checkSequence(ring, id, 3);
+	}
+
+	CHECK(ring.empty());
+}